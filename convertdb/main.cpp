@@ -34,6 +34,12 @@ namespace Error
     const int Conversion = 3;
 }
 
+static void printProgress(const QString &step)
+{
+    printf("%s\n", qPrintable(step));
+    fflush(stdout);
+}
+
 static int upgradeDatabase(const QString &upgradeFile)
 {
     QString errMsg;
@@ -42,7 +48,7 @@ static int upgradeDatabase(const QString &upgradeFile)
 	fprintf(stderr, "Upgrade error: %s\n", qPrintable(errMsg));
 	return Error::Open;
     }
-    if (!Database::upgrade(db, &errMsg)) {
+    if (!Database::upgrade(db, &errMsg, printProgress)) {
 	fprintf(stderr, "Upgrade error: %s\n", qPrintable(errMsg));
 	return Error::Conversion;
     }
@@ -46,9 +46,13 @@
 
 typedef QVariant (*DataFormatter)(QSqlDatabase db, const EntryItemModel *model, int row, int column);
 
+// trace entry timestamps are stored as nanoseconds since the epoch
 static QVariant timeFormatter(QSqlDatabase, const EntryItemModel *model, int row, int column)
 {
-    return QDateTime::fromMSecsSinceEpoch( model->getValue(row, column).toLongLong() );
+    const qint64 ns = model->getValue(row, column).toLongLong();
+    const QDateTime dt = QDateTime::fromMSecsSinceEpoch( ns / 1000000 );
+    return dt.toString( "yyyy-MM-dd hh:mm:ss.zzz" )
+        + QString( "%1" ).arg( ns % 1000000, 6, 10, QChar( '0' ) );
 }
 
 static QString tracePointTypeAsString(int i)
@@ -305,7 +309,9 @@ bool EntryItemModel::queryForEntries(QString *errMsg, int startRow)
                 predicates << "trace_entry.traced_thread_id = traced_thread.id"
                            << "traced_thread.process_id = process.id";
             } else if (cn == "Thread") {
-                fieldsToSelect.append("traced_thread.tid");
+                fieldsToSelect.append("CASE WHEN traced_thread.name IS NULL OR traced_thread.name = ''"
+                                      " THEN traced_thread.tid"
+                                      " ELSE traced_thread.tid || ' (' || traced_thread.name || ')' END");
                 tablesToSelectFrom.append("traced_thread");
                 predicates << "trace_entry.traced_thread_id = traced_thread.id";
             } else if (cn == "File") {
@@ -434,7 +440,7 @@ QVariant EntryItemModel::data(const QModelIndex& index, int role) const
         return QVariant();
     }
 
-    if (role == Qt::DisplayRole) {
+    if (role == Qt::DisplayRole || role == SortRole) {
         // undo possible column reordering 
         if (!m_columnsInfo->isVisible(index.column()))
             return QVariant();
@@ -442,7 +448,8 @@ QVariant EntryItemModel::data(const QModelIndex& index, int role) const
 
         int dbField = index.column() + 1; // id field is used in header
 
-        if (g_fields[realColumn].formatterFn)
+        // formatted values (e.g. times) don't sort like the raw ones
+        if (role == Qt::DisplayRole && g_fields[realColumn].formatterFn)
             return g_fields[realColumn].formatterFn(m_db, this, index.row(), dbField);
         return getValue(index.row(), dbField);
     } else if (role == Qt::ToolTipRole) {
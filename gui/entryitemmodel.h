@@ -36,6 +36,11 @@ class EntryItemModel : public QAbstractTableModel
 {
     Q_OBJECT
 public:
+    /* The values as stored in the database (e.g. the time in nanoseconds),
+     * which compare correctly; Qt::DisplayRole gives the formatted text.
+     */
+    static const int SortRole = Qt::UserRole;
+
     EntryItemModel(EntryFilter *filter, ColumnsInfo *ci, QObject *parent = 0);
     ~EntryItemModel();
 
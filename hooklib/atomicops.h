@@ -0,0 +1,275 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_ATOMICOPS_H
+#define TRACELIB_ATOMICOPS_H
+
+#include "tracelib_config.h"
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* A minimal set of atomic operations on machine words and 32 bit integers
+ * (and loads and stores of pointers), used by the lock-free parts of the
+ * library. Loads have acquire semantics, stores have release semantics and
+ * all read-modify-write operations are full barriers.
+ */
+#if defined(__ATOMIC_ACQUIRE)
+
+inline unsigned long atomicLoad( const volatile unsigned long *p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+inline void atomicStore( volatile unsigned long *p, unsigned long v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+inline unsigned long atomicAdd( volatile unsigned long *p, unsigned long v )
+{
+    return __atomic_add_fetch( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline unsigned long atomicExchange( volatile unsigned long *p, unsigned long v )
+{
+    return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline bool atomicCompareAndSwap( volatile unsigned long *p, unsigned long expected, unsigned long desired )
+{
+    return __atomic_compare_exchange_n( p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+inline unsigned int atomicLoad( const volatile unsigned int *p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+inline void atomicStore( volatile unsigned int *p, unsigned int v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+inline unsigned int atomicAdd( volatile unsigned int *p, unsigned int v )
+{
+    return __atomic_add_fetch( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline unsigned int atomicExchange( volatile unsigned int *p, unsigned int v )
+{
+    return __atomic_exchange_n( p, v, __ATOMIC_SEQ_CST );
+}
+
+inline bool atomicCompareAndSwap( volatile unsigned int *p, unsigned int expected, unsigned int desired )
+{
+    return __atomic_compare_exchange_n( p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+template <typename T>
+inline T *atomicLoad( T * const volatile *p )
+{
+    return __atomic_load_n( p, __ATOMIC_ACQUIRE );
+}
+
+template <typename T>
+inline void atomicStore( T * volatile *p, T *v )
+{
+    __atomic_store_n( p, v, __ATOMIC_RELEASE );
+}
+
+template <typename T>
+inline bool atomicCompareAndSwap( T * volatile *p, T *expected, T *desired )
+{
+    return __atomic_compare_exchange_n( p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+#elif defined(__GNUC__)
+
+inline unsigned long atomicLoad( const volatile unsigned long *p )
+{
+    const unsigned long v = *p;
+    __sync_synchronize();
+    return v;
+}
+
+inline void atomicStore( volatile unsigned long *p, unsigned long v )
+{
+    __sync_synchronize();
+    *p = v;
+}
+
+inline unsigned long atomicAdd( volatile unsigned long *p, unsigned long v )
+{
+    return __sync_add_and_fetch( p, v );
+}
+
+inline unsigned long atomicExchange( volatile unsigned long *p, unsigned long v )
+{
+    __sync_synchronize();
+    return __sync_lock_test_and_set( p, v );
+}
+
+inline bool atomicCompareAndSwap( volatile unsigned long *p, unsigned long expected, unsigned long desired )
+{
+    return __sync_bool_compare_and_swap( p, expected, desired );
+}
+
+inline unsigned int atomicLoad( const volatile unsigned int *p )
+{
+    const unsigned int v = *p;
+    __sync_synchronize();
+    return v;
+}
+
+inline void atomicStore( volatile unsigned int *p, unsigned int v )
+{
+    __sync_synchronize();
+    *p = v;
+}
+
+inline unsigned int atomicAdd( volatile unsigned int *p, unsigned int v )
+{
+    return __sync_add_and_fetch( p, v );
+}
+
+inline unsigned int atomicExchange( volatile unsigned int *p, unsigned int v )
+{
+    __sync_synchronize();
+    return __sync_lock_test_and_set( p, v );
+}
+
+inline bool atomicCompareAndSwap( volatile unsigned int *p, unsigned int expected, unsigned int desired )
+{
+    return __sync_bool_compare_and_swap( p, expected, desired );
+}
+
+template <typename T>
+inline T *atomicLoad( T * const volatile *p )
+{
+    T * const v = *p;
+    __sync_synchronize();
+    return v;
+}
+
+template <typename T>
+inline void atomicStore( T * volatile *p, T *v )
+{
+    __sync_synchronize();
+    *p = v;
+}
+
+template <typename T>
+inline bool atomicCompareAndSwap( T * volatile *p, T *expected, T *desired )
+{
+    return __sync_bool_compare_and_swap( p, expected, desired );
+}
+
+#elif defined(_MSC_VER)
+
+/* MSVC gives volatile accesses acquire/release semantics, all we need to
+ * prevent is the compiler reordering them.
+ */
+inline unsigned long atomicLoad( const volatile unsigned long *p )
+{
+    const unsigned long v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+inline void atomicStore( volatile unsigned long *p, unsigned long v )
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+inline unsigned long atomicAdd( volatile unsigned long *p, unsigned long v )
+{
+    return static_cast<unsigned long>( _InterlockedExchangeAdd( reinterpret_cast<volatile long *>( p ), static_cast<long>( v ) ) ) + v;
+}
+
+inline unsigned long atomicExchange( volatile unsigned long *p, unsigned long v )
+{
+    return static_cast<unsigned long>( _InterlockedExchange( reinterpret_cast<volatile long *>( p ), static_cast<long>( v ) ) );
+}
+
+inline bool atomicCompareAndSwap( volatile unsigned long *p, unsigned long expected, unsigned long desired )
+{
+    return _InterlockedCompareExchange( reinterpret_cast<volatile long *>( p ),
+                                        static_cast<long>( desired ),
+                                        static_cast<long>( expected ) ) == static_cast<long>( expected );
+}
+
+// unsigned int and long are both 32 bits wide on Windows
+inline unsigned int atomicLoad( const volatile unsigned int *p )
+{
+    return atomicLoad( reinterpret_cast<const volatile unsigned long *>( p ) );
+}
+
+inline void atomicStore( volatile unsigned int *p, unsigned int v )
+{
+    atomicStore( reinterpret_cast<volatile unsigned long *>( p ), v );
+}
+
+inline unsigned int atomicAdd( volatile unsigned int *p, unsigned int v )
+{
+    return atomicAdd( reinterpret_cast<volatile unsigned long *>( p ), v );
+}
+
+inline unsigned int atomicExchange( volatile unsigned int *p, unsigned int v )
+{
+    return atomicExchange( reinterpret_cast<volatile unsigned long *>( p ), v );
+}
+
+inline bool atomicCompareAndSwap( volatile unsigned int *p, unsigned int expected, unsigned int desired )
+{
+    return atomicCompareAndSwap( reinterpret_cast<volatile unsigned long *>( p ), expected, desired );
+}
+
+template <typename T>
+inline T *atomicLoad( T * const volatile *p )
+{
+    T * const v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+
+template <typename T>
+inline void atomicStore( T * volatile *p, T *v )
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+
+template <typename T>
+inline bool atomicCompareAndSwap( T * volatile *p, T *expected, T *desired )
+{
+    return _InterlockedCompareExchangePointer( reinterpret_cast<void * volatile *>( p ), desired, expected ) == expected;
+}
+
+#else
+#  error "No atomic operations available for this compiler"
+#endif
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_ATOMICOPS_H)
@@ -26,20 +26,39 @@ using namespace std;
 TRACELIB_NAMESPACE_BEGIN
 
 Backtrace::Backtrace( const vector<StackFrame> &frames )
-    : m_frames( frames )
+    : m_frames( frames ),
+    m_symbolizer( 0 )
+{
+}
+
+Backtrace::Backtrace( const vector<void *> &addresses, BacktraceGenerator *symbolizer )
+    : m_addresses( addresses ),
+    m_symbolizer( symbolizer )
 {
 }
 
 size_t Backtrace::depth() const
 {
+    if ( m_symbolizer ) {
+        return m_addresses.size();
+    }
     return m_frames.size();
 }
 
 const StackFrame &Backtrace::frame( size_t depth ) const
 {
+    if ( m_symbolizer ) {
+        symbolize();
+    }
     assert( depth < m_frames.size() );
     return m_frames[depth];
 }
 
+void Backtrace::symbolize() const
+{
+    m_symbolizer->symbolize( m_addresses, m_frames );
+    m_symbolizer = 0;
+}
+
 TRACELIB_NAMESPACE_END
 
@@ -25,6 +25,14 @@
 #include <string>
 #include <vector>
 
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#  pragma intrinsic(_ReturnAddress)
+#  define TRACELIB_RETURN_ADDRESS() _ReturnAddress()
+#else
+#  define TRACELIB_RETURN_ADDRESS() __builtin_return_address( 0 )
+#endif
+
 TRACELIB_NAMESPACE_BEGIN
 
 struct StackFrame
@@ -39,18 +47,28 @@ struct StackFrame
 
 class BacktraceGenerator;
 
+/* A backtrace either holds symbolized frames right away or just the raw
+ * program counters as captured by BacktraceGenerator::generate; in the
+ * latter case the frames are only symbolized once they are asked for, i.e.
+ * typically when the trace entry gets serialized.
+ */
 class Backtrace
 {
     friend class BacktraceGenerator;
 
 public:
     explicit Backtrace( const std::vector<StackFrame> &frames );
+    Backtrace( const std::vector<void *> &addresses, BacktraceGenerator *symbolizer );
 
     size_t depth() const;
     const StackFrame &frame( size_t depth ) const;
 
 private:
-    std::vector<StackFrame> m_frames;
+    void symbolize() const;
+
+    mutable std::vector<StackFrame> m_frames;
+    std::vector<void *> m_addresses;
+    mutable BacktraceGenerator *m_symbolizer;
 };
 
 class BacktraceGenerator
@@ -61,6 +79,25 @@ public:
 
     Backtrace generate( size_t skipInnermostFrames );
 
+    /* Like generate(), but omits all frames up to the one which contains the
+     * given return address; pass TRACELIB_RETURN_ADDRESS() of a library
+     * entry point to get the backtrace of its caller, no matter how many
+     * frames the library itself used (or inlined). If the address is not
+     * among the captured frames, the whole backtrace is kept.
+     */
+    Backtrace generateFromCaller( const void *callerAddress );
+
+    /* Resolves the given program counters to stack frames; this is where
+     * all the expensive work happens, so it's not done by generate().
+     */
+    void symbolize( const std::vector<void *> &addresses, std::vector<StackFrame> &frames );
+
+    /* Statistics on how many program counters could be symbolized using
+     * the cache of previously resolved frames (shared by all generators).
+     */
+    unsigned long symbolCacheHits() const;
+    unsigned long symbolCacheMisses() const;
+
 private:
     BacktraceGenerator( const BacktraceGenerator &other );
     void operator=( const BacktraceGenerator &rhs );
@@ -21,7 +21,11 @@
 
 #include <config.h>
 
+#include "atomicops.h"
+
+#include <algorithm>
 #include <cassert>
+#include <map>
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
@@ -51,9 +55,110 @@ static pthread_mutex_t trace_mutex;
 static char *symbol_buffer;
 static size_t symbol_buffer_length;
 
+/* Program counters which were symbolized before; backtraces tend to share
+ * most of their frames, so this saves most of the lookups. The cache is
+ * split into shards with a lock each, so threads symbolizing backtraces
+ * (and the expensive lookups of unknown addresses, which happen with
+ * trace_mutex locked) don't hold up each other. Each shard has a fixed
+ * number of slots which are reused using the CLOCK algorithm: entries which
+ * were hit since the hand passed them last get a second chance.
+ */
+static const size_t symbol_cache_shard_count = 16;
+static const size_t symbol_cache_slots_per_shard = 256;
+
+struct SymbolCacheShard {
+    SymbolCacheShard() : hand( 0 ) {
+        pthread_mutex_init( &mutex, NULL );
+        for ( size_t i = 0; i < symbol_cache_slots_per_shard; ++i ) {
+            addresses[i] = 0;
+            referenced[i] = false;
+        }
+    }
+
+    ~SymbolCacheShard() {
+        pthread_mutex_destroy( &mutex );
+    }
+
+    pthread_mutex_t mutex;
+    map<void *, size_t> slotOfAddress;
+    void *addresses[symbol_cache_slots_per_shard];
+    StackFrame frames[symbol_cache_slots_per_shard];
+    bool referenced[symbol_cache_slots_per_shard];
+    size_t hand;
+};
+
+static SymbolCacheShard *symbol_cache;
+static volatile unsigned long symbol_cache_hits;
+static volatile unsigned long symbol_cache_misses;
+
+static SymbolCacheShard &symbolCacheShard( void *address )
+{
+    const size_t pc = reinterpret_cast<size_t>( address );
+    return symbol_cache[( pc ^ ( pc >> 12 ) ) % symbol_cache_shard_count];
+}
+
+static bool lookupCachedFrame( void *address, StackFrame *frame )
+{
+    SymbolCacheShard &shard = symbolCacheShard( address );
+    pthread_mutex_lock( &shard.mutex );
+    const map<void *, size_t>::const_iterator it = shard.slotOfAddress.find( address );
+    const bool found = it != shard.slotOfAddress.end();
+    if ( found ) {
+        shard.referenced[it->second] = true;
+        *frame = shard.frames[it->second];
+    }
+    pthread_mutex_unlock( &shard.mutex );
+    return found;
+}
+
+static void cacheFrame( void *address, const StackFrame &frame )
+{
+    SymbolCacheShard &shard = symbolCacheShard( address );
+    pthread_mutex_lock( &shard.mutex );
+    // Another thread might have resolved the same address meanwhile
+    if ( shard.slotOfAddress.find( address ) == shard.slotOfAddress.end() ) {
+        while ( shard.referenced[shard.hand] ) {
+            shard.referenced[shard.hand] = false;
+            shard.hand = ( shard.hand + 1 ) % symbol_cache_slots_per_shard;
+        }
+        const size_t slot = shard.hand;
+        shard.hand = ( shard.hand + 1 ) % symbol_cache_slots_per_shard;
+
+        if ( shard.addresses[slot] ) {
+            shard.slotOfAddress.erase( shard.addresses[slot] );
+        }
+        shard.addresses[slot] = address;
+        shard.frames[slot] = frame;
+        shard.slotOfAddress[address] = slot;
+    }
+    pthread_mutex_unlock( &shard.mutex );
+}
+
 #if HAVE_BFD_H && HAVE_DEMANGLE_H
 static bfd *self_bfd;
 static asymbol **self_symbols;
+
+/* The allocated sections of the executable, sorted by start address so
+ * that the section containing a program counter can be found by binary
+ * search.
+ */
+struct BfdSection {
+    bfd_vma vma;
+    bfd_size_type size;
+    asection *section;
+};
+
+static bool operator<( bfd_vma pc, const BfdSection &section )
+{
+    return pc < section.vma;
+}
+
+static bool compareSectionStart( const BfdSection &lhs, const BfdSection &rhs )
+{
+    return lhs.vma < rhs.vma;
+}
+
+static vector<BfdSection> *self_sections;
 #endif
 
 extern string processFullName();
@@ -90,27 +195,33 @@ struct BfdSymbol {
     unsigned int offset;
 };
 
-static void findAddressInSection( bfd *abfd, asection *section, void *data )
+static void collectSection( bfd *abfd, asection *section, void *data )
 {
-    BfdSymbol *bfd_sym = (BfdSymbol *)data;
-
-    if ( bfd_sym->found )
-        return;
-
     if ( ( bfd_get_section_flags( abfd, section ) & SEC_ALLOC) == 0 )
         return;
 
-    bfd_vma vma = bfd_get_section_vma( abfd, section );
-    if ( bfd_sym->pc < vma )
+    BfdSection s;
+    s.vma = bfd_get_section_vma( abfd, section );
+    s.size = bfd_get_section_size( section );
+    s.section = section;
+    ( (vector<BfdSection> *)data )->push_back( s );
+}
+
+static void findAddressInSections( BfdSymbol *bfd_sym )
+{
+    vector<BfdSection>::const_iterator it = upper_bound( self_sections->begin(),
+                                                         self_sections->end(),
+                                                         bfd_sym->pc );
+    if ( it == self_sections->begin() )
         return;
 
-    bfd_size_type size = bfd_get_section_size( section );
-    if ( bfd_sym->pc >= vma + size )
+    --it;
+    if ( bfd_sym->pc >= it->vma + it->size )
         return;
 
-    bfd_sym->offset = bfd_sym->pc - vma;
-    bfd_sym->found = bfd_find_nearest_line( abfd,
-            section, self_symbols,  bfd_sym->pc - vma,
+    bfd_sym->offset = bfd_sym->pc - it->vma;
+    bfd_sym->found = bfd_find_nearest_line( self_bfd,
+            it->section, self_symbols,  bfd_sym->pc - it->vma,
             &bfd_sym->filename, &bfd_sym->functionname, &bfd_sym->linenr );
 }
 
@@ -119,7 +230,7 @@ static bool bfdAddressInfo( bfd_vma addr, StackFrame *frame )
     BfdSymbol bfd_sym;
     bfd_sym.pc = addr; //bfd_scan_vma( addr, NULL, 16 );
     bfd_sym.found = false;
-    bfd_map_over_sections( self_bfd, findAddressInSection, &bfd_sym );
+    findAddressInSections( &bfd_sym );
     if ( bfd_sym.found ) {
         if ( bfd_sym.functionname ) {
             char *demangle = bfd_demangle( self_bfd,
@@ -198,48 +309,41 @@ static bool parseLine( const string line, StackFrame *frame )
 }
 #endif
 
-static void readBacktrace( std::vector<StackFrame> &trace, size_t skip
-#ifdef __sun
-        ,ucontext_t *context
-#endif
-)
-{
 #if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+static void captureAddresses( std::vector<void *> &addresses, size_t skip )
+{
     void *array[50];
     size_t size = backtrace(array, sizeof(array)/sizeof(void*));
-    if ( size > 0 && size < sizeof ( array ) / sizeof ( void* ) ) {
-#if HAVE_BFD_H && HAVE_DEMANGLE_H
-        if ( self_symbols ) {
-            for (size_t i = skip; i < size; ++i) {
-                StackFrame frame;
-                if ( !bfdAddressInfo( (bfd_vma)array[i], &frame ) ) {
-                    fprintf( stderr, "err (%d) %p\n", i, array[i] );
-                    frame.function = "??";
-                }
-                trace.push_back( frame );
-            }
-        } else {
-#endif
-            char **strs = backtrace_symbols(array, size);
-            if (strs) {
-                for (size_t i = skip; i < size; ++i) {
-                    StackFrame frame;
-                    if ( !parseLine( strs[i], &frame ) ) {
-                        fprintf( stderr, "err (%d) %s\n", int(i), strs[i] );
-                        frame.function = "??";
-                    }
-                    trace.push_back( frame );
-                }
-                free(strs);
-            }
+    if ( size > skip && size < sizeof ( array ) / sizeof ( void* ) ) {
+        addresses.assign( array + skip, array + size );
+    }
+}
+
+/* Addresses which cannot be resolved (e.g. in stripped modules) are common
+ * and not an error, so they just yield a frame with an unknown function.
+ */
+static void resolveAddress( void *address, char *symbol, StackFrame *frame )
+{
 #if HAVE_BFD_H && HAVE_DEMANGLE_H
+    if ( self_symbols ) {
+        if ( !bfdAddressInfo( (bfd_vma)address, frame ) ) {
+            frame->function = "??";
         }
+        return;
+    }
+#else
+    (void)address;
 #endif
+    if ( !symbol || !parseLine( symbol, frame ) ) {
+        frame->function = "??";
     }
+}
 #elif defined(__sun)
+static void readBacktrace( std::vector<StackFrame> &trace, ucontext_t *context )
+{
     walkcontext( context, buildBackTrace, (void*)&trace );
-#endif
 }
+#endif
 
 static void setupSymbolTable()
 {
@@ -267,6 +371,9 @@ static void setupSymbolTable()
                     symcnt = bfd_canonicalize_symtab( self_bfd, self_symbols );
                 if ( symcnt >= 0 ) {
                     success = true;
+                    self_sections = new vector<BfdSection>;
+                    bfd_map_over_sections( self_bfd, collectSection, self_sections );
+                    sort( self_sections->begin(), self_sections->end(), compareSectionStart );
                 } else {
                     free( self_symbols );
                     self_symbols = NULL;
@@ -292,6 +399,8 @@ static void cleanupSymbolTable()
             free( self_symbols );
             self_symbols = NULL;
         }
+        delete self_sections;
+        self_sections = NULL;
     }
 #endif
 }
@@ -302,6 +411,7 @@ BacktraceGenerator::BacktraceGenerator()
         pthread_mutex_init( &trace_mutex, NULL );
         symbol_buffer = (char *)malloc( 4096 );
         symbol_buffer_length = 4096;
+        symbol_cache = new SymbolCacheShard[symbol_cache_shard_count];
         setupSymbolTable();
     }
 }
@@ -312,19 +422,100 @@ BacktraceGenerator::~BacktraceGenerator()
         pthread_mutex_destroy( &trace_mutex );
         free( symbol_buffer );
         symbol_buffer = NULL;
+        delete [] symbol_cache;
+        symbol_cache = NULL;
         cleanupSymbolTable();
     }
 }
 
+/* Only captures the program counters; this neither locks nor allocates
+ * anything but the address list, so it's cheap enough for the hot path.
+ */
 Backtrace BacktraceGenerator::generate( size_t skipInnermostFrames )
 {
+#if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+    std::vector<void *> addresses;
+    captureAddresses( addresses, skipInnermostFrames + 2 );
+    return Backtrace( addresses, this );
+#else
     std::vector<StackFrame> trace;
-
+# ifdef __sun
+    ucontext_t context;
+    getcontext( &context );
     pthread_mutex_lock( &trace_mutex );
-    readBacktrace( trace, skipInnermostFrames + 2 );
+    readBacktrace( trace, &context );
     pthread_mutex_unlock( &trace_mutex );
-
+# endif
     return Backtrace( trace );
+#endif
+}
+
+Backtrace BacktraceGenerator::generateFromCaller( const void *callerAddress )
+{
+#if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+    std::vector<void *> addresses;
+    captureAddresses( addresses, 0 );
+    const std::vector<void *>::iterator it = std::find( addresses.begin(), addresses.end(), callerAddress );
+    if ( it != addresses.end() ) {
+        addresses.erase( addresses.begin(), it );
+    }
+    return Backtrace( addresses, this );
+#else
+    (void)callerAddress;
+    return generate( 0 );
+#endif
+}
+
+void BacktraceGenerator::symbolize( const std::vector<void *> &addresses,
+                                    std::vector<StackFrame> &frames )
+{
+#if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+    frames.assign( addresses.size(), StackFrame() );
+
+    std::vector<void *> unknownAddresses;
+    std::vector<size_t> unknownFrames;
+    for ( size_t i = 0; i < addresses.size(); ++i ) {
+        if ( !lookupCachedFrame( addresses[i], &frames[i] ) ) {
+            unknownAddresses.push_back( addresses[i] );
+            unknownFrames.push_back( i );
+        }
+    }
+    atomicAdd( &symbol_cache_hits, addresses.size() - unknownAddresses.size() );
+    atomicAdd( &symbol_cache_misses, unknownAddresses.size() );
+
+    if ( !unknownAddresses.empty() ) {
+        // The BFD symbol table and the demangling buffer are shared
+        pthread_mutex_lock( &trace_mutex );
+        char **strs = 0;
+#if HAVE_BFD_H && HAVE_DEMANGLE_H
+        if ( !self_symbols )
+#endif
+            strs = backtrace_symbols( &unknownAddresses[0], unknownAddresses.size() );
+
+        for ( size_t i = 0; i < unknownAddresses.size(); ++i ) {
+            resolveAddress( unknownAddresses[i], strs ? strs[i] : 0, &frames[unknownFrames[i]] );
+        }
+        free( strs );
+        pthread_mutex_unlock( &trace_mutex );
+
+        for ( size_t i = 0; i < unknownAddresses.size(); ++i ) {
+            cacheFrame( unknownAddresses[i], frames[unknownFrames[i]] );
+        }
+    }
+#else
+    frames.clear();
+    (void)addresses;
+#endif
+}
+
+unsigned long BacktraceGenerator::symbolCacheHits() const
+{
+    return atomicLoad( &symbol_cache_hits );
+}
+
+unsigned long BacktraceGenerator::symbolCacheMisses() const
+{
+    return atomicLoad( &symbol_cache_misses );
 }
 
 TRACELIB_NAMESPACE_END
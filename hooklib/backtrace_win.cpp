@@ -24,6 +24,8 @@
 #endif
 #include <windows.h>
 
+#include <algorithm>
+
 using namespace std;
 
 namespace {
@@ -36,6 +38,7 @@ public:
 
     void setFramesToSkip( size_t i ) { m_framesToSkip = i; }
     const vector<TRACELIB_NAMESPACE_IDENT(StackFrame)> &frames() const { return m_frames; }
+    const vector<DWORD64> &addresses() const { return m_addresses; }
 
 protected:
     virtual void OnCallstackEntry( CallstackEntryType type, CallstackEntry &entry );
@@ -44,6 +47,7 @@ private:
     size_t m_framesSeen;
     size_t m_framesToSkip;
     vector<TRACELIB_NAMESPACE_IDENT(StackFrame)> m_frames;
+    vector<DWORD64> m_addresses;
 };
 
 MyStackWalker::MyStackWalker()
@@ -60,6 +64,7 @@ void MyStackWalker::OnCallstackEntry( CallstackEntryType type, CallstackEntry &e
 {
     if ( type == firstEntry ) {
         m_frames.clear();
+        m_addresses.clear();
         m_framesSeen = 0;
     }
 
@@ -75,6 +80,7 @@ void MyStackWalker::OnCallstackEntry( CallstackEntryType type, CallstackEntry &e
         frame.sourceFile = entry.lineFileName; // XXX Consider encoding issues
         frame.lineNumber = entry.lineNumber;
         m_frames.push_back( frame );
+        m_addresses.push_back( entry.offset );
     }
 }
 #endif
@@ -115,5 +121,47 @@ Backtrace BacktraceGenerator::generate( size_t skipInnermostFrames )
     return bt;
 }
 
+Backtrace BacktraceGenerator::generateFromCaller( const void *callerAddress )
+{
+#ifdef USE_STACKWALKER
+    ::EnterCriticalSection( &d->generationSection );
+    static MyStackWalker stackWalker;
+    stackWalker.setFramesToSkip( 2 /* ShowCallstack() + generateFromCaller() */ );
+    stackWalker.ShowCallstack();
+    const vector<DWORD64> &addresses = stackWalker.addresses();
+    const vector<DWORD64>::const_iterator it = find( addresses.begin(), addresses.end(),
+                                                     reinterpret_cast<DWORD64>( callerAddress ) );
+    const size_t firstFrame = it != addresses.end() ? it - addresses.begin() : 0;
+    Backtrace bt( vector<TRACELIB_NAMESPACE_IDENT(StackFrame)>( stackWalker.frames().begin() + firstFrame,
+                                                                stackWalker.frames().end() ) );
+#else
+    (void)callerAddress;
+    vector<TRACELIB_NAMESPACE_IDENT(StackFrame)> empty;
+    Backtrace bt( empty );
+#endif
+    ::LeaveCriticalSection( &d->generationSection );
+    return bt;
+}
+
+void BacktraceGenerator::symbolize( const vector<void *> &addresses,
+                                    vector<TRACELIB_NAMESPACE_IDENT(StackFrame)> &frames )
+{
+    /* generate() yields symbolized backtraces right away (StackWalker does
+     * not hand out the raw program counters), so there is nothing to do.
+     */
+    (void)addresses;
+    frames.clear();
+}
+
+unsigned long BacktraceGenerator::symbolCacheHits() const
+{
+    return 0;
+}
+
+unsigned long BacktraceGenerator::symbolCacheMisses() const
+{
+    return 0;
+}
+
 TRACELIB_NAMESPACE_END
 
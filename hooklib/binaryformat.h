@@ -0,0 +1,110 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACELIB_BINARYFORMAT_H
+#define TRACELIB_BINARYFORMAT_H
+
+#include "tracelib_config.h"
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Describes the record format written by the BinarySerializer; this header
+ * is shared with the decoder in the trace daemon.
+ *
+ * Every record starts with the RecordMarker byte followed by a record type
+ * byte, the length of the payload (as a varint) and the payload itself.
+ * Unsigned integers are encoded as varints (seven bits per byte, least
+ * significant group first, the high bit is set on all but the last byte),
+ * signed integers are zigzag encoded first. Strings are a varint length
+ * followed by that many bytes of UTF-8 data without a terminating zero,
+ * floating point values are eight bytes of an IEEE 754 double in little
+ * endian byte order.
+ *
+ * Bytes between two records which are not a RecordMarker are skipped, this
+ * allows outputs to put a newline after each record.
+ *
+ * SessionRecord payload:
+ *   pid, process start time, process name, trace key count and for each
+ *   key an enabled byte and the name, maximum trace size, shrink
+ *   percentage, archive directory. This is the first record of a session;
+ *   it applies to all records following it.
+ *
+ * TracePointDefinitionRecord payload:
+ *   trace point ID, trace point type (byte), line number, source file,
+ *   function name, flags (byte), [group name]. The definition is written
+ *   once per session, before the first entry referring to the ID.
+ *
+ * TraceEntryRecord payload:
+ *   thread id, timestamp, stack position, trace point ID, flags (byte),
+ *   [variable count and for each variable its name, its VariableType (byte)
+ *   and its value], [backtrace depth and for each frame the module,
+ *   function, function offset, source file and line number], [message].
+ *
+ * The parts in brackets are only present if the corresponding flag is set.
+ *
+ * Number variables are a signedness byte followed by the (zigzag encoded,
+ * if signed) value, boolean variables are a single byte.
+ *
+ * ShutdownEventRecord payload:
+ *   pid, process start time, shutdown time, process name
+ *
+ * CompressionRequestRecord payload:
+ *   bit mask of codecs; only sent by the NetworkOutput in front of the
+ *   actual stream, see streamcompression.h
+ *
+ * CrashRecord payload:
+ *   thread id, timestamp, signal number, fault address, frame count and
+ *   for each frame the program counter, followed by the executable
+ *   mappings of the process up to the end of the payload: start address,
+ *   end address, file offset and path of each. Written by the crash
+ *   handler, which cannot symbolize the program counters itself; the
+ *   receiving end does that using the mappings.
+ *
+ * ThreadRecord payload:
+ *   thread id, thread name. Written once per session and thread, before
+ *   the first entry of a thread which has a name.
+ *
+ * The timestamp of trace entries is given in nanoseconds since the epoch,
+ * all other times are in milliseconds since the epoch.
+ */
+namespace BinaryFormat
+{
+    const unsigned char RecordMarker = 0xB1;
+
+    enum RecordType {
+        TraceEntryRecord = 1,
+        ShutdownEventRecord = 2,
+        TracePointDefinitionRecord = 3,
+        SessionRecord = 4,
+        CompressionRequestRecord = 5,
+        CrashRecord = 6,
+        ThreadRecord = 7
+    };
+
+    enum RecordFlags {
+        HasGroupName = 0x01,
+        HasVariables = 0x02,
+        HasBacktrace = 0x04,
+        HasMessage = 0x08
+    };
+}
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_BINARYFORMAT_H)
+
@@ -22,12 +22,16 @@
 #include "filter.h"
 #include "output.h"
 #include "serializer.h"
+#include "throttle.h"
 #include "trace.h"
 
 #include "3rdparty/tinyxml/tinyxml.h"
 
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
 
+#include <signal.h>
 #include <string.h>
 
 using namespace std;
@@ -44,6 +48,28 @@ static std::string getText( const TiXmlElement *e )
              : "";
 }
 
+/* Every thread allocates the number of entries given in the size= attribute
+ * of <asyncbuffer> or <flightrecorder> up front, so anything beyond this is
+ * considered a typo.
+ */
+static const unsigned long MaximumEntriesPerThread = 1024 * 1024;
+
+// Accepts plain decimal numbers from 1 to MaximumEntriesPerThread.
+static bool parseEntriesPerThread( const string &value, unsigned long *entries )
+{
+    if ( value.empty() || value.find_first_not_of( "0123456789" ) != string::npos ) {
+        return false;
+    }
+
+    errno = 0;
+    const unsigned long v = strtoul( value.c_str(), 0, 10 );
+    if ( errno == ERANGE || v == 0 || v > MaximumEntriesPerThread ) {
+        return false;
+    }
+    *entries = v;
+    return true;
+}
+
 TRACELIB_NAMESPACE_BEGIN
 
 Configuration *Configuration::fromFile( const string &fileName, Log *log )
@@ -198,6 +224,20 @@ bool Configuration::readProcessElement( TiXmlElement *processElement )
             continue;
         }
 
+        if ( e->ValueStr() == "asyncbuffer" ) {
+            if ( !readAsyncBufferElement( e ) ) {
+                return false;
+            }
+            continue;
+        }
+
+        if ( e->ValueStr() == "flightrecorder" ) {
+            if ( !readFlightRecorderElement( e ) ) {
+                return false;
+            }
+            continue;
+        }
+
         m_log->writeError( "Tracelib Configuration: while reading %s: unexpected child element '%s' found inside <process>.", m_fileName.c_str(), processElement->Value() );
     }
     return true;
@@ -229,6 +269,16 @@ const StorageConfiguration &Configuration::storageConfiguration() const
     return m_storageConfiguration;
 }
 
+const AsyncConfiguration &Configuration::asyncConfiguration() const
+{
+    return m_asyncConfiguration;
+}
+
+const FlightRecorderConfiguration &Configuration::flightRecorderConfiguration() const
+{
+    return m_flightRecorderConfiguration;
+}
+
 const vector<TracePointSet *> &Configuration::configuredTracePointSets() const
 {
     return m_configuredTracePointSets;
@@ -418,6 +468,21 @@ Serializer *Configuration::createSerializerFromElement( TiXmlElement *e )
         return serializer;
     }
 
+    if ( serializerType == "binary" ) {
+        for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
+            if ( optionElement->ValueStr() != "option" ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <serializer> element of type binary found.", m_fileName.c_str(), optionElement->Value() );
+                return 0;
+            }
+
+            string optionName;
+            optionElement->QueryValueAttribute( "name", &optionName );
+            m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in binary serializer; ignoring this.", m_fileName.c_str(), optionName.c_str() );
+        }
+        m_log->writeStatus( "Tracelib Configuration: using binary serializer" );
+        return new BinarySerializer;
+    }
+
     m_log->writeError( "Tracelib Configuration: while reading %s: <serializer> element with unknown type '%s' found.", m_fileName.c_str(), serializerType.c_str() );
     return 0;
 }
@@ -438,6 +503,20 @@ TracePointSet *Configuration::createTracePointSetFromElement( TiXmlElement *e )
         return 0;
     }
 
+    unsigned long rate = 0;
+    const char *rateAttr = e->Attribute( "rate" );
+    if ( rateAttr && !parseRateAttribute( rateAttr, &rate ) ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for rate= attribute of <tracepointset> element", m_fileName.c_str(), rateAttr );
+        return 0;
+    }
+
+    unsigned long sampleInterval = 0;
+    const char *sampleAttr = e->Attribute( "sample" );
+    if ( sampleAttr && !parseSampleAttribute( sampleAttr, &sampleInterval ) ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for sample= attribute of <tracepointset> element", m_fileName.c_str(), sampleAttr );
+        return 0;
+    }
+
     TiXmlElement *filterElement = e->FirstChildElement();
     if ( !filterElement ) {
         m_log->writeError( "Tracelib Configuration: while reading %s: No filter element specified for <tracepointset> element", m_fileName.c_str() );
@@ -463,7 +542,7 @@ TracePointSet *Configuration::createTracePointSetFromElement( TiXmlElement *e )
         actions |= TracePointSet::YieldVariables;
     }
 
-    return new TracePointSet( filter, actions );
+    return new TracePointSet( filter, actions, rate, sampleInterval );
 }
 
 Output *Configuration::createOutputFromElement( TiXmlElement *e )
@@ -530,9 +609,71 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
         return new FileOutput( m_log, filename );
     }
 
+    if ( outputType == "mappedfile" ) {
+        std::string filename;
+        bool relativePathIsRelativeToUserHome = false;
+        MappedFileOutputConfiguration config;
+        for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
+            if ( optionElement->ValueStr() != "option" ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <output> element of type mappedfile found.", m_fileName.c_str(), optionElement->Value() );
+                return 0;
+            }
+
+            string optionName;
+            if ( optionElement->QueryValueAttribute( "name", &optionName ) != TIXML_SUCCESS ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Failed to read name property of <option> element; ignoring this.", m_fileName.c_str() );
+                continue;
+            }
+
+            if ( optionName == "filename" ) {
+                filename = getText( optionElement ); // XXX Consider encoding issues
+            } else if ( optionName == "relativeToUserHome" ) {
+                relativePathIsRelativeToUserHome = getText( optionElement ) == "true";
+            } else if ( optionName == "segmentSize" || optionName == "maximumAge" || optionName == "maximumFiles" || optionName == "flushInterval" ) {
+                unsigned long value = 0;
+                istringstream str( getText( optionElement ) );
+                if ( !( str >> value ) ||
+                     ( optionName == "segmentSize" && value < 64 * 1024 ) ||
+                     ( optionName == "maximumFiles" && value == 0 ) ) {
+                    m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for '%s' option of mappedfile output; ignoring this.", m_fileName.c_str(), getText( optionElement ).c_str(), optionName.c_str() );
+                    continue;
+                }
+                if ( optionName == "segmentSize" ) {
+                    config.segmentSize = value;
+                } else if ( optionName == "maximumAge" ) {
+                    config.maximumAge = value;
+                } else if ( optionName == "maximumFiles" ) {
+                    config.maximumFiles = value;
+                } else {
+                    config.flushInterval = value;
+                }
+            } else {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in mappedfile output; ignoring this.", m_fileName.c_str(), optionName.c_str() );
+                continue;
+            }
+        }
+
+        if ( filename.empty() ) {
+            m_log->writeError( "Tracelib Configuration: while reading %s: No 'filename' option specified for <output> element of type mappedfile.", m_fileName.c_str() );
+            return 0;
+        }
+        if( !isAbsolute( filename ) && relativePathIsRelativeToUserHome ) {
+            filename = userHome() + pathSeparator() + filename;
+        }
+
+#ifdef _WIN32
+        m_log->writeError( "Tracelib Configuration: while reading %s: <output> elements of type mappedfile are not supported on Windows", m_fileName.c_str() );
+        return 0;
+#else
+        m_log->writeStatus( "Tracelib Configuration: using mapped file output to %s (segment size=%lu, maximum age=%lu, maximum files=%lu, flush interval=%lu)", filename.c_str(), config.segmentSize, config.maximumAge, config.maximumFiles, config.flushInterval );
+        return new MappedFileOutput( m_log, filename, config );
+#endif
+    }
+
     if ( outputType == "tcp" ) {
         string hostname;
         unsigned short port = TRACELIB_DEFAULT_PORT;
+        NetworkOutputConfiguration config;
         for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
             if ( optionElement->ValueStr() != "option" ) {
                 m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <output> element of type tcp found.", m_fileName.c_str(), optionElement->Value() );
@@ -550,6 +691,42 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
             } else if ( optionName == "port" ) {
                 istringstream str( getText( optionElement ) );
                 str >> port; // XXX Error handling for non-numeric port numbers
+            } else if ( optionName == "queueSize" || optionName == "batchSize" || optionName == "flushInterval" ) {
+                unsigned long value = 0;
+                istringstream str( getText( optionElement ) );
+                if ( !( str >> value ) || ( value == 0 && optionName != "flushInterval" ) ) {
+                    m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for '%s' option of tcp output; ignoring this.", m_fileName.c_str(), getText( optionElement ).c_str(), optionName.c_str() );
+                    continue;
+                }
+                if ( optionName == "queueSize" ) {
+                    config.queueSize = value;
+                } else if ( optionName == "batchSize" ) {
+                    config.batchSize = value;
+                } else {
+                    config.flushInterval = value;
+                }
+            } else if ( optionName == "overflow" ) {
+                const string policy = getText( optionElement );
+                if ( policy == "block" ) {
+                    config.overflowPolicy = NetworkOutputConfiguration::BlockWhenFull;
+                } else if ( policy == "dropoldest" ) {
+                    config.overflowPolicy = NetworkOutputConfiguration::DropOldestWhenFull;
+                } else if ( policy == "dropnewest" ) {
+                    config.overflowPolicy = NetworkOutputConfiguration::DropNewestWhenFull;
+                } else {
+                    m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for 'overflow' option of tcp output; ignoring this.", m_fileName.c_str(), policy.c_str() );
+                    continue;
+                }
+            } else if ( optionName == "compression" ) {
+                const string compression = getText( optionElement );
+                if ( compression == "none" ) {
+                    config.compression = NetworkOutputConfiguration::NoCompression;
+                } else if ( compression == "lz4" ) {
+                    config.compression = NetworkOutputConfiguration::Lz4Compression;
+                } else {
+                    m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for 'compression' option of tcp output; ignoring this.", m_fileName.c_str(), compression.c_str() );
+                    continue;
+                }
             } else {
                 m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in tcp output; ignoring this.", m_fileName.c_str(), optionName.c_str() );
                 continue;
@@ -566,8 +743,45 @@ Output *Configuration::createOutputFromElement( TiXmlElement *e )
             return 0;
         }
 
-        m_log->writeStatus( "Tracelib Configuration: using TCP/IP output, remote = %s:%d", hostname.c_str(), port );
-        return new NetworkOutput( m_log, hostname.c_str(), port );
+        m_log->writeStatus( "Tracelib Configuration: using TCP/IP output, remote = %s:%d (queue size=%lu, batch size=%lu, flush interval=%lu, compression=%s)", hostname.c_str(), port, config.queueSize, config.batchSize, config.flushInterval, config.compression == NetworkOutputConfiguration::Lz4Compression ? "lz4" : "none" );
+        return new NetworkOutput( m_log, hostname.c_str(), port, config );
+    }
+
+    if ( outputType == "sharedmemory" ) {
+        unsigned long size = 4 * 1024 * 1024;
+        for ( TiXmlElement *optionElement = e->FirstChildElement(); optionElement; optionElement = optionElement->NextSiblingElement() ) {
+            if ( optionElement->ValueStr() != "option" ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unexpected element '%s' in <output> element of type sharedmemory found.", m_fileName.c_str(), optionElement->Value() );
+                return 0;
+            }
+
+            string optionName;
+            if ( optionElement->QueryValueAttribute( "name", &optionName ) != TIXML_SUCCESS ) {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Failed to read name property of <option> element; ignoring this.", m_fileName.c_str() );
+                continue;
+            }
+
+            if ( optionName == "size" ) {
+                unsigned long value = 0;
+                istringstream str( getText( optionElement ) );
+                if ( !( str >> value ) || value < 64 * 1024 || value > 1024 * 1024 * 1024 ) {
+                    m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for 'size' option of sharedmemory output (expected 65536 to 1073741824 bytes); ignoring this.", m_fileName.c_str(), getText( optionElement ).c_str() );
+                    continue;
+                }
+                size = value;
+            } else {
+                m_log->writeError( "Tracelib Configuration: while reading %s: Unknown <option> element with name '%s' found in sharedmemory output; ignoring this.", m_fileName.c_str(), optionName.c_str() );
+                continue;
+            }
+        }
+
+#ifdef _WIN32
+        m_log->writeError( "Tracelib Configuration: while reading %s: <output> elements of type sharedmemory are not supported on Windows", m_fileName.c_str() );
+        return 0;
+#else
+        m_log->writeStatus( "Tracelib Configuration: using shared memory output (size=%lu)", size );
+        return new SharedMemoryOutput( m_log, static_cast<unsigned int>( size ) );
+#endif
     }
 
     m_log->writeError( "Tracelib Configuration: while reading %s: Unknown type '%s' specified for <output> element", m_fileName.c_str(), outputType.c_str() );
@@ -654,5 +868,69 @@ bool Configuration::readStorageElement( TiXmlElement *storageElem )
     return true;
 }
 
+bool Configuration::readAsyncBufferElement( TiXmlElement *asyncBufferElem )
+{
+    if ( m_asyncConfiguration.enabled ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: found multiple <asyncbuffer> elements in <process> element.", m_fileName.c_str() );
+        return false;
+    }
+
+    const char *sizeAttr = asyncBufferElem->Attribute( "size" );
+    if ( sizeAttr && !parseEntriesPerThread( sizeAttr, &m_asyncConfiguration.bufferSize ) ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for size= attribute of <asyncbuffer> element (expected 1 to %lu)", m_fileName.c_str(), sizeAttr, MaximumEntriesPerThread );
+        return false;
+    }
+
+    string overflowAttr = "block";
+    asyncBufferElem->QueryValueAttribute( "overflow", &overflowAttr );
+    if ( overflowAttr == "block" ) {
+        m_asyncConfiguration.overflowPolicy = AsyncConfiguration::BlockWhenFull;
+    } else if ( overflowAttr == "drop" ) {
+        m_asyncConfiguration.overflowPolicy = AsyncConfiguration::DropWhenFull;
+    } else {
+        m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for overflow= attribute of <asyncbuffer> element", m_fileName.c_str(), overflowAttr.c_str() );
+        return false;
+    }
+
+    m_asyncConfiguration.enabled = true;
+    m_log->writeStatus( "Tracelib Configuration: using asynchronous output with %lu entries per thread (overflow=%s)", m_asyncConfiguration.bufferSize, overflowAttr.c_str() );
+    return true;
+}
+
+bool Configuration::readFlightRecorderElement( TiXmlElement *flightRecorderElem )
+{
+    if ( m_flightRecorderConfiguration.enabled ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: found multiple <flightrecorder> elements in <process> element.", m_fileName.c_str() );
+        return false;
+    }
+
+    const char *sizeAttr = flightRecorderElem->Attribute( "size" );
+    if ( sizeAttr && !parseEntriesPerThread( sizeAttr, &m_flightRecorderConfiguration.entriesPerThread ) ) {
+        m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for size= attribute of <flightrecorder> element (expected 1 to %lu)", m_fileName.c_str(), sizeAttr, MaximumEntriesPerThread );
+        return false;
+    }
+
+    string signalAttr;
+    if ( flightRecorderElem->QueryValueAttribute( "signal", &signalAttr ) == TIXML_SUCCESS ) {
+#ifdef _WIN32
+        m_log->writeError( "Tracelib Configuration: while reading %s: signal= attribute of <flightrecorder> element is not supported on Windows", m_fileName.c_str() );
+        return false;
+#else
+        if ( signalAttr == "SIGUSR1" ) {
+            m_flightRecorderConfiguration.dumpSignal = SIGUSR1;
+        } else if ( signalAttr == "SIGUSR2" ) {
+            m_flightRecorderConfiguration.dumpSignal = SIGUSR2;
+        } else {
+            m_log->writeError( "Tracelib Configuration: while reading %s: Invalid value '%s' for signal= attribute of <flightrecorder> element (expected SIGUSR1 or SIGUSR2)", m_fileName.c_str(), signalAttr.c_str() );
+            return false;
+        }
+#endif
+    }
+
+    m_flightRecorderConfiguration.enabled = true;
+    m_log->writeStatus( "Tracelib Configuration: using flight recorder with %lu entries per thread (signal=%s)", m_flightRecorderConfiguration.entriesPerThread, signalAttr.empty() ? "none" : signalAttr.c_str() );
+    return true;
+}
+
 TRACELIB_NAMESPACE_END
 
@@ -49,6 +49,39 @@ struct StorageConfiguration {
     std::string archiveDirectoryName;
 };
 
+struct AsyncConfiguration {
+    enum OverflowPolicy {
+        BlockWhenFull,
+        DropWhenFull
+    };
+
+    AsyncConfiguration()
+        : enabled( false ),
+          bufferSize( 1024 ),
+          overflowPolicy( BlockWhenFull )
+    { }
+
+    bool enabled;
+    unsigned long bufferSize;
+    OverflowPolicy overflowPolicy;
+};
+
+/* In flight recorder mode, entries are only kept in memory (the most
+ * recent ones of each thread) and written when an error trace point is
+ * hit, the application crashes or the given signal is received.
+ */
+struct FlightRecorderConfiguration {
+    FlightRecorderConfiguration()
+        : enabled( false ),
+          entriesPerThread( 1000 ),
+          dumpSignal( 0 )
+    { }
+
+    bool enabled;
+    unsigned long entriesPerThread;
+    int dumpSignal; // 0 means none
+};
+
 struct TraceKey
 {
     TraceKey() : enabled( true ) { }
@@ -70,6 +103,8 @@ public:
     static Configuration *fromMarkup( const std::string &markup, Log *log );
 
     const StorageConfiguration &storageConfiguration() const;
+    const AsyncConfiguration &asyncConfiguration() const;
+    const FlightRecorderConfiguration &flightRecorderConfiguration() const;
     const std::vector<TracePointSet *> &configuredTracePointSets() const;
     Serializer *configuredSerializer();
     Output *configuredOutput();
@@ -89,6 +124,8 @@ private:
     bool readProcessElement( TiXmlElement *e );
     bool readTraceKeysElement( TiXmlElement *e );
     bool readStorageElement( TiXmlElement *e );
+    bool readAsyncBufferElement( TiXmlElement *e );
+    bool readFlightRecorderElement( TiXmlElement *e );
 
     std::string m_fileName;
     std::vector<TracePointSet *> m_configuredTracePointSets;
@@ -97,6 +134,8 @@ private:
     Log *m_log;
     std::vector<TraceKey> m_configuredTraceKeys;
     StorageConfiguration m_storageConfiguration;
+    AsyncConfiguration m_asyncConfiguration;
+    FlightRecorderConfiguration m_flightRecorderConfiguration;
 };
 
 TRACELIB_NAMESPACE_END
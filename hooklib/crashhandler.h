@@ -24,7 +24,20 @@
 
 TRACELIB_NAMESPACE_BEGIN
 
-typedef void ( *CrashHandler )();
+/* What is known about a crash; anything not available on the platform
+ * is zero.
+ */
+struct CrashInfo
+{
+    int signalNumber;
+    void *faultAddress; // the address which could not be accessed, if any
+    void *instructionPointer; // the instruction which crashed
+};
+
+/* Called when the application crashes; on Unix systems this happens in a
+ * signal handler, so only async-signal-safe functions should be used.
+ */
+typedef void ( *CrashHandler )( const CrashInfo &info );
 void installCrashHandler( CrashHandler handler );
 
 TRACELIB_NAMESPACE_END
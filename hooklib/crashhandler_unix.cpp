@@ -24,6 +24,9 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__linux__)
+#  include <ucontext.h>
+#endif
 
 using namespace std;
 
@@ -39,15 +42,40 @@ static const int g_caughtSignals[] = {
 
 static TRACELIB_NAMESPACE_IDENT(CrashHandler) g_handler;
 
+/* Used by the crash handler of the thread which installed it, so that a
+ * stack overflow can be recorded, too (unless the application installed
+ * an alternate signal stack itself).
+ */
+static char g_signalStack[256 * 1024];
+
+static void *instructionPointer( void *context )
+{
+#if defined(__linux__) && defined(__x86_64__)
+    return reinterpret_cast<void *>( static_cast<ucontext_t *>( context )->uc_mcontext.gregs[REG_RIP] );
+#elif defined(__linux__) && defined(__i386__)
+    return reinterpret_cast<void *>( static_cast<ucontext_t *>( context )->uc_mcontext.gregs[REG_EIP] );
+#elif defined(__linux__) && defined(__aarch64__)
+    return reinterpret_cast<void *>( static_cast<ucontext_t *>( context )->uc_mcontext.pc );
+#else
+    (void)context;
+    return 0;
+#endif
+}
+
 extern "C"
 {
 
-static void crashHandler( int sig )
+static void crashHandler( int sig, siginfo_t *info, void *context )
 {
     for ( unsigned int i = 0; i < sizeof( g_caughtSignals ) / sizeof( g_caughtSignals[0] ); ++i ) {
         signal( g_caughtSignals[i], SIG_DFL );
     }
-    (*g_handler)();
+
+    TRACELIB_NAMESPACE_IDENT(CrashInfo) crashInfo;
+    crashInfo.signalNumber = sig;
+    crashInfo.faultAddress = info ? info->si_addr : 0;
+    crashInfo.instructionPointer = context ? instructionPointer( context ) : 0;
+    (*g_handler)( crashInfo );
 }
 
 }
@@ -65,8 +93,23 @@ void installCrashHandler( CrashHandler handler )
     if ( !crashHandlerInstalled ) {
         crashHandlerInstalled = true;
         g_handler = handler;
+
+        stack_t currentStack;
+        if ( sigaltstack( 0, &currentStack ) == 0 && ( currentStack.ss_flags & SS_DISABLE ) ) {
+            stack_t signalStack;
+            memset( &signalStack, 0, sizeof( signalStack ) );
+            signalStack.ss_sp = g_signalStack;
+            signalStack.ss_size = sizeof( g_signalStack );
+            sigaltstack( &signalStack, 0 );
+        }
+
+        struct sigaction action;
+        memset( &action, 0, sizeof( action ) );
+        action.sa_sigaction = crashHandler;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset( &action.sa_mask );
         for ( unsigned int i = 0; i < sizeof( g_caughtSignals ) / sizeof( g_caughtSignals[0] ); ++i ) {
-            signal( g_caughtSignals[i], crashHandler );
+            sigaction( g_caughtSignals[i], &action, 0 );
         }
     }
 }
@@ -29,7 +29,11 @@ static CrashHandler g_handler;
 
 static LONG WINAPI tracelibExceptionFilterProc( LPEXCEPTION_POINTERS ex )
 {
-    (*g_handler)();
+    CrashInfo info;
+    info.signalNumber = 0;
+    info.faultAddress = 0;
+    info.instructionPointer = ex->ExceptionRecord->ExceptionAddress;
+    (*g_handler)( info );
     if ( g_prevExceptionFilter ) {
         return g_prevExceptionFilter( ex );
     }
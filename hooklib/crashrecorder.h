@@ -0,0 +1,103 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_CRASHRECORDER_H
+#define TRACELIB_CRASHRECORDER_H
+
+#include "tracelib_config.h"
+
+#include <signal.h>
+#include <string>
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct CrashInfo;
+
+/* Writes a BinaryFormat::CrashRecord from within the crash handler. All
+ * memory needed for that is reserved up front, so write() doesn't allocate,
+ * lock or use stdio itself. The stack is walked using glibc's backtrace()
+ * though, which POSIX doesn't list as async-signal-safe; it is called once
+ * in the constructor so that the unwinder is loaded before a crash, after
+ * that it works in practice (unless the stack is too broken to walk). The
+ * program counters are written as they are; they are symbolized by the
+ * trace daemon using the executable mappings which are part of the record.
+ *
+ * The record is appended to the output descriptor if there is one;
+ * otherwise it goes to a file of its own, preceded by a session record so
+ * that the file is a complete stream (which xml2trace can import). Only
+ * available on Unix systems.
+ */
+class CrashRecorder
+{
+public:
+    enum Destination {
+        NotWritten,
+        WrittenToOutput,
+        WrittenToFallbackFile
+    };
+
+    CrashRecorder();
+    ~CrashRecorder();
+
+    const std::string &fallbackFileName() const { return m_fallbackFileName; }
+
+    /* The session record to write in front of the crash record in the
+     * fallback file; no fallback file is written while this is empty.
+     */
+    void setSessionHeader( const std::vector<char> &header );
+
+    /* A descriptor to which binary records can be appended right away, or
+     * -1 to use the fallback file. While the output is busy (i.e. data is
+     * being written to it) the fallback file is used as well since the
+     * crash record would end up in the middle of other data.
+     */
+    void setOutputDescriptor( int fd ) { m_outputDescriptor = fd; }
+
+    /* To be called around all other writes to the output; waits while the
+     * crash record is being appended to it.
+     */
+    void beginOutputWrite();
+    void endOutputWrite();
+
+    /* Meant to be called from a signal handler, see above for the caveat
+     * about backtrace(); may only be called once.
+     */
+    Destination write( const CrashInfo &info );
+
+private:
+    CrashRecorder( const CrashRecorder &other );
+    void operator=( const CrashRecorder &rhs );
+
+    size_t appendMappings( char *pos, const char *end );
+
+    std::string m_fallbackFileName;
+    std::vector<char> m_sessionHeaders[2];
+    volatile unsigned long m_currentSessionHeader;
+    volatile sig_atomic_t m_outputDescriptor;
+    // Claimed by whoever writes to the output, using compare-and-swap
+    volatile unsigned long m_outputBusy;
+    void **m_frames;
+    char *m_record;
+    char *m_readBuffer;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_CRASHRECORDER_H)
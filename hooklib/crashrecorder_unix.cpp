@@ -0,0 +1,308 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crashrecorder.h"
+
+#include <config.h>
+
+#include "atomicops.h"
+#include "binaryformat.h"
+#include "configuration.h" // for Configuration::currentProcessName
+#include "crashhandler.h"
+#include "getcurrentthreadid.h"
+#include "thread.h" // for Thread::yield
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sstream>
+#if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+#  include <execinfo.h>
+#endif
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+static const int MaximumFrames = 64;
+static const size_t RecordSize = 64 * 1024;
+static const size_t ReadBufferSize = 8192;
+
+// Room for the record marker, the record type and the payload length
+static const size_t RecordHeaderSize = 12;
+
+// Enough for any number of varints which is not proportional to the input
+static const size_t VarintSize = 10;
+
+static char *appendVarint( char *pos, uint64_t v )
+{
+    while ( v >= 0x80 ) {
+        *pos++ = static_cast<char>( ( v & 0x7f ) | 0x80 );
+        v >>= 7;
+    }
+    *pos++ = static_cast<char>( v );
+    return pos;
+}
+
+static bool parseHex( const char *&pos, const char *end, uint64_t &value )
+{
+    const char *start = pos;
+    value = 0;
+    for ( ; pos != end; ++pos ) {
+        unsigned int digit;
+        if ( *pos >= '0' && *pos <= '9' ) {
+            digit = *pos - '0';
+        } else if ( *pos >= 'a' && *pos <= 'f' ) {
+            digit = *pos - 'a' + 10;
+        } else {
+            break;
+        }
+        value = value * 16 + digit;
+    }
+    return pos != start;
+}
+
+// Skips the field at the given position and the spaces following it
+static const char *skipField( const char *pos, const char *end )
+{
+    while ( pos != end && *pos != ' ' ) {
+        ++pos;
+    }
+    while ( pos != end && *pos == ' ' ) {
+        ++pos;
+    }
+    return pos;
+}
+
+static bool writeFully( int fd, const char *data, size_t length )
+{
+    while ( length > 0 ) {
+        const ssize_t result = ::write( fd, data, length );
+        if ( result == -1 && errno == EINTR ) {
+            continue;
+        }
+        if ( result <= 0 ) {
+            return false;
+        }
+        data += result;
+        length -= result;
+    }
+    return true;
+}
+
+CrashRecorder::CrashRecorder()
+    : m_currentSessionHeader( 0 ),
+    m_outputDescriptor( -1 ),
+    m_outputBusy( 0 ),
+    m_frames( new void *[MaximumFrames] ),
+    m_record( new char[RecordSize] ),
+    m_readBuffer( new char[ReadBufferSize] )
+{
+    const char *tempDir = getenv( "TMPDIR" );
+    ostringstream str;
+    str << ( tempDir && *tempDir ? tempDir : "/tmp" ) << "/tracelib-crash-"
+        << Configuration::currentProcessName() << "-" << getpid() << ".dat";
+    m_fallbackFileName = str.str();
+
+#if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+    /* The first call loads the unwinder, which allocates memory; that must
+     * not happen in the crash handler.
+     */
+    backtrace( m_frames, 1 );
+#endif
+}
+
+CrashRecorder::~CrashRecorder()
+{
+    delete [] m_frames;
+    delete [] m_record;
+    delete [] m_readBuffer;
+}
+
+/* Called on configuration changes only, but possibly while another thread
+ * crashes; the header used by write() is never modified.
+ */
+void CrashRecorder::setSessionHeader( const vector<char> &header )
+{
+    const unsigned long next = 1 - atomicLoad( &m_currentSessionHeader );
+    m_sessionHeaders[next] = header;
+    atomicStore( &m_currentSessionHeader, next );
+}
+
+CrashRecorder::Destination CrashRecorder::write( const CrashInfo &info )
+{
+    int depth = 0;
+#if defined(__GNUC__) && defined(HAVE_EXECINFO_H)
+    depth = backtrace( m_frames, MaximumFrames );
+#endif
+
+    // Drop the frames of the crash handler
+    int firstFrame = 0;
+    for ( int i = 0; i < depth; ++i ) {
+        if ( m_frames[i] == info.instructionPointer ) {
+            firstFrame = i;
+            break;
+        }
+    }
+
+    uint64_t timeStamp = 0;
+    timespec ts;
+    if ( clock_gettime( CLOCK_REALTIME, &ts ) == 0 ) {
+        timeStamp = static_cast<uint64_t>( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+    }
+
+    char * const payload = m_record + RecordHeaderSize;
+    char *pos = payload;
+    pos = appendVarint( pos, getCurrentThreadIdUncached() );
+    pos = appendVarint( pos, timeStamp );
+    pos = appendVarint( pos, info.signalNumber );
+    pos = appendVarint( pos, reinterpret_cast<size_t>( info.faultAddress ) );
+    pos = appendVarint( pos, depth - firstFrame );
+    for ( int i = firstFrame; i < depth; ++i ) {
+        pos = appendVarint( pos, reinterpret_cast<size_t>( m_frames[i] ) );
+    }
+    // Leave room for the trailing newline
+    pos += appendMappings( pos, m_record + RecordSize - 1 );
+
+    char header[RecordHeaderSize];
+    char *headerEnd = header;
+    *headerEnd++ = static_cast<char>( BinaryFormat::RecordMarker );
+    *headerEnd++ = static_cast<char>( BinaryFormat::CrashRecord );
+    headerEnd = appendVarint( headerEnd, pos - payload );
+
+    char * const record = payload - ( headerEnd - header );
+    memcpy( record, header, headerEnd - header );
+    *pos++ = '\n';
+    const size_t recordLength = pos - record;
+
+    const int outputDescriptor = m_outputDescriptor;
+    if ( outputDescriptor != -1 && atomicCompareAndSwap( &m_outputBusy, 0, 1 ) ) {
+        const bool written = writeFully( outputDescriptor, record, recordLength );
+        // Other threads may still write, e.g. the entries of the flight recorder
+        atomicStore( &m_outputBusy, 0 );
+        if ( written ) {
+            return WrittenToOutput;
+        }
+    }
+
+    const vector<char> &sessionHeader = m_sessionHeaders[atomicLoad( &m_currentSessionHeader )];
+    if ( sessionHeader.empty() ) {
+        return NotWritten;
+    }
+
+    const int fd = open( m_fallbackFileName.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644 );
+    if ( fd == -1 ) {
+        return NotWritten;
+    }
+    const bool written = writeFully( fd, &sessionHeader[0], sessionHeader.size() ) &&
+                         writeFully( fd, "\n", 1 ) &&
+                         writeFully( fd, record, recordLength );
+    close( fd );
+    return written ? WrittenToFallbackFile : NotWritten;
+}
+
+void CrashRecorder::beginOutputWrite()
+{
+    // The crash recorder never waits, so it holds the flag only briefly
+    while ( !atomicCompareAndSwap( &m_outputBusy, 0, 1 ) ) {
+        Thread::yield();
+    }
+}
+
+void CrashRecorder::endOutputWrite()
+{
+    atomicStore( &m_outputBusy, 0 );
+}
+
+/* Appends the executable file mappings listed in /proc/self/maps (if
+ * available) as long as they fit; returns the number of bytes appended.
+ */
+size_t CrashRecorder::appendMappings( char *pos, const char *end )
+{
+    const int fd = open( "/proc/self/maps", O_RDONLY );
+    if ( fd == -1 ) {
+        return 0;
+    }
+
+    char * const begin = pos;
+    size_t filled = 0;
+    for ( ;; ) {
+        const ssize_t result = read( fd, m_readBuffer + filled, ReadBufferSize - filled );
+        if ( result == -1 && errno == EINTR ) {
+            continue;
+        }
+        if ( result <= 0 ) {
+            break;
+        }
+        filled += result;
+
+        // Lines look like "<start>-<end> <perms> <offset> <dev> <inode> <path>"
+        const char *line = m_readBuffer;
+        const char * const bufferEnd = m_readBuffer + filled;
+        const char *lineEnd;
+        while ( ( lineEnd = static_cast<const char *>( memchr( line, '\n', bufferEnd - line ) ) ) != 0 ) {
+            const char *p = line;
+            line = lineEnd + 1;
+
+            uint64_t start, stop, offset;
+            if ( !parseHex( p, lineEnd, start ) || p == lineEnd || *p++ != '-' ||
+                 !parseHex( p, lineEnd, stop ) || p == lineEnd || *p++ != ' ' ) {
+                continue;
+            }
+            if ( lineEnd - p < 4 || p[2] != 'x' ) {
+                continue;
+            }
+            p = skipField( p, lineEnd );
+            if ( !parseHex( p, lineEnd, offset ) ) {
+                continue;
+            }
+            p = skipField( skipField( skipField( p, lineEnd ), lineEnd ), lineEnd );
+            if ( p == lineEnd || *p != '/' ) {
+                continue; // anonymous memory, [vdso] etc.
+            }
+
+            const size_t pathLength = lineEnd - p;
+            if ( static_cast<size_t>( end - pos ) < 4 * VarintSize + pathLength ) {
+                close( fd );
+                return pos - begin;
+            }
+            pos = appendVarint( pos, start );
+            pos = appendVarint( pos, stop );
+            pos = appendVarint( pos, offset );
+            pos = appendVarint( pos, pathLength );
+            memcpy( pos, p, pathLength );
+            pos += pathLength;
+        }
+
+        // Keep the incomplete line; drop it if it doesn't fit at all
+        filled = bufferEnd - line;
+        if ( filled == ReadBufferSize ) {
+            filled = 0;
+        } else {
+            memmove( m_readBuffer, line, filled );
+        }
+    }
+    close( fd );
+    return pos - begin;
+}
+
+TRACELIB_NAMESPACE_END
@@ -0,0 +1,290 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "entryqueue.h"
+#include "atomicops.h"
+#include "queuedentry.h"
+#include "ringbuffer.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <string>
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* The drain thread sleeps for at most this long if there is nothing to do,
+ * which bounds the latency in case a wake up call got lost.
+ */
+static const unsigned int DrainThreadIdleTimeout = 100;
+
+struct ThreadEntryBuffer
+{
+    explicit ThreadEntryBuffer( unsigned long capacity )
+        : entries( capacity ),
+        waitingForSpace( 0 ),
+        finished( 0 ),
+        orphaned( false )
+    {
+    }
+
+    RingBuffer<QueuedEntry> entries;
+
+    // Signalled by the drain thread if the owning thread waits for space
+    AutoResetEvent spaceAvailable;
+    volatile unsigned long waitingForSpace;
+
+    /* Set when the owning thread finished and when the queue was destroyed
+     * while the thread was still running; whoever comes second deletes the
+     * buffer.
+     */
+    Mutex stateMutex;
+    volatile unsigned long finished;
+    bool orphaned;
+};
+
+EntryQueue::EntryQueue( Trace *trace, const AsyncConfiguration &config )
+    : m_trace( trace ),
+    m_running( 0 ),
+    m_bufferSize( config.bufferSize ),
+    m_dropWhenFull( config.overflowPolicy == AsyncConfiguration::DropWhenFull ),
+    m_drainThreadIdle( 0 ),
+    m_droppedEntries( 0 ),
+    m_threadBuffer( threadFinished )
+{
+    atomicStore( &m_running, 1 );
+    if ( !start() ) {
+        atomicStore( &m_running, 0 );
+    }
+}
+
+/* The buffers of threads which are still running are left to them since
+ * they might be finishing right now; threads finishing after the thread
+ * local pointer is gone don't get to free their buffer though.
+ */
+EntryQueue::~EntryQueue()
+{
+    stop();
+
+    vector<ThreadEntryBuffer *>::const_iterator it, end = m_buffers.end();
+    for ( it = m_buffers.begin(); it != end; ++it ) {
+        bool finished;
+        {
+            MutexLocker stateLocker( ( *it )->stateMutex );
+            finished = atomicLoad( &( *it )->finished );
+            ( *it )->orphaned = !finished;
+        }
+        if ( finished ) {
+            delete *it;
+        }
+    }
+}
+
+void EntryQueue::configure( const AsyncConfiguration &config )
+{
+    atomicStore( &m_bufferSize, config.bufferSize );
+    atomicStore( &m_dropWhenFull, config.overflowPolicy == AsyncConfiguration::DropWhenFull );
+}
+
+bool EntryQueue::enqueue( TraceEntry &entry, StringBuilder *messageParts )
+{
+    if ( !atomicLoad( &m_running ) ) {
+        return false;
+    }
+
+    ThreadEntryBuffer *buffer = currentThreadBuffer();
+
+    QueuedEntry *slot = buffer->entries.beginWrite();
+    while ( !slot ) {
+        if ( atomicLoad( &m_dropWhenFull ) ) {
+            atomicAdd( &m_droppedEntries, 1 );
+            return true;
+        }
+
+        /* Check again after asking for the signal since the drain thread
+         * might have made space before seeing the request.
+         */
+        atomicStore( &buffer->waitingForSpace, 1 );
+        wakeUpDrainThread();
+        slot = buffer->entries.beginWrite();
+        if ( !slot ) {
+            buffer->spaceAvailable.wait( DrainThreadIdleTimeout );
+            if ( !atomicLoad( &m_running ) ) {
+                return false;
+            }
+            slot = buffer->entries.beginWrite();
+        }
+    }
+
+    slot->assign( entry, messageParts );
+
+    buffer->entries.commitWrite();
+
+    if ( atomicExchange( &m_drainThreadIdle, 0 ) ) {
+        m_wakeUpEvent.signal();
+    }
+    return true;
+}
+
+void EntryQueue::flush()
+{
+    while ( atomicLoad( &m_running ) && haveQueuedEntries() ) {
+        wakeUpDrainThread();
+        Thread::sleep( 1 );
+    }
+}
+
+void EntryQueue::stop()
+{
+    if ( atomicExchange( &m_running, 0 ) ) {
+        m_wakeUpEvent.signal();
+        wait();
+
+        // Let threads waiting for space notice that the queue is gone
+        MutexLocker buffersLocker( m_buffersMutex );
+        vector<ThreadEntryBuffer *>::const_iterator it, end = m_buffers.end();
+        for ( it = m_buffers.begin(); it != end; ++it ) {
+            ( *it )->spaceAvailable.signal();
+        }
+    }
+}
+
+unsigned long EntryQueue::droppedEntries() const
+{
+    return atomicLoad( &m_droppedEntries );
+}
+
+void EntryQueue::run()
+{
+    while ( atomicLoad( &m_running ) ) {
+        m_trace->reportSuppressedHits();
+
+        if ( drainBuffers() ) {
+            continue;
+        }
+
+        atomicExchange( &m_drainThreadIdle, 1 );
+        if ( !haveQueuedEntries() ) {
+            m_wakeUpEvent.wait( DrainThreadIdleTimeout );
+        }
+        atomicExchange( &m_drainThreadIdle, 0 );
+    }
+
+    // Write whatever got queued before we were stopped
+    while ( drainBuffers() ) {
+    }
+}
+
+ThreadEntryBuffer *EntryQueue::currentThreadBuffer()
+{
+    ThreadEntryBuffer *buffer = static_cast<ThreadEntryBuffer *>( m_threadBuffer.get() );
+    if ( !buffer ) {
+        buffer = new ThreadEntryBuffer( atomicLoad( &m_bufferSize ) );
+        m_threadBuffer.set( buffer );
+
+        MutexLocker buffersLocker( m_buffersMutex );
+        m_buffers.push_back( buffer );
+    }
+    return buffer;
+}
+
+bool EntryQueue::drainBuffers()
+{
+    vector<ThreadEntryBuffer *> buffers;
+    {
+        MutexLocker buffersLocker( m_buffersMutex );
+        buffers = m_buffers;
+    }
+
+    bool wroteEntries = false;
+    vector<ThreadEntryBuffer *>::const_iterator it, end = buffers.end();
+    for ( it = buffers.begin(); it != end; ++it ) {
+        RingBuffer<QueuedEntry> &entries = ( *it )->entries;
+
+        /* Don't write more than one buffer's worth of entries at once so
+         * that a single busy thread cannot starve all the others.
+         */
+        for ( unsigned long i = 0; i < entries.capacity(); ++i ) {
+            QueuedEntry *queuedEntry = entries.beginRead();
+            if ( !queuedEntry ) {
+                break;
+            }
+
+            queuedEntry->writeTo( m_trace );
+            entries.commitRead();
+            wroteEntries = true;
+        }
+
+        if ( atomicExchange( &( *it )->waitingForSpace, 0 ) ) {
+            ( *it )->spaceAvailable.signal();
+        }
+    }
+
+    /* Get rid of the buffers of threads which finished in the meantime;
+     * locking the state mutex waits for threadFinished() to be done.
+     */
+    MutexLocker buffersLocker( m_buffersMutex );
+    for ( it = buffers.begin(); it != end; ++it ) {
+        if ( atomicLoad( &( *it )->finished ) && ( *it )->entries.isEmpty() ) {
+            m_buffers.erase( find( m_buffers.begin(), m_buffers.end(), *it ) );
+            {
+                MutexLocker stateLocker( ( *it )->stateMutex );
+            }
+            delete *it;
+        }
+    }
+
+    return wroteEntries;
+}
+
+bool EntryQueue::haveQueuedEntries()
+{
+    MutexLocker buffersLocker( m_buffersMutex );
+    vector<ThreadEntryBuffer *>::const_iterator it, end = m_buffers.end();
+    for ( it = m_buffers.begin(); it != end; ++it ) {
+        if ( !( *it )->entries.isEmpty() ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EntryQueue::wakeUpDrainThread()
+{
+    atomicExchange( &m_drainThreadIdle, 0 );
+    m_wakeUpEvent.signal();
+}
+
+void EntryQueue::threadFinished( void *p )
+{
+    ThreadEntryBuffer *buffer = static_cast<ThreadEntryBuffer *>( p );
+    bool orphaned;
+    {
+        MutexLocker stateLocker( buffer->stateMutex );
+        orphaned = buffer->orphaned;
+        atomicStore( &buffer->finished, 1 );
+    }
+    if ( orphaned ) {
+        delete buffer;
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
@@ -0,0 +1,93 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_ENTRYQUEUE_H
+#define TRACELIB_ENTRYQUEUE_H
+
+#include "tracelib_config.h"
+#include "configuration.h" // for AsyncConfiguration
+#include "mutex.h"
+#include "thread.h"
+#include "variabledumping.h"
+
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+class StringBuilder;
+class Trace;
+struct TraceEntry;
+struct ThreadEntryBuffer;
+
+/* Decouples the threads hitting trace points from serializing and writing
+ * the trace entries: each thread copies its entries into a ring buffer of
+ * its own, a background thread drains all ring buffers and hands the
+ * entries to Trace::addEntry. Entries of any one thread stay in order.
+ */
+class EntryQueue : private Thread
+{
+public:
+    EntryQueue( Trace *trace, const AsyncConfiguration &config );
+    ~EntryQueue();
+
+    /* Changes the overflow policy; a changed buffer size only applies to
+     * threads which did not queue any entries yet.
+     */
+    void configure( const AsyncConfiguration &config );
+
+    /* Takes over the contents of the entry (including its backtrace); the
+     * variable values and the message are copied. If message parts are
+     * given, they are moved into the queue and only formatted into the
+     * message of the entry once it is drained. Returns false if the queue
+     * is not running anymore and the entry should be written directly.
+     */
+    bool enqueue( TraceEntry &entry, StringBuilder *messageParts = 0 );
+
+    // Blocks until all entries queued so far have been written.
+    void flush();
+    void stop();
+
+    unsigned long droppedEntries() const;
+
+private:
+    virtual void run();
+
+    ThreadEntryBuffer *currentThreadBuffer();
+    bool drainBuffers();
+    bool haveQueuedEntries();
+    void wakeUpDrainThread();
+
+    static void threadFinished( void *buffer );
+
+    Trace *m_trace;
+    volatile unsigned long m_running;
+    volatile unsigned long m_bufferSize;
+    volatile unsigned long m_dropWhenFull;
+    volatile unsigned long m_drainThreadIdle;
+    volatile unsigned long m_droppedEntries;
+    ThreadLocalPointer m_threadBuffer;
+    std::vector<ThreadEntryBuffer *> m_buffers;
+    Mutex m_buffersMutex;
+    AutoResetEvent m_wakeUpEvent;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_ENTRYQUEUE_H)
+
@@ -63,6 +63,7 @@ public:
     int getFDSets( fd_set *rfds, fd_set *wfds );
 
     pthread_t event_list_thread;
+    ThreadId event_list_thread_id;
     bool keep_running;
 
     int command_pipe[2];
@@ -168,13 +169,8 @@ addToTimeOut( TimeOutMap &map, const timeval &now, EventObserver *obs, int ms )
 {
     timeval next;
     timeval add;
-    if ( ms >= 1000 ) {
-        add.tv_sec = ms / 1000;
-        ms %= 1000;
-    } else {
-        add.tv_sec = 0;
-    }
-    add.tv_usec = ms * 1000;
+    add.tv_sec = ms / 1000;
+    add.tv_usec = ( ms % 1000 ) * 1000;
     timeradd( &now, &add, &next );
 
     TimeOutMap::iterator it = map.find( next );
@@ -215,31 +211,27 @@ static void removeFromTimeOut( TimeOutMap &map, const EventObserver *observer )
 
 static void handleTimeout( EventContext *ctx, const timeval &now )
 {
-    const TimeOutMap::iterator e = ctx->m_timeout_map.end();
-    for ( TimeOutMap::iterator i = ctx->m_timeout_map.begin(); i != e; ) {
-        TimeOutMap::iterator succ = i;
-        ++succ;
-
-        if ( now < i->first )
-            break;
+    /* Observers may add or remove timers while handling the event, so the
+     * expired list is taken out of the map before notifying anybody.
+     */
+    TimeOutMap::iterator i;
+    while ( ( i = ctx->m_timeout_map.begin() ) != ctx->m_timeout_map.end() &&
+            !( now < i->first ) ) {
+        TimeOutList expired;
+        expired.swap( i->second );
+        ctx->m_timeout_map.erase( i );
 
-        const TimeOutList::iterator te = i->second.end();
-        for ( TimeOutList::iterator ti = i->second.begin(); ti != te; )
+        const TimeOutList::iterator te = expired.end();
+        for ( TimeOutList::iterator ti = expired.begin(); ti != te; ++ti )
         {
-            TimeOut timeout = *ti;
-            ti = i->second.erase( ti );
-
-            if ( timeout.timeout > 0 ) {
+            if ( ti->timeout > 0 ) {
                 addToTimeOut( ctx->m_timeout_map, now,
-                        timeout.observer, timeout.timeout );
+                        ti->observer, ti->timeout );
             }
 
             TimerEvent event;
-            timeout.observer->handleEvent( ctx, &event );
+            ti->observer->handleEvent( ctx, &event );
         }
-
-        ctx->m_timeout_map.erase( i );
-        i = succ;
     }
 }
 
@@ -288,6 +280,7 @@ static void *unixEventProc( void *user_data )
 {
     EventContext *data = (EventContext*)user_data;
 
+    data->event_list_thread_id = getCurrentThreadId();
     write( data->confirm_pipe[1], &NoError, 1 );
 
     fd_set rfds;
@@ -306,7 +299,7 @@ static void *unixEventProc( void *user_data )
     return NULL;
 }
 
-EventContext::EventContext() : keep_running( true )
+EventContext::EventContext() : event_list_thread_id( 0 ), keep_running( true )
 {
     if ( pipe( command_pipe ) != 0 ) {
         command_pipe[0] = command_pipe[1] = -1;
@@ -492,10 +485,8 @@ void EventThreadUnix::stop()
 
 ThreadId EventThreadUnix::threadId() const
 {
-    // pthread_t should be considered an opaque type, so this may
-    // not compile at all if it is a plain struct. Unfortunately
-    // supporting that would require extensive changes to the codebase
-    return (ThreadId)d->event_list_thread;
+    // Set by the event thread itself before it confirms its startup
+    return d->event_list_thread_id;
 }
 
 int EventThreadUnix::processEvents( EventContext *ctx )
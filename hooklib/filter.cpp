@@ -24,6 +24,7 @@
 #include "3rdparty/wildcmp/wildcmp.h"
 #include "3rdparty/pcre-8.10/pcrecpp.h"
 
+#include <algorithm>
 #include <assert.h>
 
 using namespace std;
@@ -38,6 +39,47 @@ Filter::~Filter()
 {
 }
 
+MatchCache::MatchCache()
+{
+}
+
+MatchCache::~MatchCache()
+{
+    clear();
+}
+
+bool MatchCache::lookup( const char *s, bool *matches )
+{
+    MutexLocker locker( m_mutex );
+    map<const char *, bool, StringLess>::const_iterator it = m_results.find( s );
+    if ( it == m_results.end() ) {
+        return false;
+    }
+    *matches = it->second;
+    return true;
+}
+
+void MatchCache::insert( const char *s, bool matches )
+{
+    MutexLocker locker( m_mutex );
+    if ( m_results.find( s ) == m_results.end() ) {
+        const size_t len = strlen( s ) + 1;
+        char *key = new char[len];
+        memcpy( key, s, len );
+        m_results[key] = matches;
+    }
+}
+
+void MatchCache::clear()
+{
+    MutexLocker locker( m_mutex );
+    map<const char *, bool, StringLess>::iterator it, end = m_results.end();
+    for ( it = m_results.begin(); it != end; ++it ) {
+        delete [] it->first;
+    }
+    m_results.clear();
+}
+
 PathFilter::PathFilter()
     : m_rx( 0 )
 {
@@ -53,6 +95,7 @@ void PathFilter::setPath( MatchingMode matchingMode, const string &path )
     m_matchingMode = matchingMode;
     m_path = path; // XXX Consider normalizing path
     delete m_rx;
+    m_cache.clear();
 
     // XXX Consider encoding issues ('path' is UTF-8 encoded!)
 #ifdef _WIN32
@@ -62,23 +105,37 @@ void PathFilter::setPath( MatchingMode matchingMode, const string &path )
 #endif
 }
 
-// XXX Consider encoding issues
 bool PathFilter::acceptsTracePoint( const TracePoint *tracePoint )
+{
+    if ( m_matchingMode == StrictMatch ) {
+        return matches( tracePoint->sourceFile );
+    }
+
+    bool result;
+    if ( !m_cache.lookup( tracePoint->sourceFile, &result ) ) {
+        result = matches( tracePoint->sourceFile );
+        m_cache.insert( tracePoint->sourceFile, result );
+    }
+    return result;
+}
+
+// XXX Consider encoding issues
+bool PathFilter::matches( const char *sourceFile ) const
 {
     switch ( m_matchingMode ) {
         case StrictMatch:
 #ifdef _WIN32
-            return _stricmp( tracePoint->sourceFile, m_path.c_str() ) == 0;
+            return _stricmp( sourceFile, m_path.c_str() ) == 0;
 #else
-            return strcmp( tracePoint->sourceFile, m_path.c_str() ) == 0;
+            return strcmp( sourceFile, m_path.c_str() ) == 0;
 #endif
         case RegExpMatch:
-            return m_rx->FullMatch( tracePoint->sourceFile );
+            return m_rx->FullMatch( sourceFile );
         case WildcardMatch:
 #ifdef _WIN32
-            return wildicmp( m_path.c_str(), tracePoint->sourceFile ) != 0;
+            return wildicmp( m_path.c_str(), sourceFile ) != 0;
 #else
-            return wildcmp( m_path.c_str(), tracePoint->sourceFile ) != 0;
+            return wildcmp( m_path.c_str(), sourceFile ) != 0;
 #endif
             return false;
         }
@@ -101,18 +158,33 @@ void FunctionFilter::setFunction( MatchingMode matchingMode, const string &funct
     m_matchingMode = matchingMode;
     m_function = function;
     delete m_rx;
+    m_cache.clear();
     m_rx = new pcrecpp::RE( m_function.c_str() );
 }
 
 bool FunctionFilter::acceptsTracePoint( const TracePoint *tracePoint )
+{
+    if ( m_matchingMode == StrictMatch ) {
+        return matches( tracePoint->functionName );
+    }
+
+    bool result;
+    if ( !m_cache.lookup( tracePoint->functionName, &result ) ) {
+        result = matches( tracePoint->functionName );
+        m_cache.insert( tracePoint->functionName, result );
+    }
+    return result;
+}
+
+bool FunctionFilter::matches( const char *functionName ) const
 {
     switch ( m_matchingMode ) {
         case StrictMatch:
-            return m_function == tracePoint->functionName;
+            return m_function == functionName;
         case RegExpMatch:
-            return m_rx->FullMatch( tracePoint->functionName );
+            return m_rx->FullMatch( functionName );
         case WildcardMatch:
-            return wildcmp( m_function.c_str(), tracePoint->functionName ) != 0;
+            return wildcmp( m_function.c_str(), functionName ) != 0;
     }
     assert( !"Unreachable" );
     return false;
@@ -130,26 +202,24 @@ void GroupFilter::setMode( Mode mode )
 
 void GroupFilter::addGroupName( const string &group )
 {
-    m_groups.push_back( group );
+    vector<string>::iterator it = lower_bound( m_groups.begin(), m_groups.end(), group );
+    if ( it == m_groups.end() || *it != group ) {
+        m_groups.insert( it, group );
+    }
+}
+
+static bool groupNameLess( const string &lhs, const char *rhs )
+{
+    return strcmp( lhs.c_str(), rhs ) < 0;
 }
 
 bool GroupFilter::acceptsTracePoint( const TracePoint *tracePoint )
 {
-    const string tpGroup = tracePoint->groupName ? tracePoint->groupName
-                                                 : "";
-    bool result = m_mode == Blacklist;
-    vector<string>::const_iterator it, end = m_groups.end();
-    for ( it = m_groups.begin(); it != end; ++it ) {
-        if ( m_mode == Whitelist && *it == tpGroup ) {
-            result = true;
-            break;
-        }
-        if ( m_mode == Blacklist && *it == tpGroup ) {
-            result = false;
-            break;
-        }
-    }
-    return result;
+    const char *tpGroup = tracePoint->groupName ? tracePoint->groupName : "";
+    vector<string>::const_iterator it = lower_bound( m_groups.begin(), m_groups.end(),
+                                                     tpGroup, groupNameLess );
+    const bool listed = it != m_groups.end() && *it == tpGroup;
+    return m_mode == Whitelist ? listed : !listed;
 }
 
 ConjunctionFilter::~ConjunctionFilter()
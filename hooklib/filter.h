@@ -21,7 +21,10 @@
 #define TRACELIB_FILTER_H
 
 #include "tracelib_config.h"
+#include "mutex.h"
 
+#include <cstring>
+#include <map>
 #include <string>
 #include <vector>
 
@@ -48,6 +51,37 @@ private:
     void operator=( const Filter &other );
 };
 
+/* Remembers whether a pattern matched a given source file or function name;
+ * there are usually plenty of trace points sharing the same file or function,
+ * and each of them is matched against the configured filters whenever the
+ * configuration changes. Multiple threads may configure trace points at the
+ * same time, so access is serialized.
+ */
+class MatchCache
+{
+public:
+    MatchCache();
+    ~MatchCache();
+
+    bool lookup( const char *s, bool *matches );
+    void insert( const char *s, bool matches );
+    void clear();
+
+private:
+    MatchCache( const MatchCache &other );
+    void operator=( const MatchCache &rhs );
+
+    struct StringLess {
+        bool operator()( const char *lhs, const char *rhs ) const {
+            return strcmp( lhs, rhs ) < 0;
+        }
+    };
+
+    // the keys are copies owned by the cache
+    std::map<const char *, bool, StringLess> m_results;
+    Mutex m_mutex;
+};
+
 enum MatchingMode {
     StrictMatch,
     RegExpMatch,
@@ -65,9 +99,12 @@ public:
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
 
 private:
+    bool matches( const char *sourceFile ) const;
+
     MatchingMode m_matchingMode;
     std::string m_path;
     pcrecpp::RE *m_rx;
+    MatchCache m_cache;
 };
 
 class FunctionFilter : public Filter
@@ -81,9 +118,12 @@ public:
     virtual bool acceptsTracePoint( const TracePoint *tracePoint );
 
 private:
+    bool matches( const char *functionName ) const;
+
     MatchingMode m_matchingMode;
     std::string m_function;
     pcrecpp::RE *m_rx;
+    MatchCache m_cache;
 };
 
 class GroupFilter : public Filter
@@ -102,7 +142,7 @@ public:
 
 private:
     Mode m_mode;
-    std::vector<std::string> m_groups;
+    std::vector<std::string> m_groups; // sorted, for binary search
 };
 
 class ConjunctionFilter : public Filter
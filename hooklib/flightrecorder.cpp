@@ -0,0 +1,315 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "flightrecorder.h"
+#include "atomicops.h"
+#include "queuedentry.h"
+#include "trace.h"
+#include "tracelib.h" // for deleteRange
+
+#include <algorithm>
+
+#ifndef _WIN32
+#  include <errno.h>
+#  include <signal.h>
+#  include <string.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Recordings of threads which finished are kept (they may well be the
+ * interesting ones) until they are dumped, but only this many of them.
+ */
+static const size_t MaximumFinishedRecordings = 16;
+
+struct ThreadRecording
+{
+    explicit ThreadRecording( unsigned long capacity )
+        : entries( capacity ),
+        next( 0 ),
+        count( 0 ),
+        finished( 0 )
+    {
+    }
+
+    Mutex mutex;
+    vector<QueuedEntry> entries;
+    size_t next;
+    size_t count;
+    volatile unsigned long finished;
+};
+
+static bool isOlder( const QueuedEntry *a, const QueuedEntry *b )
+{
+    return a->timeStamp < b->timeStamp;
+}
+
+#ifndef _WIN32
+static int g_dumpRequestPipe[2] = { -1, -1 };
+static const char DumpRequest = 0;
+static const char StopRequest = 1;
+
+extern "C" {
+
+// Only async-signal-safe functions in here; the dump happens in run()
+static void requestDump( int )
+{
+    const int savedErrno = errno;
+    ssize_t result = write( g_dumpRequestPipe[1], &DumpRequest, 1 );
+    (void)result;
+    errno = savedErrno;
+}
+
+}
+#endif
+
+FlightRecorder::FlightRecorder( Trace *trace, const FlightRecorderConfiguration &config )
+    : m_trace( trace ),
+    m_entriesPerThread( config.entriesPerThread ),
+    m_threadRecording( threadFinished ),
+    m_dumpSignal( 0 ),
+    m_threadStarted( false ),
+    m_requestedDumps( 0 ),
+    m_completedDumps( 0 )
+{
+    // The crash handler relies on the thread, it can't start it itself
+    startDumpThread();
+    setDumpSignal( config.dumpSignal );
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    setDumpSignal( 0 );
+#ifndef _WIN32
+    if ( m_threadStarted ) {
+        ssize_t result = write( g_dumpRequestPipe[1], &StopRequest, 1 );
+        (void)result;
+        wait();
+    }
+    if ( g_dumpRequestPipe[0] != -1 ) {
+        close( g_dumpRequestPipe[0] );
+        close( g_dumpRequestPipe[1] );
+        g_dumpRequestPipe[0] = g_dumpRequestPipe[1] = -1;
+    }
+#endif
+
+    MutexLocker recordingsLocker( m_recordingsMutex );
+    deleteRange( m_recordings.begin(), m_recordings.end() );
+}
+
+void FlightRecorder::configure( const FlightRecorderConfiguration &config )
+{
+    atomicStore( &m_entriesPerThread, config.entriesPerThread );
+    setDumpSignal( config.dumpSignal );
+}
+
+void FlightRecorder::record( TraceEntry &entry, StringBuilder *messageParts )
+{
+    ThreadRecording *recording = currentThreadRecording();
+
+    // Only contended while the recording is dumped
+    MutexLocker recordingLocker( recording->mutex );
+    recording->entries[recording->next].assign( entry, messageParts );
+    recording->next = ( recording->next + 1 ) % recording->entries.size();
+    if ( recording->count < recording->entries.size() ) {
+        ++recording->count;
+    }
+}
+
+/* All recordings stay locked while their entries are written, so threads
+ * hitting trace points in the meantime wait; entries recorded after the
+ * dump started would be out of order anyway.
+ */
+void FlightRecorder::dump()
+{
+    MutexLocker dumpLocker( m_dumpMutex );
+
+    vector<ThreadRecording *> recordings;
+    {
+        MutexLocker recordingsLocker( m_recordingsMutex );
+        recordings = m_recordings;
+    }
+
+    vector<QueuedEntry *> entries;
+    vector<ThreadRecording *>::const_iterator it, end = recordings.end();
+    for ( it = recordings.begin(); it != end; ++it ) {
+        ThreadRecording *recording = *it;
+        recording->mutex.lock();
+
+        const size_t size = recording->entries.size();
+        for ( size_t i = 0; i < recording->count; ++i ) {
+            entries.push_back( &recording->entries[( recording->next + size - recording->count + i ) % size] );
+        }
+        recording->count = 0;
+    }
+
+    stable_sort( entries.begin(), entries.end(), isOlder );
+    vector<QueuedEntry *>::const_iterator entryIt, entryEnd = entries.end();
+    for ( entryIt = entries.begin(); entryIt != entryEnd; ++entryIt ) {
+        ( *entryIt )->writeTo( m_trace );
+    }
+
+    for ( it = recordings.begin(); it != end; ++it ) {
+        ( *it )->mutex.unlock();
+    }
+
+    // Recordings of finished threads are of no use anymore
+    MutexLocker recordingsLocker( m_recordingsMutex );
+    for ( it = recordings.begin(); it != end; ++it ) {
+        if ( atomicLoad( &( *it )->finished ) ) {
+            m_recordings.erase( find( m_recordings.begin(), m_recordings.end(), *it ) );
+            delete *it;
+        }
+    }
+}
+
+bool FlightRecorder::dumpInBackground( unsigned int timeoutMs )
+{
+#ifndef _WIN32
+    if ( !m_threadStarted ) {
+        return false;
+    }
+
+    // Any dump which starts after this covers the request
+    const unsigned long request = atomicAdd( &m_requestedDumps, 1 );
+    if ( write( g_dumpRequestPipe[1], &DumpRequest, 1 ) != 1 ) {
+        return false;
+    }
+
+    /* The thread may well block on a lock held by the thread which called
+     * this; the caller must be able to move on then.
+     */
+    const unsigned int PollIntervalMs = 10;
+    for ( unsigned int waited = 0; waited < timeoutMs; waited += PollIntervalMs ) {
+        if ( static_cast<long>( atomicLoad( &m_completedDumps ) - request ) >= 0 ) {
+            return true;
+        }
+        timespec interval;
+        interval.tv_sec = 0;
+        interval.tv_nsec = PollIntervalMs * 1000000;
+        nanosleep( &interval, 0 );
+    }
+    return false;
+#else
+    (void)timeoutMs;
+    return false;
+#endif
+}
+
+ThreadRecording *FlightRecorder::currentThreadRecording()
+{
+    ThreadRecording *recording = static_cast<ThreadRecording *>( m_threadRecording.get() );
+    if ( recording ) {
+        return recording;
+    }
+
+    recording = new ThreadRecording( atomicLoad( &m_entriesPerThread ) );
+    m_threadRecording.set( recording );
+
+    // Not while dump() is looking at the recordings
+    MutexLocker dumpLocker( m_dumpMutex );
+    MutexLocker recordingsLocker( m_recordingsMutex );
+
+    size_t finishedRecordings = 0;
+    vector<ThreadRecording *>::iterator it = m_recordings.end();
+    while ( it != m_recordings.begin() ) {
+        --it;
+        if ( atomicLoad( &( *it )->finished ) && ++finishedRecordings > MaximumFinishedRecordings ) {
+            delete *it;
+            it = m_recordings.erase( it );
+        }
+    }
+
+    m_recordings.push_back( recording );
+    return recording;
+}
+
+void FlightRecorder::setDumpSignal( int signalNumber )
+{
+#ifndef _WIN32
+    if ( signalNumber == m_dumpSignal ) {
+        return;
+    }
+
+    if ( m_dumpSignal != 0 ) {
+        signal( m_dumpSignal, SIG_DFL );
+        m_dumpSignal = 0;
+    }
+
+    if ( signalNumber == 0 || !startDumpThread() ) {
+        return;
+    }
+
+    struct sigaction action;
+    memset( &action, 0, sizeof( action ) );
+    action.sa_handler = requestDump;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+    if ( sigaction( signalNumber, &action, 0 ) == 0 ) {
+        m_dumpSignal = signalNumber;
+    }
+#else
+    (void)signalNumber;
+#endif
+}
+
+bool FlightRecorder::startDumpThread()
+{
+#ifndef _WIN32
+    if ( g_dumpRequestPipe[0] == -1 && pipe( g_dumpRequestPipe ) != 0 ) {
+        return false;
+    }
+    if ( !m_threadStarted ) {
+        m_threadStarted = start();
+    }
+    return m_threadStarted;
+#else
+    return false;
+#endif
+}
+
+void FlightRecorder::run()
+{
+#ifndef _WIN32
+    char request;
+    for ( ;; ) {
+        const ssize_t result = read( g_dumpRequestPipe[0], &request, 1 );
+        if ( result == -1 && errno == EINTR ) {
+            continue;
+        }
+        if ( result != 1 || request == StopRequest ) {
+            break;
+        }
+        const unsigned long requestedDumps = atomicLoad( &m_requestedDumps );
+        dump();
+        atomicStore( &m_completedDumps, requestedDumps );
+    }
+#endif
+}
+
+void FlightRecorder::threadFinished( void *recording )
+{
+    atomicStore( &static_cast<ThreadRecording *>( recording )->finished, 1 );
+}
+
+TRACELIB_NAMESPACE_END
@@ -0,0 +1,92 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_FLIGHTRECORDER_H
+#define TRACELIB_FLIGHTRECORDER_H
+
+#include "tracelib_config.h"
+#include "configuration.h" // for FlightRecorderConfiguration
+#include "mutex.h"
+#include "thread.h"
+#include "variabledumping.h"
+
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+class StringBuilder;
+class Trace;
+struct TraceEntry;
+struct ThreadRecording;
+
+/* Keeps the most recent entries of each thread in memory, overwriting the
+ * oldest ones; nothing is written until dump() is called, which hands all
+ * recorded entries to Trace::addEntry in chronological order.
+ *
+ * On Unix systems, dump() can be called by a background thread as well:
+ * when the dump signal is received (if one is configured) or when the
+ * crash handler asks for it.
+ */
+class FlightRecorder : private Thread
+{
+public:
+    FlightRecorder( Trace *trace, const FlightRecorderConfiguration &config );
+    ~FlightRecorder();
+
+    /* Changes the dump signal; a changed number of entries only applies to
+     * threads which did not record any entries yet.
+     */
+    void configure( const FlightRecorderConfiguration &config );
+
+    // Takes over the backtrace and the message parts; everything else is copied.
+    void record( TraceEntry &entry, StringBuilder *messageParts = 0 );
+
+    void dump();
+
+    /* Makes the background thread dump the recordings and waits up to
+     * timeoutMs milliseconds for it; returns whether the dump finished.
+     * Async-signal-safe, the calling thread takes no locks (Unix only).
+     */
+    bool dumpInBackground( unsigned int timeoutMs );
+
+private:
+    virtual void run();
+
+    ThreadRecording *currentThreadRecording();
+    bool startDumpThread();
+    void setDumpSignal( int signalNumber );
+
+    static void threadFinished( void *recording );
+
+    Trace *m_trace;
+    volatile unsigned long m_entriesPerThread;
+    ThreadLocalPointer m_threadRecording;
+    std::vector<ThreadRecording *> m_recordings;
+    Mutex m_recordingsMutex;
+    Mutex m_dumpMutex;
+    int m_dumpSignal;
+    bool m_threadStarted;
+    // Dumps asked for by dumpInBackground(), and how many of them are done
+    volatile unsigned long m_requestedDumps;
+    volatile unsigned long m_completedDumps;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_FLIGHTRECORDER_H)
@@ -23,6 +23,8 @@
 #include "tracelib_config.h"
 #include "config.h" // for uint64_t
 
+#include <string>
+
 TRACELIB_NAMESPACE_BEGIN
 
 typedef unsigned long ProcessId;
@@ -30,8 +32,28 @@ typedef unsigned long ThreadId;
 
 uint64_t getCurrentProcessStartTime();
 ProcessId getCurrentProcessId();
+
+/* Returns the ID the operating system uses for the calling thread where
+ * available (i.e. the one shown by top or perf on Linux). It's determined
+ * once per thread, along with the thread's name.
+ */
 ThreadId getCurrentThreadId();
 
+// Like getCurrentThreadId() but doesn't allocate anything, so it may be used in signal handlers.
+ThreadId getCurrentThreadIdUncached();
+
+/* Tells apart threads which had the same ID at different times since the
+ * system may hand out the ID of a finished thread again: each thread is
+ * numbered when it first calls getCurrentThreadId().
+ */
+unsigned long getCurrentThreadGeneration();
+
+/* Returns the name the given thread of this process had when it first
+ * called getCurrentThreadId(); empty if it had none, if it's unknown or if
+ * the ID was reused by a thread of another generation meanwhile.
+ */
+std::string getThreadName( ThreadId id, unsigned long generation );
+
 TRACELIB_NAMESPACE_END
 
 #endif // !defined(TRACELIB_GETCURRENTTHREADID_H)
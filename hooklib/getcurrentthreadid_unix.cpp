@@ -18,17 +18,137 @@
  */
 
 #include "getcurrentthreadid.h"
+#include "mutex.h"
+#include "thread.h"
 #include "timehelper.h" // for now()
 
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <pthread.h>
+#if defined(__linux__)
+#  include <sys/syscall.h>
+#elif defined(__FreeBSD__)
+#  include <pthread_np.h>
+#endif
 
 #include <assert.h>
+#include <errno.h> // for program_invocation_short_name
+#include <deque>
+#include <map>
+
+using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
+/* Names of threads which finished are kept for a while since entries they
+ * generated may still be waiting to be written.
+ */
+static const size_t MaximumFinishedThreads = 256;
+
+struct ThreadContext
+{
+    ThreadId id;
+    unsigned long generation;
+    string name;
+};
+
+struct RegisteredThread
+{
+    unsigned long generation;
+    string name;
+    bool finished;
+};
+
+/* Maps IDs to names for getThreadName(). Never deleted since threads may
+ * still finish while static objects are destroyed.
+ */
+struct ThreadRegistry
+{
+    ThreadRegistry() : generations( 0 ) { }
+
+    Mutex mutex;
+    unsigned long generations;
+    map<ThreadId, RegisteredThread> threads;
+    deque<ThreadId> finishedThreads;
+};
+
+static ThreadRegistry *threadRegistry()
+{
+    static ThreadRegistry *registry = new ThreadRegistry;
+    return registry;
+}
+
+static string currentThreadName()
+{
+#if defined(__linux__) && defined(__GLIBC__)
+    char name[64];
+    if ( pthread_getname_np( pthread_self(), name, sizeof( name ) ) == 0 ) {
+        // Threads which were never named carry the (truncated) executable name
+        if ( string( program_invocation_short_name ).substr( 0, 15 ) == name ) {
+            return string();
+        }
+        return name;
+    }
+#elif defined(__APPLE__)
+    char name[64];
+    if ( pthread_getname_np( pthread_self(), name, sizeof( name ) ) == 0 ) {
+        return name;
+    }
+#endif
+    return string();
+}
+
+static void threadFinished( void *p )
+{
+    ThreadContext *context = static_cast<ThreadContext *>( p );
+    ThreadRegistry *registry = threadRegistry();
+    {
+        MutexLocker locker( registry->mutex );
+        map<ThreadId, RegisteredThread>::iterator it = registry->threads.find( context->id );
+        if ( it != registry->threads.end() ) {
+            it->second.finished = true;
+            registry->finishedThreads.push_back( context->id );
+        }
+        while ( registry->finishedThreads.size() > MaximumFinishedThreads ) {
+            // The ID may have been reused by a thread which is still running
+            it = registry->threads.find( registry->finishedThreads.front() );
+            if ( it != registry->threads.end() && it->second.finished ) {
+                registry->threads.erase( it );
+            }
+            registry->finishedThreads.pop_front();
+        }
+    }
+    delete context;
+}
+
+static const ThreadContext &currentThreadContext()
+{
+    static ThreadLocalPointer *contexts = new ThreadLocalPointer( threadFinished );
+    ThreadContext *context = static_cast<ThreadContext *>( contexts->get() );
+    if ( context ) {
+        return *context;
+    }
+
+    context = new ThreadContext;
+    context->id = getCurrentThreadIdUncached();
+    context->name = currentThreadName();
+    contexts->set( context );
+
+    ThreadRegistry *registry = threadRegistry();
+    MutexLocker locker( registry->mutex );
+    context->generation = ++registry->generations;
+    if ( context->name.empty() ) {
+        registry->threads.erase( context->id );
+    } else {
+        RegisteredThread &thread = registry->threads[context->id];
+        thread.generation = context->generation;
+        thread.name = context->name;
+        thread.finished = false;
+    }
+    return *context;
+}
+
 uint64_t getCurrentProcessStartTime()
 {
     // ### BUG: starts counting as of first call only
@@ -43,7 +163,38 @@ ProcessId getCurrentProcessId()
 
 ThreadId getCurrentThreadId()
 {
+    return currentThreadContext().id;
+}
+
+ThreadId getCurrentThreadIdUncached()
+{
+#if defined(__linux__)
+    return (ThreadId)::syscall( SYS_gettid );
+#elif defined(__APPLE__)
+    uint64_t tid = 0;
+    pthread_threadid_np( 0, &tid );
+    return (ThreadId)tid;
+#elif defined(__FreeBSD__)
+    return (ThreadId)::pthread_getthreadid_np();
+#else
     return (ThreadId)::pthread_self();
+#endif
+}
+
+unsigned long getCurrentThreadGeneration()
+{
+    return currentThreadContext().generation;
+}
+
+string getThreadName( ThreadId id, unsigned long generation )
+{
+    ThreadRegistry *registry = threadRegistry();
+    MutexLocker locker( registry->mutex );
+    map<ThreadId, RegisteredThread>::const_iterator it = registry->threads.find( id );
+    if ( it == registry->threads.end() || it->second.generation != generation ) {
+        return string();
+    }
+    return it->second.name;
 }
 
 TRACELIB_NAMESPACE_END
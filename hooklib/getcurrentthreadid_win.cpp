@@ -53,5 +53,20 @@ ThreadId getCurrentThreadId()
     return (ThreadId)::GetCurrentThreadId();
 }
 
+ThreadId getCurrentThreadIdUncached()
+{
+    return (ThreadId)::GetCurrentThreadId();
+}
+
+unsigned long getCurrentThreadGeneration()
+{
+    return 0;
+}
+
+std::string getThreadName( ThreadId, unsigned long )
+{
+    return std::string();
+}
+
 TRACELIB_NAMESPACE_END
 
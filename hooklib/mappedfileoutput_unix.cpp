@@ -0,0 +1,294 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+#include "atomicops.h"
+#include "log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* A new file is started once less than this fraction of the current one
+ * is left, so that the next entry (and the session header preceding it)
+ * still goes into a fresh file.
+ */
+static const size_t RotationReserveDivisor = 16;
+
+static const unsigned int AgeCheckInterval = 1000;
+
+// Seconds to wait before trying to open a file again after it failed
+static const time_t OpenRetryInterval = 10;
+
+MappedFileOutput::MappedFileOutput( Log *log, const string &filename,
+                                    const MappedFileOutputConfiguration &config )
+    : m_log( log ),
+    m_filename( filename ),
+    m_config( config ),
+    m_running( 0 ),
+    m_rotationPending( 0 ),
+    m_fd( -1 ),
+    m_map( 0 ),
+    m_size( 0 ),
+    m_used( 0 ),
+    m_flushed( 0 ),
+    m_segmentStarted( 0 ),
+    m_retryTime( 0 ),
+    m_threadStarted( false ),
+    m_mappingGeneration( 0 ),
+    m_sessionId( 0 )
+{
+}
+
+MappedFileOutput::~MappedFileOutput()
+{
+    if ( atomicExchange( &m_running, 0 ) ) {
+        m_wakeUpEvent.signal();
+        wait();
+    }
+
+    MutexLocker locker( m_mutex );
+    finishSegment();
+}
+
+bool MappedFileOutput::open()
+{
+    MutexLocker locker( m_mutex );
+    if ( m_map && !atomicLoad( &m_rotationPending ) ) {
+        return true;
+    }
+
+    // Don't try again (and log another error) for every trace entry
+    if ( m_retryTime != 0 && time( NULL ) < m_retryTime ) {
+        return false;
+    }
+
+    // The files were rotated already before the attempt which failed
+    finishSegment();
+    if ( m_retryTime == 0 ) {
+        rotateFiles();
+    }
+    if ( !startSegment( m_config.segmentSize ) ) {
+        m_retryTime = time( NULL ) + OpenRetryInterval;
+        return false;
+    }
+    m_retryTime = 0;
+
+    if ( !m_threadStarted && ( m_config.flushInterval > 0 || m_config.maximumAge > 0 ) ) {
+        atomicStore( &m_running, 1 );
+        m_threadStarted = start();
+        if ( !m_threadStarted ) {
+            atomicStore( &m_running, 0 );
+            m_log->writeError( "MappedFileOutput: failed to start flush thread; data is only flushed at shutdown" );
+        }
+    }
+    return true;
+}
+
+bool MappedFileOutput::canWrite() const
+{
+    return m_map != 0 && !atomicLoad( &m_rotationPending );
+}
+
+void MappedFileOutput::write( const vector<char> &data )
+{
+    MutexLocker locker( m_mutex );
+    if ( !m_map ) {
+        return;
+    }
+
+    // Like FileOutput, each entry is followed by a newline
+    const size_t length = data.size() + 1;
+    if ( length > m_size - m_used ) {
+        /* Only happens for entries larger than the reserve left in the
+         * file; the entry goes to the new file right away, the session
+         * header follows with the next entry.
+         */
+        finishSegment();
+        rotateFiles();
+        if ( !startSegment( length > m_config.segmentSize ? length : m_config.segmentSize ) ) {
+            // open() tries again later, the entry is lost
+            m_retryTime = time( NULL ) + OpenRetryInterval;
+            return;
+        }
+    }
+
+    if ( !data.empty() ) {
+        memcpy( m_map + m_used, &data[0], data.size() );
+    }
+    m_map[m_used + data.size()] = '\n';
+    m_used += length;
+
+    if ( m_size - m_used < m_size / RotationReserveDivisor ) {
+        atomicStore( &m_rotationPending, 1 );
+    }
+}
+
+void MappedFileOutput::flush()
+{
+    MutexLocker locker( m_mutex );
+    if ( m_map && m_used > 0 ) {
+        msync( m_map, m_used, MS_SYNC );
+        m_flushed = m_used;
+    }
+}
+
+void MappedFileOutput::run()
+{
+    const unsigned int interval = m_config.flushInterval > 0 ? m_config.flushInterval : AgeCheckInterval;
+    const size_t pageSize = sysconf( _SC_PAGESIZE );
+
+    while ( atomicLoad( &m_running ) ) {
+        m_wakeUpEvent.wait( interval );
+
+        char *start = 0;
+        size_t length = 0;
+        unsigned long generation = 0;
+        {
+            MutexLocker locker( m_mutex );
+            if ( !m_map ) {
+                continue;
+            }
+
+            if ( m_config.maximumAge > 0 && m_used > 0 &&
+                 time( NULL ) - m_segmentStarted >= (time_t)m_config.maximumAge ) {
+                atomicStore( &m_rotationPending, 1 );
+            }
+
+            if ( m_config.flushInterval == 0 || m_flushed == m_used ) {
+                continue;
+            }
+
+            const size_t pageStart = m_flushed - m_flushed % pageSize;
+            start = m_map + pageStart;
+            length = m_used - pageStart;
+            m_flushed = m_used;
+            generation = m_mappingGeneration;
+        }
+
+        /* Writers shouldn't wait for the disk, so this happens without
+         * m_mutex. If the file was rotated meanwhile, the address range may
+         * belong to another mapping by now, so it's skipped.
+         */
+        MutexLocker syncLocker( m_syncMutex );
+        if ( m_mappingGeneration == generation ) {
+            msync( start, length, MS_SYNC );
+        }
+    }
+}
+
+bool MappedFileOutput::startSegment( size_t size )
+{
+    m_fd = ::open( m_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( m_fd == -1 ) {
+        m_log->writeError( "MappedFileOutput: failed to open %s: %s", m_filename.c_str(), strerror( errno ) );
+        return false;
+    }
+
+    /* Allocating the blocks up front avoids a SIGBUS when writing to the
+     * mapping while the disk is full.
+     */
+#ifdef __linux__
+    const int error = posix_fallocate( m_fd, 0, size );
+#else
+    const int error = ftruncate( m_fd, size ) == 0 ? 0 : errno;
+#endif
+    void *map = MAP_FAILED;
+    if ( error == 0 ) {
+        map = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0 );
+    }
+    if ( map == MAP_FAILED ) {
+        m_log->writeError( "MappedFileOutput: failed to allocate %lu bytes for %s: %s", (unsigned long)size, m_filename.c_str(), strerror( error ? error : errno ) );
+        ::close( m_fd );
+        m_fd = -1;
+        return false;
+    }
+
+    m_map = static_cast<char *>( map );
+    m_size = size;
+    m_used = 0;
+    m_flushed = 0;
+    m_segmentStarted = time( NULL );
+    atomicStore( &m_rotationPending, 0 );
+
+    // The new file doesn't have the data written before
+    ++m_sessionId;
+    m_log->writeStatus( "MappedFileOutput: writing to %s (%lu bytes)", m_filename.c_str(), (unsigned long)size );
+    return true;
+}
+
+// Cuts off the preallocated space which was not used
+void MappedFileOutput::finishSegment()
+{
+    if ( !m_map ) {
+        return;
+    }
+
+    {
+        MutexLocker syncLocker( m_syncMutex );
+        munmap( m_map, m_size );
+        ++m_mappingGeneration;
+    }
+    m_map = 0;
+    if ( ftruncate( m_fd, m_used ) != 0 ) {
+        m_log->writeError( "MappedFileOutput: failed to truncate %s: %s", m_filename.c_str(), strerror( errno ) );
+    }
+    ::close( m_fd );
+    m_fd = -1;
+}
+
+void MappedFileOutput::rotateFiles()
+{
+    // Renaming onto the oldest file removes it
+    for ( unsigned long i = m_config.maximumFiles - 1; i > 0; --i ) {
+        const string from = rotatedFileName( i - 1 );
+        if ( rename( from.c_str(), rotatedFileName( i ).c_str() ) != 0 && errno != ENOENT ) {
+            m_log->writeError( "MappedFileOutput: failed to rename %s: %s", from.c_str(), strerror( errno ) );
+        }
+    }
+}
+
+// trace.log is rotated to trace.1.log, trace.2.log and so on
+string MappedFileOutput::rotatedFileName( unsigned long index ) const
+{
+    if ( index == 0 ) {
+        return m_filename;
+    }
+
+    const string::size_type lastSlash = m_filename.rfind( '/' );
+    string::size_type dot = m_filename.rfind( '.' );
+    if ( dot == string::npos || ( lastSlash != string::npos && dot < lastSlash ) ) {
+        dot = m_filename.size();
+    }
+
+    ostringstream str;
+    str << m_filename.substr( 0, dot ) << "." << index << m_filename.substr( dot );
+    return str.str();
+}
+
+TRACELIB_NAMESPACE_END
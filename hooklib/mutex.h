@@ -25,9 +25,12 @@
 TRACELIB_NAMESPACE_BEGIN
 
 struct MutexHandle;
+struct WaitConditionHandle;
 
 class Mutex
 {
+    friend class WaitCondition;
+
 public:
     Mutex();
     ~Mutex();
@@ -55,6 +58,28 @@ private:
     Mutex &m_mutex;
 };
 
+/* Lets threads wait until a condition guarded by a mutex changes; unlike
+ * an AutoResetEvent, wakeAll() wakes up every thread waiting right now.
+ */
+class WaitCondition
+{
+public:
+    WaitCondition();
+    ~WaitCondition();
+
+    /* Unlocks the mutex, which has to be locked by the calling thread,
+     * while waiting; returns false if the timeout expired.
+     */
+    bool wait( Mutex &mutex, unsigned int timeoutMilliSeconds );
+    void wakeAll();
+
+private:
+    WaitCondition( const WaitCondition &other ); // disabled
+    void operator=( const WaitCondition &rhs ); // disabled
+
+    WaitConditionHandle *m_handle;
+};
+
 TRACELIB_NAMESPACE_END
 
 #endif // !defined(TRACELIB_MUTEX_H)
@@ -19,7 +19,10 @@
 
 #include "mutex.h"
 
+#include <errno.h>
 #include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
 
 TRACELIB_NAMESPACE_BEGIN
 
@@ -48,5 +51,41 @@ void Mutex::unlock()
     pthread_mutex_unlock( &m_handle->mutex );
 }
 
+struct WaitConditionHandle {
+    pthread_cond_t cond;
+};
+
+WaitCondition::WaitCondition() : m_handle( new WaitConditionHandle )
+{
+    pthread_cond_init( &m_handle->cond, NULL );
+}
+
+WaitCondition::~WaitCondition()
+{
+    pthread_cond_destroy( &m_handle->cond );
+    delete m_handle;
+}
+
+bool WaitCondition::wait( Mutex &mutex, unsigned int timeoutMilliSeconds )
+{
+    timeval now;
+    gettimeofday( &now, 0 );
+
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + timeoutMilliSeconds / 1000;
+    deadline.tv_nsec = now.tv_usec * 1000 + ( timeoutMilliSeconds % 1000 ) * 1000000;
+    if ( deadline.tv_nsec >= 1000000000 ) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    return pthread_cond_timedwait( &m_handle->cond, &mutex.m_handle->mutex, &deadline ) != ETIMEDOUT;
+}
+
+void WaitCondition::wakeAll()
+{
+    pthread_cond_broadcast( &m_handle->cond );
+}
+
 TRACELIB_NAMESPACE_END
 
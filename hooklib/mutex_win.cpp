@@ -48,5 +48,29 @@ void Mutex::unlock()
     ::LeaveCriticalSection( &m_handle->section );
 }
 
+struct WaitConditionHandle {
+    CONDITION_VARIABLE cond;
+};
+
+WaitCondition::WaitCondition() : m_handle( new WaitConditionHandle )
+{
+    ::InitializeConditionVariable( &m_handle->cond );
+}
+
+WaitCondition::~WaitCondition()
+{
+    delete m_handle;
+}
+
+bool WaitCondition::wait( Mutex &mutex, unsigned int timeoutMilliSeconds )
+{
+    return ::SleepConditionVariableCS( &m_handle->cond, &mutex.m_handle->section, timeoutMilliSeconds ) != FALSE;
+}
+
+void WaitCondition::wakeAll()
+{
+    ::WakeAllConditionVariable( &m_handle->cond );
+}
+
 TRACELIB_NAMESPACE_END
 
@@ -92,9 +92,14 @@ static size_t writeTo( int fd, const char *data, const int length, Log *log )
     return (size_t)written;
 }
 
-NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port )
+/* The data is sent synchronously and uncompressed here, so the
+ * NetworkOutputConfiguration is not used.
+ */
+NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port,
+                              const NetworkOutputConfiguration &config )
     : m_host( host ), m_port( port ), m_socket( -1 ), m_log( log ),
-    m_lastConnectionAttemptFailed( false ), d( 0 )
+    m_lastConnectionAttemptFailed( false ), m_sessionId( 0 ), d( 0 ),
+    m_config( config )
 {
 #ifdef _WIN32
     WSADATA wsaData;
@@ -125,6 +130,8 @@ bool NetworkOutput::open()
         m_socket = connectTo( m_host, m_port, m_log );
         if ( m_socket == -1 ) {
             m_lastConnectionAttemptFailed = true;
+        } else {
+            ++m_sessionId;
         }
     }
     return m_socket != -1;
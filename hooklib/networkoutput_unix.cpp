@@ -19,24 +19,47 @@
 
 #include "output.h"
 #include "log.h"
+#include "atomicops.h"
 #include "eventthread_unix.h"
+#include "mutex.h"
+#include "streamcompression.h"
 
 #include <arpa/inet.h>
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netdb.h>
 
+#include <deque>
 #include <list>
 
 using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
+// How long to wait for the reply to a compression request
+static const int NegotiationTimeout = 2000;
+
+class NetworkOutputPrivate;
+
+/* Periodically moves the queued data over to the event thread in case a
+ * flush interval is configured.
+ */
+class FlushTimer : public EventObserver {
+public:
+    explicit FlushTimer( NetworkOutputPrivate *output ) : m_output( output ) { }
+
+    void handleEvent( EventContext *ctx, Event *event );
+
+private:
+    NetworkOutputPrivate *m_output;
+};
+
 class NetworkOutputPrivate : public FileEventObserver {
 public:
     typedef std::list< std::vector<char> * > BufferList;
@@ -51,10 +74,22 @@ public:
     Log *log;
     ssize_t buf_pos;
     int watching;
+    FlushTimer flush_timer;
+
+    /* In compressed mode the buffers are packed into one frame at a time;
+     * 'frame' is what is currently being sent.
+     */
+    bool negotiated;
+    bool compressing;
+    std::vector<char> frame;
+    size_t frame_pos;
+    std::vector<char> uncompressed;
+    unsigned char reply[StreamCompression::ReplyLength];
+    size_t reply_pos;
 
     enum ObserverState {
         NotConnected,
-        Connecting, Connected,
+        Connecting, Negotiating, Connected,
         Closing,
         Error
     };
@@ -69,29 +104,55 @@ public:
     };
     NetworkOutputState network_state;
 
-    NetworkOutputPrivate( const string h, unsigned short p, Log *log );
+    /* Data written by the NetworkOutput calling thread which was not picked
+     * up by the event thread yet. queued_entries also includes the buffers
+     * which the event thread did not finish sending yet, so it's what the
+     * queue size limit applies to.
+     */
+    const NetworkOutputConfiguration config;
+    std::deque< std::vector<char> * > pending;
+    size_t pending_bytes;
+    bool flush_scheduled;
+    Mutex pending_mutex;
+    volatile unsigned long queued_entries;
+    volatile unsigned long dropped_entries;
+    volatile unsigned long failed;
+    // Broadcast with pending_mutex held once queued_entries shrank or failed got set
+    WaitCondition space_available;
+
+    NetworkOutputPrivate( const string h, unsigned short p, Log *log,
+                          const NetworkOutputConfiguration &config );
     ~NetworkOutputPrivate();
 
     // Only used in NetworkOutput calling thread
     void connect();
     void close();
+    bool enqueue( const std::vector<char> &data );
 
     // Only used in event thread
     void clear();
     void addObserver( EventContext *ctx, int watch );
     void removeObserver( EventContext *ctx, int watch );
     void endClosing( EventContext *ctx );
-    bool write( EventContext *ctx, std::vector<char>* buffer );
+    void requestCompression( EventContext *ctx, int fd );
+    void readReply( EventContext *ctx );
+    void finishNegotiation( EventContext *ctx, bool useCompression );
+    void takePending( EventContext *ctx );
+    bool hasDataToSend() const { return !buffers.empty() || !frame.empty(); }
+    void writeBuffers( int fd );
+    void writeFrame( int fd );
+    void sendFailed();
+    void releaseBuffer( std::vector<char> *buffer );
+    void wakeUpWaitingThreads();
     void handleEvent( EventContext*, Event *event );
 };
 
-class WriteDataTask : public Task
+class FlushPendingTask : public Task
 {
     NetworkOutputPrivate *observer;
-    vector<char> *data;
 public:
-    WriteDataTask( NetworkOutputPrivate *obs, vector<char> *d )
-        : observer( obs ), data( d )
+    FlushPendingTask( NetworkOutputPrivate *obs )
+        : observer( obs )
     {}
 
     void *exec( EventContext* );
@@ -108,7 +169,13 @@ public:
 };
 
 
-NetworkOutputPrivate::NetworkOutputPrivate( const string h, unsigned short p, Log *_log )
+void FlushTimer::handleEvent( EventContext *ctx, Event * )
+{
+    m_output->takePending( ctx );
+}
+
+NetworkOutputPrivate::NetworkOutputPrivate( const string h, unsigned short p, Log *_log,
+                                            const NetworkOutputConfiguration &_config )
  : host( h ),
    port( p ),
    notify_on_close( true ),
@@ -116,8 +183,19 @@ NetworkOutputPrivate::NetworkOutputPrivate( const string h, unsigned short p, Lo
    log( _log ),
    buf_pos( 0),
    watching( FileEvent::Error ),
+   flush_timer( this ),
+   negotiated( true ),
+   compressing( false ),
+   frame_pos( 0 ),
+   reply_pos( 0 ),
    state( NotConnected ),
-   network_state( Idle )
+   network_state( Idle ),
+   config( _config ),
+   pending_bytes( 0 ),
+   flush_scheduled( false ),
+   queued_entries( 0 ),
+   dropped_entries( 0 ),
+   failed( 0 )
 {}
 
 NetworkOutputPrivate::~NetworkOutputPrivate()
@@ -130,6 +208,8 @@ void NetworkOutputPrivate::connect()
     // NetworkOutput calling thread, no event thread calls at this point
     state = Error;
     network_state = Opened;
+    negotiated = config.compression == NetworkOutputConfiguration::NoCompression;
+    compressing = false;
 
     struct hostent *he = gethostbyname( host.c_str() );
     if ( !he ) {
@@ -150,6 +230,10 @@ void NetworkOutputPrivate::connect()
         watching = FileEvent::FileReadWrite;
         EventThreadUnix::self()->postTask(
                 new AddIOObserverTask( m_socket, this, watching ) );
+        if ( config.flushInterval > 0 ) {
+            EventThreadUnix::self()->postTask(
+                    new TimerTask( config.flushInterval, &flush_timer ) );
+        }
 
         state = Connecting;
     } else {
@@ -159,6 +243,75 @@ void NetworkOutputPrivate::connect()
     }
 }
 
+/* Queues a copy of the data for the event thread; the event thread is only
+ * told about it once per batch, so this usually doesn't need any system
+ * calls at all. Returns false if the connection failed meanwhile.
+ */
+bool NetworkOutputPrivate::enqueue( const std::vector<char> &data )
+{
+    if ( atomicLoad( &failed ) || !EventThreadUnix::running() ) {
+        return false;
+    }
+
+    vector<char> *buf = new vector<char>( data );
+
+    bool wakeUpEventThread = false;
+    {
+        MutexLocker locker( pending_mutex );
+        while ( atomicLoad( &queued_entries ) >= config.queueSize ) {
+            if ( config.overflowPolicy == NetworkOutputConfiguration::DropOldestWhenFull &&
+                 !pending.empty() ) {
+                pending_bytes -= pending.front()->size();
+                delete pending.front();
+                pending.pop_front();
+                atomicAdd( &queued_entries, (unsigned long)-1 );
+                atomicAdd( &dropped_entries, 1 );
+                break;
+            }
+
+            if ( config.overflowPolicy == NetworkOutputConfiguration::DropNewestWhenFull ) {
+                atomicAdd( &dropped_entries, 1 );
+                delete buf;
+                return true;
+            }
+
+            /* Block until the event thread sent something. With
+             * DropOldestWhenFull, this happens if all queued entries were
+             * taken over by the event thread already; those are being sent,
+             * so there is nothing left to drop and dropping the newest
+             * entry instead would violate the policy.
+             */
+
+            if ( !flush_scheduled ) {
+                flush_scheduled = true;
+                EventThreadUnix::self()->postTask( new FlushPendingTask( this ) );
+            }
+
+            space_available.wait( pending_mutex, 100 );
+
+            if ( atomicLoad( &failed ) ) {
+                delete buf;
+                return false;
+            }
+        }
+
+        pending.push_back( buf );
+        pending_bytes += buf->size();
+        atomicAdd( &queued_entries, 1 );
+
+        if ( !flush_scheduled &&
+             ( config.flushInterval == 0 || pending_bytes >= config.batchSize ) ) {
+            flush_scheduled = true;
+            wakeUpEventThread = true;
+        }
+    }
+
+    if ( wakeUpEventThread ) {
+        EventThreadUnix::self()->postTask( new FlushPendingTask( this ) );
+    }
+    return true;
+}
+
 void NetworkOutputPrivate::addObserver( EventContext *ctx, int watch )
 {
     AddIOObserverTask( m_socket, this, watch ).exec( ctx );
@@ -171,6 +324,114 @@ void NetworkOutputPrivate::removeObserver( EventContext *ctx, int watch )
     watching &= ~watch;
 }
 
+/* Sends as many of the queued buffers as fit into one batch with a single
+ * writev() call.
+ */
+void NetworkOutputPrivate::writeBuffers( int fd )
+{
+    if ( compressing ) {
+        writeFrame( fd );
+        return;
+    }
+
+    static const int MaxIoVectors = 64;
+    iovec iov[MaxIoVectors];
+    int count = 0;
+    size_t bytes = 0;
+
+    BufferList::iterator it, e = buffers.end();
+    for ( it = buffers.begin(); it != e && count < MaxIoVectors && bytes < config.batchSize; ++it ) {
+        const size_t offset = count == 0 ? buf_pos : 0;
+        iov[count].iov_base = &(**it)[0] + offset;
+        iov[count].iov_len = ( *it )->size() - offset;
+        bytes += iov[count].iov_len;
+        ++count;
+    }
+
+    ssize_t nr = ::writev( fd, iov, count );
+    if ( nr < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ) {
+        return;
+    }
+
+    if ( nr <= 0 ) {
+        sendFailed();
+        return;
+    }
+
+    while ( nr > 0 ) {
+        vector<char> *buf = buffers.front();
+        const ssize_t remaining = buf->size() - buf_pos;
+        if ( nr < remaining ) {
+            buf_pos += nr;
+            break;
+        }
+        nr -= remaining;
+        buffers.pop_front();
+        releaseBuffer( buf );
+        buf_pos = 0;
+    }
+    wakeUpWaitingThreads();
+}
+
+/* Packs as many of the queued buffers as fit into one batch into a
+ * compressed frame and sends (the rest of) it.
+ */
+void NetworkOutputPrivate::writeFrame( int fd )
+{
+    if ( frame.empty() ) {
+        uncompressed.clear();
+        while ( !buffers.empty() && uncompressed.size() < config.batchSize ) {
+            vector<char> *buf = buffers.front();
+            uncompressed.insert( uncompressed.end(), buf->begin(), buf->end() );
+            buffers.pop_front();
+            releaseBuffer( buf );
+        }
+        wakeUpWaitingThreads();
+        StreamCompression::appendFrame( frame, &uncompressed[0], uncompressed.size() );
+        frame_pos = 0;
+    }
+
+    ssize_t nr = ::write( fd, &frame[frame_pos], frame.size() - frame_pos );
+    if ( nr < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ) {
+        return;
+    }
+
+    if ( nr <= 0 ) {
+        sendFailed();
+        return;
+    }
+
+    frame_pos += nr;
+    if ( frame_pos == frame.size() ) {
+        frame.clear();
+        frame_pos = 0;
+    }
+}
+
+void NetworkOutputPrivate::sendFailed()
+{
+    clear(); // clears buffers, FileWrite observer removed by caller
+    state = Error;
+    atomicStore( &failed, 1 );
+    wakeUpWaitingThreads();
+}
+
+// Callers wake up the threads waiting for space once they released all
+void NetworkOutputPrivate::releaseBuffer( std::vector<char> *buffer )
+{
+    delete buffer;
+    atomicAdd( &queued_entries, (unsigned long)-1 );
+}
+
+/* Holding the mutex makes sure that a thread which just found the queue
+ * full is waiting already, so it cannot miss the wake up call.
+ */
+void NetworkOutputPrivate::wakeUpWaitingThreads()
+{
+    MutexLocker locker( pending_mutex );
+    space_available.wakeAll();
+}
+
 void NetworkOutputPrivate::handleEvent( EventContext *ctx, Event *event )
 {
     if ( event->eventType() == Event::FileEventType ) {
@@ -180,42 +441,30 @@ void NetworkOutputPrivate::handleEvent( EventContext *ctx, Event *event )
                 state = Connected;
                 removeObserver( ctx, FileEvent::FileRead );
             }
-            if ( buffers.size() ) {
-                int total_written = 0;
-                BufferList::iterator e = buffers.end();
-                for ( BufferList::iterator it = buffers.begin(); it != e; ) {
-                    vector<char> *buf = *it;
-
-                    int nr = ::write( fe->fd, &(*buf)[0] + buf_pos, buf->size() - buf_pos );
-                    if ( nr <= 0 )
-                        break;
-
-                    total_written += nr;
-                    buf_pos += nr;
-                    if ( buf_pos != (ssize_t)buf->size() )
-                        break;
-
-                    delete buf;
-                    it = buffers.erase( it );
-                    buf_pos = 0;
-                }
-                if ( !total_written ) {
-                    clear(); // clears buffers, FileWrite observer below removed
-                    state = Error;
-                }
+            if ( !negotiated && !buffers.empty() ) {
+                requestCompression( ctx, fe->fd );
+                return;
             }
-            if ( buffers.size() == 0 ) {
+            if ( hasDataToSend() ) {
+                writeBuffers( fe->fd );
+            }
+            if ( !hasDataToSend() ) {
                 removeObserver( ctx, FileEvent::FileWrite );
                 if ( Closing == state ) {
                     endClosing( ctx );
                 }
             }
         } else if ( FileEvent::FileRead == fe->watch ) {
-            log->writeError( "Connect error to %s %d %d",
-                    host.c_str(), fe->fd, m_socket );
-            removeObserver( ctx, FileEvent::FileReadWrite );
-            clear();
-            state = Error;
+            if ( Negotiating == state ) {
+                readReply( ctx );
+            } else {
+                log->writeError( "Connect error to %s %d %d",
+                        host.c_str(), fe->fd, m_socket );
+                removeObserver( ctx, FileEvent::FileReadWrite );
+                clear();
+                state = Error;
+                atomicStore( &failed, 1 );
+            }
         } else if ( FileEvent::Error == fe->watch ) {
             log->writeError( "Network error to %s: %s %d",
                     host.c_str(), strerror( fe->err ), fe->fd );
@@ -223,27 +472,119 @@ void NetworkOutputPrivate::handleEvent( EventContext *ctx, Event *event )
                 removeObserver( ctx, FileEvent::FileWrite );
             clear();
             state = Error;
+            atomicStore( &failed, 1 );
             watching = FileEvent::Error;
         }
     } else { //TimerEventType
-        if ( Closing == state ) {
+        if ( Negotiating == state ) {
+            log->writeStatus( "NetworkOutput: %s:%d did not reply to the compression request, sending uncompressed data",
+                    host.c_str(), port );
+            finishNegotiation( ctx, false );
+        } else if ( Closing == state ) {
             endClosing( ctx );
         }
     }
 }
 
-bool NetworkOutputPrivate::write( EventContext *ctx, std::vector<char>* buffer )
+/* Sends the compression request in front of the first data; the kind of
+ * request depends on the format of that data.
+ */
+void NetworkOutputPrivate::requestCompression( EventContext *ctx, int fd )
+{
+    const vector<char> request = StreamCompression::compressionRequest( buffers.front()->front() );
+
+    // Nothing was sent yet, so the request fits into the socket buffer
+    if ( ::write( fd, &request[0], request.size() ) != (ssize_t)request.size() ) {
+        log->writeError( "Network error to %s: %s", host.c_str(), strerror( errno ) );
+        removeObserver( ctx, FileEvent::FileWrite );
+        sendFailed();
+        return;
+    }
+
+    // Nothing else is sent until we know whether the server can decompress it
+    state = Negotiating;
+    reply_pos = 0;
+    removeObserver( ctx, FileEvent::FileWrite );
+    addObserver( ctx, FileEvent::FileRead );
+    TimerTask( NegotiationTimeout, this ).exec( ctx );
+}
+
+void NetworkOutputPrivate::readReply( EventContext *ctx )
+{
+    const ssize_t nr = ::recv( m_socket, reply + reply_pos,
+                               sizeof( reply ) - reply_pos, 0 );
+    if ( nr < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ) ) {
+        return;
+    }
+
+    if ( nr <= 0 ) {
+        log->writeError( "Network error to %s: %s", host.c_str(),
+                nr == 0 ? "connection closed by server" : strerror( errno ) );
+        TimerTask( this ).exec( ctx );
+        removeObserver( ctx, FileEvent::FileRead );
+        sendFailed();
+        return;
+    }
+
+    reply_pos += nr;
+    if ( reply_pos == sizeof( reply ) ) {
+        finishNegotiation( ctx, StreamCompression::replyAcceptsCodec(
+                    reply, StreamCompression::Lz4Codec ) );
+    }
+}
+
+void NetworkOutputPrivate::finishNegotiation( EventContext *ctx, bool useCompression )
+{
+    TimerTask( this ).exec( ctx );
+    removeObserver( ctx, FileEvent::FileRead );
+    state = Connected;
+
+    negotiated = true;
+    compressing = useCompression;
+    if ( compressing ) {
+        frame.assign( StreamCompression::StreamHeader,
+                      StreamCompression::StreamHeader + StreamCompression::StreamHeaderLength );
+        frame_pos = 0;
+    }
+
+    if ( hasDataToSend() ) {
+        buf_pos = 0;
+        addObserver( ctx, FileEvent::FileWrite );
+    }
+}
+
+/* Moves the data queued by the NetworkOutput calling thread over to the
+ * list of buffers to send.
+ */
+void NetworkOutputPrivate::takePending( EventContext *ctx )
 {
+    std::deque< std::vector<char> * > batch;
+    {
+        MutexLocker locker( pending_mutex );
+        batch.swap( pending );
+        pending_bytes = 0;
+        flush_scheduled = false;
+    }
+
+    if ( batch.empty() ) {
+        return;
+    }
+
     if ( state > NotConnected && state < Closing ) {
-        buffers.push_back( buffer );
-        if ( !(watching & FileEvent::FileWrite ) ) {
+        buffers.insert( buffers.end(), batch.begin(), batch.end() );
+        if ( Negotiating != state && !(watching & FileEvent::FileWrite ) ) {
             buf_pos = 0;
             addObserver( ctx, FileEvent::FileWrite );
         }
-        return true;
+        return;
     }
-    delete buffer;
-    return false;
+
+    std::deque< std::vector<char> * >::iterator it, e = batch.end();
+    for ( it = batch.begin(); it != e; ++it ) {
+        releaseBuffer( *it );
+    }
+    wakeUpWaitingThreads();
+    atomicStore( &failed, 1 );
 }
 
 void NetworkOutputPrivate::close()
@@ -277,6 +618,10 @@ void NetworkOutputPrivate::endClosing( EventContext *ctx )
     }
     state = NotConnected;
 
+    if ( config.flushInterval > 0 ) {
+        TimerTask( &flush_timer ).exec( ctx );
+    }
+
     if ( notify_on_close ) {
         int in, out;
         void *response = 0;
@@ -290,29 +635,54 @@ void NetworkOutputPrivate::endClosing( EventContext *ctx )
 void NetworkOutputPrivate::clear()
 {
     if ( m_socket > -1 ) {
+        /* A reply which arrived after the negotiation timed out would make
+         * close() reset the connection, discarding data the server did not
+         * read yet.
+         */
+        if ( config.compression != NetworkOutputConfiguration::NoCompression ) {
+            char discard[64];
+            while ( ::recv( m_socket, discard, sizeof( discard ), MSG_DONTWAIT ) > 0 ) {
+            }
+        }
         ::close( m_socket );
         m_socket = -1;
         state = NotConnected;
     }
     BufferList::iterator e = buffers.end();
     for ( BufferList::iterator it = buffers.begin(); it != e; ) {
-        delete *it;
+        releaseBuffer( *it );
         it = buffers.erase( it );
     }
+    frame.clear();
+    frame_pos = 0;
+    compressing = false;
+
+    MutexLocker locker( pending_mutex );
+    while ( !pending.empty() ) {
+        releaseBuffer( pending.front() );
+        pending.pop_front();
+    }
+    pending_bytes = 0;
+    space_available.wakeAll();
 }
 
 
-void *WriteDataTask::exec( EventContext *ctx )
+void *FlushPendingTask::exec( EventContext *ctx )
 {
-    return observer->write( ctx, data )
-        ? (void*)(long)NetworkOutputPrivate::Opened
-        : (void*)(long)NetworkOutputPrivate::Failure;
+    observer->takePending( ctx );
+    return NULL;
 }
 
 
 void *SocketClosingTask::exec( EventContext *ctx )
 {
-    if ( observer->buffers.size() > 0 ) {
+    // Don't hold back the remaining data any longer for the reply
+    if ( NetworkOutputPrivate::Negotiating == observer->state ) {
+        observer->finishNegotiation( ctx, false );
+    }
+    observer->negotiated = true;
+    observer->takePending( ctx );
+    if ( observer->hasDataToSend() ) {
         // try for 10s to flush remaining buffers
         observer->state = NetworkOutputPrivate::Closing;
         TimerTask( 10000, observer ).exec( ctx );
@@ -323,21 +693,31 @@ void *SocketClosingTask::exec( EventContext *ctx )
 }
 
 
-NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port )
+NetworkOutput::NetworkOutput( Log *log, const string &host, unsigned short port,
+                              const NetworkOutputConfiguration &config )
     : m_host( host ), m_port( port ), m_socket( -1 ), m_log( log ),
-    d( new NetworkOutputPrivate( host, port, log ) )
+    d( new NetworkOutputPrivate( host, port, log, config ) ),
+    m_sessionId( 0 ),
+    m_config( config )
 {
 }
 
 NetworkOutput::~NetworkOutput()
 {
+    if ( atomicLoad( &d->dropped_entries ) > 0 ) {
+        m_log->writeStatus( "NetworkOutput: dropped the %s %lu trace entries since the send queue was full",
+                            m_config.overflowPolicy == NetworkOutputConfiguration::DropOldestWhenFull ? "oldest" : "newest",
+                            atomicLoad( &d->dropped_entries ) );
+    }
     delete d;
 }
 
 bool NetworkOutput::open()
 {
-    if ( d->network_state == NetworkOutputPrivate::Idle )
+    if ( d->network_state == NetworkOutputPrivate::Idle ) {
         d->connect();
+        ++m_sessionId;
+    }
 
     return NetworkOutputPrivate::Opened == d->network_state;
 }
@@ -350,13 +730,10 @@ bool NetworkOutput::canWrite() const
 
 void NetworkOutput::write( const vector<char> &data )
 {
-    if ( NetworkOutputPrivate::Opened == d->network_state ) {
-        vector<char> *buf = new vector<char>( data );
-        //buf->swap( data );
-        WriteDataTask task( d, buf );
-        d->network_state =
-            (NetworkOutputPrivate::NetworkOutputState)(long)
-            EventThreadUnix::self()->sendTask( &task );
+    if ( NetworkOutputPrivate::Opened == d->network_state && !data.empty() ) {
+        if ( !d->enqueue( data ) ) {
+            d->network_state = NetworkOutputPrivate::Failure;
+        }
     }
 }
 
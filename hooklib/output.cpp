@@ -38,14 +38,24 @@ Output::~Output()
 
 void StdoutOutput::write( const vector<char> &data )
 {
-    vector<char> nullTerminatedData = data;
-    nullTerminatedData.push_back( '\0' );
-    fprintf(stdout, "%s\n", &nullTerminatedData[0]);
-    fflush(stdout);
+    if ( !data.empty() ) {
+        fwrite( &data[0], 1, data.size(), stdout );
+    }
+    fputc( '\n', stdout );
+    fflush( stdout );
+}
+
+int StdoutOutput::crashDescriptor() const
+{
+#ifndef _WIN32
+    return fileno( stdout );
+#else
+    return -1;
+#endif
 }
 
 FileOutput::FileOutput( Log *log, const string& filename )
-    : m_filename( filename ), m_file( 0 ), m_log( log )
+    : m_filename( filename ), m_file( 0 ), m_log( log ), m_sessionId( 0 )
 {
 }
 
@@ -66,24 +76,45 @@ bool FileOutput::canWrite() const
 
 bool FileOutput::open()
 {
-    m_file = fopen( m_filename.c_str(), "w" );
+    m_file = fopen( m_filename.c_str(), "wb" );
     if( !m_file ) {
         m_log->writeError( "Failed to open file!: %s", strerror( errno ) );
         return false;
     }
+    // The file got truncated, so everything written before is gone
+    ++m_sessionId;
     return true;
 }
 
 void FileOutput::write( const vector<char> &data )
 {
     if( m_file ) {
-        vector<char> nullTerminatedData = data;
-        nullTerminatedData.push_back( '\0' );
-        fprintf( m_file, "%s\n", &nullTerminatedData[0] );
+        // Not using fprintf, serialized data may contain null bytes
+        if ( !data.empty() ) {
+            fwrite( &data[0], 1, data.size(), m_file );
+        }
+        fputc( '\n', m_file );
+        fflush( m_file );
+    }
+}
+
+void FileOutput::flush()
+{
+    if ( m_file ) {
         fflush( m_file );
     }
 }
 
+// Everything is flushed after each write, so the stream has nothing pending
+int FileOutput::crashDescriptor() const
+{
+#ifndef _WIN32
+    return m_file ? fileno( m_file ) : -1;
+#else
+    return -1;
+#endif
+}
+
 void MultiplexingOutput::addOutput( Output *output )
 {
     m_outputs.push_back( output );
@@ -97,6 +128,27 @@ void MultiplexingOutput::write( const vector<char> &data )
     }
 }
 
+void MultiplexingOutput::flush()
+{
+    vector<Output *>::const_iterator it, end = m_outputs.end();
+    for ( it = m_outputs.begin(); it != end; ++it ) {
+        ( *it )->flush();
+    }
+}
+
+unsigned long MultiplexingOutput::sessionId() const
+{
+    /* All outputs get the same data, so start a new session for all of them
+     * if any of them starts one.
+     */
+    unsigned long id = 0;
+    vector<Output *>::const_iterator it, end = m_outputs.end();
+    for ( it = m_outputs.begin(); it != end; ++it ) {
+        id += ( *it )->sessionId();
+    }
+    return id;
+}
+
 MultiplexingOutput::~MultiplexingOutput()
 {
     vector<Output *>::const_iterator it, end = m_outputs.end();
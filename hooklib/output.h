@@ -21,8 +21,11 @@
 #define TRACELIB_OUTPUT_H
 
 #include "tracelib_config.h"
+#include "mutex.h"
+#include "thread.h"
 
 #include <stdio.h>
+#include <time.h>
 #include <string>
 #include <vector>
 
@@ -31,6 +34,11 @@ TRACELIB_NAMESPACE_BEGIN
 class Log;
 class NetworkOutputPrivate;
 
+namespace SharedMemoryFormat
+{
+    struct SharedMemoryHeader;
+}
+
 class Output
 {
 public:
@@ -40,6 +48,23 @@ public:
     virtual bool canWrite() const { return true; }
     virtual void write( const std::vector<char> &data ) = 0;
 
+    /* Makes sure everything written so far reached its destination; called
+     * when the process shuts down.
+     */
+    virtual void flush() {}
+
+    /* Changes whenever the receiving end may have lost track of the data
+     * written before, e.g. because a new connection was established. A new
+     * session makes the serializer start over with a self-contained stream.
+     */
+    virtual unsigned long sessionId() const { return 0; }
+
+    /* A file descriptor to which the crash handler can append a record with
+     * write(2) directly, bypassing this object; -1 if there is none, e.g.
+     * because the data is sent by a background thread.
+     */
+    virtual int crashDescriptor() const { return -1; }
+
 protected:
     Output();
 
@@ -52,6 +77,7 @@ class StdoutOutput : public Output
 {
 public:
     virtual void write( const std::vector<char> &data );
+    virtual int crashDescriptor() const;
 };
 
 class FileOutput : public Output
@@ -59,12 +85,85 @@ class FileOutput : public Output
     std::string m_filename;
     FILE* m_file;
     Log *m_log;
+    unsigned long m_sessionId;
 public:
     FileOutput( Log *erroLog, const std::string& filename );
     virtual ~FileOutput();
     virtual void write( const std::vector<char> &data );
     virtual bool open();
     virtual bool canWrite() const;
+    virtual void flush();
+    virtual unsigned long sessionId() const { return m_sessionId; }
+    virtual int crashDescriptor() const;
+};
+
+/* Controls the files written by a MappedFileOutput. */
+struct MappedFileOutputConfiguration
+{
+    MappedFileOutputConfiguration()
+        : segmentSize( 16 * 1024 * 1024 ),
+        maximumAge( 0 ),
+        maximumFiles( 5 ),
+        flushInterval( 1000 )
+    {
+    }
+
+    unsigned long segmentSize; // bytes preallocated for each file
+    unsigned long maximumAge; // seconds before a new file is started; 0 means no limit
+    unsigned long maximumFiles; // including the file currently written
+    unsigned long flushInterval; // milliseconds; 0 means only at shutdown
+};
+
+/* Appends the data to a file which is preallocated and mapped into memory,
+ * so writing an entry is just a copy. Once the file is (almost) full or
+ * too old, it is truncated to the data actually written and renamed to
+ * <name>.1.<extension> (shifting older files up and removing the oldest);
+ * writing continues in a new file. A background thread flushes the
+ * mapping to disk periodically. Only available on Unix systems.
+ */
+class MappedFileOutput : public Output, private Thread
+{
+public:
+    MappedFileOutput( Log *log, const std::string &filename,
+                      const MappedFileOutputConfiguration &config = MappedFileOutputConfiguration() );
+    virtual ~MappedFileOutput();
+
+    virtual bool open();
+    virtual bool canWrite() const;
+    virtual void write( const std::vector<char> &data );
+    virtual void flush();
+    virtual unsigned long sessionId() const { return m_sessionId; }
+
+private:
+    virtual void run();
+
+    bool startSegment( size_t size );
+    void finishSegment();
+    void rotateFiles();
+    std::string rotatedFileName( unsigned long index ) const;
+
+    Log *m_log;
+    std::string m_filename;
+    MappedFileOutputConfiguration m_config;
+    Mutex m_mutex;
+    AutoResetEvent m_wakeUpEvent;
+    volatile unsigned long m_running;
+    volatile unsigned long m_rotationPending;
+    int m_fd;
+    char *m_map;
+    size_t m_size;
+    size_t m_used;
+    size_t m_flushed;
+    time_t m_segmentStarted;
+    time_t m_retryTime; // when to try opening again after a failure, 0 if none
+    bool m_threadStarted;
+
+    /* Held while the flush thread syncs without m_mutex and while a mapping
+     * goes away; the generation counts the mappings which went away.
+     */
+    Mutex m_syncMutex;
+    unsigned long m_mappingGeneration;
+    unsigned long m_sessionId;
 };
 
 class MultiplexingOutput : public Output
@@ -75,11 +174,45 @@ public:
     void addOutput( Output *output );
 
     virtual void write( const std::vector<char> &data );
+    virtual void flush();
+    virtual unsigned long sessionId() const;
 
 private:
     std::vector<Output *> m_outputs;
 };
 
+/* Controls how data written to a NetworkOutput is queued; entries are
+ * handed to a background thread which sends whatever accumulated in one go.
+ */
+struct NetworkOutputConfiguration
+{
+    enum OverflowPolicy {
+        BlockWhenFull,
+        DropOldestWhenFull,
+        DropNewestWhenFull
+    };
+
+    enum Compression {
+        NoCompression,
+        Lz4Compression
+    };
+
+    NetworkOutputConfiguration()
+        : queueSize( 4096 ),
+        overflowPolicy( BlockWhenFull ),
+        batchSize( 65536 ),
+        flushInterval( 0 ),
+        compression( NoCompression )
+    {
+    }
+
+    unsigned long queueSize; // entries which may be waiting to be sent
+    OverflowPolicy overflowPolicy;
+    unsigned long batchSize; // bytes to send with a single system call
+    unsigned long flushInterval; // milliseconds; 0 means send right away
+    Compression compression; // only used if the server supports it
+};
+
 class NetworkOutput : public Output
 {
     std::string m_host;
@@ -88,16 +221,50 @@ class NetworkOutput : public Output
     Log *m_log;
     NetworkOutputPrivate *d;
     bool m_lastConnectionAttemptFailed;
+    unsigned long m_sessionId;
+    NetworkOutputConfiguration m_config;
 
     void close();
 
 public:
-    NetworkOutput( Log *log, const std::string &remoteHost, unsigned short remotePort );
+    NetworkOutput( Log *log, const std::string &remoteHost, unsigned short remotePort,
+                   const NetworkOutputConfiguration &config = NetworkOutputConfiguration() );
     virtual ~NetworkOutput();
 
     virtual bool open();
     virtual bool canWrite() const;
     virtual void write( const std::vector<char> &data );
+    virtual unsigned long sessionId() const { return m_sessionId; }
+};
+
+/* Writes the data into a ring buffer in shared memory which is read by a
+ * trace daemon running on the same machine; see sharedmemoryformat.h. Data
+ * is dropped if the buffer is full, the traced process never waits for the
+ * daemon. Only available on Unix systems.
+ */
+class SharedMemoryOutput : public Output
+{
+public:
+    SharedMemoryOutput( Log *log, unsigned int capacity );
+    virtual ~SharedMemoryOutput();
+
+    virtual bool open();
+    virtual bool canWrite() const;
+    virtual void write( const std::vector<char> &data );
+    virtual unsigned long sessionId() const;
+
+private:
+    void ringDoorbell();
+
+    Log *m_log;
+    unsigned int m_capacity;
+    std::string m_name;
+    SharedMemoryFormat::SharedMemoryHeader *m_header;
+    char *m_data;
+    size_t m_mappedSize;
+    bool m_openFailed;
+    mutable unsigned int m_readerPid;
+    mutable unsigned long m_sessionId;
 };
 
 TRACELIB_NAMESPACE_END
@@ -0,0 +1,101 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "queuedentry.h"
+#include "trace.h"
+#include "tracelib.h" // for StringBuilder
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+QueuedEntry::QueuedEntry()
+    : tracePoint( 0 ),
+    threadId( 0 ),
+    threadGeneration( 0 ),
+    timeStamp( 0 ),
+    stackPosition( 0 ),
+    hasMessage( false ),
+    hasVariables( false ),
+    backtrace( 0 )
+{
+}
+
+QueuedEntry::~QueuedEntry()
+{
+    delete backtrace;
+}
+
+void QueuedEntry::assign( TraceEntry &entry, StringBuilder *messageParts_ )
+{
+    tracePoint = entry.tracePoint;
+    threadId = entry.threadId;
+    threadGeneration = entry.threadGeneration;
+    timeStamp = entry.timeStamp;
+    stackPosition = entry.stackPosition;
+    hasMessage = entry.message != 0 || messageParts_ != 0;
+    if ( entry.message ) {
+        message = entry.message;
+        messageParts.clear();
+    } else if ( messageParts_ ) {
+        message.clear();
+        messageParts.resize( messageParts_->size() );
+        for ( size_t i = 0; i < messageParts.size(); ++i ) {
+            messageParts[i].swap( ( *messageParts_ )[i] );
+        }
+    }
+    hasVariables = entry.variables != 0;
+    variables.clear();
+    if ( entry.variables ) {
+        for ( size_t i = 0; i < entry.variables->size(); ++i ) {
+            const AbstractVariable *v = ( *entry.variables )[i];
+            variables.push_back( ValueVariable( v->name(), v->value() ) );
+        }
+    }
+    delete backtrace;
+    backtrace = entry.backtrace;
+    entry.backtrace = 0;
+}
+
+void QueuedEntry::writeTo( Trace *trace )
+{
+    if ( !messageParts.empty() ) {
+        message = formatMessage( messageParts );
+        messageParts.clear();
+    }
+
+    VariableSnapshot snapshot;
+    TraceEntry entry( tracePoint, hasMessage ? message.c_str() : 0,
+                      threadId, threadGeneration, timeStamp, stackPosition );
+    entry.backtrace = backtrace;
+    backtrace = 0;
+    if ( hasVariables ) {
+        vector<ValueVariable>::iterator it, end = variables.end();
+        for ( it = variables.begin(); it != end; ++it ) {
+            snapshot << &*it;
+        }
+        entry.variables = &snapshot;
+    }
+
+    trace->addEntry( entry );
+
+    variables.clear();
+}
+
+TRACELIB_NAMESPACE_END
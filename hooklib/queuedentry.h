@@ -0,0 +1,88 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_QUEUEDENTRY_H
+#define TRACELIB_QUEUEDENTRY_H
+
+#include "tracelib_config.h"
+#include "getcurrentthreadid.h"
+#include "variabledumping.h"
+#include "config.h" // for uint64_t
+
+#include <string>
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+class Backtrace;
+class StringBuilder;
+class Trace;
+struct TraceEntry;
+struct TracePoint;
+
+/* Holds a copy of a variable's value as it was when the trace point was
+ * hit; the original variable may be gone by the time the entry is written.
+ */
+class ValueVariable : public AbstractVariable
+{
+public:
+    ValueVariable( const char *name, const VariableValue &value )
+        : m_name( name ), m_value( value ) { }
+
+    virtual const char *name() const { return m_name; }
+    virtual VariableValue value() const { return m_value; }
+
+private:
+    const char *m_name;
+    VariableValue m_value;
+};
+
+/* A copy of a trace entry which is written later on. Slots are meant to be
+ * allocated once and reused, so they keep their buffers between entries.
+ */
+struct QueuedEntry
+{
+    QueuedEntry();
+    ~QueuedEntry();
+
+    /* Copies the entry (taking over its backtrace); if message parts are
+     * given, they are moved into the entry and only formatted when the entry
+     * is written.
+     */
+    void assign( TraceEntry &entry, StringBuilder *messageParts );
+
+    // Hands the entry to Trace::addEntry and releases what it held.
+    void writeTo( Trace *trace );
+
+    const TracePoint *tracePoint;
+    ThreadId threadId;
+    unsigned long threadGeneration;
+    uint64_t timeStamp;
+    size_t stackPosition;
+    bool hasMessage;
+    std::string message;
+    std::vector<VariableValue> messageParts;
+    bool hasVariables;
+    std::vector<ValueVariable> variables; // keeps its capacity between entries
+    Backtrace *backtrace;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_QUEUEDENTRY_H)
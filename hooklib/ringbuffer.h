@@ -0,0 +1,105 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_RINGBUFFER_H
+#define TRACELIB_RINGBUFFER_H
+
+#include "tracelib_config.h"
+#include "atomicops.h"
+
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* A bounded queue for exactly one producing and one consuming thread
+ * which works without any locks. The slots are allocated once and are
+ * reused, so T should be cheap to overwrite (e.g. keep its buffers).
+ *
+ * The producer calls beginWrite() to get a free slot, fills it and then
+ * publishes it using commitWrite(); the consumer does the same using
+ * beginRead() and commitRead().
+ */
+template <typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer( unsigned long capacity )
+        : m_writePos( 0 ),
+        m_readPos( 0 )
+    {
+        // Round up to a power of two so that wrapping positions is cheap
+        const unsigned long largestSize = ~( ~0UL >> 1 );
+        unsigned long size = 1;
+        while ( size < capacity && size < largestSize ) {
+            size <<= 1;
+        }
+        m_slots.resize( size );
+        m_mask = size - 1;
+    }
+
+    unsigned long capacity() const { return m_mask + 1; }
+
+    bool isEmpty() const {
+        return atomicLoad( &m_readPos ) == atomicLoad( &m_writePos );
+    }
+
+    T *beginWrite() {
+        const unsigned long writePos = m_writePos;
+        if ( writePos - atomicLoad( &m_readPos ) > m_mask ) {
+            return 0;
+        }
+        return &m_slots[writePos & m_mask];
+    }
+
+    void commitWrite() {
+        atomicStore( &m_writePos, m_writePos + 1 );
+    }
+
+    T *beginRead() {
+        const unsigned long readPos = m_readPos;
+        if ( readPos == atomicLoad( &m_writePos ) ) {
+            return 0;
+        }
+        return &m_slots[readPos & m_mask];
+    }
+
+    void commitRead() {
+        atomicStore( &m_readPos, m_readPos + 1 );
+    }
+
+private:
+    RingBuffer( const RingBuffer &other ); // disabled
+    void operator=( const RingBuffer &rhs ); // disabled
+
+    std::vector<T> m_slots;
+    unsigned long m_mask;
+
+    // Keep the two positions on separate cache lines, they are written
+    // by different threads.
+    char m_padding0[64];
+    volatile unsigned long m_writePos;
+    char m_padding1[64];
+    volatile unsigned long m_readPos;
+    char m_padding2[64];
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_RINGBUFFER_H)
+
@@ -18,12 +18,13 @@
  */
 
 #include "serializer.h"
+#include "binaryformat.h"
 #include "trace.h"
 #include "tracepoint.h"
 #include "configuration.h"
 #include "timehelper.h" // for timeToString
 
-#include <string.h> // for strlen
+#include <string.h> // for strlen, memcpy
 
 #include <sstream>
 
@@ -33,6 +34,20 @@ using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
+/* Returns whether the thread of the entry still has to be announced, i.e.
+ * whether its name has to be sent along; a thread which got the ID of a
+ * finished thread is announced again.
+ */
+static bool announceThread( map<ThreadId, unsigned long> &announcedThreads, const TraceEntry &entry )
+{
+    map<ThreadId, unsigned long>::iterator it = announcedThreads.find( entry.threadId );
+    if ( it != announcedThreads.end() && it->second == entry.threadGeneration ) {
+        return false;
+    }
+    announcedThreads[entry.threadId] = entry.threadGeneration;
+    return true;
+}
+
 Serializer::Serializer()
 {
 }
@@ -56,7 +71,7 @@ vector<char> PlaintextSerializer::serialize( const TraceEntry &entry )
     ostringstream str;
 
     if ( m_showTimestamp ) {
-        str << timeToString( entry.timeStamp ) << ": ";
+        str << timeToString( entry.timeStamp / 1000000 ) << ": ";
     }
 
     str << "Process " << entry.process.id << " [started at " << timeToString( entry.process.startTime ) << "] (Thread " << entry.threadId << "): ";
@@ -158,10 +173,18 @@ static std::string splitCDataEndToken( const std::string& input )
     return copy;
 }
 
-vector<char> XMLSerializer::serialize( const TraceEntry &entry )
+/* The trace keys and the storage configuration only change when the
+ * configuration is reloaded (which yields a new serializer), so they are
+ * sent once at the start of the session instead of with every entry.
+ */
+vector<char> XMLSerializer::startSession()
 {
+    const TracedProcess &process = TraceEntry::process;
+
+    m_announcedThreads.clear();
+
     ostringstream str;
-    str << "<traceentry pid=\"" << entry.process.id << "\" process_starttime=\"" << entry.process.startTime << "\" tid=\"" << entry.threadId << "\" time=\"" << entry.timeStamp << "\">";
+    str << "<session pid=\"" << process.id << "\" process_starttime=\"" << process.startTime << "\">";
 
     std::string indent;
     if ( m_beautifiedOutput ) {
@@ -171,17 +194,13 @@ vector<char> XMLSerializer::serialize( const TraceEntry &entry )
     static string myProcessName = Configuration::currentProcessName();
     str << indent << "<processname><![CDATA[" << splitCDataEndToken( myProcessName ) << "]]></processname>";
 
-    str << indent << "<stackposition>" << entry.stackPosition << "</stackposition>";
-    if ( entry.tracePoint->groupName ) {
-        str << indent << "<group>" << entry.tracePoint->groupName << "</group>";
-    }
-    if ( !entry.process.availableTraceKeys.empty() ) {
+    if ( !process.availableTraceKeys.empty() ) {
         str << indent << "<tracekeys>";
         if ( m_beautifiedOutput ) {
             indent = "\n    ";
         }
-        vector<TraceKey>::const_iterator it, end = entry.process.availableTraceKeys.end();
-        for ( it = entry.process.availableTraceKeys.begin(); it != end; ++it ) {
+        vector<TraceKey>::const_iterator it, end = process.availableTraceKeys.end();
+        for ( it = process.availableTraceKeys.begin(); it != end; ++it ) {
             str << indent << "<key enabled=\"" << ( it->enabled ? "true" : "false" ) << "\"><![CDATA[" << splitCDataEndToken( it->name ) << "]]></key>";
         }
         if ( m_beautifiedOutput ) {
@@ -189,6 +208,57 @@ vector<char> XMLSerializer::serialize( const TraceEntry &entry )
         }
         str << indent << "</tracekeys>";
     }
+
+    str << indent << "<storageconfiguration"
+                  << " maxSize=\"" << m_cfg.maximumTraceSize << "\""
+                  << " shrinkBy=\"" << m_cfg.shrinkPercentage << "\""
+                  << ">";
+    if ( m_beautifiedOutput ) {
+        indent += "  ";
+    }
+    str << indent << "<![CDATA[" << splitCDataEndToken( m_cfg.archiveDirectoryName ) << "]]>";
+    if ( m_beautifiedOutput ) {
+        indent = "\n  ";
+    }
+    str << indent << "</storageconfiguration>";
+
+    if ( m_beautifiedOutput ) {
+        indent = "\n";
+    }
+    str << indent << "</session>";
+    if ( m_beautifiedOutput ) {
+        str << "\n";
+    }
+
+    const string result = str.str();
+    return vector<char>( result.begin(), result.end() );
+}
+
+vector<char> XMLSerializer::serialize( const TraceEntry &entry )
+{
+    ostringstream str;
+    str << "<traceentry pid=\"" << entry.process.id << "\" process_starttime=\"" << entry.process.startTime << "\" tid=\"" << entry.threadId << "\" time=\"" << entry.timeStamp / 1000000 << "\" time_ns=\"" << entry.timeStamp << "\">";
+
+    std::string indent;
+    if ( m_beautifiedOutput ) {
+        indent = "\n  ";
+    }
+
+    static string myProcessName = Configuration::currentProcessName();
+    str << indent << "<processname><![CDATA[" << splitCDataEndToken( myProcessName ) << "]]></processname>";
+
+    // The thread name only comes with the first entry of each thread
+    if ( announceThread( m_announcedThreads, entry ) ) {
+        const string threadName = getThreadName( entry.threadId, entry.threadGeneration );
+        if ( !threadName.empty() ) {
+            str << indent << "<threadname><![CDATA[" << splitCDataEndToken( threadName ) << "]]></threadname>";
+        }
+    }
+
+    str << indent << "<stackposition>" << entry.stackPosition << "</stackposition>";
+    if ( entry.tracePoint->groupName ) {
+        str << indent << "<group>" << entry.tracePoint->groupName << "</group>";
+    }
     str << indent << "<type>" << entry.tracePoint->type << "</type>";
     str << indent << "<location lineno=\"" << entry.tracePoint->lineno << "\"><![CDATA[" << splitCDataEndToken( entry.tracePoint->sourceFile ) << "]]></location>";
     str << indent << "<function><![CDATA[" << splitCDataEndToken( entry.tracePoint->functionName ) << "]]></function>";
@@ -239,19 +309,6 @@ vector<char> XMLSerializer::serialize( const TraceEntry &entry )
         str << indent << "<message><![CDATA[" << splitCDataEndToken( entry.message ) << "]]></message>";
     }
 
-    str << indent << "<storageconfiguration"
-                  << " maxSize=\"" << m_cfg.maximumTraceSize << "\""
-                  << " shrinkBy=\"" << m_cfg.shrinkPercentage << "\""
-                  << ">";
-    if ( m_beautifiedOutput ) {
-        indent += "  ";
-    }
-    str << indent << "<![CDATA[" << splitCDataEndToken( m_cfg.archiveDirectoryName ) << "]]>";
-    if ( m_beautifiedOutput ) {
-        indent = "\n  ";
-    }
-    str << indent << "</storageconfiguration>";
-
     if ( m_beautifiedOutput ) {
         indent = "\n";
     }
@@ -307,5 +364,225 @@ string XMLSerializer::convertVariable( const char *n, const VariableValue &v ) c
     return str.str();
 }
 
+static void appendVarint( vector<char> &buf, uint64_t v )
+{
+    while ( v >= 0x80 ) {
+        buf.push_back( static_cast<char>( ( v & 0x7f ) | 0x80 ) );
+        v >>= 7;
+    }
+    buf.push_back( static_cast<char>( v ) );
+}
+
+static void appendSignedVarint( vector<char> &buf, vlonglong v )
+{
+    // Zigzag encoding keeps small negative numbers short
+    appendVarint( buf, ( static_cast<uint64_t>( v ) << 1 ) ^ static_cast<uint64_t>( v >> 63 ) );
+}
+
+static void appendByte( vector<char> &buf, unsigned char b )
+{
+    buf.push_back( static_cast<char>( b ) );
+}
+
+static void appendString( vector<char> &buf, const char *s, size_t len )
+{
+    appendVarint( buf, len );
+    buf.insert( buf.end(), s, s + len );
+}
+
+static void appendString( vector<char> &buf, const char *s )
+{
+    appendString( buf, s, s ? strlen( s ) : 0 );
+}
+
+static void appendString( vector<char> &buf, const string &s )
+{
+    appendString( buf, s.data(), s.size() );
+}
+
+static void appendDouble( vector<char> &buf, double d )
+{
+    uint64_t bits;
+    memcpy( &bits, &d, sizeof( bits ) );
+    for ( int i = 0; i < 8; ++i ) {
+        buf.push_back( static_cast<char>( bits & 0xff ) );
+        bits >>= 8;
+    }
+}
+
+static void appendVariableValue( vector<char> &buf, const VariableValue &v )
+{
+    appendByte( buf, static_cast<unsigned char>( v.type() ) );
+    switch ( v.type() ) {
+        case VariableType::String:
+            appendString( buf, v.asString() );
+            break;
+        case VariableType::Number:
+            appendByte( buf, v.isSignedNumber() ? 1 : 0 );
+            if ( v.isSignedNumber() ) {
+                appendSignedVarint( buf, static_cast<vlonglong>( v.asNumber() ) );
+            } else {
+                appendVarint( buf, v.asNumber() );
+            }
+            break;
+        case VariableType::Float:
+            appendDouble( buf, static_cast<double>( v.asFloat() ) );
+            break;
+        case VariableType::Boolean:
+            appendByte( buf, v.asBoolean() ? 1 : 0 );
+            break;
+        default:
+            assert( !"Unreachable" );
+    }
+}
+
+static vector<char> makeRecord( BinaryFormat::RecordType type, const vector<char> &payload )
+{
+    vector<char> record;
+    record.reserve( payload.size() + 12 );
+    appendByte( record, BinaryFormat::RecordMarker );
+    appendByte( record, static_cast<unsigned char>( type ) );
+    appendVarint( record, payload.size() );
+    record.insert( record.end(), payload.begin(), payload.end() );
+    return record;
+}
+
+BinarySerializer::BinarySerializer()
+{
+}
+
+vector<char> BinarySerializer::startSession()
+{
+    static string myProcessName = Configuration::currentProcessName();
+    const TracedProcess &process = TraceEntry::process;
+
+    // The receiving end doesn't know about any trace points or threads yet
+    m_tracePointIds.clear();
+    m_announcedThreads.clear();
+
+    vector<char> payload;
+    appendVarint( payload, process.id );
+    appendVarint( payload, process.startTime );
+    appendString( payload, myProcessName );
+
+    appendVarint( payload, process.availableTraceKeys.size() );
+    vector<TraceKey>::const_iterator it, end = process.availableTraceKeys.end();
+    for ( it = process.availableTraceKeys.begin(); it != end; ++it ) {
+        appendByte( payload, it->enabled ? 1 : 0 );
+        appendString( payload, it->name );
+    }
+
+    appendVarint( payload, m_cfg.maximumTraceSize );
+    appendVarint( payload, m_cfg.shrinkPercentage );
+    appendString( payload, m_cfg.archiveDirectoryName );
+
+    return makeRecord( BinaryFormat::SessionRecord, payload );
+}
+
+/* Returns the ID of the given trace point; the definition of the trace point
+ * is appended to the buffer in case it was not written in this session yet.
+ */
+unsigned long BinarySerializer::tracePointId( const TracePoint *tracePoint, vector<char> &buf )
+{
+    map<const TracePoint *, unsigned long>::const_iterator it = m_tracePointIds.find( tracePoint );
+    if ( it != m_tracePointIds.end() ) {
+        return it->second;
+    }
+
+    const unsigned long id = m_tracePointIds.size() + 1;
+    m_tracePointIds[tracePoint] = id;
+
+    vector<char> payload;
+    appendVarint( payload, id );
+    appendByte( payload, static_cast<unsigned char>( tracePoint->type ) );
+    appendVarint( payload, tracePoint->lineno );
+    appendString( payload, tracePoint->sourceFile );
+    appendString( payload, tracePoint->functionName );
+    appendByte( payload, tracePoint->groupName ? BinaryFormat::HasGroupName : 0 );
+    if ( tracePoint->groupName ) {
+        appendString( payload, tracePoint->groupName );
+    }
+
+    const vector<char> record = makeRecord( BinaryFormat::TracePointDefinitionRecord, payload );
+    buf.insert( buf.end(), record.begin(), record.end() );
+    return id;
+}
+
+vector<char> BinarySerializer::serialize( const TraceEntry &entry )
+{
+    vector<char> result;
+    if ( announceThread( m_announcedThreads, entry ) ) {
+        const string threadName = getThreadName( entry.threadId, entry.threadGeneration );
+        if ( !threadName.empty() ) {
+            vector<char> payload;
+            appendVarint( payload, entry.threadId );
+            appendString( payload, threadName );
+            result = makeRecord( BinaryFormat::ThreadRecord, payload );
+        }
+    }
+    const unsigned long id = tracePointId( entry.tracePoint, result );
+
+    vector<char> payload;
+    payload.reserve( 128 );
+    appendVarint( payload, entry.threadId );
+    appendVarint( payload, entry.timeStamp );
+    appendVarint( payload, entry.stackPosition );
+    appendVarint( payload, id );
+
+    unsigned char flags = 0;
+    if ( entry.variables ) {
+        flags |= BinaryFormat::HasVariables;
+    }
+    if ( entry.backtrace ) {
+        flags |= BinaryFormat::HasBacktrace;
+    }
+    if ( entry.message ) {
+        flags |= BinaryFormat::HasMessage;
+    }
+    appendByte( payload, flags );
+
+    if ( entry.variables ) {
+        appendVarint( payload, entry.variables->size() );
+        for ( size_t i = 0; i < entry.variables->size(); ++i ) {
+            AbstractVariable *v = (*entry.variables)[i];
+            appendString( payload, v->name() );
+            appendVariableValue( payload, v->value() );
+        }
+    }
+
+    if ( entry.backtrace ) {
+        appendVarint( payload, entry.backtrace->depth() );
+        for ( size_t i = 0; i < entry.backtrace->depth(); ++i ) {
+            const StackFrame &frame = entry.backtrace->frame( i );
+            appendString( payload, frame.module );
+            appendString( payload, frame.function );
+            appendVarint( payload, frame.functionOffset );
+            appendString( payload, frame.sourceFile );
+            appendVarint( payload, frame.lineNumber );
+        }
+    }
+
+    if ( entry.message ) {
+        appendString( payload, entry.message );
+    }
+
+    const vector<char> record = makeRecord( BinaryFormat::TraceEntryRecord, payload );
+    result.insert( result.end(), record.begin(), record.end() );
+    return result;
+}
+
+vector<char> BinarySerializer::serialize( const ProcessShutdownEvent &ev )
+{
+    static string myProcessName = Configuration::currentProcessName();
+
+    vector<char> payload;
+    appendVarint( payload, ev.process->id );
+    appendVarint( payload, ev.process->startTime );
+    appendVarint( payload, ev.shutdownTime );
+    appendString( payload, myProcessName );
+
+    return makeRecord( BinaryFormat::ShutdownEventRecord, payload );
+}
+
 TRACELIB_NAMESPACE_END
 
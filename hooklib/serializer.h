@@ -22,15 +22,18 @@
 
 #include "tracelib_config.h"
 
+#include <map>
 #include <string>
 #include <vector>
 
 #include "configuration.h" // for StorageConfiguration
+#include "getcurrentthreadid.h" // for ThreadId
 
 TRACELIB_NAMESPACE_BEGIN
 
 struct TraceEntry;
 struct ProcessShutdownEvent;
+struct TracePoint;
 class VariableValue;
 
 class Serializer
@@ -38,11 +41,23 @@ class Serializer
 public:
     virtual ~Serializer();
 
+    /* Called before anything is serialized for an output which did not see
+     * any data of this serializer yet (e.g. after reconnecting); returns
+     * data to write before anything else.
+     */
+    virtual std::vector<char> startSession() { return std::vector<char>(); }
+
     virtual std::vector<char> serialize( const TraceEntry &entry ) = 0;
     virtual std::vector<char> serialize( const ProcessShutdownEvent &ev ) = 0;
 
     virtual void setStorageConfiguration( const StorageConfiguration &cfg ) { }
 
+    /* Whether the data is made up of the records described in
+     * binaryformat.h, so that records written by other means (e.g. by the
+     * crash handler) can be mixed in.
+     */
+    virtual bool isBinary() const { return false; }
+
 protected:
     Serializer();
 
@@ -73,6 +88,7 @@ public:
 
     void setBeautifiedOutput( bool beautifiedOutput );
 
+    virtual std::vector<char> startSession();
     virtual std::vector<char> serialize( const TraceEntry &entry );
     virtual std::vector<char> serialize( const ProcessShutdownEvent &ev );
 
@@ -85,6 +101,35 @@ private:
 
     bool m_beautifiedOutput;
     StorageConfiguration m_cfg;
+    std::map<ThreadId, unsigned long> m_announcedThreads; // maps to the generation
+};
+
+/* Writes compact, length-prefixed records; see binaryformat.h for a
+ * description of the format. The static data of each trace point is only
+ * written once per session, entries refer to it using a numeric ID. The
+ * same goes for thread names.
+ */
+class BinarySerializer : public Serializer
+{
+public:
+    BinarySerializer();
+
+    virtual std::vector<char> startSession();
+    virtual std::vector<char> serialize( const TraceEntry &entry );
+    virtual std::vector<char> serialize( const ProcessShutdownEvent &ev );
+
+    virtual void setStorageConfiguration( const StorageConfiguration &cfg ) {
+        m_cfg = cfg;
+    }
+
+    virtual bool isBinary() const { return true; }
+
+private:
+    unsigned long tracePointId( const TracePoint *tracePoint, std::vector<char> &buf );
+
+    StorageConfiguration m_cfg;
+    std::map<const TracePoint *, unsigned long> m_tracePointIds;
+    std::map<ThreadId, unsigned long> m_announcedThreads; // maps to the generation
 };
 
 TRACELIB_NAMESPACE_END
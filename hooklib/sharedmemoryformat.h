@@ -0,0 +1,87 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_SHAREDMEMORYFORMAT_H
+#define TRACELIB_SHAREDMEMORYFORMAT_H
+
+#include "tracelib_config.h"
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Describes the shared memory segment written by the SharedMemoryOutput;
+ * this header is shared with the reader in the trace daemon.
+ *
+ * Each traced process creates its own segment, named SegmentPrefix
+ * followed by the process ID and a timestamp, in the directory used for
+ * POSIX shared memory (/dev/shm). The segment starts with a
+ * SharedMemoryHeader, followed by 'capacity' bytes of ring buffer.
+ *
+ * The ring buffer holds records: a four byte length (in host byte order)
+ * followed by that many bytes of serialized data, padded to a multiple of
+ * RecordAlignment. Records never wrap around the end of the buffer; if a
+ * record does not fit into the space left before the end, that space is
+ * skipped with a PaddingRecord length.
+ *
+ * writePos and readPos count the bytes written and consumed so far (modulo
+ * 2^32). Only the producer changes writePos and only the reader changes
+ * readPos, so the producer never waits for the reader: if the buffer is
+ * full, records are dropped (and counted in droppedRecords). After
+ * advancing writePos, the producer increments the doorbell and, if
+ * readerWaiting is set, wakes up the reader (using a futex on Linux).
+ *
+ * readerPid is claimed by the reader with a compare-and-swap; a reader may
+ * take over the segment if the process whose ID is stored there died. The
+ * producer starts a new session whenever records were dropped or the
+ * reader changed. Once the producer is done, it sets producerClosed; the
+ * reader removes the segment after it consumed everything.
+ */
+namespace SharedMemoryFormat
+{
+    const char SegmentPrefix[] = "tracelib-";
+    const unsigned int Magic = 0x4d535254; // "TRSM"
+    const unsigned int Version = 1;
+    const unsigned int RecordAlignment = 8;
+    const unsigned int PaddingRecord = 0xffffffffu;
+
+    struct SharedMemoryHeader
+    {
+        unsigned int magic;
+        unsigned int version;
+        unsigned int capacity; // a power of two
+        unsigned int pid;
+
+        volatile unsigned int writePos;
+        volatile unsigned int readPos;
+        volatile unsigned int doorbell;
+        volatile unsigned int readerWaiting;
+        volatile unsigned int readerPid;
+        volatile unsigned int droppedRecords;
+        volatile unsigned int producerClosed;
+        unsigned int reserved[5];
+    };
+
+    inline unsigned int recordSize( unsigned int length )
+    {
+        return ( 4 + length + RecordAlignment - 1 ) & ~( RecordAlignment - 1 );
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_SHAREDMEMORYFORMAT_H)
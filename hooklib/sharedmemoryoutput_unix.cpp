@@ -0,0 +1,208 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "output.h"
+#include "atomicops.h"
+#include "log.h"
+#include "sharedmemoryformat.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+using namespace SharedMemoryFormat;
+
+static unsigned int roundUpToPowerOfTwo( unsigned int v )
+{
+    unsigned int result = 1;
+    while ( result < v ) {
+        result <<= 1;
+    }
+    return result;
+}
+
+SharedMemoryOutput::SharedMemoryOutput( Log *log, unsigned int capacity )
+    : m_log( log ),
+    m_capacity( roundUpToPowerOfTwo( capacity ) ),
+    m_header( 0 ),
+    m_data( 0 ),
+    m_mappedSize( 0 ),
+    m_openFailed( false ),
+    m_readerPid( 0 ),
+    m_sessionId( 0 )
+{
+}
+
+SharedMemoryOutput::~SharedMemoryOutput()
+{
+    if ( !m_header ) {
+        return;
+    }
+
+    atomicStore( &m_header->producerClosed, 1u );
+    ringDoorbell();
+
+    /* If no reader attached yet and there's nothing left to read, nobody
+     * needs the segment anymore; otherwise the reader removes it.
+     */
+    if ( atomicLoad( &m_header->readerPid ) == 0 &&
+         atomicLoad( &m_header->readPos ) == m_header->writePos ) {
+        shm_unlink( m_name.c_str() );
+    }
+    munmap( m_header, m_mappedSize );
+}
+
+bool SharedMemoryOutput::open()
+{
+    if ( m_header ) {
+        return true;
+    }
+
+    // Don't try again (and log another error) for every trace entry
+    if ( m_openFailed ) {
+        return false;
+    }
+    m_openFailed = true;
+
+    timeval now;
+    gettimeofday( &now, NULL );
+    char name[64];
+    snprintf( name, sizeof( name ), "/%s%ld-%ld%06ld", SegmentPrefix, (long)getpid(),
+              (long)now.tv_sec, (long)now.tv_usec );
+    m_name = name;
+
+    const int fd = shm_open( name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+    if ( fd == -1 ) {
+        m_log->writeError( "SharedMemoryOutput: failed to create shared memory segment %s: %s", name, strerror( errno ) );
+        return false;
+    }
+
+    m_mappedSize = sizeof( SharedMemoryHeader ) + m_capacity;
+    void *segment = MAP_FAILED;
+    if ( ftruncate( fd, m_mappedSize ) == 0 ) {
+        segment = mmap( 0, m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    }
+    if ( segment == MAP_FAILED ) {
+        m_log->writeError( "SharedMemoryOutput: failed to map shared memory segment %s: %s", name, strerror( errno ) );
+        ::close( fd );
+        shm_unlink( name );
+        return false;
+    }
+    ::close( fd );
+
+    // The segment is zero-filled, only the constant fields need to be set
+    m_header = static_cast<SharedMemoryHeader *>( segment );
+    m_data = static_cast<char *>( segment ) + sizeof( SharedMemoryHeader );
+    m_header->version = Version;
+    m_header->capacity = m_capacity;
+    m_header->pid = getpid();
+
+    // Readers ignore the segment until the magic value is there
+    atomicStore( &m_header->magic, Magic );
+
+    m_openFailed = false;
+    ++m_sessionId;
+    m_log->writeStatus( "SharedMemoryOutput: writing to shared memory segment %s (%u bytes)", name, m_capacity );
+    return true;
+}
+
+bool SharedMemoryOutput::canWrite() const
+{
+    return m_header != 0;
+}
+
+void SharedMemoryOutput::write( const vector<char> &data )
+{
+    if ( !m_header || data.empty() ) {
+        return;
+    }
+
+    const unsigned int length = static_cast<unsigned int>( data.size() );
+    const unsigned int size = recordSize( length );
+    unsigned int writePos = m_header->writePos;
+    const unsigned int offset = writePos & ( m_capacity - 1 );
+    const unsigned int padding = m_capacity - offset < size ? m_capacity - offset : 0;
+    const unsigned int used = writePos - atomicLoad( &m_header->readPos );
+
+    if ( size > m_capacity / 2 || m_capacity - used < padding + size ) {
+        atomicAdd( &m_header->droppedRecords, 1u );
+        // The reader misses whatever the dropped data defined, so start over
+        ++m_sessionId;
+        return;
+    }
+
+    if ( padding > 0 ) {
+        memcpy( m_data + offset, &PaddingRecord, sizeof( PaddingRecord ) );
+        writePos += padding;
+    }
+
+    char *record = m_data + ( writePos & ( m_capacity - 1 ) );
+    memcpy( record, &length, sizeof( length ) );
+    memcpy( record + sizeof( length ), &data[0], length );
+
+    atomicStore( &m_header->writePos, writePos + size );
+    ringDoorbell();
+}
+
+unsigned long SharedMemoryOutput::sessionId() const
+{
+    /* A reader taking over from another one doesn't know what its
+     * predecessor saw; the first reader starts at the beginning though.
+     */
+    if ( m_header ) {
+        const unsigned int readerPid = atomicLoad( &m_header->readerPid );
+        if ( readerPid != m_readerPid ) {
+            if ( m_readerPid != 0 ) {
+                ++m_sessionId;
+            }
+            m_readerPid = readerPid;
+        }
+    }
+    return m_sessionId;
+}
+
+/* The doorbell is incremented unconditionally (which also orders the
+ * writePos update before reading readerWaiting), the system call is only
+ * made if the reader actually sleeps.
+ */
+void SharedMemoryOutput::ringDoorbell()
+{
+    atomicAdd( &m_header->doorbell, 1u );
+    if ( atomicLoad( &m_header->readerWaiting ) ) {
+#ifdef __linux__
+        syscall( SYS_futex, &m_header->doorbell, FUTEX_WAKE, 1, NULL, NULL, 0 );
+#endif
+    }
+}
+
+TRACELIB_NAMESPACE_END
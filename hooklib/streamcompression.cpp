@@ -0,0 +1,304 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streamcompression.h"
+
+#include <string.h>
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+namespace StreamCompression
+{
+
+/* Parameters of the LZ4 block format: matches are at least MinMatch bytes
+ * long and at most MaxOffset bytes back, the last match has to start
+ * MatchFindLimit bytes before the end of the block and the last LastLiterals
+ * bytes are always literals.
+ */
+static const size_t MinMatch = 4;
+static const size_t MaxOffset = 65535;
+static const size_t MatchFindLimit = 12;
+static const size_t LastLiterals = 5;
+static const unsigned int HashLog = 12;
+
+static unsigned int read32( const unsigned char *p )
+{
+    unsigned int v;
+    memcpy( &v, p, sizeof( v ) );
+    return v;
+}
+
+static unsigned int hashSequence( unsigned int sequence )
+{
+    return ( sequence * 2654435761U ) >> ( 32 - HashLog );
+}
+
+static void writeLE32( unsigned char *p, unsigned long v )
+{
+    p[0] = static_cast<unsigned char>( v );
+    p[1] = static_cast<unsigned char>( v >> 8 );
+    p[2] = static_cast<unsigned char>( v >> 16 );
+    p[3] = static_cast<unsigned char>( v >> 24 );
+}
+
+static unsigned long readLE32( const unsigned char *p )
+{
+    return (unsigned long)p[0] | (unsigned long)p[1] << 8 |
+           (unsigned long)p[2] << 16 | (unsigned long)p[3] << 24;
+}
+
+static unsigned char *writeLength( unsigned char *op, size_t length )
+{
+    while ( length >= 255 ) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<unsigned char>( length );
+    return op;
+}
+
+static unsigned char *writeSequence( unsigned char *op, const unsigned char *literals,
+                                     size_t literalLength, size_t offset, size_t matchLength )
+{
+    unsigned char *token = op++;
+    if ( literalLength >= 15 ) {
+        *token = 15 << 4;
+        op = writeLength( op, literalLength - 15 );
+    } else {
+        *token = static_cast<unsigned char>( literalLength << 4 );
+    }
+    memcpy( op, literals, literalLength );
+    op += literalLength;
+
+    if ( matchLength == 0 ) { // last sequence
+        return op;
+    }
+
+    *op++ = static_cast<unsigned char>( offset );
+    *op++ = static_cast<unsigned char>( offset >> 8 );
+    matchLength -= MinMatch;
+    if ( matchLength >= 15 ) {
+        *token |= 15;
+        op = writeLength( op, matchLength - 15 );
+    } else {
+        *token |= static_cast<unsigned char>( matchLength );
+    }
+    return op;
+}
+
+size_t maximumCompressedLength( size_t length )
+{
+    return length + length / 255 + 16;
+}
+
+/* A greedy single pass compressor: it looks up the last position at which
+ * the same four bytes were seen and takes the match if it's close enough.
+ * This is far from the best possible ratio but fast enough to run on every
+ * batch sent, which is what matters for trace data.
+ */
+size_t compressBlock( const char *data, size_t length, char *out )
+{
+    const unsigned char * const src = reinterpret_cast<const unsigned char *>( data );
+    unsigned char * const dst = reinterpret_cast<unsigned char *>( out );
+    unsigned char *op = dst;
+    size_t anchor = 0;
+
+    if ( length > MatchFindLimit ) {
+        // Positions are stored plus one so that zero means 'not seen yet'
+        size_t table[1 << HashLog];
+        memset( table, 0, sizeof( table ) );
+
+        const size_t matchFindEnd = length - MatchFindLimit;
+        const size_t matchEnd = length - LastLiterals;
+        size_t pos = 0;
+        while ( pos < matchFindEnd ) {
+            const unsigned int sequence = read32( src + pos );
+            const unsigned int h = hashSequence( sequence );
+            const size_t candidate = table[h];
+            table[h] = pos + 1;
+
+            if ( candidate == 0 || pos - ( candidate - 1 ) > MaxOffset ||
+                 read32( src + candidate - 1 ) != sequence ) {
+                ++pos;
+                continue;
+            }
+
+            size_t match = candidate - 1;
+            while ( pos > anchor && match > 0 && src[pos - 1] == src[match - 1] ) {
+                --pos;
+                --match;
+            }
+
+            size_t matchLength = MinMatch;
+            while ( pos + matchLength < matchEnd &&
+                    src[pos + matchLength] == src[match + matchLength] ) {
+                ++matchLength;
+            }
+
+            op = writeSequence( op, src + anchor, pos - anchor, pos - match, matchLength );
+            pos += matchLength;
+            anchor = pos;
+        }
+    }
+
+    op = writeSequence( op, src + anchor, length - anchor, 0, 0 );
+    return op - dst;
+}
+
+/* Decodes a block written by compressBlock() (or any other LZ4 block
+ * compressor). Returns false unless the block decodes to exactly outLength
+ * bytes without reading or writing out of bounds.
+ */
+bool decompressBlock( const char *data, size_t length, char *out, size_t outLength )
+{
+    const unsigned char * const src = reinterpret_cast<const unsigned char *>( data );
+    unsigned char * const dst = reinterpret_cast<unsigned char *>( out );
+    size_t ip = 0;
+    size_t op = 0;
+
+    while ( ip < length ) {
+        const unsigned char token = src[ip++];
+
+        size_t literalLength = token >> 4;
+        if ( literalLength == 15 ) {
+            unsigned char b;
+            do {
+                if ( ip == length ) {
+                    return false;
+                }
+                b = src[ip++];
+                literalLength += b;
+            } while ( b == 255 );
+        }
+        if ( literalLength > length - ip || literalLength > outLength - op ) {
+            return false;
+        }
+        memcpy( dst + op, src + ip, literalLength );
+        ip += literalLength;
+        op += literalLength;
+
+        if ( ip == length ) { // last sequence
+            break;
+        }
+
+        if ( length - ip < 2 ) {
+            return false;
+        }
+        const size_t offset = src[ip] | ( src[ip + 1] << 8 );
+        ip += 2;
+        if ( offset == 0 || offset > op ) {
+            return false;
+        }
+
+        size_t matchLength = token & 15;
+        if ( matchLength == 15 ) {
+            unsigned char b;
+            do {
+                if ( ip == length ) {
+                    return false;
+                }
+                b = src[ip++];
+                matchLength += b;
+            } while ( b == 255 );
+        }
+        matchLength += MinMatch;
+        if ( matchLength > outLength - op ) {
+            return false;
+        }
+
+        // Byte by byte since the match may overlap the data being written
+        for ( size_t i = 0; i < matchLength; ++i ) {
+            dst[op + i] = dst[op - offset + i];
+        }
+        op += matchLength;
+    }
+
+    return op == outLength;
+}
+
+vector<char> compressionRequest( char firstByte )
+{
+    if ( static_cast<unsigned char>( firstByte ) == BinaryFormat::RecordMarker ) {
+        return vector<char>( BinaryRequest, BinaryRequest + sizeof( BinaryRequest ) );
+    }
+    return vector<char>( XmlRequest, XmlRequest + sizeof( XmlRequest ) - 1 );
+}
+
+static RequestMatch matchRequest( const char *data, size_t length,
+                                  const char *request, size_t requestLength )
+{
+    if ( memcmp( data, request, length < requestLength ? length : requestLength ) != 0 ) {
+        return NoRequest;
+    }
+    return length < requestLength ? IncompleteRequest : CompleteRequest;
+}
+
+RequestMatch matchCompressionRequest( const char *data, size_t length,
+                                      size_t *requestLength )
+{
+    const char *binaryRequest = reinterpret_cast<const char *>( BinaryRequest );
+    RequestMatch m = matchRequest( data, length, binaryRequest, sizeof( BinaryRequest ) );
+    *requestLength = sizeof( BinaryRequest );
+    if ( m == NoRequest ) {
+        m = matchRequest( data, length, XmlRequest, sizeof( XmlRequest ) - 1 );
+        *requestLength = sizeof( XmlRequest ) - 1;
+    }
+    return m;
+}
+
+void writeReply( unsigned char *reply, unsigned int codecs )
+{
+    memcpy( reply, ReplyMagic, sizeof( ReplyMagic ) );
+    reply[4] = ProtocolVersion;
+    reply[5] = static_cast<unsigned char>( codecs );
+}
+
+bool replyAcceptsCodec( const unsigned char *reply, Codec codec )
+{
+    return memcmp( reply, ReplyMagic, sizeof( ReplyMagic ) ) == 0 &&
+           reply[4] >= ProtocolVersion &&
+           ( reply[5] & codec ) != 0;
+}
+
+void appendFrame( vector<char> &frame, const char *data, size_t length )
+{
+    const size_t start = frame.size();
+    frame.resize( start + FrameHeaderLength + maximumCompressedLength( length ) );
+
+    char * const header = &frame[start];
+    const size_t compressedLength = compressBlock( data, length, header + FrameHeaderLength );
+    writeLE32( reinterpret_cast<unsigned char *>( header ), compressedLength );
+    writeLE32( reinterpret_cast<unsigned char *>( header ) + 4, length );
+
+    frame.resize( start + FrameHeaderLength + compressedLength );
+}
+
+void readFrameHeader( const char *header, unsigned long *compressedLength,
+                      unsigned long *length )
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( header );
+    *compressedLength = readLE32( p );
+    *length = readLE32( p + 4 );
+}
+
+}
+
+TRACELIB_NAMESPACE_END
@@ -0,0 +1,101 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_STREAMCOMPRESSION_H
+#define TRACELIB_STREAMCOMPRESSION_H
+
+#include "tracelib_config.h"
+#include "binaryformat.h"
+
+#include <stddef.h>
+#include <vector>
+
+TRACELIB_NAMESPACE_BEGIN
+
+/* Describes the compressed stream mode of the TCP connection between the
+ * NetworkOutput and the trace daemon; this header is shared with the
+ * daemon.
+ *
+ * Clients which want to compress their data start the connection with a
+ * compression request which old daemons ignore: an XML processing
+ * instruction (XmlRequest) in front of XML streams and a record of an
+ * unknown type (BinaryRequest) in front of binary streams. A daemon which
+ * supports compression strips the request and replies with the
+ * ReplyMagic bytes, the protocol version and a bit mask of the codecs it
+ * accepts. If the reply announces Lz4Codec, the client continues with the
+ * StreamHeader followed by nothing but frames; if there is no reply in
+ * time, it just sends the plain stream. Since a plain stream never starts
+ * with a zero byte, the daemon can tell the two apart by the first byte
+ * following the request.
+ *
+ * Every frame is a four byte little endian length of the compressed data,
+ * a four byte little endian length of the uncompressed data and the
+ * compressed data itself, in the LZ4 block format. Each frame is
+ * self-contained, i.e. matches never refer to data of an earlier frame.
+ */
+namespace StreamCompression
+{
+    enum Codec {
+        Lz4Codec = 0x01
+    };
+
+    const char XmlRequest[] = "<?tracelib-stream compression=\"lz4\"?>";
+    const unsigned char BinaryRequest[] = {
+        BinaryFormat::RecordMarker, BinaryFormat::CompressionRequestRecord, 1, Lz4Codec
+    };
+
+    const unsigned char ReplyMagic[4] = { 'T', 'R', 'C', 'D' };
+    const size_t ReplyLength = 6;
+    const unsigned char ProtocolVersion = 1;
+
+    const unsigned char StreamHeader[4] = { 0x00, 'L', 'Z', '4' };
+    const size_t StreamHeaderLength = sizeof( StreamHeader );
+
+    const size_t FrameHeaderLength = 8;
+    const unsigned long MaximumFrameLength = 64 * 1024 * 1024;
+
+    /* Returns the request to send in front of a stream whose first byte is
+     * given.
+     */
+    std::vector<char> compressionRequest( char firstByte );
+
+    enum RequestMatch {
+        NoRequest,
+        IncompleteRequest,
+        CompleteRequest
+    };
+    RequestMatch matchCompressionRequest( const char *data, size_t length,
+                                          size_t *requestLength );
+
+    void writeReply( unsigned char *reply, unsigned int codecs );
+    bool replyAcceptsCodec( const unsigned char *reply, Codec codec );
+
+    /* Appends a frame holding the given data to 'frame'. */
+    void appendFrame( std::vector<char> &frame, const char *data, size_t length );
+    void readFrameHeader( const char *header, unsigned long *compressedLength,
+                          unsigned long *length );
+
+    size_t maximumCompressedLength( size_t length );
+    size_t compressBlock( const char *data, size_t length, char *out );
+    bool decompressBlock( const char *data, size_t length, char *out, size_t outLength );
+}
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_STREAMCOMPRESSION_H)
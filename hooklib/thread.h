@@ -0,0 +1,99 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACELIB_THREAD_H
+#define TRACELIB_THREAD_H
+
+#include "tracelib_config.h"
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct ThreadHandle;
+struct AutoResetEventHandle;
+struct ThreadLocalPointerHandle;
+
+class Thread
+{
+    friend struct ThreadHandle;
+
+public:
+    Thread();
+    virtual ~Thread();
+
+    bool start();
+    void wait();
+
+    static void yield();
+    static void sleep( unsigned int milliSeconds );
+
+protected:
+    virtual void run() = 0;
+
+private:
+    Thread( const Thread &other ); // disabled
+    void operator=( const Thread &rhs ); // disabled
+
+    ThreadHandle *m_handle;
+};
+
+/* An event which stays signalled until a single waiting thread
+ * consumed it; signalling it repeatedly without anybody waiting
+ * wakes up just one wait() call.
+ */
+class AutoResetEvent
+{
+public:
+    AutoResetEvent();
+    ~AutoResetEvent();
+
+    void signal();
+    bool wait( unsigned int timeoutMilliSeconds );
+
+private:
+    AutoResetEvent( const AutoResetEvent &other ); // disabled
+    void operator=( const AutoResetEvent &rhs ); // disabled
+
+    AutoResetEventHandle *m_handle;
+};
+
+/* A per-thread pointer; the optional destructor function is called for
+ * all non-null values when the respective thread terminates.
+ */
+class ThreadLocalPointer
+{
+public:
+    typedef void (*Destructor)( void * );
+
+    explicit ThreadLocalPointer( Destructor destructor = 0 );
+    ~ThreadLocalPointer();
+
+    void *get() const;
+    void set( void *value );
+
+private:
+    ThreadLocalPointer( const ThreadLocalPointer &other ); // disabled
+    void operator=( const ThreadLocalPointer &rhs ); // disabled
+
+    ThreadLocalPointerHandle *m_handle;
+};
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_THREAD_H)
+
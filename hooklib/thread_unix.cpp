@@ -0,0 +1,162 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <time.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct ThreadHandle {
+    ThreadHandle() : started( false ) { }
+
+    static void *threadProc( void *arg ) {
+        static_cast<Thread *>( arg )->run();
+        return 0;
+    }
+
+    pthread_t thread;
+    bool started;
+};
+
+Thread::Thread() : m_handle( new ThreadHandle )
+{
+}
+
+Thread::~Thread()
+{
+    delete m_handle;
+}
+
+bool Thread::start()
+{
+    if ( m_handle->started ) {
+        return false;
+    }
+    m_handle->started = pthread_create( &m_handle->thread, NULL, ThreadHandle::threadProc, this ) == 0;
+    return m_handle->started;
+}
+
+void Thread::wait()
+{
+    if ( m_handle->started ) {
+        pthread_join( m_handle->thread, NULL );
+        m_handle->started = false;
+    }
+}
+
+void Thread::yield()
+{
+    sched_yield();
+}
+
+void Thread::sleep( unsigned int milliSeconds )
+{
+    struct timespec ts;
+    ts.tv_sec = milliSeconds / 1000;
+    ts.tv_nsec = ( milliSeconds % 1000 ) * 1000000;
+    while ( nanosleep( &ts, &ts ) == -1 && errno == EINTR ) {
+    }
+}
+
+struct AutoResetEventHandle {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool signalled;
+};
+
+AutoResetEvent::AutoResetEvent() : m_handle( new AutoResetEventHandle )
+{
+    pthread_mutex_init( &m_handle->mutex, NULL );
+    pthread_cond_init( &m_handle->cond, NULL );
+    m_handle->signalled = false;
+}
+
+AutoResetEvent::~AutoResetEvent()
+{
+    pthread_cond_destroy( &m_handle->cond );
+    pthread_mutex_destroy( &m_handle->mutex );
+    delete m_handle;
+}
+
+void AutoResetEvent::signal()
+{
+    pthread_mutex_lock( &m_handle->mutex );
+    m_handle->signalled = true;
+    pthread_cond_signal( &m_handle->cond );
+    pthread_mutex_unlock( &m_handle->mutex );
+}
+
+bool AutoResetEvent::wait( unsigned int timeoutMilliSeconds )
+{
+    timeval now;
+    gettimeofday( &now, 0 );
+
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + timeoutMilliSeconds / 1000;
+    deadline.tv_nsec = now.tv_usec * 1000 + ( timeoutMilliSeconds % 1000 ) * 1000000;
+    if ( deadline.tv_nsec >= 1000000000 ) {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock( &m_handle->mutex );
+    while ( !m_handle->signalled ) {
+        if ( pthread_cond_timedwait( &m_handle->cond, &m_handle->mutex, &deadline ) == ETIMEDOUT ) {
+            break;
+        }
+    }
+    const bool wasSignalled = m_handle->signalled;
+    m_handle->signalled = false;
+    pthread_mutex_unlock( &m_handle->mutex );
+    return wasSignalled;
+}
+
+struct ThreadLocalPointerHandle {
+    pthread_key_t key;
+};
+
+ThreadLocalPointer::ThreadLocalPointer( Destructor destructor )
+    : m_handle( new ThreadLocalPointerHandle )
+{
+    pthread_key_create( &m_handle->key, destructor );
+}
+
+ThreadLocalPointer::~ThreadLocalPointer()
+{
+    pthread_key_delete( m_handle->key );
+    delete m_handle;
+}
+
+void *ThreadLocalPointer::get() const
+{
+    return pthread_getspecific( m_handle->key );
+}
+
+void ThreadLocalPointer::set( void *value )
+{
+    pthread_setspecific( m_handle->key, value );
+}
+
+TRACELIB_NAMESPACE_END
+
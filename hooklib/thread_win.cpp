@@ -0,0 +1,161 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "thread.h"
+
+#include <windows.h>
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct ThreadHandle {
+    ThreadHandle() : thread( 0 ) { }
+
+    static DWORD WINAPI threadProc( LPVOID lpParameter ) {
+        static_cast<Thread *>( lpParameter )->run();
+        return 0;
+    }
+
+    HANDLE thread;
+};
+
+Thread::Thread() : m_handle( new ThreadHandle )
+{
+}
+
+Thread::~Thread()
+{
+    if ( m_handle->thread ) {
+        ::CloseHandle( m_handle->thread );
+    }
+    delete m_handle;
+}
+
+bool Thread::start()
+{
+    if ( m_handle->thread ) {
+        return false;
+    }
+    m_handle->thread = ::CreateThread( NULL, 0, ThreadHandle::threadProc, this, 0, NULL );
+    return m_handle->thread != 0;
+}
+
+void Thread::wait()
+{
+    if ( m_handle->thread ) {
+        ::WaitForSingleObject( m_handle->thread, INFINITE );
+        ::CloseHandle( m_handle->thread );
+        m_handle->thread = 0;
+    }
+}
+
+void Thread::yield()
+{
+    ::SwitchToThread();
+}
+
+void Thread::sleep( unsigned int milliSeconds )
+{
+    ::Sleep( milliSeconds );
+}
+
+struct AutoResetEventHandle {
+    HANDLE event;
+};
+
+AutoResetEvent::AutoResetEvent() : m_handle( new AutoResetEventHandle )
+{
+    m_handle->event = ::CreateEvent( NULL, FALSE, FALSE, NULL );
+}
+
+AutoResetEvent::~AutoResetEvent()
+{
+    ::CloseHandle( m_handle->event );
+    delete m_handle;
+}
+
+void AutoResetEvent::signal()
+{
+    ::SetEvent( m_handle->event );
+}
+
+bool AutoResetEvent::wait( unsigned int timeoutMilliSeconds )
+{
+    return ::WaitForSingleObject( m_handle->event, timeoutMilliSeconds ) == WAIT_OBJECT_0;
+}
+
+/* Fiber local storage is used instead of plain TLS slots since only the
+ * former invokes a callback when a thread terminates. The callback has a
+ * fixed signature, so every value remembers which pointer it belongs to.
+ */
+struct ThreadLocalPointerHandle {
+    struct Value {
+        ThreadLocalPointerHandle *owner;
+        void *data;
+    };
+
+    static VOID WINAPI destroyValue( PVOID p ) {
+        Value *v = static_cast<Value *>( p );
+        if ( v ) {
+            // Like pthread_key_delete(), freeing the slot runs no destructors
+            if ( !v->owner->beingDestroyed && v->owner->destructor && v->data ) {
+                v->owner->destructor( v->data );
+            }
+            delete v;
+        }
+    }
+
+    DWORD index;
+    ThreadLocalPointer::Destructor destructor;
+    bool beingDestroyed;
+};
+
+ThreadLocalPointer::ThreadLocalPointer( Destructor destructor )
+    : m_handle( new ThreadLocalPointerHandle )
+{
+    m_handle->index = ::FlsAlloc( ThreadLocalPointerHandle::destroyValue );
+    m_handle->destructor = destructor;
+    m_handle->beingDestroyed = false;
+}
+
+ThreadLocalPointer::~ThreadLocalPointer()
+{
+    m_handle->beingDestroyed = true;
+    ::FlsFree( m_handle->index );
+    delete m_handle;
+}
+
+void *ThreadLocalPointer::get() const
+{
+    ThreadLocalPointerHandle::Value *v = static_cast<ThreadLocalPointerHandle::Value *>( ::FlsGetValue( m_handle->index ) );
+    return v ? v->data : 0;
+}
+
+void ThreadLocalPointer::set( void *value )
+{
+    ThreadLocalPointerHandle::Value *v = static_cast<ThreadLocalPointerHandle::Value *>( ::FlsGetValue( m_handle->index ) );
+    if ( !v ) {
+        v = new ThreadLocalPointerHandle::Value;
+        v->owner = m_handle;
+        ::FlsSetValue( m_handle->index, v );
+    }
+    v->data = value;
+}
+
+TRACELIB_NAMESPACE_END
+
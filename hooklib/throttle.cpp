@@ -0,0 +1,105 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "throttle.h"
+#include "atomicops.h"
+#include "tracepoint.h"
+
+#include <cerrno>
+#include <cstdlib>
+
+using namespace std;
+
+TRACELIB_NAMESPACE_BEGIN
+
+static bool parseUnsignedLong( const string &value, unsigned long *result )
+{
+    if ( value.empty() || value.find_first_not_of( "0123456789" ) != string::npos ) {
+        return false;
+    }
+
+    errno = 0;
+    const unsigned long v = strtoul( value.c_str(), 0, 10 );
+    if ( errno == ERANGE ) {
+        return false;
+    }
+    *result = v;
+    return true;
+}
+
+bool parseRateAttribute( const string &value, unsigned long *rate )
+{
+    return parseUnsignedLong( value, rate );
+}
+
+bool parseSampleAttribute( const string &value, unsigned long *sampleInterval )
+{
+    unsigned long v;
+    if ( !parseUnsignedLong( value, &v ) || v == 0 ) {
+        return false;
+    }
+    *sampleInterval = v;
+    return true;
+}
+
+/* Sampling picks every n-th hit; the rate limit uses the generic cell rate
+ * algorithm, i.e. a token bucket which holds one second worth of entries
+ * and is represented by the time at which it would be full again.
+ */
+bool acceptThrottledHit( TracePointThrottle *throttle, unsigned long currentTime )
+{
+    const unsigned long sampleInterval = atomicLoad( &throttle->sampleInterval );
+    if ( sampleInterval > 1 && ( atomicAdd( &throttle->hits, 1 ) - 1 ) % sampleInterval != 0 ) {
+        atomicAdd( &throttle->suppressedHits, 1 );
+        return false;
+    }
+
+    const unsigned long rate = atomicLoad( &throttle->rate );
+    if ( rate == 0 ) {
+        return true;
+    }
+
+    const unsigned long emissionInterval = rate < 1000000 ? 1000000 / rate : 1;
+    const unsigned long tolerance = 1000000 - emissionInterval;
+    while ( true ) {
+        const unsigned long arrivalTime = atomicLoad( &throttle->theoreticalArrivalTime );
+
+        /* The clock value wraps around, so only the difference is meaningful;
+         * anything out of range means the trace point wasn't hit for a long
+         * time.
+         */
+        long backlog = static_cast<long>( arrivalTime - currentTime );
+        if ( backlog < 0 || backlog > static_cast<long>( tolerance + emissionInterval ) ) {
+            backlog = 0;
+        }
+
+        if ( backlog > static_cast<long>( tolerance ) ) {
+            atomicAdd( &throttle->suppressedHits, 1 );
+            return false;
+        }
+
+        if ( atomicCompareAndSwap( &throttle->theoreticalArrivalTime, arrivalTime,
+                                   currentTime + backlog + emissionInterval ) ) {
+            return true;
+        }
+    }
+}
+
+TRACELIB_NAMESPACE_END
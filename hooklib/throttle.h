@@ -0,0 +1,47 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef TRACELIB_THROTTLE_H
+#define TRACELIB_THROTTLE_H
+
+#include "tracelib_config.h"
+
+#include <string>
+
+TRACELIB_NAMESPACE_BEGIN
+
+struct TracePointThrottle;
+
+/* Parse the values of the rate= and sample= attributes of <tracepointset>
+ * elements; a rate of 0 means unlimited, a sample interval must be at
+ * least 1. Return false for anything else than a plain decimal number.
+ */
+bool parseRateAttribute( const std::string &value, unsigned long *rate );
+bool parseSampleAttribute( const std::string &value, unsigned long *sampleInterval );
+
+/* Decides whether a hit of a throttled trace point at the given time (in
+ * microseconds, wrapping around) is logged; suppressed hits are counted
+ * in the throttle.
+ */
+bool acceptThrottledHit( TracePointThrottle *throttle, unsigned long currentTime );
+
+TRACELIB_NAMESPACE_END
+
+#endif // !defined(TRACELIB_THROTTLE_H)
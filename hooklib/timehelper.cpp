@@ -18,6 +18,7 @@
  */
 
 #include "timehelper.h"
+#include "atomicops.h"
 
 #include <time.h>
 #include <stdio.h>
@@ -26,8 +27,7 @@
 
 #ifdef _WIN32
 #define snprintf _snprintf
-#  include <sys/types.h> // for _ftime
-#  include <sys/timeb.h> // for struct timeb
+#  include <windows.h>
 #else
 #  include <sys/time.h> // for gettimeofday
 #endif
@@ -46,17 +46,91 @@ std::string timeToString( uint64_t t )
     return std::string( timestamp );
 }
 
-uint64_t now()
-{
 #ifdef _WIN32
-    struct _timeb timebuffer;
-    _ftime( &timebuffer );
-    return timebuffer.time * 1000 + timebuffer.millitm;
+static uint64_t wallClockNanoseconds()
+{
+    // FILETIME counts 100ns intervals since January 1st, 1601
+    static const uint64_t epochOffset = 116444736000000000ULL;
+    FILETIME ft;
+    GetSystemTimeAsFileTime( &ft );
+    const uint64_t t = ( (uint64_t)ft.dwHighDateTime << 32 ) | ft.dwLowDateTime;
+    return ( t - epochOffset ) * 100;
+}
+
+static uint64_t monotonicNanoseconds()
+{
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &counter );
+    const uint64_t f = frequency.QuadPart;
+    const uint64_t c = counter.QuadPart;
+    // avoid overflowing by scaling seconds and remainder separately
+    return ( c / f ) * 1000000000ULL + ( c % f ) * 1000000000ULL / f;
+}
 #else
+static uint64_t wallClockNanoseconds()
+{
+#ifdef CLOCK_REALTIME
+    timespec ts;
+    if ( clock_gettime( CLOCK_REALTIME, &ts ) == 0 ) {
+        return ( (uint64_t)ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+    }
+#endif
     timeval tv;
-    gettimeofday(&tv, 0);
-    return ((uint64_t)tv.tv_sec) * 1000 + ((uint64_t)tv.tv_usec) / 1000;
+    gettimeofday( &tv, 0 );
+    return ( (uint64_t)tv.tv_sec ) * 1000000000 + ( (uint64_t)tv.tv_usec ) * 1000;
+}
+
+static uint64_t monotonicNanoseconds()
+{
+#ifdef CLOCK_MONOTONIC
+    timespec ts;
+    if ( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 ) {
+        return ( (uint64_t)ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+    }
+#endif
+    return wallClockNanoseconds();
+}
 #endif
+
+/* The wall clock time and the monotonic clock reading at the time the
+ * clock was first read. This is set up lazily (instead of using a static
+ * object) since the time may be requested by other static initializers.
+ */
+enum ClockAnchorState { AnchorUnset, AnchorInitializing, AnchorReady };
+
+struct ClockAnchor {
+    uint64_t wallClock;
+    uint64_t monotonic;
+};
+
+static ClockAnchor g_clockAnchor;
+static volatile unsigned long g_clockAnchorState = AnchorUnset;
+
+static const ClockAnchor &clockAnchor()
+{
+    if ( atomicLoad( &g_clockAnchorState ) != AnchorReady ) {
+        if ( atomicCompareAndSwap( &g_clockAnchorState, AnchorUnset, AnchorInitializing ) ) {
+            g_clockAnchor.monotonic = monotonicNanoseconds();
+            g_clockAnchor.wallClock = wallClockNanoseconds();
+            atomicStore( &g_clockAnchorState, AnchorReady );
+        } else {
+            while ( atomicLoad( &g_clockAnchorState ) != AnchorReady ) {
+            }
+        }
+    }
+    return g_clockAnchor;
+}
+
+uint64_t nowNanoseconds()
+{
+    const ClockAnchor &anchor = clockAnchor();
+    return anchor.wallClock + ( monotonicNanoseconds() - anchor.monotonic );
+}
+
+uint64_t now()
+{
+    return nowNanoseconds() / 1000000;
 }
 
 TRACELIB_NAMESPACE_END
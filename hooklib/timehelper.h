@@ -23,7 +23,15 @@
 
 TRACELIB_NAMESPACE_BEGIN
 
+/* Milliseconds since the epoch. */
 uint64_t now();
+
+/* Nanoseconds since the epoch. The value is taken from a monotonic clock
+ * which is anchored to the wall clock once, so consecutive calls never go
+ * backwards even if the system time is adjusted meanwhile.
+ */
+uint64_t nowNanoseconds();
+
 std::string timeToString( uint64_t );
 
 TRACELIB_NAMESPACE_END
@@ -18,54 +18,61 @@
  */
 
 #include "trace.h"
+#include "atomicops.h"
 #include "configuration.h"
 #include "crashhandler.h"
+#include "crashrecorder.h"
+#include "entryqueue.h"
 #include "filter.h"
+#include "flightrecorder.h"
 #include "output.h"
 #include "serializer.h"
+#include "thread.h"
+#include "throttle.h"
 #include "tracepoint.h"
 #include "log.h"
 #include "tracelib.h" // for deleteRange
-#include "timehelper.h" // for now
+#include "timehelper.h" // for now and nowNanoseconds
 
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 
+#ifndef _WIN32
+#  include <signal.h>
+#  include <unistd.h>
+#endif
+
 using namespace std;
 
 TRACELIB_NAMESPACE_BEGIN
 
-static void recordCrashInTrace()
-{
-    string sourceFile = "<unknown file>";
-    size_t lineNumber = 0;
-    string functionName = "<unknown function>";
-
-    BacktraceGenerator backtraceGenerator;
-    Backtrace *bt = new Backtrace( backtraceGenerator.generate( 8 ) );
-    if ( bt->depth() > 0 ) {
-        const StackFrame &f = bt->frame( 0 );
-        sourceFile = f.sourceFile;
-        lineNumber = f.lineNumber;
-        functionName = f.function;
-    }
+static Trace *g_activeTrace = 0;
 
-    static TracePoint tp( TracePointType::Error, sourceFile.c_str(), lineNumber,
-                          functionName.c_str(), 0 );
-    TraceEntry te( &tp, "The application crashed at this point!" );
-    te.backtrace = bt;
-    getActiveTrace()->addEntry( te );
+/* Seconds the crash handler waits for the flight recorder to be dumped by
+ * its background thread, and the time the process may take for writing a
+ * crash entry the unsafe way before it's killed.
+ */
+static const unsigned int CrashRecordingTimeout = 5;
 
+static void recordCrashInTrace( const CrashInfo &info )
+{
+    // Not getActiveTrace(), creating a Trace in a crash handler won't work
+    if ( g_activeTrace ) {
+        g_activeTrace->recordCrash( info );
+    }
 }
 
 const struct CrashHandlerInstaller {
     CrashHandlerInstaller() { installCrashHandler( recordCrashInTrace ); }
 } g_crashHandlerInstaller;
 
-TracePointSet::TracePointSet( Filter *filter, unsigned int actions )
+TracePointSet::TracePointSet( Filter *filter, unsigned int actions,
+                              unsigned long rate, unsigned long sampleInterval )
     : m_filter( filter ),
-    m_actions( actions )
+    m_actions( actions ),
+    m_rate( rate ),
+    m_sampleInterval( sampleInterval )
 {
 }
 
@@ -88,6 +95,27 @@ TracedProcess TraceEntry::process = {
     vector<TraceKey>()
 };
 
+extern string stringRep( const VariableValue &v );
+
+string formatMessage( const vector<VariableValue> &parts )
+{
+    string s;
+    vector<VariableValue>::const_iterator it, end = parts.end();
+    for ( it = parts.begin(); it != end; ++it ) {
+        s += stringRep( *it );
+    }
+    return s;
+}
+
+string formatMessage( const StringBuilder &parts )
+{
+    string s;
+    for ( size_t i = 0; i < parts.size(); ++i ) {
+        s += stringRep( parts[i] );
+    }
+    return s;
+}
+
 ProcessShutdownEvent::ProcessShutdownEvent()
     : process( &TraceEntry::process ),
     shutdownTime( now() )
@@ -96,7 +124,8 @@ ProcessShutdownEvent::ProcessShutdownEvent()
 
 TraceEntry::TraceEntry( const TracePoint *tracePoint_, const char *msg )
     : threadId( getCurrentThreadId() ),
-    timeStamp( now() ),
+    threadGeneration( getCurrentThreadGeneration() ),
+    timeStamp( nowNanoseconds() ),
     tracePoint( tracePoint_ ),
     variables( 0 ),
     backtrace( 0 ),
@@ -105,10 +134,24 @@ TraceEntry::TraceEntry( const TracePoint *tracePoint_, const char *msg )
 {
 }
 
+TraceEntry::TraceEntry( const TracePoint *tracePoint_, const char *msg,
+                        ThreadId threadId_, unsigned long threadGeneration_,
+                        uint64_t timeStamp_, size_t stackPosition_ )
+    : threadId( threadId_ ),
+    threadGeneration( threadGeneration_ ),
+    timeStamp( timeStamp_ ),
+    tracePoint( tracePoint_ ),
+    variables( 0 ),
+    backtrace( 0 ),
+    message( msg ),
+    stackPosition( stackPosition_ )
+{
+}
+
 TraceEntry::~TraceEntry()
 {
-    // variables are deleted on the caller side of the macros so the delete happens with the
-    // same C runtime as the allocation
+    // variables are destroyed on the caller side of the macros, their storage
+    // is owned by the library's per-thread variable arena
     delete backtrace;
 }
 
@@ -127,7 +170,17 @@ static LogOutput* checkForLogFileEnvVar( const char* envVar )
 Trace::Trace()
     : m_serializer( 0 ),
     m_output( 0 ),
-    m_configuration( 0 ),
+    m_sessionStarted( false ),
+    m_sessionId( 0 ),
+    m_tracePointConfiguration( 0 ),
+    m_configurationGeneration( 0 ),
+    m_configurationReaders( 0 ),
+    m_entryQueue( 0 ),
+    m_asyncOutputEnabled( 0 ),
+    m_flightRecorder( 0 ),
+    m_flightRecorderEnabled( 0 ),
+    m_lastSuppressedHitsReportTime( 0 ),
+    m_crashRecorder( 0 ),
     m_configFileMonitor( 0 ),
     m_log( 0 ),
     m_errorOutput( 0 ),
@@ -155,6 +208,11 @@ Trace::Trace()
     }
     m_log = new Log( m_statusOutput, m_errorOutput );
 
+#ifndef _WIN32
+    m_crashRecorder = new CrashRecorder;
+    m_log->writeStatus( "Trace::Trace: crashes are recorded in '%s' unless the output can take them", m_crashRecorder->fallbackFileName().c_str() );
+#endif
+
     const string cfgFileName = Configuration::defaultFileName();
     reloadConfiguration( cfgFileName );
     m_configFileMonitor = FileModificationMonitor::create( cfgFileName, this );
@@ -166,6 +224,10 @@ Trace::~Trace()
 {
     ShutdownNotifier::self().removeObserver( this );
 
+    // Stop the drain thread before it loses its serializer and output
+    delete m_entryQueue;
+    delete m_flightRecorder;
+
     {
         MutexLocker serializerLocker( m_serializerMutex );
         delete m_serializer;
@@ -173,52 +235,77 @@ Trace::~Trace()
 
     {
         MutexLocker outputLocker( m_outputMutex );
+        if ( m_crashRecorder ) {
+            m_crashRecorder->setOutputDescriptor( -1 );
+        }
         delete m_output;
     }
 
+    delete m_crashRecorder;
+    delete m_configFileMonitor;
+
     {
         MutexLocker configurationLocker( m_configurationMutex );
-        deleteRange( m_tracePointSets.begin(), m_tracePointSets.end() );
-        delete m_configuration;
+        deleteRange( m_retiredTracePointConfigurations.begin(), m_retiredTracePointConfigurations.end() );
+        delete m_tracePointConfiguration;
     }
 
-    delete m_configFileMonitor;
     delete m_log;
     delete m_errorOutput;
     delete m_statusOutput;
 }
 
+Trace::TracePointConfiguration::TracePointConfiguration( Configuration *configuration_ )
+    : generation( 0 ),
+    configuration( configuration_ )
+{
+}
+
+Trace::TracePointConfiguration::~TracePointConfiguration()
+{
+    deleteRange( tracePointSets.begin(), tracePointSets.end() );
+    delete configuration;
+}
+
 void Trace::reloadConfiguration( const string &fileName )
 {
     m_log->writeStatus( "Trace::reloadConfiguration: reading configuration file from '%s'", fileName.c_str() );
     Configuration *cfg = Configuration::fromFile( fileName, m_log );
+    TracePointConfiguration *tracePointConfiguration = new TracePointConfiguration( cfg );
     if ( cfg ) {
-        setSerializer( cfg->configuredSerializer() );
-        setOutput( cfg->configuredOutput() );
-        {
-            MutexLocker configurationLocker( m_configurationMutex );
-            deleteRange( m_tracePointSets.begin(), m_tracePointSets.end() );
-            m_tracePointSets = cfg->configuredTracePointSets();
-            delete m_configuration;
-            m_configuration = cfg;
+        /* The storage configuration and the trace keys are written at the
+         * start of each session, so they need to be up to date before the
+         * new serializer is used; installing it starts a new session.
+         */
+        Serializer *serializer = cfg->configuredSerializer();
+        if ( serializer ) {
+            serializer->setStorageConfiguration( cfg->storageConfiguration() );
         }
-
+        const vector<TraceKey> traceKeys = cfg->configuredTraceKeys();
         {
             MutexLocker serializerLocker( m_serializerMutex );
-            if ( m_serializer ) {
-                m_serializer->setStorageConfiguration( cfg->storageConfiguration() );
+            TraceEntry::process.availableTraceKeys = traceKeys;
+            if ( m_crashRecorder ) {
+                BinarySerializer crashSerializer;
+                crashSerializer.setStorageConfiguration( cfg->storageConfiguration() );
+                m_crashRecorder->setSessionHeader( crashSerializer.startSession() );
             }
         }
+        setSerializer( serializer );
+        setOutput( cfg->configuredOutput() );
+        applyAsyncConfiguration( cfg->asyncConfiguration() );
+        applyFlightRecorderConfiguration( cfg->flightRecorderConfiguration() );
+
+        vector<TracePointSet *> &tracePointSets = tracePointConfiguration->tracePointSets;
+        tracePointSets = cfg->configuredTracePointSets();
 
         /* If any trace keys are given in the XML file, they also implicitely
          * filter out all those trace entries which do not have any of the
          * specified keys. A feature requested by Siemens.
          */
-        const vector<TraceKey> traceKeys = cfg->configuredTraceKeys();
-        TraceEntry::process.availableTraceKeys = traceKeys;
         if ( !traceKeys.empty() ) {
-            vector<TracePointSet *>::iterator setIt, setEnd = m_tracePointSets.end();
-            for ( setIt = m_tracePointSets.begin(); setIt != setEnd; ++setIt ) {
+            vector<TracePointSet *>::iterator setIt, setEnd = tracePointSets.end();
+            for ( setIt = tracePointSets.begin(); setIt != setEnd; ++setIt ) {
                 bool haveEnabledTraceKey = false;
                 GroupFilter *groupFilter = new GroupFilter;
                 groupFilter->setMode( GroupFilter::Whitelist );
@@ -239,121 +326,484 @@ void Trace::reloadConfiguration( const string &fileName )
             }
         }
     } else {
+        applyAsyncConfiguration( AsyncConfiguration() );
+        applyFlightRecorderConfiguration( FlightRecorderConfiguration() );
         setSerializer( 0 );
         setOutput( 0 );
         {
-            MutexLocker configurationLocker( m_configurationMutex );
-            deleteRange( m_tracePointSets.begin(), m_tracePointSets.end() );
-            m_tracePointSets.clear();
-            delete m_configuration;
-            m_configuration = 0;
+            MutexLocker serializerLocker( m_serializerMutex );
+            TraceEntry::process.availableTraceKeys.clear();
+            if ( m_crashRecorder ) {
+                m_crashRecorder->setSessionHeader( vector<char>() );
+            }
         }
-        TraceEntry::process.availableTraceKeys.clear();
     }
-    if( m_configuration ) {
+    publishTracePointConfiguration( tracePointConfiguration );
+    if( cfg ) {
         m_log->writeStatus( "Trace::reloadConfiguration: configuration updated with serializer: %s and output: %s",
                             (m_serializer ? "yes" : "no"),
                             (m_output ? "yes" : "no") );
     }
 }
 
-void Trace::configureTracePoint( TracePoint *tracePoint ) const
+/* Retired configurations are kept while trace points are being configured;
+ * if there are always some, this many of them are kept before waiting for
+ * a moment without any.
+ */
+static const size_t MaximumRetiredConfigurations = 8;
+
+/* Counts the threads reading the current trace point configuration; the
+ * increment is a full barrier, so the configuration loaded afterwards is
+ * at least as recent as the one seen by reclaimRetiredConfigurations() if
+ * that didn't see this reader.
+ */
+class ConfigurationReader
+{
+public:
+    explicit ConfigurationReader( volatile unsigned long *readers ) : m_readers( readers ) { atomicAdd( m_readers, 1 ); }
+    ~ConfigurationReader() { atomicAdd( m_readers, static_cast<unsigned long>( -1 ) ); }
+
+private:
+    volatile unsigned long *m_readers;
+};
+
+/* Makes the given configuration the one used for configuring trace points.
+ * The snapshot is published before its generation so that any thread which
+ * sees the new generation is guaranteed to find the new snapshot as well.
+ */
+void Trace::publishTracePointConfiguration( TracePointConfiguration *tracePointConfiguration )
 {
     MutexLocker configurationLocker( m_configurationMutex );
-    tracePoint->lastUsedConfiguration = m_configuration;
+    TracePointConfiguration *previousConfiguration = m_tracePointConfiguration;
+    tracePointConfiguration->generation = m_configurationGeneration + 1;
+    // A full barrier, unlike atomicStore; see ConfigurationReader
+    atomicCompareAndSwap( &m_tracePointConfiguration, previousConfiguration, tracePointConfiguration );
+    atomicStore( &m_configurationGeneration, tracePointConfiguration->generation );
+    if ( previousConfiguration ) {
+        m_retiredTracePointConfigurations.push_back( previousConfiguration );
+    }
+    reclaimRetiredConfigurations();
+}
 
-    if ( m_tracePointSets.empty() ) {
-        tracePoint->active = true;
+// Called with the configuration mutex locked
+void Trace::reclaimRetiredConfigurations()
+{
+    if ( m_retiredTracePointConfigurations.empty() ) {
         return;
     }
+    if ( atomicAdd( &m_configurationReaders, 0 ) != 0 ) {
+        if ( m_retiredTracePointConfigurations.size() <= MaximumRetiredConfigurations ) {
+            return;
+        }
+        while ( atomicAdd( &m_configurationReaders, 0 ) != 0 ) {
+            Thread::yield();
+        }
+    }
+    deleteRange( m_retiredTracePointConfigurations.begin(), m_retiredTracePointConfigurations.end() );
+    m_retiredTracePointConfigurations.clear();
+}
+
+void Trace::applyAsyncConfiguration( const AsyncConfiguration &config )
+{
+    if ( config.enabled ) {
+        /* The queue is never deleted while the process is running since
+         * other threads might be about to enqueue entries; reconfiguring
+         * it is fine though.
+         */
+        if ( m_entryQueue ) {
+            m_entryQueue->configure( config );
+        } else {
+            m_entryQueue = new EntryQueue( this, config );
+        }
+        atomicStore( &m_asyncOutputEnabled, 1 );
+    } else if ( atomicExchange( &m_asyncOutputEnabled, 0 ) ) {
+        m_entryQueue->flush();
+    }
+}
+
+/* Like the entry queue, the flight recorder is never deleted while the
+ * process is running. Entries recorded before it got disabled are kept in
+ * case it's enabled again.
+ */
+void Trace::applyFlightRecorderConfiguration( const FlightRecorderConfiguration &config )
+{
+    if ( config.enabled ) {
+        if ( m_flightRecorder ) {
+            m_flightRecorder->configure( config );
+        } else {
+            m_flightRecorder = new FlightRecorder( this, config );
+        }
+        atomicStore( &m_flightRecorderEnabled, 1 );
+    } else {
+        atomicStore( &m_flightRecorderEnabled, 0 );
+        if ( m_flightRecorder ) {
+            m_flightRecorder->configure( config );
+        }
+    }
+}
+
+void Trace::dumpFlightRecorder()
+{
+    if ( atomicLoad( &m_flightRecorderEnabled ) ) {
+        m_flightRecorder->dump();
+    }
+}
+
+void Trace::recordCrash( const CrashInfo &info )
+{
+#ifndef _WIN32
+    /* The crashed thread may hold any lock (e.g. the one of its flight
+     * recording or of the output), so it neither dumps the flight recorder
+     * itself nor writes an entry, unless there is no crash record at all.
+     */
+    const CrashRecorder::Destination destination = m_crashRecorder->write( info );
+    if ( atomicLoad( &m_flightRecorderEnabled ) ) {
+        m_flightRecorder->dumpInBackground( CrashRecordingTimeout * 1000 );
+    }
+    if ( destination != CrashRecorder::NotWritten ) {
+        return;
+    }
+
+    // Whatever follows may well deadlock; make sure the process terminates
+    signal( SIGALRM, SIG_DFL );
+    alarm( CrashRecordingTimeout );
+#else
+    (void)info;
+    dumpFlightRecorder();
+#endif
+
+    // Without a crash record, an entry is better than nothing
+    string sourceFile = "<unknown file>";
+    size_t lineNumber = 0;
+    string functionName = "<unknown function>";
+
+    BacktraceGenerator backtraceGenerator;
+    Backtrace *bt = new Backtrace( backtraceGenerator.generate( 8 ) );
+    if ( bt->depth() > 0 ) {
+        const StackFrame &f = bt->frame( 0 );
+        sourceFile = f.sourceFile;
+        lineNumber = f.lineNumber;
+        functionName = f.function;
+    }
+
+    static TracePoint tp( TracePointType::Error, sourceFile.c_str(), lineNumber,
+                          functionName.c_str(), 0 );
+    TraceEntry te( &tp, "The application crashed at this point!" );
+    te.backtrace = bt;
+    addEntry( te );
+}
+
+void Trace::configureTracePoint( TracePoint *tracePoint ) const
+{
+    ConfigurationReader reader( &m_configurationReaders );
+    const TracePointConfiguration *tracePointConfiguration = atomicLoad( &m_tracePointConfiguration );
+    const unsigned long generationBits = tracePointConfiguration->generation << TracePoint::GenerationShift;
+    const vector<TracePointSet *> &tracePointSets = tracePointConfiguration->tracePointSets;
 
-    tracePoint->active = false;
+    if ( tracePointSets.empty() ) {
+        atomicStore( &tracePoint->state, generationBits | TracePoint::Active );
+        return;
+    }
 
-    vector<TracePointSet *>::const_iterator it, end = m_tracePointSets.end();
-    for ( it = m_tracePointSets.begin(); it != end; ++it ) {
+    vector<TracePointSet *>::const_iterator it, end = tracePointSets.end();
+    for ( it = tracePointSets.begin(); it != end; ++it ) {
         const unsigned int action = ( *it )->actionForTracePoint( tracePoint );
         if ( action == TracePointSet::IgnoreTracePoint ) {
             continue;
         }
 
-        tracePoint->active = true;
-        tracePoint->backtracesEnabled = ( action & TracePointSet::YieldBacktrace ) == TracePointSet::YieldBacktrace;
-        tracePoint->variableSnapshotEnabled = ( action & TracePointSet::YieldVariables ) == TracePointSet::YieldVariables;
+        const bool backtracesEnabled = ( action & TracePointSet::YieldBacktrace ) == TracePointSet::YieldBacktrace;
+        const bool variableSnapshotEnabled = ( action & TracePointSet::YieldVariables ) == TracePointSet::YieldVariables;
+        unsigned long state = generationBits | TracePoint::Active;
+        if ( backtracesEnabled ) {
+            state |= TracePoint::BacktracesEnabled;
+        }
+        if ( variableSnapshotEnabled ) {
+            state |= TracePoint::VariableSnapshotEnabled;
+        }
+        if ( ( *it )->rate() > 0 || ( *it )->sampleInterval() > 1 ) {
+            atomicStore( &tracePoint->throttle.rate, ( *it )->rate() );
+            atomicStore( &tracePoint->throttle.sampleInterval, ( *it )->sampleInterval() );
+            state |= TracePoint::Throttled;
+            if ( atomicCompareAndSwap( &tracePoint->throttle.registered, 0, 1 ) ) {
+                MutexLocker throttledTracePointsLocker( m_throttledTracePointsMutex );
+                m_throttledTracePoints.push_back( tracePoint );
+            }
+        }
+        atomicStore( &tracePoint->state, state );
 
-        m_log->writeStatus( "Trace::configureTracePoint: activating trace point at %s:%d (backtraces=%d, variables=%d)", tracePoint->sourceFile, tracePoint->lineno, tracePoint->backtracesEnabled, tracePoint->variableSnapshotEnabled );
+        m_log->writeStatus( "Trace::configureTracePoint: activating trace point at %s:%d (backtraces=%d, variables=%d)", tracePoint->sourceFile, tracePoint->lineno, backtracesEnabled, variableSnapshotEnabled );
 
         return;
     }
 
+    atomicStore( &tracePoint->state, generationBits );
+
     m_log->writeStatus( "Trace::configureTracePoint: trace point at %s:%d is not active", tracePoint->sourceFile, tracePoint->lineno );
 }
 
 // configures the trace point if necessary and tells us if it's
-// supposed to be visited.
-bool Trace::advanceVisit( TracePoint *tracePoint ) const
+// supposed to be visited. Unless the configuration changed since the
+// trace point was last visited, this does not take any locks.
+bool Trace::advanceVisit( TracePoint *tracePoint )
 {
-    if ( tracePoint->lastUsedConfiguration != m_configuration ) {
+    unsigned long state = atomicLoad( &tracePoint->state );
+    if ( ( state >> TracePoint::GenerationShift ) != atomicLoad( &m_configurationGeneration ) ) {
         configureTracePoint( tracePoint );
+        state = atomicLoad( &tracePoint->state );
+    }
+
+    if ( !( state & TracePoint::Active ) || !m_serializer || !m_output ) {
+        return false;
     }
 
-    return tracePoint->active && m_serializer && m_output;
+    if ( state & TracePoint::Throttled ) {
+        if ( !acceptThrottledHit( &tracePoint->throttle, static_cast<unsigned long>( nowNanoseconds() / 1000 ) ) ) {
+            return false;
+        }
+        reportSuppressedHits( tracePoint );
+    }
+    return true;
 }
 
-void Trace::visitTracePoint( const TracePoint *tracePoint,
-                             const char *msg,
-                             VariableSnapshot *variables )
+/* Writes an entry saying how many hits of the given trace point were not
+ * logged due to throttling; this happens at most once per second and trace
+ * point, right before the next entry which does get logged.
+ */
+void Trace::reportSuppressedHits( TracePoint *tracePoint )
+{
+    const unsigned long suppressedHits = takeSuppressedHits( tracePoint, false );
+    if ( suppressedHits == 0 || !canRecordEntry() ) {
+        return;
+    }
+    submitSuppressedHitsEntry( tracePoint, suppressedHits, true );
+}
+
+/* Trace points which are not hit anymore would never report their
+ * suppressed hits otherwise, so this is called regularly by the drain
+ * thread; it goes through all throttled trace points at most once per
+ * second.
+ */
+void Trace::reportSuppressedHits()
 {
+    const unsigned long currentTime = static_cast<unsigned long>( now() / 1000 );
+    const unsigned long lastReportTime = atomicLoad( &m_lastSuppressedHitsReportTime );
+    if ( currentTime == lastReportTime ||
+         !atomicCompareAndSwap( &m_lastSuppressedHitsReportTime, lastReportTime, currentTime ) ) {
+        return;
+    }
+    reportSuppressedHitsOfAllTracePoints( false );
+}
+
+/* The entries are never queued (the drain thread would end up waiting for
+ * itself if its buffer was full), they go to the flight recorder or are
+ * written right away.
+ */
+void Trace::reportSuppressedHitsOfAllTracePoints( bool ignoreSummaryInterval )
+{
+    vector<TracePoint *> tracePoints;
     {
-        MutexLocker outputLocker( m_outputMutex );
-        if ( !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
-            return;
+        MutexLocker throttledTracePointsLocker( m_throttledTracePointsMutex );
+        tracePoints = m_throttledTracePoints;
+    }
+
+    vector<TracePoint *>::const_iterator it, end = tracePoints.end();
+    for ( it = tracePoints.begin(); it != end; ++it ) {
+        const unsigned long suppressedHits = takeSuppressedHits( *it, ignoreSummaryInterval );
+        if ( suppressedHits > 0 ) {
+            submitSuppressedHitsEntry( *it, suppressedHits, false );
         }
     }
+}
+
+// Resets the number of suppressed hits if a summary is due and returns it
+unsigned long Trace::takeSuppressedHits( TracePoint *tracePoint, bool ignoreSummaryInterval )
+{
+    if ( atomicLoad( &tracePoint->throttle.suppressedHits ) == 0 ) {
+        return 0;
+    }
+
+    const unsigned long currentTime = static_cast<unsigned long>( now() / 1000 );
+    const unsigned long lastSummaryTime = atomicLoad( &tracePoint->throttle.lastSummaryTime );
+    if ( !ignoreSummaryInterval &&
+         ( currentTime == lastSummaryTime ||
+           !atomicCompareAndSwap( &tracePoint->throttle.lastSummaryTime, lastSummaryTime, currentTime ) ) ) {
+        return 0;
+    }
+
+    return atomicExchange( &tracePoint->throttle.suppressedHits, 0 );
+}
+
+void Trace::submitSuppressedHitsEntry( TracePoint *tracePoint, unsigned long suppressedHits, bool mayQueue )
+{
+    StringBuilder messageParts;
+    messageParts << "Suppressed " << static_cast<vulonglong>( suppressedHits )
+                 << " hits of this trace point due to its rate= or sample= setting";
+
+    TraceEntry entry( tracePoint );
+    submitEntry( entry, &messageParts, mayQueue );
+}
 
+void Trace::visitTracePoint( const TracePoint *tracePoint,
+                             const char *msg,
+                             VariableSnapshot *variables,
+                             const void *callerAddress )
+{
+    recordEntry( tracePoint, msg, 0, variables, callerAddress );
+}
+
+void Trace::visitTracePoint( const TracePoint *tracePoint,
+                             StringBuilder &messageParts,
+                             VariableSnapshot *variables,
+                             const void *callerAddress )
+{
+    recordEntry( tracePoint, 0, &messageParts, variables, callerAddress );
+}
+
+/* Records an entry for the given trace point; the message is either given
+ * as text or as a list of parts which are formatted as late as possible,
+ * i.e. by the drain thread in case asynchronous output is enabled. The
+ * parts are moved into the queued entry rather than copied.
+ */
+void Trace::recordEntry( const TracePoint *tracePoint,
+                         const char *msg,
+                         StringBuilder *messageParts,
+                         VariableSnapshot *variables,
+                         const void *callerAddress )
+{
+    if ( !canRecordEntry() ) {
+        return;
+    }
+
+    const unsigned long state = atomicLoad( &tracePoint->state );
     TraceEntry entry( tracePoint, msg );
-    if ( tracePoint->backtracesEnabled ) {
-        entry.backtrace = new Backtrace( m_backtraceGenerator.generate( 1 /* omit this function in backtrace */ ) );
+    if ( state & TracePoint::BacktracesEnabled ) {
+        entry.backtrace = new Backtrace( m_backtraceGenerator.generateFromCaller( callerAddress ) );
     }
 
-    if ( tracePoint->variableSnapshotEnabled ) {
+    if ( state & TracePoint::VariableSnapshotEnabled ) {
         entry.variables = variables;
     }
 
-    addEntry( entry );
+    submitEntry( entry, messageParts );
 }
 
-void Trace::addEntry( const TraceEntry &entry )
+/* In asynchronous mode the output is only ever checked by the drain
+ * thread; we don't want to hold up the traced thread with it.
+ */
+bool Trace::canRecordEntry()
 {
-    vector<char> data;
-    {
-        MutexLocker serializerLocker( m_serializerMutex );
-        if ( !m_serializer ) {
+    if ( atomicLoad( &m_asyncOutputEnabled ) || atomicLoad( &m_flightRecorderEnabled ) ) {
+        return true;
+    }
+
+    MutexLocker outputLocker( m_outputMutex );
+    return m_output && ( m_output->canWrite() || m_output->open() );
+}
+
+// Hands the entry to the asynchronous queue or writes it right away
+void Trace::submitEntry( TraceEntry &entry, StringBuilder *messageParts, bool mayQueue )
+{
+    // Errors are written along with what led up to them
+    if ( atomicLoad( &m_flightRecorderEnabled ) ) {
+        if ( entry.tracePoint->type != TracePointType::Error ) {
+            m_flightRecorder->record( entry, messageParts );
             return;
         }
-        data = m_serializer->serialize( entry );
+        m_flightRecorder->dump();
+    }
+
+    if ( mayQueue && atomicLoad( &m_asyncOutputEnabled ) && m_entryQueue->enqueue( entry, messageParts ) ) {
+        return;
     }
 
+    string formattedMessage;
+    if ( messageParts ) {
+        formattedMessage = formatMessage( *messageParts );
+        entry.message = formattedMessage.c_str();
+    }
+
+    addEntry( entry );
+}
+
+void Trace::addEntry( const TraceEntry &entry )
+{
+    /* Serializing and writing happens with both mutexes locked since the
+     * serialized data may refer to data written before in the same session
+     * (e.g. trace point definitions), so the order must be preserved.
+     */
+    MutexLocker serializerLocker( m_serializerMutex );
+    MutexLocker outputLocker( m_outputMutex );
+    if ( !prepareWrite() ) {
+        return;
+    }
+
+    const vector<char> data = m_serializer->serialize( entry );
     if ( !data.empty() ) {
-        MutexLocker outputLocker( m_outputMutex );
-        if ( !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
-            return;
+        writeToOutput( data );
+    }
+}
+
+/* Checks whether there is anything to write to and starts a new session
+ * in case the output lost what was written so far (or it's a new output
+ * or serializer). Must be called with both the serializer and the output
+ * mutex locked.
+ */
+bool Trace::prepareWrite()
+{
+    if ( !m_serializer || !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
+        return false;
+    }
+
+    const unsigned long sessionId = m_output->sessionId();
+    if ( !m_sessionStarted || sessionId != m_sessionId ) {
+        m_sessionStarted = true;
+        m_sessionId = sessionId;
+        const vector<char> header = m_serializer->startSession();
+        if ( !header.empty() ) {
+            writeToOutput( header );
+        }
+        if ( m_crashRecorder ) {
+            m_crashRecorder->setOutputDescriptor( m_serializer->isBinary() ? m_output->crashDescriptor() : -1 );
         }
-        m_output->write( data );
+    }
+    return true;
+}
+
+/* Writes to the output, keeping the crash recorder from appending to it at
+ * the same time. Must be called with the output mutex locked.
+ */
+void Trace::writeToOutput( const vector<char> &data )
+{
+    if ( m_crashRecorder ) {
+        m_crashRecorder->beginOutputWrite();
+    }
+    m_output->write( data );
+    if ( m_crashRecorder ) {
+        m_crashRecorder->endOutputWrite();
     }
 }
 
 void Trace::setSerializer( Serializer *serializer )
 {
     MutexLocker serializerLocker( m_serializerMutex );
+    if ( m_crashRecorder ) {
+        m_crashRecorder->setOutputDescriptor( -1 );
+    }
     delete m_serializer;
     m_serializer = serializer;
+    m_sessionStarted = false;
 }
 
 void Trace::setOutput( Output *output )
 {
     MutexLocker outputLocker( m_outputMutex );
+    if ( m_crashRecorder ) {
+        m_crashRecorder->setOutputDescriptor( -1 );
+    }
     delete m_output;
     m_output = output;
+    m_sessionStarted = false;
 }
 
 void Trace::handleFileModification( const std::string &fileName, NotificationReason reason )
@@ -365,35 +815,48 @@ void Trace::handleProcessShutdown()
 {
     m_log->writeStatus( "Trace::handleProcessShutdown: detected process shutdown" );
 
+    /* Write out all queued entries before the shutdown event; anything
+     * traced from now on is written synchronously.
+     */
+    if ( m_entryQueue ) {
+        atomicStore( &m_asyncOutputEnabled, 0 );
+        m_entryQueue->stop();
+        if ( m_entryQueue->droppedEntries() > 0 ) {
+            m_log->writeStatus( "Trace::handleProcessShutdown: dropped %lu trace entries since the asynchronous buffers were full", m_entryQueue->droppedEntries() );
+        }
+    }
+
+    reportSuppressedHitsOfAllTracePoints( true );
+
+    if ( m_backtraceGenerator.symbolCacheMisses() > 0 ) {
+        m_log->writeStatus( "Trace::handleProcessShutdown: symbolized backtrace frames: %lu cache hits, %lu cache misses", m_backtraceGenerator.symbolCacheHits(), m_backtraceGenerator.symbolCacheMisses() );
+    }
+
     ProcessShutdownEvent ev;
 
-    vector<char> data;
-    {
-        MutexLocker serializerLocker( m_serializerMutex );
-        if ( !m_serializer ) {
-            return;
-        }
-        data = m_serializer->serialize( ev );
+    MutexLocker serializerLocker( m_serializerMutex );
+    MutexLocker outputLocker( m_outputMutex );
+    if ( !prepareWrite() ) {
+        return;
     }
 
+    const vector<char> data = m_serializer->serialize( ev );
     if ( !data.empty() ) {
-        MutexLocker outputLocker( m_outputMutex );
-        if ( !m_output || ( !m_output->canWrite() && !m_output->open() ) ) {
-            return;
-        }
-        m_output->write( data );
+        writeToOutput( data );
+        m_output->flush();
 
         /* Delete the output object to make sure it flushes any data which
          * it might have buffered. We most likely don't need the object anymore
          * anyway - after all, the process is shutting down.
          */
+        if ( m_crashRecorder ) {
+            m_crashRecorder->setOutputDescriptor( -1 );
+        }
         delete m_output;
         m_output = 0;
     }
 }
 
-static Trace *g_activeTrace = 0;
-
 Trace *getActiveTrace()
 {
     if ( !g_activeTrace ) {
@@ -34,9 +34,14 @@
 
 TRACELIB_NAMESPACE_BEGIN
 
+class CrashRecorder;
+struct CrashInfo;
+class EntryQueue;
 class Filter;
+class FlightRecorder;
 class Output;
 class Serializer;
+class StringBuilder;
 struct TracePoint;
 class Log;
 class LogOutput;
@@ -49,7 +54,8 @@ public:
     static const unsigned int YieldBacktrace = LogTracePoint | 0x0100;
     static const unsigned int YieldVariables = LogTracePoint | 0x0200;
 
-    TracePointSet( Filter *filter, unsigned int actions );
+    TracePointSet( Filter *filter, unsigned int actions,
+                   unsigned long rate = 0, unsigned long sampleInterval = 0 );
     ~TracePointSet();
 
     Filter *filter() { return m_filter; }
@@ -57,12 +63,20 @@ public:
 
     unsigned int actionForTracePoint( const TracePoint *tracePoint );
 
+    // Maximum number of entries per second and trace point; 0 = unlimited
+    unsigned long rate() const { return m_rate; }
+
+    // Only every n-th hit of a trace point is logged; 0 or 1 = all hits
+    unsigned long sampleInterval() const { return m_sampleInterval; }
+
 private:
     TracePointSet( const TracePointSet &other );
     void operator=( const TracePointSet &rhs );
 
     Filter *m_filter;
     const unsigned int m_actions;
+    const unsigned long m_rate;
+    const unsigned long m_sampleInterval;
 };
 
 struct TracedProcess
@@ -76,18 +90,26 @@ struct TracedProcess
 struct TraceEntry
 {
     TraceEntry( const TracePoint *tracePoint_, const char *msg = 0 );
+    TraceEntry( const TracePoint *tracePoint_, const char *msg,
+                ThreadId threadId_, unsigned long threadGeneration_,
+                uint64_t timeStamp_, size_t stackPosition_ );
     ~TraceEntry();
 
     static TracedProcess process;
     const ThreadId threadId;
-    const uint64_t timeStamp;
+    const unsigned long threadGeneration; // see getCurrentThreadGeneration()
+    const uint64_t timeStamp; // nanoseconds since the epoch
     const TracePoint *tracePoint;
     VariableSnapshot *variables;
     Backtrace *backtrace;
-    const char * const message;
+    const char *message;
     const size_t stackPosition;
 };
 
+// Concatenates the textual representations of the given message parts.
+std::string formatMessage( const std::vector<VariableValue> &parts );
+std::string formatMessage( const StringBuilder &parts );
+
 struct ProcessShutdownEvent
 {
     ProcessShutdownEvent();
@@ -104,13 +126,31 @@ public:
     ~Trace();
 
     void configureTracePoint( TracePoint *tracePoint ) const;
-    bool advanceVisit( TracePoint *tracePoint ) const;
+    bool advanceVisit( TracePoint *tracePoint );
+    /* The caller address is the return address of the library function
+     * called by the traced code; backtraces start at the frame containing it.
+     */
     void visitTracePoint( const TracePoint *tracePoint,
                           const char *msg = 0,
-                          VariableSnapshot *variables = 0 );
+                          VariableSnapshot *variables = 0,
+                          const void *callerAddress = 0 );
+    void visitTracePoint( const TracePoint *tracePoint,
+                          StringBuilder &messageParts,
+                          VariableSnapshot *variables = 0,
+                          const void *callerAddress = 0 );
 
     void addEntry( const TraceEntry &e );
 
+    // Writes the entries kept by the flight recorder, if it's enabled.
+    void dumpFlightRecorder();
+
+    /* Called by the crash handler. On Unix systems, a crash record is
+     * written without allocating or locking (see CrashRecorder) and the
+     * flight recorder is dumped by its own thread; only if the crash record
+     * can't be written, an entry is written on a best effort basis.
+     */
+    void recordCrash( const CrashInfo &info );
+
     void setSerializer( Serializer *serializer );
     void setOutput( Output *output );
 
@@ -118,20 +158,70 @@ public:
 
     virtual void handleProcessShutdown();
 
+    /* Writes the due summaries of suppressed hits of all throttled trace
+     * points, including those which are not hit anymore.
+     */
+    void reportSuppressedHits();
+
 private:
     Trace( const Trace &trace );
     void operator=( const Trace &trace );
 
+    /* An immutable snapshot of everything needed to configure trace points.
+     * A new one is published on every configuration reload; the ones it
+     * replaces are deleted once no thread is configuring a trace point
+     * anymore, since those threads might still be reading them.
+     */
+    struct TracePointConfiguration {
+        explicit TracePointConfiguration( Configuration *configuration_ );
+        ~TracePointConfiguration();
+
+        unsigned long generation;
+        Configuration * const configuration;
+        std::vector<TracePointSet *> tracePointSets;
+    };
+
     void reloadConfiguration( const std::string &fileName );
+    void publishTracePointConfiguration( TracePointConfiguration *tracePointConfiguration );
+    void reclaimRetiredConfigurations();
+    void applyAsyncConfiguration( const AsyncConfiguration &config );
+    void applyFlightRecorderConfiguration( const FlightRecorderConfiguration &config );
+    bool prepareWrite();
+    void writeToOutput( const std::vector<char> &data );
+    void recordEntry( const TracePoint *tracePoint,
+                      const char *msg,
+                      StringBuilder *messageParts,
+                      VariableSnapshot *variables,
+                      const void *callerAddress );
+    bool canRecordEntry();
+    void submitEntry( TraceEntry &entry, StringBuilder *messageParts, bool mayQueue = true );
+    void reportSuppressedHits( TracePoint *tracePoint );
+    void reportSuppressedHitsOfAllTracePoints( bool ignoreSummaryInterval );
+    unsigned long takeSuppressedHits( TracePoint *tracePoint, bool ignoreSummaryInterval );
+    void submitSuppressedHitsEntry( TracePoint *tracePoint, unsigned long suppressedHits, bool mayQueue );
 
     Serializer *m_serializer;
     Mutex m_serializerMutex;
     Output *m_output;
     Mutex m_outputMutex;
-    std::vector<TracePointSet *> m_tracePointSets;
-    Configuration *m_configuration;
-    mutable Mutex m_configurationMutex;
+    bool m_sessionStarted;
+    unsigned long m_sessionId;
+    TracePointConfiguration * volatile m_tracePointConfiguration;
+    volatile unsigned long m_configurationGeneration;
+    std::vector<TracePointConfiguration *> m_retiredTracePointConfigurations;
+    // The number of threads in configureTracePoint
+    mutable volatile unsigned long m_configurationReaders;
+    Mutex m_configurationMutex;
     BacktraceGenerator m_backtraceGenerator;
+    EntryQueue *m_entryQueue;
+    volatile unsigned long m_asyncOutputEnabled;
+    FlightRecorder *m_flightRecorder;
+    volatile unsigned long m_flightRecorderEnabled;
+    // Trace points which were throttled at some point, see reportSuppressedHits()
+    mutable std::vector<TracePoint *> m_throttledTracePoints;
+    mutable Mutex m_throttledTracePointsMutex;
+    volatile unsigned long m_lastSuppressedHitsReportTime;
+    CrashRecorder *m_crashRecorder;
     FileModificationMonitor *m_configFileMonitor;
     Log *m_log;
     LogOutput *m_errorOutput;
@@ -12,7 +12,14 @@ void visitTracePoint( const TracePoint *tracePoint,
                       const char *msg,
                       VariableSnapshot *variables )
 {
-    getActiveTrace()->visitTracePoint( tracePoint, msg, variables );
+    getActiveTrace()->visitTracePoint( tracePoint, msg, variables, TRACELIB_RETURN_ADDRESS() );
+}
+
+void visitTracePoint( const TracePoint *tracePoint,
+                      StringBuilder &msg,
+                      VariableSnapshot *variables )
+{
+    getActiveTrace()->visitTracePoint( tracePoint, msg, variables, TRACELIB_RETURN_ADDRESS() );
 }
 
 TRACELIB_NAMESPACE_END
@@ -70,12 +70,11 @@
 { \
     static TRACELIB_NAMESPACE_IDENT(TracePoint) tracePoint(TRACELIB_NAMESPACE_IDENT(TracePointType)::Watch, TRACELIB_CURRENT_FILE_NAME, TRACELIB_CURRENT_LINE_NUMBER, TRACELIB_CURRENT_FUNCTION_NAME, key); \
     if ( TRACELIB_NAMESPACE_IDENT(advanceVisit)( &tracePoint ) ) { \
-        TRACELIB_NAMESPACE_IDENT(VariableSnapshot) *variableSnapshot = new TRACELIB_NAMESPACE_IDENT(VariableSnapshot); \
-        (*variableSnapshot) << vars; \
+        TRACELIB_NAMESPACE_IDENT(VariableSnapshot) variableSnapshot; \
+        variableSnapshot << vars; \
         msg \
-        TRACELIB_NAMESPACE_IDENT(visitTracePoint)( &tracePoint, msgBuilder, variableSnapshot ); \
-        for ( size_t i = 0; i < variableSnapshot->size(); ++i ) delete (*variableSnapshot)[i]; \
-        delete variableSnapshot; \
+        TRACELIB_NAMESPACE_IDENT(visitTracePoint)( &tracePoint, msgBuilder, &variableSnapshot ); \
+        for ( size_t i = 0; i < variableSnapshot.size(); ++i ) TRACELIB_NAMESPACE_IDENT(destroyVariable)( variableSnapshot[i] ); \
     } \
 }
 #  define TRACELIB_VISIT_TRACEPOINT(type, key, msg) \
@@ -90,46 +89,86 @@
     static TRACELIB_NAMESPACE_IDENT(TracePoint) TRACELIB_TOKEN_GLUE(tracePoint, TRACELIB_CURRENT_LINE_NUMBER)( (type), TRACELIB_CURRENT_FILE_NAME, TRACELIB_CURRENT_LINE_NUMBER, TRACELIB_CURRENT_FUNCTION_NAME, (key) ); TRACELIB_NAMESPACE_IDENT(VisitorType) TRACELIB_TOKEN_GLUE(tracePointVisitor, TRACELIB_CURRENT_LINE_NUMBER)( &TRACELIB_TOKEN_GLUE(tracePoint, TRACELIB_CURRENT_LINE_NUMBER) ); if ( TRACELIB_NAMESPACE_IDENT(advanceVisit)( &TRACELIB_TOKEN_GLUE(tracePoint, TRACELIB_CURRENT_LINE_NUMBER) ) ) (TRACELIB_TOKEN_GLUE(tracePointVisitor, TRACELIB_CURRENT_LINE_NUMBER))
 #  define TRACELIB_VAR_IMPL(v) TRACELIB_NAMESPACE_IDENT(makeConverter)(#v, v)
 #else
-#  define TRACELIB_VISIT_TRACEPOINT_VARS(key, vars, msg) (void)0;
-#  define TRACELIB_VISIT_TRACEPOINT_VARS(key, vars) (void)0;
-#  define TRACELIB_VISIT_TRACEPOINT(type, key) (void)0;
-#  define TRACELIB_VISIT_TRACEPOINT(type, key, msg) (void)0;
-#  define TRACELIB_VISIT_TRACEPOINT_STREAM(VisitorType, type, key) if (false) (TRACELIB_NAMESPACE_IDENT(VisitorType)( NULL ))
+#  define TRACELIB_VISIT_TRACEPOINT_VARS(key, vars, msg) TRACELIB_SKIP_TRACEPOINT
+#  define TRACELIB_VISIT_TRACEPOINT(type, key, msg) TRACELIB_SKIP_TRACEPOINT
+#  define TRACELIB_VISIT_TRACEPOINT_STREAM(VisitorType, type, key) TRACELIB_SKIP_TRACEPOINT_STREAM(VisitorType)
 #  define TRACELIB_VAR_IMPL(v) NULL
+#  undef TRACELIB_MIN_TRACEPOINT_TYPE
+#  define TRACELIB_MIN_TRACEPOINT_TYPE (TRACELIB_LEVEL_ERROR + 1)
+#endif
+
+/* What trace points which are stripped at compile time expand to; the
+ * stream variant must still accept the << operators following it, so it
+ * yields a visitor reference in a branch which is never taken (no visitor
+ * or trace point object is ever created).
+ */
+#define TRACELIB_SKIP_TRACEPOINT (void)0;
+#define TRACELIB_SKIP_TRACEPOINT_STREAM(VisitorType) if (false) *static_cast<TRACELIB_NAMESPACE_IDENT(VisitorType) *>( 0 )
+
+#if TRACELIB_MIN_TRACEPOINT_TYPE > TRACELIB_LEVEL_DEBUG
+#  define TRACELIB_VISIT_DEBUG_TRACEPOINT(key, msg) TRACELIB_SKIP_TRACEPOINT
+#  define TRACELIB_VISIT_DEBUG_TRACEPOINT_STREAM(key) TRACELIB_SKIP_TRACEPOINT_STREAM(TracePointVisitor)
+#else
+#  define TRACELIB_VISIT_DEBUG_TRACEPOINT(key, msg) TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, key, msg)
+#  define TRACELIB_VISIT_DEBUG_TRACEPOINT_STREAM(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, key)
+#endif
+
+#if TRACELIB_MIN_TRACEPOINT_TYPE > TRACELIB_LEVEL_WATCH
+#  define TRACELIB_VISIT_WATCH_TRACEPOINT(key, vars, msg) TRACELIB_SKIP_TRACEPOINT
+#  define TRACELIB_VISIT_WATCH_TRACEPOINT_STREAM(key) TRACELIB_SKIP_TRACEPOINT_STREAM(TracePointVisitor)
+#else
+#  define TRACELIB_VISIT_WATCH_TRACEPOINT(key, vars, msg) TRACELIB_VISIT_TRACEPOINT_VARS(key, vars, msg)
+#  define TRACELIB_VISIT_WATCH_TRACEPOINT_STREAM(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Watch, key)
+#endif
+
+#if TRACELIB_MIN_TRACEPOINT_TYPE > TRACELIB_LEVEL_LOG
+#  define TRACELIB_VISIT_LOG_TRACEPOINT(key, msg) TRACELIB_SKIP_TRACEPOINT
+#  define TRACELIB_VISIT_LOG_TRACEPOINT_STREAM(key) TRACELIB_SKIP_TRACEPOINT_STREAM(TracePointVisitor)
+#else
+#  define TRACELIB_VISIT_LOG_TRACEPOINT(key, msg) TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, key, msg)
+#  define TRACELIB_VISIT_LOG_TRACEPOINT_STREAM(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, key)
+#endif
+
+#if TRACELIB_MIN_TRACEPOINT_TYPE > TRACELIB_LEVEL_ERROR
+#  define TRACELIB_VISIT_ERROR_TRACEPOINT(key, msg) TRACELIB_SKIP_TRACEPOINT
+#  define TRACELIB_VISIT_ERROR_TRACEPOINT_STREAM(key) TRACELIB_SKIP_TRACEPOINT_STREAM(TracePointVisitor)
+#else
+#  define TRACELIB_VISIT_ERROR_TRACEPOINT(key, msg) TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, key, msg)
+#  define TRACELIB_VISIT_ERROR_TRACEPOINT_STREAM(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, key)
 #endif
 
 /* All the _IMPL macros which are referenced from the public macros listed
  * in tracelib_config.h; these macros are just convenience wrappers around
  * the above core macros.
  */
-#define TRACELIB_DEBUG_IMPL                   TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, 0, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_DEBUG_MSG_IMPL(msg)          TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, 0, TRACELIB_CREATE_MESSAGE_VAR(msg))
-#define TRACELIB_DEBUG_KEY_IMPL(key)          TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, key, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_DEBUG_KEY_MSG_IMPL(key, msg) TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, key, TRACELIB_CREATE_MESSAGE_VAR(msg))
-
-#define TRACELIB_ERROR_IMPL                   TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, 0, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_ERROR_MSG_IMPL(msg)          TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, 0, TRACELIB_CREATE_MESSAGE_VAR(msg))
-#define TRACELIB_ERROR_KEY_IMPL(key)          TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, key, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_ERROR_KEY_MSG_IMPL(key, msg) TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, key, TRACELIB_CREATE_MESSAGE_VAR(msg))
-
-#define TRACELIB_TRACE_IMPL                   TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, 0, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_TRACE_MSG_IMPL(msg)          TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, 0, TRACELIB_CREATE_MESSAGE_VAR(msg))
-#define TRACELIB_TRACE_KEY_IMPL(key)          TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, key, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_TRACE_KEY_MSG_IMPL(key, msg) TRACELIB_VISIT_TRACEPOINT(TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, key, TRACELIB_CREATE_MESSAGE_VAR(msg))
-
-#define TRACELIB_WATCH_IMPL(vars)                   TRACELIB_VISIT_TRACEPOINT_VARS(0, vars, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_WATCH_MSG_IMPL(msg, vars)          TRACELIB_VISIT_TRACEPOINT_VARS(0, vars, TRACELIB_CREATE_MESSAGE_VAR(msg))
-#define TRACELIB_WATCH_KEY_IMPL(key, vars)          TRACELIB_VISIT_TRACEPOINT_VARS(key, vars, TRACELIB_CREATE_NULL_VAR)
-#define TRACELIB_WATCH_KEY_MSG_IMPL(key, msg, vars) TRACELIB_VISIT_TRACEPOINT_VARS(key, vars, TRACELIB_CREATE_MESSAGE_VAR(msg))
+#define TRACELIB_DEBUG_IMPL                   TRACELIB_VISIT_DEBUG_TRACEPOINT(0, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_DEBUG_MSG_IMPL(msg)          TRACELIB_VISIT_DEBUG_TRACEPOINT(0, TRACELIB_CREATE_MESSAGE_VAR(msg))
+#define TRACELIB_DEBUG_KEY_IMPL(key)          TRACELIB_VISIT_DEBUG_TRACEPOINT(key, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_DEBUG_KEY_MSG_IMPL(key, msg) TRACELIB_VISIT_DEBUG_TRACEPOINT(key, TRACELIB_CREATE_MESSAGE_VAR(msg))
+
+#define TRACELIB_ERROR_IMPL                   TRACELIB_VISIT_ERROR_TRACEPOINT(0, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_ERROR_MSG_IMPL(msg)          TRACELIB_VISIT_ERROR_TRACEPOINT(0, TRACELIB_CREATE_MESSAGE_VAR(msg))
+#define TRACELIB_ERROR_KEY_IMPL(key)          TRACELIB_VISIT_ERROR_TRACEPOINT(key, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_ERROR_KEY_MSG_IMPL(key, msg) TRACELIB_VISIT_ERROR_TRACEPOINT(key, TRACELIB_CREATE_MESSAGE_VAR(msg))
+
+#define TRACELIB_TRACE_IMPL                   TRACELIB_VISIT_LOG_TRACEPOINT(0, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_TRACE_MSG_IMPL(msg)          TRACELIB_VISIT_LOG_TRACEPOINT(0, TRACELIB_CREATE_MESSAGE_VAR(msg))
+#define TRACELIB_TRACE_KEY_IMPL(key)          TRACELIB_VISIT_LOG_TRACEPOINT(key, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_TRACE_KEY_MSG_IMPL(key, msg) TRACELIB_VISIT_LOG_TRACEPOINT(key, TRACELIB_CREATE_MESSAGE_VAR(msg))
+
+#define TRACELIB_WATCH_IMPL(vars)                   TRACELIB_VISIT_WATCH_TRACEPOINT(0, vars, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_WATCH_MSG_IMPL(msg, vars)          TRACELIB_VISIT_WATCH_TRACEPOINT(0, vars, TRACELIB_CREATE_MESSAGE_VAR(msg))
+#define TRACELIB_WATCH_KEY_IMPL(key, vars)          TRACELIB_VISIT_WATCH_TRACEPOINT(key, vars, TRACELIB_CREATE_NULL_VAR)
+#define TRACELIB_WATCH_KEY_MSG_IMPL(key, msg, vars) TRACELIB_VISIT_WATCH_TRACEPOINT(key, vars, TRACELIB_CREATE_MESSAGE_VAR(msg))
 
 #define TRACELIB_VALUE_IMPL(v) #v << "=" << v
 
 #define TRACELIB_STREAM_END_IMPL TRACELIB_NAMESPACE_IDENT(StreamEnd())
 
-#define TRACELIB_DEBUG_STREAM_IMPL(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Debug, (key))
-#define TRACELIB_ERROR_STREAM_IMPL(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Error, (key))
-#define TRACELIB_TRACE_STREAM_IMPL(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Log, (key))
-#define TRACELIB_WATCH_STREAM_IMPL(key) TRACELIB_VISIT_TRACEPOINT_STREAM(TracePointVisitor, TRACELIB_NAMESPACE_IDENT(TracePointType)::Watch, (key))
+#define TRACELIB_DEBUG_STREAM_IMPL(key) TRACELIB_VISIT_DEBUG_TRACEPOINT_STREAM((key))
+#define TRACELIB_ERROR_STREAM_IMPL(key) TRACELIB_VISIT_ERROR_TRACEPOINT_STREAM((key))
+#define TRACELIB_TRACE_STREAM_IMPL(key) TRACELIB_VISIT_LOG_TRACEPOINT_STREAM((key))
+#define TRACELIB_WATCH_STREAM_IMPL(key) TRACELIB_VISIT_WATCH_TRACEPOINT_STREAM((key))
 
 TRACELIB_NAMESPACE_BEGIN
 
@@ -147,32 +186,72 @@ inline std::string variableValueAsString( const VariableValue &v )
     return &buf[0];
 }
 
+/* Collects the parts of a trace entry message. The parts are only turned
+ * into text when the entry gets written, which happens in a background
+ * thread if asynchronous output is enabled.
+ */
 class StringBuilder
 {
 public:
-    StringBuilder() { }
+    StringBuilder() : m_size( 0 ), m_moreParts( 0 ) { }
+    ~StringBuilder() { delete m_moreParts; }
 
     inline operator const char *() {
-        m_s = m_stream.str();
+        m_s.clear();
+        for ( size_t i = 0; i < m_size; ++i ) {
+            m_s += variableValueAsString( (*this)[i] );
+        }
         return m_s.c_str();
     }
 
     StringBuilder &operator<<( const VariableValue &v ) {
-        m_stream << variableValueAsString( v );
+        VariableValue part( v );
+        return append( part );
+    }
+
+    // Takes over the given value (without copying it), leaving an Unknown one behind
+    StringBuilder &append( VariableValue &v ) {
+        if ( m_size < InlineCapacity ) {
+            m_inlineParts[m_size].swap( v );
+        } else {
+            if ( !m_moreParts ) {
+                m_moreParts = new std::vector<VariableValue>;
+            }
+            m_moreParts->push_back( VariableValue() );
+            m_moreParts->back().swap( v );
+        }
+        ++m_size;
         return *this;
     }
 
+    size_t size() const {
+        return m_size;
+    }
+
+    VariableValue &operator[]( size_t idx ) {
+        return idx < InlineCapacity ? m_inlineParts[idx] : (*m_moreParts)[idx - InlineCapacity];
+    }
+
+    const VariableValue &operator[]( size_t idx ) const {
+        return idx < InlineCapacity ? m_inlineParts[idx] : (*m_moreParts)[idx - InlineCapacity];
+    }
+
 private:
     StringBuilder( const StringBuilder &other );
     void operator=( const StringBuilder &rhs );
 
+    enum { InlineCapacity = 8 };
+
     std::string m_s;
-    std::ostringstream m_stream;
+    VariableValue m_inlineParts[InlineCapacity];
+    size_t m_size;
+    std::vector<VariableValue> *m_moreParts;
 };
 
 template <class T>
 inline StringBuilder &operator<<( StringBuilder &lhs, const T &rhs ) {
-    return lhs << convertVariable( rhs );
+    VariableValue v = convertVariable( rhs );
+    return lhs.append( v );
 }
 
 TRACELIB_EXPORT bool advanceVisit( TracePoint *tracePoint );
@@ -181,6 +260,13 @@ TRACELIB_EXPORT void visitTracePoint( const TracePoint *tracePoint,
                       const char *msg = 0,
                       VariableSnapshot *variables = 0 );
 
+/* The message parts are moved into the trace entry, so the builder is
+ * left with values of type Unknown.
+ */
+TRACELIB_EXPORT void visitTracePoint( const TracePoint *tracePoint,
+                      StringBuilder &msg,
+                      VariableSnapshot *variables = 0 );
+
 struct StreamEnd {
 };
 
@@ -188,22 +274,27 @@ class TracePointVisitor {
 public:
     inline TracePointVisitor( TracePoint *tracePoint )
         : m_tracePoint( tracePoint )
-        , m_stream( 0 )
+        , m_message( 0 )
         , m_variables( 0 )
     { }
     inline ~TracePointVisitor() {
         if( m_variables ) {
-            for ( size_t i = 0; i < m_variables->size(); ++i ) delete (*m_variables)[i];
+            for ( size_t i = 0; i < m_variables->size(); ++i ) destroyVariable( (*m_variables)[i] );
             delete m_variables;
         }
-        delete m_stream;
+        delete m_message;
     }
 
     inline TracePointVisitor &operator<<( const VariableValue &v ) {
-        if( !m_stream ) {
-            m_stream = new std::ostringstream();
+        VariableValue part( v );
+        return append( part );
+    }
+
+    inline TracePointVisitor &append( VariableValue &v ) {
+        if( !m_message ) {
+            m_message = new StringBuilder;
         }
-        (*m_stream) << variableValueAsString( v );
+        m_message->append( v );
         return *this;
     }
 
@@ -215,8 +306,12 @@ public:
     }
 
     void flush() {
-        if( m_tracePoint->active ) {
-            visitTracePoint( m_tracePoint, m_stream ? m_stream->str().c_str() : "", m_variables );
+        if( m_tracePoint->isActive() ) {
+            if ( m_message ) {
+                visitTracePoint( m_tracePoint, *m_message, m_variables );
+            } else {
+                visitTracePoint( m_tracePoint, "", m_variables );
+            }
         }
     }
 
@@ -225,7 +320,7 @@ private:
     void operator=( const TracePointVisitor &rhs );
 
     TracePoint *m_tracePoint;
-    std::ostringstream *m_stream;
+    StringBuilder *m_message;
     VariableSnapshot *m_variables;
 };
 
@@ -242,7 +337,8 @@ inline void operator<<( TracePointVisitor &lhs, const StreamEnd & ) {
 
 template <class T>
 inline TracePointVisitor &operator<<( TracePointVisitor &lhs, const T &rhs ) {
-    return lhs << convertVariable( rhs );
+    VariableValue v = convertVariable( rhs );
+    return lhs.append( v );
 }
 
 TRACELIB_NAMESPACE_END
@@ -203,6 +203,37 @@
  */
 #define TRACELIB_DEFAULT_CONFIGFILE_NAME "tracelib.xml"
 
+/**
+ * @brief Levels for use with #TRACELIB_MIN_TRACEPOINT_TYPE.
+ *
+ * The levels order the trace point types by importance, starting with the
+ * least important one.
+ */
+#define TRACELIB_LEVEL_DEBUG 1
+#define TRACELIB_LEVEL_WATCH 2
+#define TRACELIB_LEVEL_LOG 3
+#define TRACELIB_LEVEL_ERROR 4
+
+/**
+ * @brief Least important type of trace points which is compiled in.
+ *
+ * Defining this macro (e.g. on the compiler command line) to one of the
+ * TRACELIB_LEVEL_* values strips all trace points of less important types
+ * from the code at compile time; there is no runtime overhead whatsoever for
+ * them. For instance, defining it to TRACELIB_LEVEL_LOG leaves only the
+ * #TRACELIB_TRACE and #TRACELIB_ERROR family of macros in place.
+ *
+ * \code
+ * g++ -DTRACELIB_MIN_TRACEPOINT_TYPE=TRACELIB_LEVEL_LOG -c myfile.cpp
+ * \endcode
+ *
+ * By default, all trace points are compiled in. Use
+ * TRACELIB_DISABLE_TRACE_CODE to strip all trace points.
+ */
+#ifndef TRACELIB_MIN_TRACEPOINT_TYPE
+#  define TRACELIB_MIN_TRACEPOINT_TYPE TRACELIB_LEVEL_DEBUG
+#endif
+
 /**
  * @brief Add a debug entry to the current thread's trace.
  *
@@ -39,31 +39,64 @@ struct TracePointType {
     }
 };
 
-class Configuration;
+/* Bookkeeping for trace points which are only logged at a limited rate or
+ * only for every n-th hit (see the rate= and sample= attributes of the
+ * <tracepointset> element). All fields are accessed atomically.
+ */
+struct TracePointThrottle {
+    TracePointThrottle()
+        : rate( 0 ),
+        sampleInterval( 0 ),
+        hits( 0 ),
+        suppressedHits( 0 ),
+        theoreticalArrivalTime( 0 ),
+        lastSummaryTime( 0 ),
+        registered( 0 )
+    {
+    }
+
+    volatile unsigned long rate; // entries per second, 0 means unlimited
+    volatile unsigned long sampleInterval; // log one in this many hits
+    volatile unsigned long hits;
+    volatile unsigned long suppressedHits;
+    volatile unsigned long theoreticalArrivalTime; // microseconds
+    volatile unsigned long lastSummaryTime; // seconds
+    volatile unsigned long registered; // known to the Trace, see Trace::reportSuppressedHits()
+};
 
 struct TracePoint {
+    /* The state of a trace point combines the generation of the configuration
+     * it was last configured for (shifted left by GenerationShift) with the
+     * flags below. It is always written as a whole so that a thread never
+     * sees flags which belong to a different configuration.
+     */
+    enum StateFlags {
+        Active = 1,
+        BacktracesEnabled = 2,
+        VariableSnapshotEnabled = 4,
+        Throttled = 8,
+        GenerationShift = 4
+    };
+
     TRACELIB_EXPORT TracePoint( TracePointType::Value type_, const char *sourceFile_, unsigned int lineno_, const char *functionName_, const char *groupName_ )
         : type( type_ ),
         sourceFile( sourceFile_ ),
         lineno( lineno_ ),
         functionName( functionName_ ),
         groupName( groupName_ ),
-        lastUsedConfiguration( 0 ),
-        active( false ),
-        backtracesEnabled( false ),
-        variableSnapshotEnabled( false )
+        state( 0 )
     {
     }
 
+    bool isActive() const { return ( state & Active ) != 0; }
+
     const TracePointType::Value type;
     const char * const sourceFile;
     const unsigned int lineno;
     const char * const functionName;
     const char * const groupName;
-    const Configuration *lastUsedConfiguration;
-    bool active;
-    bool backtracesEnabled;
-    bool variableSnapshotEnabled;
+    volatile unsigned long state;
+    TracePointThrottle throttle;
 };
 
 TRACELIB_NAMESPACE_END
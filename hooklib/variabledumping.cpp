@@ -18,7 +18,10 @@
  */
 
 #include "variabledumping.h"
+#include "atomicops.h"
+#include "thread.h"
 
+#include <algorithm> // for swap
 #include <cassert>
 #include <cstdlib> // for free
 #include <cstring> // for strncpy, strdup
@@ -31,7 +34,13 @@ VariableValue VariableValue::stringValue( const char *s )
 {
     VariableValue var;
     var.m_type = VariableType::String;
-    var.m_primitiveValue.string = strdup( s );
+    const size_t len = strlen( s );
+    if ( len < ShortStringCapacity ) {
+        memcpy( var.m_primitiveValue.shortString, s, len + 1 );
+        var.m_isShortString = true;
+    } else {
+        var.m_primitiveValue.string = strdup( s );
+    }
     return var;
 }
 
@@ -108,20 +117,46 @@ size_t VariableValue::convertToString( const VariableValue &v, char *buf, size_t
 VariableValue::VariableValue( const VariableValue &other )
     : m_type( other.m_type ),
     m_primitiveValue( other.m_primitiveValue ),
-	m_isSignedNumber( other.m_isSignedNumber )
+	m_isSignedNumber( other.m_isSignedNumber ),
+    m_isShortString( other.m_isShortString )
 {
-    if ( m_type == VariableType::String ) {
+    if ( m_type == VariableType::String && !m_isShortString ) {
         m_primitiveValue.string = strdup( other.asString() );
     }
 }
 
 VariableValue::~VariableValue()
 {
-    if ( m_type == VariableType::String ) {
+    if ( m_type == VariableType::String && !m_isShortString ) {
         free( m_primitiveValue.string );
     }
 }
 
+VariableValue &VariableValue::operator=( const VariableValue &other )
+{
+    if ( this != &other ) {
+        if ( m_type == VariableType::String && !m_isShortString ) {
+            free( m_primitiveValue.string );
+        }
+        m_type = other.m_type;
+        m_primitiveValue = other.m_primitiveValue;
+        m_isSignedNumber = other.m_isSignedNumber;
+        m_isShortString = other.m_isShortString;
+        if ( m_type == VariableType::String && !m_isShortString ) {
+            m_primitiveValue.string = strdup( other.asString() );
+        }
+    }
+    return *this;
+}
+
+void VariableValue::swap( VariableValue &other )
+{
+    std::swap( m_type, other.m_type );
+    std::swap( m_primitiveValue, other.m_primitiveValue );
+    std::swap( m_isSignedNumber, other.m_isSignedNumber );
+    std::swap( m_isShortString, other.m_isShortString );
+}
+
 VariableType::Value VariableValue::type() const
 {
     return m_type;
@@ -129,7 +164,7 @@ VariableType::Value VariableValue::type() const
 
 const char *VariableValue::asString() const
 {
-    return m_primitiveValue.string;
+    return m_isShortString ? m_primitiveValue.shortString : m_primitiveValue.string;
 }
 
 vulonglong VariableValue::asNumber() const
@@ -153,35 +188,165 @@ bool VariableValue::isSignedNumber() const
 }
 
 VariableValue::VariableValue()
-    : m_type( VariableType::Unknown )
+    : m_type( VariableType::Unknown ),
+    m_isSignedNumber( false ),
+    m_isShortString( false )
 {
 }
 
 VariableSnapshot::VariableSnapshot()
-    : m_variables( new std::vector<AbstractVariable *> )
+    : m_size( 0 ),
+    m_moreVariables( 0 )
 {
 }
 
 VariableSnapshot::~VariableSnapshot()
 {
+    delete m_moreVariables;
 }
 
 
 VariableSnapshot &VariableSnapshot::operator<<( AbstractVariable *v )
 {
-    m_variables->push_back( v );
+    if ( m_size < InlineCapacity ) {
+        m_inlineVariables[m_size] = v;
+    } else {
+        if ( !m_moreVariables ) {
+            m_moreVariables = new std::vector<AbstractVariable *>;
+        }
+        m_moreVariables->push_back( v );
+    }
+    ++m_size;
     return *this;
 }
 
 size_t VariableSnapshot::size() const
 {
-    return m_variables->size();
+    return m_size;
 }
 
 
 AbstractVariable *&VariableSnapshot::operator[]( size_t idx )
 {
-    return (*m_variables)[idx];
+    if ( idx < InlineCapacity ) {
+        return m_inlineVariables[idx];
+    }
+    return (*m_moreVariables)[idx - InlineCapacity];
+}
+
+namespace {
+
+/* A simple bump allocator; memory is handed out from a list of chunks and
+ * all of it becomes available again once every allocation was released.
+ * Each allocation is preceded by a header pointing back to the arena (or
+ * null for allocations too large for a chunk, which go to the heap).
+ */
+class VariableArena
+{
+public:
+    VariableArena()
+        : m_currentChunk( 0 ),
+        m_chunkUsed( 0 ),
+        m_liveAllocations( 0 )
+    {
+    }
+
+    ~VariableArena() {
+        std::vector<char *>::const_iterator it, end = m_chunks.end();
+        for ( it = m_chunks.begin(); it != end; ++it ) {
+            delete [] *it;
+        }
+    }
+
+    void *allocate( size_t size ) {
+        const size_t required = roundUp( HeaderSize + size );
+        if ( required > ChunkSize ) {
+            char *p = new char[HeaderSize + size];
+            *reinterpret_cast<VariableArena **>( p ) = 0;
+            return p + HeaderSize;
+        }
+
+        if ( m_chunkUsed + required > ChunkSize || m_chunks.empty() ) {
+            if ( !m_chunks.empty() ) {
+                ++m_currentChunk;
+            }
+            if ( m_currentChunk == m_chunks.size() ) {
+                m_chunks.push_back( new char[ChunkSize] );
+            }
+            m_chunkUsed = 0;
+        }
+
+        char *p = m_chunks[m_currentChunk] + m_chunkUsed;
+        m_chunkUsed += required;
+        ++m_liveAllocations;
+        *reinterpret_cast<VariableArena **>( p ) = this;
+        return p + HeaderSize;
+    }
+
+    static void release( void *p ) {
+        char *header = static_cast<char *>( p ) - HeaderSize;
+        VariableArena *arena = *reinterpret_cast<VariableArena **>( header );
+        if ( !arena ) {
+            delete [] header;
+            return;
+        }
+        if ( --arena->m_liveAllocations == 0 ) {
+            arena->m_currentChunk = 0;
+            arena->m_chunkUsed = 0;
+        }
+    }
+
+    static void destroy( void *arena ) {
+        delete static_cast<VariableArena *>( arena );
+    }
+
+private:
+    // the header size keeps the returned memory suitably aligned
+    enum { HeaderSize = 16, ChunkSize = 4096 };
+
+    static size_t roundUp( size_t size ) {
+        return ( size + HeaderSize - 1 ) & ~static_cast<size_t>( HeaderSize - 1 );
+    }
+
+    std::vector<char *> m_chunks;
+    size_t m_currentChunk;
+    size_t m_chunkUsed;
+    size_t m_liveAllocations;
+};
+
+}
+
+static ThreadLocalPointer * volatile g_variableArenas = 0;
+
+static VariableArena *currentThreadArena()
+{
+    ThreadLocalPointer *arenas = atomicLoad( &g_variableArenas );
+    if ( !arenas ) {
+        ThreadLocalPointer *newArenas = new ThreadLocalPointer( VariableArena::destroy );
+        if ( atomicCompareAndSwap( &g_variableArenas, static_cast<ThreadLocalPointer *>( 0 ), newArenas ) ) {
+            arenas = newArenas;
+        } else {
+            delete newArenas;
+            arenas = atomicLoad( &g_variableArenas );
+        }
+    }
+
+    VariableArena *arena = static_cast<VariableArena *>( arenas->get() );
+    if ( !arena ) {
+        arena = new VariableArena;
+        arenas->set( arena );
+    }
+    return arena;
+}
+
+void *allocateVariableStorage( size_t size )
+{
+    return currentThreadArena()->allocate( size );
+}
+
+void releaseVariableStorage( void *p )
+{
+    VariableArena::release( p );
 }
 
 TRACELIB_NAMESPACE_END
@@ -26,7 +26,7 @@
 #include <stdio.h> // for snprintf
 
 #include <cstddef>
-#include <memory>
+#include <new>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -84,8 +84,14 @@ public:
     TRACELIB_EXPORT static VariableValue floatValue( long double v );
     TRACELIB_EXPORT static size_t convertToString( const VariableValue &v, char *buf, size_t bufsize );
 
+    // Creates a value of type Unknown, e.g. to swap() another value into
+    TRACELIB_EXPORT VariableValue();
     TRACELIB_EXPORT VariableValue( const VariableValue &other );
     TRACELIB_EXPORT ~VariableValue();
+    TRACELIB_EXPORT VariableValue &operator=( const VariableValue &other );
+
+    // Exchanges the values without copying any string
+    TRACELIB_EXPORT void swap( VariableValue &other );
 
     VariableType::Value type() const;
     const char *asString() const;
@@ -95,7 +101,8 @@ public:
     bool isSignedNumber() const;
 
 private:
-    VariableValue();
+    // strings shorter than this are stored without allocating memory
+    enum { ShortStringCapacity = 16 };
 
     VariableType::Value m_type;
     union {
@@ -103,8 +110,10 @@ private:
         bool boolean;
         long double float_;
         char *string;
+        char shortString[ShortStringCapacity];
     } m_primitiveValue;
     bool m_isSignedNumber;
+    bool m_isShortString;
 };
 
 template <typename T>
@@ -221,9 +230,24 @@ private:
     const T &m_o;
 };
 
+/* The variables created by makeConverter() live in a per-thread arena of
+ * the library instead of on the heap; they are only needed while a trace
+ * point is visited, so the arena memory is reused as soon as all variables
+ * of a thread got destroyed again. The storage has to be released by the
+ * thread which allocated it.
+ */
+TRACELIB_EXPORT void *allocateVariableStorage( size_t size );
+TRACELIB_EXPORT void releaseVariableStorage( void *p );
+
 template <typename T>
 AbstractVariable *makeConverter( const char *name, const T &o ) {
-    return new Variable<T>( name, o );
+    return new ( allocateVariableStorage( sizeof( Variable<T> ) ) ) Variable<T>( name, o );
+}
+
+// Counterpart of makeConverter()
+inline void destroyVariable( AbstractVariable *v ) {
+    v->~AbstractVariable();
+    releaseVariableStorage( v );
 }
 
 class VariableSnapshot
@@ -238,7 +262,15 @@ public:
     TRACELIB_EXPORT AbstractVariable *&operator[]( size_t idx );
 
 private:
-    std::auto_ptr<std::vector<AbstractVariable *> > m_variables;
+    VariableSnapshot( const VariableSnapshot &other ); // disabled
+    void operator=( const VariableSnapshot &rhs ); // disabled
+
+    // most trace points watch only a few variables, avoid allocating for them
+    enum { InlineCapacity = 8 };
+
+    AbstractVariable *m_inlineVariables[InlineCapacity];
+    size_t m_size;
+    std::vector<AbstractVariable *> *m_moreVariables;
 };
 
 TRACELIB_NAMESPACE_END
@@ -0,0 +1,423 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "binarycontenthandler.h"
+
+#include "crashsymbolizer.h"
+#include "../hooklib/binaryformat.h"
+#include "../hooklib/tracepoint.h" // for TracePointType
+
+#include <QAtomicInt>
+#include <QDebug>
+
+#include <cstring>
+
+using namespace TRACELIB_NAMESPACE_IDENT(BinaryFormat);
+
+/* Anything larger than this is assumed to be garbage rather than a record;
+ * the decoder then resynchronizes on the next record marker.
+ */
+static const quint64 MaximumPayloadLength = 64 * 1024 * 1024;
+
+/* The IDs of trace points are only unique per connection; the keys handed
+ * out to the database feeder are unique for the lifetime of traced.
+ */
+static QAtomicInt g_nextTracePointKey( 1 );
+
+class BinaryRecordReader
+{
+public:
+    BinaryRecordReader( const char *data, int length )
+        : m_begin( data ), m_pos( data ), m_end( data + length ), m_ok( true ) { }
+
+    bool ok() const { return m_ok; }
+    bool atEnd() const { return m_pos == m_end; }
+    int position() const { return static_cast<int>( m_pos - m_begin ); }
+
+    quint64 readVarint() {
+        quint64 v = 0;
+        for ( int shift = 0; shift < 64; shift += 7 ) {
+            if ( m_pos == m_end ) {
+                m_ok = false;
+                return 0;
+            }
+            const unsigned char b = static_cast<unsigned char>( *m_pos++ );
+            v |= static_cast<quint64>( b & 0x7f ) << shift;
+            if ( !( b & 0x80 ) ) {
+                return v;
+            }
+        }
+        m_ok = false;
+        return 0;
+    }
+
+    qint64 readSignedVarint() {
+        const quint64 v = readVarint();
+        return static_cast<qint64>( v >> 1 ) ^ -static_cast<qint64>( v & 1 );
+    }
+
+    unsigned char readByte() {
+        if ( m_pos == m_end ) {
+            m_ok = false;
+            return 0;
+        }
+        return static_cast<unsigned char>( *m_pos++ );
+    }
+
+    QString readString() {
+        const quint64 length = readVarint();
+        if ( !m_ok || length > static_cast<quint64>( m_end - m_pos ) ) {
+            m_ok = false;
+            return QString();
+        }
+        const QString s = QString::fromUtf8( m_pos, static_cast<int>( length ) );
+        m_pos += length;
+        return s;
+    }
+
+    double readDouble() {
+        if ( m_end - m_pos < 8 ) {
+            m_ok = false;
+            return 0.0;
+        }
+        quint64 bits = 0;
+        for ( int i = 7; i >= 0; --i ) {
+            bits = ( bits << 8 ) | static_cast<unsigned char>( m_pos[i] );
+        }
+        m_pos += 8;
+        double d;
+        memcpy( &d, &bits, sizeof( d ) );
+        return d;
+    }
+
+private:
+    const char * const m_begin;
+    const char *m_pos;
+    const char * const m_end;
+    bool m_ok;
+};
+
+BinaryContentHandler::BinaryContentHandler( XmlParseEventsHandler *handler,
+                                            CrashSymbolizerThread *symbolizer )
+    : m_handler( handler ),
+    m_symbolizer( symbolizer ),
+    m_sessionStarted( false ),
+    m_pid( 0 )
+{
+}
+
+void BinaryContentHandler::addData( const QByteArray &data )
+{
+    m_buffer.append( data );
+}
+
+void BinaryContentHandler::continueParsing()
+{
+    const char * const data = m_buffer.constData();
+    const int size = m_buffer.size();
+    int pos = 0;
+    while ( pos < size ) {
+        // Skip anything between records, e.g. newlines added by the output
+        if ( static_cast<unsigned char>( data[pos] ) != RecordMarker ) {
+            ++pos;
+            continue;
+        }
+
+        if ( size - pos < 3 ) {
+            break;
+        }
+
+        const unsigned char type = static_cast<unsigned char>( data[pos + 1] );
+        BinaryRecordReader header( data + pos + 2, qMin( size - pos - 2, 10 ) );
+        const quint64 length = header.readVarint();
+        if ( !header.ok() ) {
+            if ( size - pos - 2 < 10 ) {
+                break; // length not complete yet
+            }
+            qWarning() << "Skipping binary trace record with invalid length";
+            ++pos;
+            continue;
+        }
+        if ( length > MaximumPayloadLength ) {
+            qWarning() << "Skipping binary trace record with excessive length" << length;
+            ++pos;
+            continue;
+        }
+
+        const int headerLength = 2 + static_cast<int>( header.position() );
+        if ( static_cast<quint64>( size - pos - headerLength ) < length ) {
+            break; // payload not complete yet
+        }
+
+        const int recordEnd = pos + headerLength + static_cast<int>( length );
+        try {
+            if ( !handleRecord( type, data + pos + headerLength, static_cast<int>( length ) ) ) {
+                qWarning() << "Skipping malformed binary trace record of type" << type;
+            }
+        } catch ( ... ) {
+            // Don't process the record again when parsing is continued
+            m_buffer.remove( 0, recordEnd );
+            throw;
+        }
+        pos = recordEnd;
+    }
+    m_buffer.remove( 0, pos );
+}
+
+bool BinaryContentHandler::handleRecord( unsigned char type, const char *payload, int length )
+{
+    BinaryRecordReader reader( payload, length );
+    switch ( type ) {
+        case SessionRecord:
+            return readSession( reader );
+        case TracePointDefinitionRecord:
+            return readTracePointDefinition( reader );
+        case ThreadRecord:
+            return readThread( reader );
+        case TraceEntryRecord:
+            return readTraceEntry( reader );
+        case ShutdownEventRecord:
+            return readShutdownEvent( reader );
+        case CrashRecord:
+            return readCrash( reader );
+    }
+    // Records of unknown types are ignored for the sake of compatibility
+    return true;
+}
+
+bool BinaryContentHandler::readSession( BinaryRecordReader &reader )
+{
+    const unsigned int pid = reader.readVarint();
+    const QDateTime processStartTime = QDateTime::fromMSecsSinceEpoch( reader.readVarint() );
+    const QString processName = reader.readString();
+
+    QList<TraceKey> traceKeys;
+    const quint64 numKeys = reader.readVarint();
+    for ( quint64 i = 0; i < numKeys && reader.ok(); ++i ) {
+        TraceKey key;
+        key.enabled = reader.readByte() != 0;
+        key.name = reader.readString();
+        traceKeys.append( key );
+    }
+
+    StorageConfiguration storageConfig;
+    storageConfig.maximumSize = reader.readVarint();
+    storageConfig.shrinkBy = reader.readVarint();
+    storageConfig.archiveDir = reader.readString();
+
+    if ( !reader.ok() ) {
+        return false;
+    }
+
+    // Trace point IDs and thread names are only valid within a session
+    m_tracePoints.clear();
+    m_threadNames.clear();
+    m_sessionStarted = true;
+    m_pid = pid;
+    m_processStartTime = processStartTime;
+    m_processName = processName;
+
+    m_handler->applyStorageConfiguration( storageConfig );
+    m_handler->handleTraceKeys( traceKeys );
+    return true;
+}
+
+bool BinaryContentHandler::readTracePointDefinition( BinaryRecordReader &reader )
+{
+    const quint64 id = reader.readVarint();
+    TracePointDefinition def;
+    def.type = reader.readByte();
+    def.lineno = reader.readVarint();
+    def.path = reader.readString();
+    def.function = reader.readString();
+    if ( reader.readByte() & HasGroupName ) {
+        def.groupName = reader.readString();
+    }
+
+    if ( !reader.ok() ) {
+        return false;
+    }
+
+    def.key = g_nextTracePointKey.fetchAndAddRelaxed( 1 );
+    m_tracePoints.insert( id, def );
+    return true;
+}
+
+bool BinaryContentHandler::readThread( BinaryRecordReader &reader )
+{
+    const quint64 tid = reader.readVarint();
+    const QString name = reader.readString();
+
+    if ( !reader.ok() ) {
+        return false;
+    }
+
+    m_threadNames.insert( tid, name );
+    return true;
+}
+
+bool BinaryContentHandler::readTraceEntry( BinaryRecordReader &reader )
+{
+    if ( !m_sessionStarted ) {
+        return false;
+    }
+
+    TraceEntry e = TraceEntry();
+    e.pid = m_pid;
+    e.processStartTime = m_processStartTime;
+    e.processName = m_processName;
+    e.tid = reader.readVarint();
+    e.threadName = m_threadNames.value( e.tid );
+    e.timestamp = reader.readVarint();
+    e.stackPosition = reader.readVarint();
+
+    const QHash<quint64, TracePointDefinition>::const_iterator def = m_tracePoints.constFind( reader.readVarint() );
+    if ( def == m_tracePoints.constEnd() ) {
+        return false;
+    }
+    e.tracePointKey = def->key;
+    e.type = def->type;
+    e.lineno = def->lineno;
+    e.path = def->path;
+    e.function = def->function;
+    e.groupName = def->groupName;
+
+    const unsigned char flags = reader.readByte();
+
+    if ( flags & HasVariables ) {
+        const quint64 numVariables = reader.readVarint();
+        for ( quint64 i = 0; i < numVariables && reader.ok(); ++i ) {
+            Variable var;
+            var.name = reader.readString();
+            var.type = static_cast<TRACELIB_NAMESPACE_IDENT(VariableType)::Value>( reader.readByte() );
+            // Values are stored as text, formatted like the XML serializer does
+            switch ( var.type ) {
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::String:
+                    var.value = reader.readString();
+                    break;
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::Number:
+                    if ( reader.readByte() ) {
+                        var.value = QString::number( reader.readSignedVarint() );
+                    } else {
+                        var.value = QString::number( reader.readVarint() );
+                    }
+                    break;
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::Float:
+                    var.value = QString::number( reader.readDouble() );
+                    break;
+                case TRACELIB_NAMESPACE_IDENT(VariableType)::Boolean:
+                    var.value = reader.readByte() ? QLatin1String( "1" ) : QLatin1String( "0" );
+                    break;
+                default:
+                    return false;
+            }
+            e.variables.append( var );
+        }
+    }
+
+    if ( flags & HasBacktrace ) {
+        const quint64 depth = reader.readVarint();
+        for ( quint64 i = 0; i < depth && reader.ok(); ++i ) {
+            StackFrame frame;
+            frame.module = reader.readString();
+            frame.function = reader.readString();
+            frame.functionOffset = reader.readVarint();
+            frame.sourceFile = reader.readString();
+            frame.lineNumber = reader.readVarint();
+            e.backtrace.append( frame );
+        }
+    }
+
+    if ( flags & HasMessage ) {
+        e.message = reader.readString();
+    }
+
+    if ( !reader.ok() ) {
+        return false;
+    }
+
+    m_handler->handleTraceEntry( e );
+    return true;
+}
+
+bool BinaryContentHandler::readShutdownEvent( BinaryRecordReader &reader )
+{
+    ProcessShutdownEvent ev = ProcessShutdownEvent();
+    ev.pid = reader.readVarint();
+    ev.startTime = QDateTime::fromMSecsSinceEpoch( reader.readVarint() );
+    ev.stopTime = QDateTime::fromMSecsSinceEpoch( reader.readVarint() );
+    ev.name = reader.readString();
+
+    if ( !reader.ok() ) {
+        return false;
+    }
+
+    m_handler->handleShutdownEvent( ev );
+    return true;
+}
+
+bool BinaryContentHandler::readCrash( BinaryRecordReader &reader )
+{
+    if ( !m_sessionStarted ) {
+        return false;
+    }
+
+    TraceEntry e = TraceEntry();
+    e.pid = m_pid;
+    e.processStartTime = m_processStartTime;
+    e.processName = m_processName;
+    e.tid = reader.readVarint();
+    e.threadName = m_threadNames.value( e.tid );
+    e.timestamp = reader.readVarint();
+    const quint64 signalNumber = reader.readVarint();
+    const quint64 faultAddress = reader.readVarint();
+
+    QList<quint64> programCounters;
+    const quint64 depth = reader.readVarint();
+    for ( quint64 i = 0; i < depth && reader.ok(); ++i ) {
+        programCounters.append( reader.readVarint() );
+    }
+
+    QList<MappedModule> modules;
+    while ( reader.ok() && !reader.atEnd() ) {
+        MappedModule module;
+        module.start = reader.readVarint();
+        module.end = reader.readVarint();
+        module.offset = reader.readVarint();
+        module.path = reader.readString();
+        modules.append( module );
+    }
+
+    if ( !reader.ok() ) {
+        return false;
+    }
+
+    // Like the entry the hook library writes if it can't write a crash record
+    e.type = TRACELIB_NAMESPACE_IDENT(TracePointType)::Error;
+    e.message = QString::fromLatin1( "The application crashed at this point! (signal %1, address 0x%2)" )
+                    .arg( signalNumber ).arg( faultAddress, 0, 16 );
+
+    if ( m_symbolizer ) {
+        m_symbolizer->symbolizeLater( e, programCounters, modules, m_handler );
+        return true;
+    }
+
+    CrashSymbolizer().symbolize( e, programCounters, modules );
+    m_handler->handleTraceEntry( e );
+    return true;
+}
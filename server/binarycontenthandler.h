@@ -0,0 +1,77 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACER_BINARYCONTENTHANDLER_H
+#define TRACER_BINARYCONTENTHANDLER_H
+
+#include "contenthandler.h"
+#include "xmlcontenthandler.h" // for XmlParseEventsHandler, StorageConfiguration
+
+#include <QByteArray>
+#include <QHash>
+
+class BinaryRecordReader;
+class CrashSymbolizerThread;
+
+/* Decodes the records written by the binary serializer of the hook
+ * library; see hooklib/binaryformat.h for a description of the format.
+ */
+class BinaryContentHandler : public ContentHandler
+{
+public:
+    /* Crash records are symbolized by the given thread if there is one,
+     * otherwise right away.
+     */
+    BinaryContentHandler( XmlParseEventsHandler *handler,
+                          CrashSymbolizerThread *symbolizer = 0 );
+
+    virtual void addData( const QByteArray &data );
+    virtual void continueParsing();
+
+private:
+    bool handleRecord( unsigned char type, const char *payload, int length );
+    bool readSession( BinaryRecordReader &reader );
+    bool readTracePointDefinition( BinaryRecordReader &reader );
+    bool readThread( BinaryRecordReader &reader );
+    bool readTraceEntry( BinaryRecordReader &reader );
+    bool readShutdownEvent( BinaryRecordReader &reader );
+    bool readCrash( BinaryRecordReader &reader );
+
+    struct TracePointDefinition
+    {
+        unsigned int key;
+        unsigned int type;
+        QString path;
+        unsigned long lineno;
+        QString function;
+        QString groupName;
+    };
+
+    XmlParseEventsHandler *m_handler;
+    CrashSymbolizerThread *m_symbolizer;
+    QByteArray m_buffer;
+    bool m_sessionStarted;
+    unsigned int m_pid;
+    QDateTime m_processStartTime;
+    QString m_processName;
+    // Maps the IDs used by the traced process to the definitions
+    QHash<quint64, TracePointDefinition> m_tracePoints;
+    QHash<quint64, QString> m_threadNames;
+};
+
+#endif // TRACER_BINARYCONTENTHANDLER_H
@@ -0,0 +1,73 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "contenthandler.h"
+#include "binarycontenthandler.h"
+#include "xmlcontenthandler.h"
+
+#include "../hooklib/binaryformat.h"
+
+#include <QByteArray>
+#include <QDebug>
+
+#include <stdexcept>
+
+using namespace std;
+
+ContentHandler::~ContentHandler()
+{
+}
+
+ContentHandler *ContentHandler::createForData( const QByteArray &data, XmlParseEventsHandler *handler,
+                                               CrashSymbolizerThread *symbolizer )
+{
+    if ( !data.isEmpty() && static_cast<unsigned char>( data.at( 0 ) ) == TRACELIB_NAMESPACE_IDENT(BinaryFormat)::RecordMarker ) {
+        return new BinaryContentHandler( handler, symbolizer );
+    }
+
+    XmlContentHandler *xmlHandler = new XmlContentHandler( handler );
+    xmlHandler->addData( "<toplevel_trace_element>" );
+    return xmlHandler;
+}
+
+ConnectionParser::ConnectionParser( XmlParseEventsHandler *handler,
+                                    CrashSymbolizerThread *symbolizer )
+    : m_handler( handler ),
+    m_symbolizer( symbolizer ),
+    m_contentHandler( 0 )
+{
+}
+
+ConnectionParser::~ConnectionParser()
+{
+    delete m_contentHandler;
+}
+
+void ConnectionParser::addData( const QByteArray &data )
+{
+    if ( !m_contentHandler ) {
+        m_contentHandler = ContentHandler::createForData( data, m_handler, m_symbolizer );
+    }
+
+    try {
+        m_contentHandler->addData( data );
+        m_contentHandler->continueParsing();
+    } catch ( const runtime_error &e ) {
+        qWarning() << e.what();
+    }
+}
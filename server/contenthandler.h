@@ -0,0 +1,66 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2013-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TRACER_CONTENTHANDLER_H
+#define TRACER_CONTENTHANDLER_H
+
+class CrashSymbolizerThread;
+class QByteArray;
+class XmlParseEventsHandler;
+
+/* Common interface of the parsers for the formats which traced accepts;
+ * each connection gets a parser of its own.
+ */
+class ContentHandler
+{
+public:
+    virtual ~ContentHandler();
+
+    virtual void addData( const QByteArray &data ) = 0;
+    virtual void continueParsing() = 0;
+
+    /* Creates a parser suitable for the format of the given data, which
+     * should be the first data received on a connection. Crash records are
+     * symbolized by the given thread if there is one.
+     */
+    static ContentHandler *createForData( const QByteArray &data, XmlParseEventsHandler *handler,
+                                          CrashSymbolizerThread *symbolizer = 0 );
+};
+
+/* Parses all data received on a single connection; the parser is created
+ * as soon as the first data arrives. Parse errors are logged.
+ */
+class ConnectionParser
+{
+public:
+    explicit ConnectionParser( XmlParseEventsHandler *handler,
+                               CrashSymbolizerThread *symbolizer = 0 );
+    ~ConnectionParser();
+
+    void addData( const QByteArray &data );
+
+private:
+    ConnectionParser( const ConnectionParser &other ); // disabled
+    void operator=( const ConnectionParser &rhs ); // disabled
+
+    XmlParseEventsHandler *m_handler;
+    CrashSymbolizerThread *m_symbolizer;
+    ContentHandler *m_contentHandler;
+};
+
+#endif // TRACER_CONTENTHANDLER_H
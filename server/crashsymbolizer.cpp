@@ -0,0 +1,291 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crashsymbolizer.h"
+
+#include "xmlcontenthandler.h" // for XmlParseEventsHandler
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QStringList>
+
+/* The cache of a module is started afresh once it holds more frames than
+ * this, so that a long running traced doesn't grow without limits.
+ */
+static const int MaximumCachedFramesPerModule = 10000;
+
+static quint64 readLittleEndian( const QByteArray &data, int pos, int size )
+{
+    quint64 v = 0;
+    for ( int i = size - 1; i >= 0; --i ) {
+        v = ( v << 8 ) | static_cast<unsigned char>( data.at( pos + i ) );
+    }
+    return v;
+}
+
+/* Returns what to add to an offset within the given ELF file to get the
+ * address the linker assigned to the byte at that offset, which is what
+ * addr2line expects; zero if the file cannot be read. Only little endian
+ * files are handled, the crash handler doesn't report mappings for any
+ * other platforms anyway.
+ */
+static quint64 linkAddressDelta( const QString &path, quint64 fileOffset )
+{
+    QFile file( path );
+    if ( !file.open( QIODevice::ReadOnly ) ) {
+        return 0;
+    }
+
+    const QByteArray header = file.read( 64 );
+    if ( header.size() < 52 || !header.startsWith( "\x7f" "ELF" ) || header.at( 5 ) != 1 ) {
+        return 0;
+    }
+    const bool is64Bit = header.at( 4 ) == 2;
+    if ( is64Bit && header.size() < 64 ) {
+        return 0;
+    }
+
+    const quint64 programHeaderOffset = is64Bit ? readLittleEndian( header, 32, 8 ) : readLittleEndian( header, 28, 4 );
+    const int entrySize = static_cast<int>( readLittleEndian( header, is64Bit ? 54 : 42, 2 ) );
+    const int entryCount = static_cast<int>( readLittleEndian( header, is64Bit ? 56 : 44, 2 ) );
+    if ( !file.seek( programHeaderOffset ) ) {
+        return 0;
+    }
+    const QByteArray programHeaders = file.read( entrySize * entryCount );
+
+    for ( int i = 0; i < entryCount; ++i ) {
+        const int pos = i * entrySize;
+        if ( pos + ( is64Bit ? 40 : 20 ) > programHeaders.size() ) {
+            break;
+        }
+        if ( readLittleEndian( programHeaders, pos, 4 ) != 1 ) { // PT_LOAD
+            continue;
+        }
+
+        quint64 offset, address, size;
+        if ( is64Bit ) {
+            offset = readLittleEndian( programHeaders, pos + 8, 8 );
+            address = readLittleEndian( programHeaders, pos + 16, 8 );
+            size = readLittleEndian( programHeaders, pos + 32, 8 );
+        } else {
+            offset = readLittleEndian( programHeaders, pos + 4, 4 );
+            address = readLittleEndian( programHeaders, pos + 8, 4 );
+            size = readLittleEndian( programHeaders, pos + 16, 4 );
+        }
+        if ( fileOffset >= offset && fileOffset < offset + size ) {
+            return address - offset;
+        }
+    }
+    return 0;
+}
+
+static QString hexAddress( quint64 address )
+{
+    return QString::fromLatin1( "0x%1" ).arg( address, 0, 16 );
+}
+
+void CrashSymbolizer::symbolize( TraceEntry &e, const QList<quint64> &programCounters,
+                                 const QList<MappedModule> &modules )
+{
+    QList<StackFrame> frames;
+    QList<quint64> addresses;
+    QHash<QString, QList<quint64> > uncachedAddresses;
+    for ( int i = 0; i < programCounters.size(); ++i ) {
+        const quint64 pc = programCounters[i];
+
+        StackFrame frame = StackFrame();
+        quint64 address = pc;
+        foreach ( const MappedModule &module, modules ) {
+            if ( pc >= module.start && pc < module.end ) {
+                const quint64 fileOffset = pc - module.start + module.offset;
+                address = fileOffset + linkAddressDelta( module.path, fileOffset );
+                frame.module = module.path;
+
+                const ModuleCache &cache = moduleCache( module.path );
+                if ( !cache.unusable && !cache.frames.contains( address ) &&
+                     !uncachedAddresses[module.path].contains( address ) ) {
+                    uncachedAddresses[module.path].append( address );
+                }
+                break;
+            }
+        }
+        frame.function = hexAddress( address );
+        frames.append( frame );
+        addresses.append( address );
+    }
+
+    QHash<QString, QList<quint64> >::const_iterator it, end = uncachedAddresses.constEnd();
+    for ( it = uncachedAddresses.constBegin(); it != end; ++it ) {
+        if ( !it.value().isEmpty() ) {
+            runAddr2Line( it.key(), it.value() );
+        }
+    }
+
+    for ( int i = 0; i < frames.size(); ++i ) {
+        if ( frames[i].module.isEmpty() ) {
+            continue;
+        }
+        const ModuleCache &cache = m_modules[frames[i].module];
+        QHash<quint64, StackFrame>::const_iterator cached = cache.frames.constFind( addresses[i] );
+        if ( cached != cache.frames.constEnd() ) {
+            frames[i] = *cached;
+        }
+    }
+
+    e.backtrace = frames;
+    if ( !frames.isEmpty() ) {
+        const StackFrame &frame = frames.first();
+        e.path = frame.sourceFile;
+        e.lineno = frame.lineNumber;
+        e.function = frame.function;
+    }
+    if ( e.path.isEmpty() ) {
+        e.path = QLatin1String( "<unknown file>" );
+    }
+    if ( e.function.isEmpty() ) {
+        e.function = QLatin1String( "<unknown function>" );
+    }
+}
+
+/* Returns the cache for the given module, which is emptied first if the
+ * module changed since the cached frames were found.
+ */
+CrashSymbolizer::ModuleCache &CrashSymbolizer::moduleCache( const QString &path )
+{
+    const QDateTime lastModified = QFileInfo( path ).lastModified();
+    ModuleCache &cache = m_modules[path];
+    if ( cache.lastModified != lastModified || cache.frames.size() > MaximumCachedFramesPerModule ) {
+        cache = ModuleCache();
+        cache.lastModified = lastModified;
+    }
+    return cache;
+}
+
+/* Adds the frames for the given addresses within the module to its cache;
+ * the module is marked unusable if addr2line fails for it.
+ */
+void CrashSymbolizer::runAddr2Line( const QString &path, const QList<quint64> &addresses )
+{
+    ModuleCache &cache = m_modules[path];
+
+    QStringList arguments;
+    arguments << QLatin1String( "-f" ) << QLatin1String( "-C" )
+              << QLatin1String( "-e" ) << path;
+    foreach ( quint64 address, addresses ) {
+        arguments << hexAddress( address );
+    }
+
+    QProcess addr2line;
+    addr2line.start( QLatin1String( "addr2line" ), arguments );
+    if ( !addr2line.waitForFinished( 10000 ) ) {
+        addr2line.kill();
+        addr2line.waitForFinished();
+        cache.unusable = true;
+        return;
+    }
+    if ( addr2line.exitStatus() != QProcess::NormalExit || addr2line.exitCode() != 0 ) {
+        cache.unusable = true;
+        return;
+    }
+
+    // Two lines per address: the function and <file>:<line>
+    const QStringList lines = QString::fromLocal8Bit( addr2line.readAllStandardOutput() ).split( QLatin1Char( '\n' ) );
+    for ( int i = 0; i < addresses.size() && 2 * i + 1 < lines.size(); ++i ) {
+        StackFrame frame = StackFrame();
+        frame.module = path;
+        frame.function = hexAddress( addresses[i] );
+        if ( lines[2 * i] != QLatin1String( "??" ) ) {
+            frame.function = lines[2 * i];
+        }
+
+        QString location = lines[2 * i + 1];
+        const int discriminator = location.indexOf( QLatin1String( " (discriminator" ) );
+        if ( discriminator != -1 ) {
+            location.truncate( discriminator );
+        }
+        const int colon = location.lastIndexOf( QLatin1Char( ':' ) );
+        if ( colon > 0 && !location.startsWith( QLatin1String( "??" ) ) ) {
+            frame.sourceFile = location.left( colon );
+            frame.lineNumber = location.mid( colon + 1 ).toULong();
+        }
+        cache.frames.insert( addresses[i], frame );
+    }
+}
+
+CrashSymbolizerThread::CrashSymbolizerThread( QObject *parent )
+    : QThread( parent ),
+    m_stopRequested( false )
+{
+}
+
+CrashSymbolizerThread::~CrashSymbolizerThread()
+{
+    stop();
+}
+
+void CrashSymbolizerThread::symbolizeLater( const TraceEntry &e, const QList<quint64> &programCounters,
+                                            const QList<MappedModule> &modules,
+                                            XmlParseEventsHandler *handler )
+{
+    Job job;
+    job.entry = e;
+    job.programCounters = programCounters;
+    job.modules = modules;
+    job.handler = handler;
+
+    QMutexLocker locker( &m_mutex );
+    if ( m_stopRequested ) {
+        return;
+    }
+    m_jobs.enqueue( job );
+    m_jobAvailable.wakeOne();
+}
+
+void CrashSymbolizerThread::stop()
+{
+    {
+        QMutexLocker locker( &m_mutex );
+        m_stopRequested = true;
+        m_jobs.clear();
+        m_jobAvailable.wakeOne();
+    }
+    wait();
+}
+
+void CrashSymbolizerThread::run()
+{
+    for ( ;; ) {
+        Job job;
+        {
+            QMutexLocker locker( &m_mutex );
+            while ( m_jobs.isEmpty() && !m_stopRequested ) {
+                m_jobAvailable.wait( &m_mutex );
+            }
+            if ( m_stopRequested ) {
+                return;
+            }
+            job = m_jobs.dequeue();
+        }
+
+        m_symbolizer.symbolize( job.entry, job.programCounters, job.modules );
+        job.handler->handleTraceEntry( job.entry );
+    }
+}
@@ -0,0 +1,118 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACER_CRASHSYMBOLIZER_H
+#define TRACER_CRASHSYMBOLIZER_H
+
+#include "database.h" // for TraceEntry, StackFrame
+
+#include <QDateTime>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+class XmlParseEventsHandler;
+
+/* An executable file mapping of a crashed process, as listed in its crash
+ * record.
+ */
+struct MappedModule
+{
+    quint64 start;
+    quint64 end;
+    quint64 offset;
+    QString path;
+};
+
+/* Turns the program counters of a crashed process into the backtrace and
+ * location of its crash entry. The frames are symbolized using addr2line
+ * if it's installed and the modules exist on this machine; otherwise they
+ * just name the module and the address within it.
+ *
+ * The frames found for each module are cached, so addr2line only runs for
+ * addresses it wasn't asked about before; modules it fails for aren't
+ * tried again until they are modified.
+ */
+class CrashSymbolizer
+{
+public:
+    void symbolize( TraceEntry &e, const QList<quint64> &programCounters,
+                    const QList<MappedModule> &modules );
+
+private:
+    struct ModuleCache
+    {
+        ModuleCache() : unusable( false ) { }
+
+        QDateTime lastModified;
+        bool unusable;
+        QHash<quint64, StackFrame> frames;
+    };
+
+    ModuleCache &moduleCache( const QString &path );
+    void runAddr2Line( const QString &path, const QList<quint64> &addresses );
+
+    QHash<QString, ModuleCache> m_modules;
+};
+
+/* Symbolizes crash entries in a thread of its own and passes them on to
+ * the given handler afterwards, so that running addr2line doesn't hold up
+ * the thread parsing the connection. A crash entry may therefore reach the
+ * handler after entries which the traced process recorded later.
+ */
+class CrashSymbolizerThread : public QThread
+{
+public:
+    explicit CrashSymbolizerThread( QObject *parent = 0 );
+    ~CrashSymbolizerThread();
+
+    /* The handler has to stay around until the thread was stopped. */
+    void symbolizeLater( const TraceEntry &e, const QList<quint64> &programCounters,
+                         const QList<MappedModule> &modules,
+                         XmlParseEventsHandler *handler );
+
+    /* Drops the entries which weren't symbolized yet and waits for the
+     * thread to finish.
+     */
+    void stop();
+
+protected:
+    virtual void run();
+
+private:
+    struct Job
+    {
+        TraceEntry entry;
+        QList<quint64> programCounters;
+        QList<MappedModule> modules;
+        XmlParseEventsHandler *handler;
+    };
+
+    CrashSymbolizer m_symbolizer;
+    QMutex m_mutex;
+    QWaitCondition m_jobAvailable;
+    QQueue<Job> m_jobs;
+    bool m_stopRequested;
+};
+
+#endif // TRACER_CRASHSYMBOLIZER_H
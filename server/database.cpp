@@ -24,6 +24,7 @@
 #include <QDataStream>
 #include <QDebug>
 #include <QFile>
+#include <QHash>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
@@ -39,7 +40,8 @@ public:
 
 Transaction::Transaction( QSqlDatabase db )
     : m_query( db ),
-    m_commitChanges( true )
+    m_commitChanges( true ),
+    m_finished( false )
 {
     m_query.setForwardOnly( true );
     m_query.exec( "BEGIN TRANSACTION;" );
@@ -47,7 +49,18 @@ Transaction::Transaction( QSqlDatabase db )
 
 Transaction::~Transaction()
 {
-    m_query.exec( m_commitChanges ? "COMMIT;" : "ROLLBACK;" );
+    if ( !m_finished ) {
+        m_query.exec( m_commitChanges ? "COMMIT;" : "ROLLBACK;" );
+    }
+}
+
+void Transaction::rollback()
+{
+    if ( !m_finished ) {
+        m_query.exec( "ROLLBACK;" );
+        m_commitChanges = false;
+        m_finished = true;
+    }
 }
 
 QVariant Transaction::exec( const QString &statement )
@@ -79,7 +92,63 @@ QVariant Transaction::insert( const QString &statement )
     return m_query.lastInsertId();
 }
 
-const int Database::expectedVersion = 5;
+QVariant Transaction::exec( QSqlQuery &query )
+{
+    if ( !query.exec() ) {
+        m_commitChanges = false;
+        throw SQLTransactionException( QString( "Failed to store entry in database: executing SQL command '%1' failed: %2" )
+                                        .arg( query.lastQuery() ).arg( query.lastError().text() ),
+                                       query.lastError().text(),
+                                       query.lastError().number() );
+    }
+    QVariant result;
+    if ( query.next() ) {
+        result = query.value( 0 );
+    }
+    // Statements still in progress would keep the transaction from being committed
+    query.finish();
+    return result;
+}
+
+QVariant Transaction::insert( QSqlQuery &query )
+{
+    if ( !query.exec() ) {
+        m_commitChanges = false;
+        throw SQLTransactionException( QString( "Failed to store entry in database: executing SQL command '%1' failed: %2" )
+                                        .arg( query.lastQuery() ).arg( query.lastError().text() ),
+                                       query.lastError().text(),
+                                       query.lastError().number() );
+    }
+
+    assert( query.driver()->hasFeature( QSqlDriver::LastInsertId ) );
+    const QVariant id = query.lastInsertId();
+    query.finish();
+    return id;
+}
+
+// The queries are never deleted at exit, the connections may be gone by then
+typedef QHash<const char *, QSqlQuery *> QueryHash;
+static QHash<QString, QueryHash> g_preparedStatements;
+
+QSqlQuery &PreparedStatements::get( QSqlDatabase db, const char *statement )
+{
+    QSqlQuery *&query = g_preparedStatements[db.connectionName()][statement];
+    if ( !query ) {
+        query = new QSqlQuery( db );
+        query->setForwardOnly( true );
+        // Failures are reported when the query is executed
+        query->prepare( QString::fromLatin1( statement ) );
+    }
+    return *query;
+}
+
+void PreparedStatements::release( QSqlDatabase db )
+{
+    const QueryHash queries = g_preparedStatements.take( db.connectionName() );
+    qDeleteAll( queries );
+}
+
+const int Database::expectedVersion = 8;
 
 static const char * const schemaStatements[] = {
     "CREATE TABLE schema_downgrade (from_version INTEGER,"
@@ -112,6 +181,7 @@ static const char * const schemaStatements[] = {
     "CREATE TABLE traced_thread (id INTEGER PRIMARY KEY AUTOINCREMENT,"
     " process_id INTEGER,"
     " tid INTEGER,"
+    " name TEXT,"
     " UNIQUE(process_id, tid));",
     "CREATE TABLE variable (trace_entry_id INTEGER,"
     " name TEXT,"
@@ -129,14 +199,39 @@ static const char * const schemaStatements[] = {
     " UNIQUE(name));"
 };
 
+/* The thread and trace point indexes serve the filters of the entry view,
+ * the watch tree (which looks for the latest entry per trace point and
+ * thread) and the cleanup after archiving; the others serve looking up
+ * the entries of a time span and the data belonging to an entry.
+ */
+static const char * const indexStatements[] = {
+    "CREATE INDEX IF NOT EXISTS trace_entry_thread_index ON trace_entry (traced_thread_id);",
+    "CREATE INDEX IF NOT EXISTS trace_entry_trace_point_index ON trace_entry (trace_point_id, traced_thread_id);",
+    "CREATE INDEX IF NOT EXISTS trace_entry_timestamp_index ON trace_entry (timestamp);",
+    "CREATE INDEX IF NOT EXISTS variable_trace_entry_index ON variable (trace_entry_id);",
+    "CREATE INDEX IF NOT EXISTS stackframe_trace_entry_index ON stackframe (trace_entry_id, depth);"
+};
+
 static const char * const downgradeStatementsInsert[] = {
     0, // can't downgrade further than version 0
     "INSERT INTO schema_downgrade VALUES(1, 'NOT IMPLEMENTED');",
     "INSERT INTO schema_downgrade VALUES(2, 'NOT IMPLEMENTED');",
     "INSERT INTO schema_downgrade VALUES(3, 'NOT IMPLEMENTED');",
     "INSERT INTO schema_downgrade VALUES(4, 'NOT IMPLEMENTED');",
-    "INSERT INTO schema_downgrade VALUES(5, 'NOT IMPLEMENTED');"
-
+    "INSERT INTO schema_downgrade VALUES(5, 'NOT IMPLEMENTED');",
+    "INSERT INTO schema_downgrade VALUES(6, 'UPDATE trace_entry SET timestamp = timestamp / 1000000;');",
+    // SQLite only supports DROP COLUMN since 3.35, so the table is copied
+    "INSERT INTO schema_downgrade VALUES(7, 'CREATE TEMPORARY TABLE traced_thread_backup (id INTEGER PRIMARY KEY AUTOINCREMENT, process_id INTEGER, tid INTEGER);"
+    " INSERT INTO traced_thread_backup SELECT id, process_id, tid FROM traced_thread;"
+    " DROP TABLE traced_thread;"
+    " CREATE TABLE traced_thread (id INTEGER PRIMARY KEY AUTOINCREMENT, process_id INTEGER, tid INTEGER, UNIQUE(process_id, tid));"
+    " INSERT INTO traced_thread SELECT id, process_id, tid FROM traced_thread_backup;"
+    " DROP TABLE traced_thread_backup;');",
+    "INSERT INTO schema_downgrade VALUES(8, 'DROP INDEX trace_entry_thread_index;"
+    " DROP INDEX trace_entry_trace_point_index;"
+    " DROP INDEX trace_entry_timestamp_index;"
+    " DROP INDEX variable_trace_entry_index;"
+    " DROP INDEX stackframe_trace_entry_index;');"
 };
 
 int Database::currentVersion( QSqlDatabase db, QString *errMsg )
@@ -210,6 +305,15 @@ QSqlDatabase Database::create(const QString &fileName,
 	    return QSqlDatabase();
 	}
     }
+    for (unsigned i = 0; i < sizeof(indexStatements) / sizeof(indexStatements[0]); ++i) {
+	if (!query.exec(indexStatements[i])) {
+	    *errMsg = QObject::tr("Failed to execute '%1': %2")
+		.arg(indexStatements[i])
+		.arg(query.lastError().text());
+	    query.exec("ROLLBACK;");
+	    return QSqlDatabase();
+	}
+    }
     // statements that allow users of older versions
     // to downgrade a database created by us
     for (int v = 1; v <= expectedVersion; ++v) {
@@ -278,12 +382,20 @@ static QString downgradeStatementsForVersion(QSqlDatabase db,
 
 static void downgradeVersion(QSqlDatabase db, int version)
 {
-    QString sql = downgradeStatementsForVersion(db, version);
+    // The driver only executes one statement at a time
+    const QStringList statements = downgradeStatementsForVersion(db, version)
+        .split(';', QString::SkipEmptyParts);
     db.transaction();
     QSqlQuery query(db);
-    if (!query.exec(sql)) {
-        db.rollback();
-        throw Qruntime_error(query.lastError().text());
+    QStringList::ConstIterator it, end = statements.end();
+    for (it = statements.begin(); it != end; ++it) {
+        if (it->trimmed().isEmpty()) {
+            continue;
+        }
+        if (!query.exec(*it)) {
+            db.rollback();
+            throw Qruntime_error(query.lastError().text());
+        }
     }
     // even remove the downgrade statements to make the conversion
     // perfect. remember that they are being used to designate the
@@ -373,8 +485,69 @@ static bool upgradeToVersion5(QSqlDatabase db, QString *errMsg)
     return true;
 }
 
+// trace entry timestamps are stored in nanoseconds instead of milliseconds
+static bool upgradeToVersion6(QSqlDatabase db, QString *errMsg)
+{
+    const char* const statements[] = {
+	"BEGIN TRANSACTION;",
+	"UPDATE trace_entry SET timestamp = timestamp * 1000000;",
+	downgradeStatementsInsert[6],
+	"COMMIT;" };
+    QSqlQuery query(db);
+    for (unsigned i = 0; i < sizeof(statements)/sizeof(char*); ++i) {
+	if (!query.exec(statements[i])) {
+	    *errMsg = query.lastError().text();
+	    return false;
+	}
+    }
+    return true;
+}
+
+// threads may have a name
+static bool upgradeToVersion7(QSqlDatabase db, QString *errMsg)
+{
+    const char* const statements[] = {
+	"BEGIN TRANSACTION;",
+	"ALTER TABLE traced_thread ADD COLUMN name TEXT;",
+	downgradeStatementsInsert[7],
+	"COMMIT;" };
+    QSqlQuery query(db);
+    for (unsigned i = 0; i < sizeof(statements)/sizeof(char*); ++i) {
+	if (!query.exec(statements[i])) {
+	    *errMsg = query.lastError().text();
+	    return false;
+	}
+    }
+    return true;
+}
+
+/* Each index is created in a transaction of its own, so that the database
+ * is only locked while one of them is built, and an interrupted upgrade
+ * can be resumed.
+ */
+static bool upgradeToVersion8(QSqlDatabase db, QString *errMsg,
+                              Database::ProgressFunction progress)
+{
+    const unsigned count = sizeof(indexStatements) / sizeof(indexStatements[0]);
+    QSqlQuery query(db);
+    for (unsigned i = 0; i < count; ++i) {
+        if (progress) {
+            progress(QObject::tr("Creating index %1 of %2...").arg(i + 1).arg(count));
+        }
+        if (!query.exec(indexStatements[i])) {
+            *errMsg = query.lastError().text();
+            return false;
+        }
+    }
+    if (!query.exec(downgradeStatementsInsert[8])) {
+        *errMsg = query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
 static bool upgradeVersion(QSqlDatabase db, int version,
-			   QString *errMsg)
+			   QString *errMsg, Database::ProgressFunction progress)
 {
     switch (version) {
     case 0:
@@ -382,13 +555,20 @@ static bool upgradeVersion(QSqlDatabase db, int version,
     case 4:
     return upgradeToVersion5(db, errMsg);
 	break;
+    case 5:
+	return upgradeToVersion6(db, errMsg);
+    case 6:
+	return upgradeToVersion7(db, errMsg);
+    case 7:
+	return upgradeToVersion8(db, errMsg, progress);
     default:
 	*errMsg = QObject::tr("Automatic upgrade to version %1 is not implemented");
 	return false;
     }
 }
 
-bool Database::upgrade(QSqlDatabase db, QString *errMsg)
+bool Database::upgrade(QSqlDatabase db, QString *errMsg,
+                       ProgressFunction progress)
 {
     const int current = currentVersion(db, errMsg);
     if (current == -1)
@@ -402,7 +582,10 @@ bool Database::upgrade(QSqlDatabase db, QString *errMsg)
 	return false;
     }
     for (int v = current; v < expectedVersion; ++v) {
-	if (!upgradeVersion(db, v, errMsg))
+	if (progress) {
+	    progress(QObject::tr("Upgrading to version %1...").arg(v + 1));
+	}
+	if (!upgradeVersion(db, v, errMsg, progress))
 	    return false;
     }
     return true;
@@ -570,7 +753,7 @@ QDataStream &operator<<( QDataStream &stream, const TraceEntry &entry )
         << entry.processStartTime
         << entry.processName
         << (quint32)entry.tid
-        << entry.timestamp
+        << (quint64)entry.timestamp
         << (quint8)entry.type
         << entry.path
         << (quint32)entry.lineno
@@ -587,13 +770,13 @@ QDataStream &operator>>( QDataStream &stream, TraceEntry &entry )
 {
     quint32 pid, tid, lineno;
     quint8 type;
-    quint64 stackPosition;
+    quint64 timestamp, stackPosition;
 
     stream >> pid
         >> entry.processStartTime
         >> entry.processName
         >> tid
-        >> entry.timestamp
+        >> timestamp
         >> type
         >> entry.path
         >> lineno
@@ -607,6 +790,7 @@ QDataStream &operator>>( QDataStream &stream, TraceEntry &entry )
 
     entry.pid = pid;
     entry.tid = tid;
+    entry.timestamp = timestamp;
     entry.lineno = lineno;
     entry.type = type;
     entry.stackPosition = stackPosition;
@@ -69,7 +69,8 @@ struct TraceEntry
     QDateTime processStartTime;
     QString processName;
     unsigned int tid;
-    QDateTime timestamp;
+    QString threadName; // empty if unknown
+    quint64 timestamp; // nanoseconds since the epoch
     unsigned int type;
     QString path;
     unsigned long lineno;
@@ -80,6 +81,11 @@ struct TraceEntry
     QList<StackFrame> backtrace;
     unsigned long stackPosition;
     QList<TraceKey> traceKeys;
+
+    /* Entries with the same non-zero key share type, path, line number,
+     * function and group; zero if no such key was transmitted.
+     */
+    unsigned int tracePointKey;
 };
 
 QDataStream &operator<<( QDataStream &stream, const TraceEntry &entry );
@@ -132,12 +138,37 @@ public:
     QVariant exec( const QString &statement );
     QVariant insert( const QString &statement );
 
+    // Execute a prepared query (see PreparedStatements) with bound values.
+    QVariant exec( QSqlQuery &query );
+    QVariant insert( QSqlQuery &query );
+
+    /* Discards all changes right away; failing statements do that when the
+     * transaction ends, other errors need to call this.
+     */
+    void rollback();
+
 private:
     Transaction( const Transaction &other );
     void operator=( const Transaction &rhs );
 
     QSqlQuery m_query;
     bool m_commitChanges;
+    bool m_finished;
+};
+
+/* Statements which are prepared only once per database connection, so that
+ * SQLite doesn't parse and plan them again each time they're executed.
+ * Values are bound to the placeholders of the returned query before it's
+ * passed to Transaction::exec or Transaction::insert.
+ */
+class PreparedStatements
+{
+public:
+    // The statement is identified by its address, so it should be a literal.
+    static QSqlQuery &get( QSqlDatabase db, const char *statement );
+
+    // Needs to be called before the connection is removed.
+    static void release( QSqlDatabase db );
 };
 
 class Database
@@ -154,8 +185,12 @@ public:
     static QSqlDatabase openAnyVersion(const QString &fileName,
 				       QString *errMsg);
 
+    // Called with a description of each step of an upgrade
+    typedef void (*ProgressFunction)(const QString &step);
+
     static bool downgrade(QSqlDatabase db, QString *errMsg);
-    static bool upgrade(QSqlDatabase db, QString *errMsg);
+    static bool upgrade(QSqlDatabase db, QString *errMsg,
+                        ProgressFunction progress = 0);
 
     static bool isValidFileName(const QString &fileName,
                                 QString *errMsg);
@@ -20,9 +20,11 @@
 #include "databasefeeder.h"
 
 #include "database.h"
-#include "lru_cache.h"
 
+#include <QDebug>
 #include <QDir>
+#include <QHash>
+#include <QPair>
 #include <QSqlDatabase>
 #include <QSqlError>
 #include <QSqlQuery>
@@ -35,9 +37,13 @@ using namespace std;
 
 static bool getGroupId( QSqlDatabase db, Transaction *transaction, const QString &name, unsigned int *id )
 {
-    QVariant v = transaction->exec( QString( "SELECT id FROM trace_point_group WHERE name=%1;" ).arg( Database::formatValue( db, name ) ) );
+    QSqlQuery &selectQuery = PreparedStatements::get( db, "SELECT id FROM trace_point_group WHERE name=?;" );
+    selectQuery.addBindValue( name );
+    QVariant v = transaction->exec( selectQuery );
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO trace_point_group VALUES(NULL, %1);" ).arg( Database::formatValue( db, name ) ) );
+        QSqlQuery &insertQuery = PreparedStatements::get( db, "INSERT INTO trace_point_group VALUES(NULL, ?);" );
+        insertQuery.addBindValue( name );
+        v = transaction->insert( insertQuery );
     }
 
     if ( !id ) {
@@ -49,6 +55,114 @@ static bool getGroupId( QSqlDatabase db, Transaction *transaction, const QString
     return ok;
 }
 
+/* The rough number of bytes a table entry takes up, used for keeping the
+ * tables within their memory budget.
+ */
+template <typename Key>
+static qint64 memoryUsage( const Key & )
+{
+    return sizeof( Key ) + sizeof( unsigned int ) + 2 * sizeof( void * );
+}
+
+static qint64 memoryUsage( const QString &s )
+{
+    return memoryUsage<QString>( s ) + sizeof( QArrayData ) + ( s.size() + 1 ) * sizeof( QChar );
+}
+
+/* Maps the values stored in one of the lookup tables of the database (path
+ * names, processes, ...) to the IDs of their rows. A table holds all rows
+ * of the database (see IdTables::load), so a value which is not found in
+ * it doesn't need to be looked up in the database either; that is, unless
+ * the table ran out of memory, in which case it's no longer complete.
+ */
+template <typename Key>
+class IdTable
+{
+public:
+    // Without a budget, the table may use any amount of memory
+    explicit IdTable( qint64 *budget = 0 )
+        : m_budget( budget ), m_memoryUsage( 0 ), m_complete( true ), m_hits( 0 ), m_misses( 0 ) { }
+
+    void clear()
+    {
+        if ( m_budget ) {
+            *m_budget += m_memoryUsage;
+        }
+        m_memoryUsage = 0;
+        m_ids.clear();
+        m_complete = true;
+    }
+
+    // Whether values which are not in the table are not in the database either
+    bool isComplete() const { return m_complete; }
+    void setIncomplete() { m_complete = false; }
+
+    bool contains( const Key &key ) const { return m_ids.contains( key ); }
+
+    bool find( const Key &key, unsigned int *id )
+    {
+        typename QHash<Key, unsigned int>::ConstIterator it = m_ids.constFind( key );
+        if ( it == m_ids.constEnd() ) {
+            ++m_misses;
+            return false;
+        }
+        ++m_hits;
+        *id = it.value();
+        return true;
+    }
+
+    // Returns false if the budget is used up.
+    bool insert( const Key &key, unsigned int id )
+    {
+        if ( !reserve( memoryUsage( key ) ) ) {
+            m_complete = false;
+            return false;
+        }
+        m_ids.insert( key, id );
+        return true;
+    }
+
+    QString statistics( const char *name ) const
+    {
+        const quint64 lookups = m_hits + m_misses;
+        return QString( "%1: %2 entries (%3 kB), %4 of %5 lookups hit (%6%)%7" )
+            .arg( QLatin1String( name ) )
+            .arg( m_ids.size() )
+            .arg( m_memoryUsage / 1024 )
+            .arg( m_hits )
+            .arg( lookups )
+            .arg( lookups > 0 ? 100.0 * m_hits / lookups : 0.0, 0, 'f', 1 )
+            .arg( QLatin1String( m_complete ? "" : ", incomplete" ) );
+    }
+
+protected:
+    /* Takes memory for data kept along with the IDs from the budget;
+     * returns false if it's used up.
+     */
+    bool reserve( qint64 size )
+    {
+        if ( m_budget && *m_budget < size ) {
+            return false;
+        }
+        if ( m_budget ) {
+            *m_budget -= size;
+        }
+        m_memoryUsage += size;
+        return true;
+    }
+
+private:
+    IdTable( const IdTable &other );
+    void operator=( const IdTable &rhs );
+
+    QHash<Key, unsigned int> m_ids;
+    qint64 *m_budget;
+    qint64 m_memoryUsage;
+    bool m_complete;
+    quint64 m_hits;
+    quint64 m_misses;
+};
+
 class TraceKeyCache {
 public:
     void update( QSqlDatabase db, Transaction *transaction,
@@ -56,25 +170,31 @@ public:
          const QList<TraceKey> &traceKeys ) {
         QList<TraceKey>::ConstIterator it, end = traceKeys.end();
         for ( it = traceKeys.begin(); it != end; ++it ) {
-            if ( m_map.find( (*it).name ) == m_map.end() ) {
+            if ( !m_groups.contains( (*it).name ) ) {
                 registerGroupName( db, transaction, (*it).name );
             }
         }
         // in case the entry comes with a name not listed in the
         // AUT-side configuration file
-        if ( !groupName.isNull() && m_map.find( groupName ) == m_map.end() ) {
+        if ( !groupName.isNull() && !m_groups.contains( groupName ) ) {
             registerGroupName( db, transaction, groupName );
         }
     }
     void clear() {
-        m_map.clear();
+        m_groups.clear();
+    }
+    void load( const QString &name, unsigned int id ) {
+        m_groups.insert( name, id );
     }
-    unsigned int fetch( const QString &name ) const {
-        std::map<QString, unsigned int>::const_iterator it = m_map.find( name );
-        if ( it == m_map.end() ) {
+    unsigned int fetch( const QString &name ) {
+        unsigned int id;
+        if ( !m_groups.find( name, &id ) ) {
             throw runtime_error( QString( "Failed to find trace point group %1 in cache" ).arg( name ).toUtf8().constData() );
         }
-        return (*it).second;
+        return id;
+    }
+    QString statistics() const {
+        return m_groups.statistics( "trace point groups" );
     }
 private:
     void registerGroupName( QSqlDatabase db, Transaction *transaction, const QString &name )
@@ -83,147 +203,211 @@ private:
         if ( !getGroupId( db, transaction, name, &id ) ) {
             throw runtime_error( "Read non-numeric trace point group id from database - corrupt database?" );
         }
-        m_map[name] = id;
-    }
-
-    std::map<QString, unsigned int> m_map;
-} traceKeyCache;
-
-template <typename KeyType, typename IdType, int CacheSize = 10>
-class StorageCache
-{
-public:
-    StorageCache() : m_lru( CacheSize ) { }
-    void clear()
-    {
-    m_lru.clear();
+        m_groups.insert( name, id );
     }
-protected:
-    typedef KeyType CacheKey;
 
-    IdType* checkCache( const KeyType &key )
-    {
-    return m_lru.fetch_ptr( key );
-    }
-    void cache( const KeyType &key, IdType id )
-    {
-    m_lru.insert( key, id );
-    }
-
-private:
-    LRUCache<KeyType, IdType> m_lru;
+    // There are only few groups, and all of them are needed
+    IdTable<QString> m_groups;
 };
 
-class PathCache : public StorageCache<QString, unsigned int> {
+class PathCache : public IdTable<QString> {
 public:
+    explicit PathCache( qint64 *budget ) : IdTable<QString>( budget ) { }
+
     unsigned int store( QSqlDatabase db, Transaction *transaction,
             const QString &path )
     {
-    unsigned int *cachedId = checkCache( path );
-    if ( cachedId )
-        return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM path_name WHERE name=%1;" ).arg( Database::formatValue( db, path ) ) );
+    unsigned int cachedId;
+    if ( find( path, &cachedId ) )
+        return cachedId;
+    QVariant v;
+    if ( !isComplete() ) {
+        QSqlQuery &selectQuery = PreparedStatements::get( db, "SELECT id FROM path_name WHERE name=?;" );
+        selectQuery.addBindValue( path );
+        v = transaction->exec( selectQuery );
+    }
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO path_name VALUES(NULL, %1);" ).arg( Database::formatValue( db, path ) ) );
+        QSqlQuery &insertQuery = PreparedStatements::get( db, "INSERT INTO path_name VALUES(NULL, ?);" );
+        insertQuery.addBindValue( path );
+        v = transaction->insert( insertQuery );
     }
     bool ok;
     unsigned int pathId = v.toUInt( &ok );
     if ( !ok ) {
         throw runtime_error( "Failed to store entry in database: read non-numeric path id from database - corrupt database?" );
     }
-    cache( path, pathId );
+    insert( path, pathId );
     return pathId;
     }
-} pathCache;
+};
 
-class FunctionCache : public StorageCache<QString, unsigned int> {
+class FunctionCache : public IdTable<QString> {
 public:
+    explicit FunctionCache( qint64 *budget ) : IdTable<QString>( budget ) { }
+
     unsigned int store( QSqlDatabase db, Transaction *transaction,
             const QString &function )
     {
-    unsigned int *cachedId = checkCache( function );
-    if ( cachedId )
-        return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM function_name WHERE name=%1;" ).arg( Database::formatValue( db, function ) ) );
+    unsigned int cachedId;
+    if ( find( function, &cachedId ) )
+        return cachedId;
+    QVariant v;
+    if ( !isComplete() ) {
+        QSqlQuery &selectQuery = PreparedStatements::get( db, "SELECT id FROM function_name WHERE name=?;" );
+        selectQuery.addBindValue( function );
+        v = transaction->exec( selectQuery );
+    }
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO function_name VALUES(NULL, %1);" ).arg( Database::formatValue( db, function ) ) );
+        QSqlQuery &insertQuery = PreparedStatements::get( db, "INSERT INTO function_name VALUES(NULL, ?);" );
+        insertQuery.addBindValue( function );
+        v = transaction->insert( insertQuery );
     }
     bool ok;
     unsigned int functionId = v.toUInt( &ok );
     if ( !ok ) {
         throw runtime_error( "Failed to store entry in database: read non-numeric function id from database - corrupt database?" );
     }
-    cache( function, functionId );
+    insert( function, functionId );
     return functionId;
     }
-} functionCache;
+};
 
-class ProcessCache : public StorageCache<std::pair<QString, unsigned int>,
-                     unsigned int>
+// Processes are identified by their PID and start time (in msecs since the epoch)
+typedef QPair<unsigned int, qint64> ProcessKey;
+
+class ProcessCache : public IdTable<ProcessKey>
 {
 public:
+    explicit ProcessCache( qint64 *budget ) : IdTable<ProcessKey>( budget ) { }
+
     unsigned int store( QSqlDatabase db, Transaction *transaction,
             const QString &processName,
             unsigned int pid,
             const QDateTime &processStartTime )
     {
-    CacheKey key( processName, pid );
-    unsigned int *cachedId = checkCache( key );
-    if ( cachedId )
-        return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM process WHERE pid=%1 AND start_time=%2;" ).arg( pid ).arg( Database::formatValue( db, processStartTime ) ) );
+    ProcessKey key( pid, processStartTime.toMSecsSinceEpoch() );
+    unsigned int cachedId;
+    if ( find( key, &cachedId ) )
+        return cachedId;
+    QVariant v;
+    if ( !isComplete() ) {
+        QSqlQuery &selectQuery = PreparedStatements::get( db, "SELECT id FROM process WHERE pid=? AND start_time=?;" );
+        selectQuery.addBindValue( key.first );
+        selectQuery.addBindValue( key.second );
+        v = transaction->exec( selectQuery );
+    }
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO process VALUES(NULL, %1, %2, %3, 0);" ).arg( Database::formatValue( db, processName ) ).arg( pid ).arg( Database::formatValue( db, processStartTime ) ) );
+        QSqlQuery &insertQuery = PreparedStatements::get( db, "INSERT INTO process VALUES(NULL, ?, ?, ?, 0);" );
+        insertQuery.addBindValue( processName );
+        insertQuery.addBindValue( key.first );
+        insertQuery.addBindValue( key.second );
+        v = transaction->insert( insertQuery );
     }
     bool ok;
     unsigned int processId = v.toUInt( &ok );
     if ( !ok ) {
         throw runtime_error( "Failed to store entry in database: read non-numeric process id from database - corrupt database?" );
     }
-    cache( key, processId );
+    insert( key, processId );
     return processId;
     }
-} processCache;
+};
 
-class ThreadCache : public StorageCache<std::pair<unsigned int, unsigned int>,
-                    unsigned int>
+// Threads are identified by the ID of their process and their TID
+typedef QPair<unsigned int, unsigned int> ThreadKey;
+
+class ThreadCache : public IdTable<ThreadKey>
 {
 public:
+    explicit ThreadCache( qint64 *budget ) : IdTable<ThreadKey>( budget ) { }
+
+    void clear()
+    {
+        IdTable<ThreadKey>::clear();
+        m_names.clear();
+    }
+
+    // Returns false if the budget is used up.
+    bool insert( const ThreadKey &key, unsigned int id, const QString &name )
+    {
+        if ( !IdTable<ThreadKey>::insert( key, id ) ) {
+            return false;
+        }
+        rememberName( id, name );
+        return true;
+    }
+
+    /* Most entries carry the name of their thread, so the name is only
+     * written if it differs from the one in the database; an empty name
+     * never replaces a stored one.
+     */
     unsigned int store( QSqlDatabase db, Transaction *transaction,
             unsigned int processId,
-            unsigned int tid )
+            unsigned int tid,
+            const QString &name )
     {
-    CacheKey key( processId, tid );
-    unsigned int *cachedId = checkCache( key );
-    if ( cachedId )
-        return *cachedId;
+    ThreadKey key( processId, tid );
+    unsigned int cachedId;
+    if ( find( key, &cachedId ) ) {
+        if ( !name.isEmpty() && m_names.value( cachedId ) != name ) {
+            storeName( db, transaction, cachedId, name );
+            rememberName( cachedId, name );
+        }
+        return cachedId;
+    }
 
-    QVariant v = transaction->exec( QString( "SELECT id FROM traced_thread WHERE process_id=%1 AND tid=%2;" ).arg( processId ).arg( tid ) );
+    QVariant v;
+    if ( !isComplete() ) {
+        QSqlQuery &selectQuery = PreparedStatements::get( db, "SELECT id FROM traced_thread WHERE process_id=? AND tid=?;" );
+        selectQuery.addBindValue( processId );
+        selectQuery.addBindValue( tid );
+        v = transaction->exec( selectQuery );
+    }
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO traced_thread VALUES(NULL, %1, %2);" ).arg( processId ).arg( tid ) );
+        QSqlQuery &insertQuery = PreparedStatements::get( db, "INSERT INTO traced_thread VALUES(NULL, ?, ?, ?);" );
+        insertQuery.addBindValue( processId );
+        insertQuery.addBindValue( tid );
+        insertQuery.addBindValue( name );
+        v = transaction->insert( insertQuery );
+    } else if ( !name.isEmpty() ) {
+        storeName( db, transaction, v.toUInt(), name );
     }
     bool ok;
     unsigned int threadId = v.toUInt( &ok );
     if ( !ok ) {
         throw runtime_error( "Failed to store entry in database: read non-numeric traced thread id from database - corrupt database?" );
     }
-    cache( key, threadId );
+    insert( key, threadId, name );
     return threadId;
     }
-} threadCache;
 
-static unsigned int storeGroup( QSqlDatabase db, Transaction *transaction,
-                const QString &groupName,
-                const QList<TraceKey> &traceKeys )
-{
-    traceKeyCache.update( db, transaction, groupName, traceKeys );
+private:
+    void rememberName( unsigned int threadId, const QString &name )
+    {
+        if ( name.isEmpty() ) {
+            return;
+        }
+        // Threads are rarely renamed, so a new name is not charged to the budget again
+        QHash<unsigned int, QString>::Iterator it = m_names.find( threadId );
+        if ( it != m_names.end() ) {
+            *it = name;
+        } else if ( reserve( memoryUsage( name ) ) ) {
+            m_names.insert( threadId, name );
+        }
+    }
 
-    unsigned int groupId = 0;
-    if ( !groupName.isNull() ) {
-    groupId = traceKeyCache.fetch( groupName );
+    void storeName( QSqlDatabase db, Transaction *transaction,
+            unsigned int threadId, const QString &name )
+    {
+    QSqlQuery &query = PreparedStatements::get( db, "UPDATE traced_thread SET name=? WHERE id=?;" );
+    query.addBindValue( name );
+    query.addBindValue( threadId );
+    transaction->exec( query );
     }
-    return groupId;
-}
+
+    // The names stored in the database, by thread ID
+    QHash<unsigned int, QString> m_names;
+};
 
 // ### some portable, ready-made tuple template type would be nice
 struct TracePointTuple
@@ -234,21 +418,24 @@ struct TracePointTuple
     unsigned int functionId;
     unsigned int groupId;
 
-    bool operator<(const TracePointTuple &tp) const
+    bool operator==(const TracePointTuple &tp) const
     {
-        if ( type != tp.type ) return type < tp.type;
-        if ( pathId != tp.pathId ) return pathId < tp.pathId;
-        if ( lineno != tp.lineno ) return lineno < tp.lineno;
-        if ( functionId != tp.functionId ) return functionId < tp.functionId;
-        if ( groupId != tp.groupId ) return groupId < tp.groupId;
-        return false;
+        return type == tp.type && pathId == tp.pathId && lineno == tp.lineno &&
+               functionId == tp.functionId && groupId == tp.groupId;
     };
 };
 
-class TracePointCache : public StorageCache<TracePointTuple,
-                        unsigned int>
+static uint qHash( const TracePointTuple &tp, uint seed = 0 )
+{
+    return ( ( ( ( qHash( tp.type, seed ) * 31 + tp.pathId ) * 31 + uint( tp.lineno ) ) * 31 +
+             tp.functionId ) * 31 ) + tp.groupId;
+}
+
+class TracePointCache : public IdTable<TracePointTuple>
 {
 public:
+    explicit TracePointCache( qint64 *budget ) : IdTable<TracePointTuple>( budget ) { }
+
     unsigned int store( QSqlDatabase db, Transaction *transaction,
             unsigned int type,
             unsigned int pathId,
@@ -256,42 +443,207 @@ public:
             unsigned int functionId,
             unsigned int groupId )
     {
-    CacheKey key;
+    TracePointTuple key;
     key.type = type;
     key.pathId = pathId;
     key.lineno = lineno;
     key.functionId = functionId;
     key.groupId = groupId;
-    unsigned int *cachedId = checkCache( key );
-    if ( cachedId )
-        return *cachedId;
-    QVariant v = transaction->exec( QString( "SELECT id FROM trace_point WHERE type=%1 AND path_id=%2 AND line=%3 AND function_id=%4 AND group_id=%5;" ).arg( type ).arg( pathId ).arg( lineno ).arg( functionId ).arg( groupId ) );
+    unsigned int cachedId;
+    if ( find( key, &cachedId ) )
+        return cachedId;
+    QVariant v;
+    if ( !isComplete() ) {
+        QSqlQuery &selectQuery = PreparedStatements::get( db, "SELECT id FROM trace_point WHERE type=? AND path_id=? AND line=? AND function_id=? AND group_id=?;" );
+        selectQuery.addBindValue( type );
+        selectQuery.addBindValue( pathId );
+        selectQuery.addBindValue( static_cast<qint64>( lineno ) );
+        selectQuery.addBindValue( functionId );
+        selectQuery.addBindValue( groupId );
+        v = transaction->exec( selectQuery );
+    }
     if ( !v.isValid() ) {
-        v = transaction->insert( QString( "INSERT INTO trace_point VALUES(NULL, %1, %2, %3, %4, %5);" ).arg( type ).arg( pathId ).arg( lineno ).arg( functionId ).arg( groupId ) );
+        QSqlQuery &insertQuery = PreparedStatements::get( db, "INSERT INTO trace_point VALUES(NULL, ?, ?, ?, ?, ?);" );
+        insertQuery.addBindValue( type );
+        insertQuery.addBindValue( pathId );
+        insertQuery.addBindValue( static_cast<qint64>( lineno ) );
+        insertQuery.addBindValue( functionId );
+        insertQuery.addBindValue( groupId );
+        v = transaction->insert( insertQuery );
     }
     bool ok;
     unsigned int tracepointId = v.toUInt( &ok );
     if ( !ok ) {
         throw runtime_error( "Failed to store entry in database: read non-numeric tracepoint id from database - corrupt database?" );
     }
-    cache( key, tracepointId );
+    insert( key, tracepointId );
     return tracepointId;
     }
-} tracePointCache;
+};
+
+/* The ID tables of one database; all tables except the one for the trace
+ * point groups share the memory budget.
+ */
+class IdTables
+{
+public:
+    explicit IdTables( qint64 memoryBudget );
+
+    // Replaces the contents of all tables with the rows of the database.
+    void load( QSqlDatabase db );
+    void clear();
+    QStringList statistics() const;
+
+    // The part of the memory budget which is not used by the tables yet
+    qint64 availableMemory() const { return m_availableMemory; }
+
+    TraceKeyCache traceKeyCache;
+    PathCache pathCache;
+    FunctionCache functionCache;
+    ProcessCache processCache;
+    ThreadCache threadCache;
+    TracePointCache tracePointCache;
+
+private:
+    IdTables( const IdTables &other );
+    void operator=( const IdTables &rhs );
+
+    qint64 m_availableMemory;
+};
+
+IdTables::IdTables( qint64 memoryBudget )
+    : pathCache( &m_availableMemory ),
+    functionCache( &m_availableMemory ),
+    processCache( &m_availableMemory ),
+    threadCache( &m_availableMemory ),
+    tracePointCache( &m_availableMemory ),
+    m_availableMemory( memoryBudget )
+{
+}
+
+void IdTables::clear()
+{
+    tracePointCache.clear();
+    functionCache.clear();
+    pathCache.clear();
+    traceKeyCache.clear();
+    threadCache.clear();
+    processCache.clear();
+}
+
+static bool selectAll( QSqlQuery &query, const char *statement )
+{
+    if ( !query.exec( statement ) ) {
+        qWarning() << "Failed to load IDs from database: executing SQL command" << statement
+                   << "failed:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+/* The tables which are likely to be needed most, and which save the most
+ * work, are loaded first in case the budget doesn't suffice for all rows.
+ * If a table can't be loaded, it's just marked incomplete.
+ */
+void IdTables::load( QSqlDatabase db )
+{
+    clear();
+
+    QSqlQuery q( db );
+    q.setForwardOnly( true );
+    if ( selectAll( q, "SELECT id, name FROM trace_point_group;" ) ) {
+        while ( q.next() ) {
+            traceKeyCache.load( q.value( 1 ).toString(), q.value( 0 ).toUInt() );
+        }
+    }
+
+    if ( selectAll( q, "SELECT id, pid, start_time FROM process;" ) ) {
+        while ( q.next() &&
+                processCache.insert( ProcessKey( q.value( 1 ).toUInt(), q.value( 2 ).toLongLong() ), q.value( 0 ).toUInt() ) ) {
+        }
+    } else {
+        processCache.setIncomplete();
+    }
+
+    if ( selectAll( q, "SELECT id, process_id, tid, name FROM traced_thread;" ) ) {
+        while ( q.next() &&
+                threadCache.insert( ThreadKey( q.value( 1 ).toUInt(), q.value( 2 ).toUInt() ), q.value( 0 ).toUInt(),
+                                    q.value( 3 ).toString() ) ) {
+        }
+    } else {
+        threadCache.setIncomplete();
+    }
+
+    if ( selectAll( q, "SELECT id, type, path_id, line, function_id, group_id FROM trace_point;" ) ) {
+        while ( q.next() ) {
+            TracePointTuple key;
+            key.type = q.value( 1 ).toUInt();
+            key.pathId = q.value( 2 ).toUInt();
+            key.lineno = q.value( 3 ).toULongLong();
+            key.functionId = q.value( 4 ).toUInt();
+            key.groupId = q.value( 5 ).toUInt();
+            if ( !tracePointCache.insert( key, q.value( 0 ).toUInt() ) ) {
+                break;
+            }
+        }
+    } else {
+        tracePointCache.setIncomplete();
+    }
+
+    if ( selectAll( q, "SELECT id, name FROM path_name;" ) ) {
+        while ( q.next() && pathCache.insert( q.value( 1 ).toString(), q.value( 0 ).toUInt() ) ) {
+        }
+    } else {
+        pathCache.setIncomplete();
+    }
+
+    if ( selectAll( q, "SELECT id, name FROM function_name;" ) ) {
+        while ( q.next() && functionCache.insert( q.value( 1 ).toString(), q.value( 0 ).toUInt() ) ) {
+        }
+    } else {
+        functionCache.setIncomplete();
+    }
+}
+
+QStringList IdTables::statistics() const
+{
+    return QStringList()
+        << traceKeyCache.statistics()
+        << pathCache.statistics( "paths" )
+        << functionCache.statistics( "functions" )
+        << processCache.statistics( "processes" )
+        << threadCache.statistics( "threads" )
+        << tracePointCache.statistics( "trace points" );
+}
+
+static unsigned int storeGroup( QSqlDatabase db, Transaction *transaction,
+                IdTables *tables,
+                const QString &groupName,
+                const QList<TraceKey> &traceKeys )
+{
+    tables->traceKeyCache.update( db, transaction, groupName, traceKeys );
+
+    unsigned int groupId = 0;
+    if ( !groupName.isNull() ) {
+    groupId = tables->traceKeyCache.fetch( groupName );
+    }
+    return groupId;
+}
 
 static unsigned int storeTraceEntry( QSqlDatabase db, Transaction *transaction,
                      unsigned int threadId,
-                     const QDateTime &timestamp,
+                     quint64 timestamp,
                      unsigned int pointId,
                      const QString &message,
                      unsigned long stackPosition )
 {
-    return transaction->insert( QString( "INSERT INTO trace_entry VALUES(NULL, " + QString::number( threadId )
-                                         + ", " + Database::formatValue( db, timestamp )
-                                         + ", " + QString::number( pointId )
-                                         + ", " + Database::formatValue( db, message )
-                                         + ", " + QString::number( stackPosition )
-                                         + ")" ) ).toUInt();
+    QSqlQuery &query = PreparedStatements::get( db, "INSERT INTO trace_entry VALUES(NULL, ?, ?, ?, ?, ?);" );
+    query.addBindValue( threadId );
+    query.addBindValue( static_cast<qint64>( timestamp ) );
+    query.addBindValue( pointId );
+    query.addBindValue( message );
+    query.addBindValue( static_cast<qint64>( stackPosition ) );
+    return transaction->insert( query ).toUInt();
 }
 
 static void storeVariables( QSqlDatabase db, Transaction *transaction,
@@ -300,11 +652,12 @@ static void storeVariables( QSqlDatabase db, Transaction *transaction,
 {
     QList<Variable>::ConstIterator it, end = variables.end();
     for ( it = variables.begin(); it != end; ++it ) {
-        transaction->exec( QString( "INSERT INTO variable VALUES(" + QString::number( traceentryId )
-                                    + ", " + Database::formatValue( db, it->name )
-                                    + ", " + Database::formatValue( db, it->value )
-                                    + ", " + QString::number( it->type )
-                                    + ")" ) );
+        QSqlQuery &query = PreparedStatements::get( db, "INSERT INTO variable VALUES(?, ?, ?, ?);" );
+        query.addBindValue( traceentryId );
+        query.addBindValue( it->name );
+        query.addBindValue( it->value );
+        query.addBindValue( static_cast<int>( it->type ) );
+        transaction->exec( query );
     }
 }
 
@@ -316,30 +669,47 @@ static void storeBacktrace( QSqlDatabase db, Transaction *transaction,
     unsigned int depthCount = 0;
     QList<StackFrame>::ConstIterator it, end = backtrace.end();
     for ( it = backtrace.begin(); it != end; ++it, ++depthCount ) {
-        transaction->exec( QString( "INSERT INTO stackframe VALUES(" + QString::number( traceentryId )
-                                    + ", " + QString::number( depthCount )
-                                    + ", " + Database::formatValue( db, it->module )
-                                    + ", " + Database::formatValue( db, it->function )
-                                    + ", " + QString::number( it->functionOffset )
-                                    + ", " + Database::formatValue( db, it->sourceFile )
-                                    + ", " + QString::number( it->lineNumber )
-                                    + ")" ) );
+        QSqlQuery &query = PreparedStatements::get( db, "INSERT INTO stackframe VALUES(?, ?, ?, ?, ?, ?, ?);" );
+        query.addBindValue( traceentryId );
+        query.addBindValue( depthCount );
+        query.addBindValue( it->module );
+        query.addBindValue( it->function );
+        query.addBindValue( static_cast<qint64>( it->functionOffset ) );
+        query.addBindValue( it->sourceFile );
+        query.addBindValue( static_cast<qint64>( it->lineNumber ) );
+        transaction->exec( query );
     }
 }
 
-static void storeEntry( QSqlDatabase db, Transaction *transaction, const TraceEntry &e )
+static unsigned int storeTracePoint( QSqlDatabase db, Transaction *transaction, IdTables *tables, const TraceEntry &e )
 {
-    unsigned int pathId = pathCache.store( db, transaction, e.path );
-    unsigned int functionId = functionCache.store( db, transaction, e.function );
-    unsigned int processId = processCache.store( db, transaction, e.processName,
-                         e.pid, e.processStartTime );
-    unsigned int threadId = threadCache.store( db, transaction, processId, e.tid );
-    unsigned int groupId = storeGroup( db, transaction,
+    unsigned int pathId = tables->pathCache.store( db, transaction, e.path );
+    unsigned int functionId = tables->functionCache.store( db, transaction, e.function );
+    unsigned int groupId = storeGroup( db, transaction, tables,
                        e.groupName,
                        e.traceKeys );
-    unsigned int tracepointId = tracePointCache.store( db, transaction,
-                               e.type, pathId, e.lineno,
-                               functionId, groupId );
+    return tables->tracePointCache.store( db, transaction,
+                                  e.type, pathId, e.lineno,
+                                  functionId, groupId );
+}
+
+static void storeEntry( QSqlDatabase db, Transaction *transaction, IdTables *tables, const TraceEntry &e,
+                        QHash<unsigned int, unsigned int> *tracePointIds = 0 )
+{
+    unsigned int tracepointId = 0;
+    if ( tracePointIds && e.tracePointKey != 0 ) {
+        tracepointId = tracePointIds->value( e.tracePointKey );
+    }
+    if ( tracepointId == 0 ) {
+        tracepointId = storeTracePoint( db, transaction, tables, e );
+        if ( tracePointIds && e.tracePointKey != 0 ) {
+            tracePointIds->insert( e.tracePointKey, tracepointId );
+        }
+    }
+
+    unsigned int processId = tables->processCache.store( db, transaction, e.processName,
+                         e.pid, e.processStartTime );
+    unsigned int threadId = tables->threadCache.store( db, transaction, processId, e.tid, e.threadName );
     unsigned int traceentryId = storeTraceEntry( db, transaction,
                          threadId,
                          e.timestamp,
@@ -362,10 +732,23 @@ static QString archiveFileName( const QString &archiveDirName, const QString &cu
         .arg( QFileInfo( currentFileName ).fileName() );
 }
 
-static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QString &archiveDir )
+// Releases the prepared statements of a connection, even if storing failed
+class PreparedStatementsReleaser
+{
+public:
+    explicit PreparedStatementsReleaser( QSqlDatabase db ) : m_db( db ) { }
+    ~PreparedStatementsReleaser() { PreparedStatements::release( m_db ); }
+
+private:
+    QSqlDatabase m_db;
+};
+
+// Returns the number of entries which were archived.
+static qulonglong archiveEntries( QSqlDatabase db, unsigned short percentage, const QString &archiveDir,
+                                  qint64 memoryBudget )
 {
     if ( percentage == 0 ) {
-        return;
+        return 0;
     }
 
     if ( percentage > 100 ) {
@@ -382,6 +765,9 @@ static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QS
             throw runtime_error( "Failed to count number of entries to archive" );
         }
     }
+    if ( numCopy == 0 ) {
+        return 0;
+    }
 
     QString connName;
     {
@@ -399,6 +785,9 @@ static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QS
             }
         }
         connName = archiveDB.connectionName();
+        PreparedStatementsReleaser releaser( archiveDB );
+        IdTables archiveTables( memoryBudget );
+        archiveTables.load( archiveDB );
 
         {
             QString query = QString( "SELECT"
@@ -414,7 +803,8 @@ static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QS
                             " trace_point.group_id,"
                             " function_name.name,"
                             " trace_entry.message, "
-                            " trace_entry.stack_position "
+                            " trace_entry.stack_position, "
+                            " traced_thread.name "
                             "FROM"
                             " trace_entry,"
                             " trace_point,"
@@ -447,12 +837,12 @@ static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QS
             while ( q.next() ) {
                 qulonglong id = q.value( 0 ).toULongLong();
 
-                TraceEntry e;
+                TraceEntry e = TraceEntry();
                 e.pid = q.value( 1 ).toUInt();
                 e.processStartTime = QDateTime::fromMSecsSinceEpoch( q.value( 2 ).toLongLong() );
                 e.processName = q.value( 3 ).toString();
                 e.tid = q.value( 4 ).toUInt();
-                e.timestamp = QDateTime::fromMSecsSinceEpoch( q.value( 5 ).toLongLong() );
+                e.timestamp = q.value( 5 ).toULongLong();
                 e.type = q.value( 6 ).toUInt();
                 e.path = q.value( 7 ).toString();
                 e.lineno = q.value( 8 ).toULongLong();
@@ -471,6 +861,7 @@ static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QS
                 e.function = q.value( 10 ).toString();
                 e.message = q.value( 11 ).toString();
                 e.stackPosition = q.value( 12 ).toULongLong();
+                e.threadName = q.value( 13 ).toString();
                 e.backtrace = Database::backtraceForEntry( db, id );
 
                 {
@@ -493,50 +884,65 @@ static void archiveEntries( QSqlDatabase db, unsigned short percentage, const QS
                         }
                     }
                 }
-                ::storeEntry( archiveDB, &archiveTransaction, e );
+                ::storeEntry( archiveDB, &archiveTransaction, &archiveTables, e );
             }
         }
     }
 
     {
         transaction.exec( QString( "DELETE FROM trace_entry WHERE id IN (SELECT id FROM trace_entry ORDER BY id LIMIT %1);" ).arg( numCopy ) );
-
         transaction.exec( QString( "DELETE FROM trace_point WHERE id NOT IN (SELECT trace_point_id FROM trace_entry);" ) );
-        tracePointCache.clear();
-
         transaction.exec( QString( "DELETE FROM function_name WHERE id NOT IN (SELECT function_id FROM trace_point);" ) );
-        functionCache.clear();
-
         transaction.exec( QString( "DELETE FROM path_name WHERE id NOT IN (SELECT path_id FROM trace_point);" ) );
-        pathCache.clear();
-
         transaction.exec( QString( "DELETE FROM trace_point_group WHERE id NOT IN (SELECT group_id FROM trace_point);" ) );
-        traceKeyCache.clear();
-
         transaction.exec( QString( "DELETE FROM traced_thread WHERE id NOT IN (SELECT traced_thread_id FROM trace_entry);" ) );
-        threadCache.clear();
-
         transaction.exec( QString( "DELETE FROM process WHERE id NOT IN (SELECT process_id FROM traced_thread);" ) );
-        processCache.clear();
-
         transaction.exec( QString( "DELETE FROM variable WHERE trace_entry_id NOT IN (SELECT id FROM trace_entry);" ) );
         transaction.exec( QString( "DELETE FROM stackframe WHERE trace_entry_id NOT IN (SELECT id FROM trace_entry);" ) );
     }
     QSqlDatabase::removeDatabase( connName );
+    return numCopy;
 }
 
-DatabaseFeeder::DatabaseFeeder( QSqlDatabase db )
+DatabaseFeeder::DatabaseFeeder( QSqlDatabase db, qint64 cacheMemoryBudget )
     : m_db( db )
+    , m_maximumBatchSize( 1 )
+    , m_idTables( 0 )
     , m_shrinkBy( 0 )
     , m_maximumSize( StorageConfiguration::UnlimitedTraceSize )
 {
     assert( m_db.isValid() );
     m_db.exec( "PRAGMA synchronous=OFF;");
+
+    m_idTables = new IdTables( cacheMemoryBudget );
+    m_idTables->load( m_db );
+}
+
+DatabaseFeeder::~DatabaseFeeder()
+{
+    delete m_idTables;
+}
+
+QStringList DatabaseFeeder::cacheStatistics() const
+{
+    return m_idTables->statistics();
+}
+
+void DatabaseFeeder::setMaximumBatchSize( int entries )
+{
+    m_maximumBatchSize = qMax( entries, 1 );
+    if ( m_pendingEntries.size() >= m_maximumBatchSize ) {
+        flush();
+    }
 }
 
 void DatabaseFeeder::trimDb()
 {
+    // These would be removed right away
+    m_pendingEntries.clear();
     Database::trimTo( m_db, 0 );
+    m_tracePointIds.clear();
+    m_idTables->load( m_db );
 }
 
 // Definition taken from http://www.sqlite.org/c_interface.html
@@ -544,26 +950,118 @@ void DatabaseFeeder::trimDb()
 
 void DatabaseFeeder::handleTraceEntry( const TraceEntry &e )
 {
+    m_pendingEntries.append( e );
+    if ( m_pendingEntries.size() >= m_maximumBatchSize ) {
+        flush();
+    }
+}
+
+/* If the database is full, old entries are archived and the whole batch is
+ * stored once more since the failed transaction was rolled back. A batch
+ * which can't be stored otherwise, or still doesn't fit, is dropped:
+ * storing it again would most likely fail the same way.
+ */
+void DatabaseFeeder::flush()
+{
+    if ( m_pendingEntries.isEmpty() ) {
+        return;
+    }
+
     try {
-        Transaction transaction( m_db );
-        ::storeEntry( m_db, &transaction, e );
-    } catch ( const SQLTransactionException &ex ) {
-        if ( ex.driverCode() == SQLITE_FULL ) {
-            archiveEntries( m_db, m_shrinkBy, m_archiveDir );
+        try {
+            storePendingEntries();
+        } catch ( const SQLTransactionException &ex ) {
+            if ( ex.driverCode() != SQLITE_FULL || m_shrinkBy == 0 ) {
+                throw;
+            }
+            if ( makeRoom() == 0 ) {
+                throw;
+            }
+            storePendingEntries();
+        }
+    } catch ( const runtime_error & ) {
+        m_pendingEntries.clear();
+        throw;
+    }
+}
 
-            archivedEntries();
+void DatabaseFeeder::storePendingEntries()
+{
+    {
+        Transaction transaction( m_db );
+        try {
+            QList<TraceEntry>::ConstIterator it, end = m_pendingEntries.end();
+            for ( it = m_pendingEntries.begin(); it != end; ++it ) {
+                ::storeEntry( m_db, &transaction, m_idTables, *it, &m_tracePointIds );
+            }
+        } catch ( const runtime_error & ) {
+            // Nothing of a batch is stored unless all of it is
+            transaction.rollback();
 
-            handleTraceEntry( e );
-        } else {
+            // The rows inserted by this batch are gone, and so are their IDs
+            m_tracePointIds.clear();
+            m_idTables->load( m_db );
             throw;
         }
     }
+
+    QList<TraceEntry> entries;
+    entries.swap( m_pendingEntries );
+    storedEntries( entries );
+}
+
+qulonglong DatabaseFeeder::makeRoom()
+{
+    /* The tables of the archive only exist while archiving, they may use
+     * what's left of the budget.
+     */
+    const qulonglong archived = archiveEntries( m_db, m_shrinkBy, m_archiveDir, m_idTables->availableMemory() );
+    if ( archived == 0 ) {
+        return 0;
+    }
+
+    // Archiving deleted the rows which are no longer used, unused trace keys included
+    m_tracePointIds.clear();
+    m_idTables->load( m_db );
+    {
+        Transaction transaction( m_db );
+        m_idTables->traceKeyCache.update( m_db, &transaction, QString(), m_traceKeys );
+    }
+
+    archivedEntries();
+    return archived;
 }
 
 void DatabaseFeeder::handleShutdownEvent( const ProcessShutdownEvent &ev )
 {
+    // The process (or its entries) may still be waiting for being stored
+    flush();
+
     Transaction transaction( m_db );
-    transaction.exec( QString( "UPDATE process SET end_time=%1 WHERE pid=%2 AND start_time=%3;" ).arg( Database::formatValue( m_db, ev.stopTime ) ).arg( ev.pid ).arg( Database::formatValue( m_db, ev.startTime ) ) );
+    QSqlQuery &query = PreparedStatements::get( m_db, "UPDATE process SET end_time=? WHERE pid=? AND start_time=?;" );
+    query.addBindValue( ev.stopTime.toMSecsSinceEpoch() );
+    query.addBindValue( ev.pid );
+    query.addBindValue( ev.startTime.toMSecsSinceEpoch() );
+    transaction.exec( query );
+}
+
+void DatabaseFeeder::handleTraceKeys( const QList<TraceKey> &traceKeys )
+{
+    QList<TraceKey>::ConstIterator it, end = traceKeys.end();
+    for ( it = traceKeys.begin(); it != end; ++it ) {
+        bool known = false;
+        QList<TraceKey>::ConstIterator knownIt, knownEnd = m_traceKeys.end();
+        for ( knownIt = m_traceKeys.begin(); knownIt != knownEnd && !known; ++knownIt ) {
+            known = knownIt->name == it->name;
+        }
+        if ( !known ) {
+            m_traceKeys.append( *it );
+        }
+    }
+
+    flush();
+    Transaction transaction( m_db );
+    m_idTables->traceKeyCache.update( m_db, &transaction, QString(), traceKeys );
 }
 
 template <typename T>
@@ -575,6 +1073,9 @@ T clamp( T v, T lowerBound, T upperBound ) {
 
 void DatabaseFeeder::applyStorageConfiguration( const StorageConfiguration &cfg )
 {
+    // Entries received before apply to the previous configuration
+    flush();
+
     const unsigned short shrinkBy = clamp<unsigned short>( cfg.shrinkBy, 1, 100 );
     if ( m_maximumSize == cfg.maximumSize &&
          m_shrinkBy == shrinkBy &&
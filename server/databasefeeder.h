@@ -22,24 +22,73 @@
 
 #include "xmlcontenthandler.h"
 
+#include <QHash>
+#include <QStringList>
+
+class IdTables;
+
+/* Stores the parsed data in a database. Trace entries are collected and
+ * stored in batches, each in a single transaction, since that's a lot
+ * cheaper than a transaction per entry.
+ */
 class DatabaseFeeder : public XmlParseEventsHandler
 {
 public:
-    DatabaseFeeder( QSqlDatabase db );
+    static const qint64 DefaultCacheMemoryBudget = 64 * 1024 * 1024;
+
+    /* The IDs of the paths, functions, processes, threads and trace points
+     * in the database are kept in memory as long as they take up less than
+     * cacheMemoryBudget bytes; all others are looked up in the database.
+     * The budget covers the IDs of the archive database while entries are
+     * archived as well.
+     */
+    DatabaseFeeder( QSqlDatabase db, qint64 cacheMemoryBudget = DefaultCacheMemoryBudget );
+    ~DatabaseFeeder();
+
+    // The number of entries after which a batch is stored; 1 by default.
+    void setMaximumBatchSize( int entries );
+
+    // The size and hit rate of each table of IDs, one line per table.
+    QStringList cacheStatistics() const;
+
+    /* Stores all entries which were not stored yet. If that fails, the
+     * entries are dropped and the error is thrown as a runtime_error.
+     */
+    void flush();
+    bool hasPendingEntries() const { return !m_pendingEntries.isEmpty(); }
+
 protected:
     virtual void handleTraceEntry( const TraceEntry & );
     virtual void applyStorageConfiguration( const StorageConfiguration & );
     virtual void handleShutdownEvent( const ProcessShutdownEvent & );
+    virtual void handleTraceKeys( const QList<TraceKey> & );
 
     // Needed for the server to send out notifications to the GUI when entries are archived
     virtual void archivedEntries() {}
+    // Called after a batch of entries was committed
+    virtual void storedEntries( const QList<TraceEntry> & ) {}
     // Needed for the server subclass to nuke the database
     void trimDb();
 private:
+    DatabaseFeeder( const DatabaseFeeder &other );
+    void operator=( const DatabaseFeeder &rhs );
+
+    void storePendingEntries();
+    // Archives old entries; returns how many.
+    qulonglong makeRoom();
+
     QSqlDatabase m_db;
+    QList<TraceEntry> m_pendingEntries;
+    int m_maximumBatchSize;
+    // The IDs of the rows of the lookup tables, loaded from the database
+    IdTables *m_idTables;
     unsigned short m_shrinkBy;
     unsigned long m_maximumSize;
     QString m_archiveDir;
+    // Maps TraceEntry::tracePointKey to the id of the trace_point row
+    QHash<unsigned int, unsigned int> m_tracePointIds;
+    // All trace keys announced so far, re-registered after archiving
+    QList<TraceKey> m_traceKeys;
 };
 
 #endif // TRACER_DATABASEFEEDER_H
@@ -91,11 +91,20 @@ int main( int argc, char **argv )
                                   "port", QString::number(TRACELIB_DEFAULT_PORT));
     QCommandLineOption guiportOption(QStringList() << "g" << "guiport", "Listening Port for the trace gui to connect to.",
                                      "guiport", QString::number(TRACELIB_DEFAULT_PORT + 1));
+    QCommandLineOption batchSizeOption(QStringList() << "batch-size", "Maximum number of trace entries to store in one transaction.",
+                                       "entries", "500");
+    QCommandLineOption batchLatencyOption(QStringList() << "batch-latency", "Maximum time in milliseconds a trace entry waits for being stored.",
+                                          "msecs", "100");
+    QCommandLineOption cacheSizeOption(QStringList() << "cache-size", "Maximum memory in MiB used for keeping the IDs of paths, functions etc. in memory, including those of the archive while archiving.",
+                                       "MiB", QString::number(DatabaseFeeder::DefaultCacheMemoryBudget / (1024 * 1024)));
     opt.addHelpOption();
     opt.addVersionOption();
     opt.setApplicationDescription("Listens for trace library connections to store trace entries into a database");
     opt.addOption(portOption);
     opt.addOption(guiportOption);
+    opt.addOption(batchSizeOption);
+    opt.addOption(batchLatencyOption);
+    opt.addOption(cacheSizeOption);
     opt.addPositionalArgument(".trace_file", "Trace database to store the trace entries into");
     opt.process(app);
 
@@ -128,6 +137,28 @@ int main( int argc, char **argv )
 	cout << "Trace port and GUI port have to be different." << endl;
 	return Error::CommandLineArgs;
     }
+    const int batchSize = opt.value(batchSizeOption).toInt(&ok);
+    if (!ok || batchSize < 1) {
+        cout << "Invalid batch size '"
+             << opt.value(batchSizeOption).toLocal8Bit().constData()
+             << "' given." << endl;
+        return Error::CommandLineArgs;
+    }
+    const int batchLatency = opt.value(batchLatencyOption).toInt(&ok);
+    if (!ok || batchLatency < 0) {
+        cout << "Invalid batch latency '"
+             << opt.value(batchLatencyOption).toLocal8Bit().constData()
+             << "' given." << endl;
+        return Error::CommandLineArgs;
+    }
+
+    const int cacheSize = opt.value(cacheSizeOption).toInt(&ok);
+    if (!ok || cacheSize < 0) {
+        cout << "Invalid cache size '"
+             << opt.value(cacheSizeOption).toLocal8Bit().constData()
+             << "' given." << endl;
+        return Error::CommandLineArgs;
+    }
 
     QSqlDatabase database;
     if (QFile::exists(traceFile)) {
@@ -142,7 +173,8 @@ int main( int argc, char **argv )
         return Error::Database;
     }
 
-    Server server(traceFile, database, port, guiport);
+    Server server(traceFile, database, port, guiport, batchSize, batchLatency,
+                  qint64(cacheSize) * 1024 * 1024);
 
     return app.exec();
 }
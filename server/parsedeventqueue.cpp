@@ -0,0 +1,130 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "parsedeventqueue.h"
+
+#include <QDebug>
+#include <QMetaObject>
+
+#include <stdexcept>
+
+using namespace std;
+
+ParsedEventQueue::ParsedEventQueue( XmlParseEventsHandler *consumer, int capacity, QObject *parent )
+    : QObject( parent ),
+    m_consumer( consumer ),
+    m_capacity( capacity ),
+    m_deliveryScheduled( false ),
+    m_closed( false )
+{
+}
+
+void ParsedEventQueue::close()
+{
+    QMutexLocker locker( &m_mutex );
+    m_closed = true;
+    m_events.clear();
+    m_notFull.wakeAll();
+}
+
+void ParsedEventQueue::handleTraceEntry( const TraceEntry &e )
+{
+    ParsedEvent event = ParsedEvent();
+    event.type = ParsedEvent::TraceEntryEvent;
+    event.entry = e;
+    enqueue( event );
+}
+
+void ParsedEventQueue::applyStorageConfiguration( const StorageConfiguration &cfg )
+{
+    ParsedEvent event = ParsedEvent();
+    event.type = ParsedEvent::StorageConfigurationEvent;
+    event.storageConfig = cfg;
+    enqueue( event );
+}
+
+void ParsedEventQueue::handleShutdownEvent( const ProcessShutdownEvent &ev )
+{
+    ParsedEvent event = ParsedEvent();
+    event.type = ParsedEvent::ShutdownEvent;
+    event.shutdownEvent = ev;
+    enqueue( event );
+}
+
+void ParsedEventQueue::handleTraceKeys( const QList<TraceKey> &traceKeys )
+{
+    ParsedEvent event = ParsedEvent();
+    event.type = ParsedEvent::TraceKeysEvent;
+    event.traceKeys = traceKeys;
+    enqueue( event );
+}
+
+// Called by the producer threads
+void ParsedEventQueue::enqueue( const ParsedEvent &event )
+{
+    QMutexLocker locker( &m_mutex );
+    while ( m_events.size() >= m_capacity && !m_closed ) {
+        m_notFull.wait( &m_mutex );
+    }
+    if ( m_closed ) {
+        return;
+    }
+
+    m_events.enqueue( event );
+    if ( !m_deliveryScheduled ) {
+        m_deliveryScheduled = true;
+        QMetaObject::invokeMethod( this, "deliverEvents", Qt::QueuedConnection );
+    }
+}
+
+/* Takes all queued events at once so that the producers only wait for the
+ * consumer while the queue is full.
+ */
+void ParsedEventQueue::deliverEvents()
+{
+    QQueue<ParsedEvent> events;
+    {
+        QMutexLocker locker( &m_mutex );
+        events.swap( m_events );
+        m_deliveryScheduled = false;
+        m_notFull.wakeAll();
+    }
+
+    while ( !events.isEmpty() ) {
+        const ParsedEvent event = events.dequeue();
+        try {
+            switch ( event.type ) {
+                case ParsedEvent::TraceEntryEvent:
+                    m_consumer->handleTraceEntry( event.entry );
+                    break;
+                case ParsedEvent::StorageConfigurationEvent:
+                    m_consumer->applyStorageConfiguration( event.storageConfig );
+                    break;
+                case ParsedEvent::ShutdownEvent:
+                    m_consumer->handleShutdownEvent( event.shutdownEvent );
+                    break;
+                case ParsedEvent::TraceKeysEvent:
+                    m_consumer->handleTraceKeys( event.traceKeys );
+                    break;
+            }
+        } catch ( const runtime_error &e ) {
+            qWarning() << e.what();
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_PARSEDEVENTQUEUE_H
+#define TRACE_PARSEDEVENTQUEUE_H
+
+#include <QMutex>
+#include <QObject>
+#include <QQueue>
+#include <QWaitCondition>
+
+#include "xmlcontenthandler.h"
+
+/* Hands the data parsed by the threads serving the traced processes over
+ * to the thread which owns the queue, where it's passed on to the consumer
+ * (i.e. stored). Data of each connection stays in order.
+ *
+ * The queue is bounded: producers wait while it's full, so that a process
+ * sending more than the database can keep up with is slowed down instead
+ * of making the daemon grow without limits.
+ */
+class ParsedEventQueue : public QObject, public XmlParseEventsHandler
+{
+    Q_OBJECT
+public:
+    ParsedEventQueue( XmlParseEventsHandler *consumer, int capacity, QObject *parent = 0 );
+
+    /* Makes waiting producers continue and drops everything queued from
+     * now on; needed before the producer threads can be stopped.
+     */
+    void close();
+
+protected:
+    virtual void handleTraceEntry( const TraceEntry &e );
+    virtual void applyStorageConfiguration( const StorageConfiguration &cfg );
+    virtual void handleShutdownEvent( const ProcessShutdownEvent &ev );
+    virtual void handleTraceKeys( const QList<TraceKey> &traceKeys );
+
+private slots:
+    void deliverEvents();
+
+private:
+    struct ParsedEvent
+    {
+        enum Type {
+            TraceEntryEvent,
+            StorageConfigurationEvent,
+            ShutdownEvent,
+            TraceKeysEvent
+        };
+
+        Type type;
+        TraceEntry entry;
+        StorageConfiguration storageConfig;
+        ProcessShutdownEvent shutdownEvent;
+        QList<TraceKey> traceKeys;
+    };
+
+    void enqueue( const ParsedEvent &event );
+
+    XmlParseEventsHandler *m_consumer;
+    const int m_capacity;
+    QMutex m_mutex;
+    QWaitCondition m_notFull;
+    QQueue<ParsedEvent> m_events;
+    bool m_deliveryScheduled;
+    bool m_closed;
+};
+
+#endif // !defined(TRACE_PARSEDEVENTQUEUE_H)
@@ -19,8 +19,15 @@
 
 #include "server.h"
 
+#include "crashsymbolizer.h"
 #include "database.h"
 #include "datagramtypes.h"
+#include "parsedeventqueue.h"
+#ifdef Q_OS_UNIX
+#  include "sharedmemoryreader.h"
+#endif
+
+#include "../hooklib/streamcompression.h"
 
 #include <QDataStream>
 #include <QDir>
@@ -29,12 +36,23 @@
 #include <QSqlDatabase>
 
 #include <cassert>
+#include <cstring>
 #include <stdexcept>
 
 using namespace std;
 
-ClientSocket::ClientSocket( QObject *parent )
-    : QTcpSocket( parent )
+using namespace TRACELIB_NAMESPACE_IDENT(StreamCompression);
+
+/* Number of parsed entries which may wait for being stored; the threads
+ * serving the traced processes stop reading while this is exceeded.
+ */
+static const int ParsedEventQueueCapacity = 10000;
+
+ClientSocket::ClientSocket( XmlParseEventsHandler *handler, CrashSymbolizerThread *symbolizer,
+                            QObject *parent )
+    : QTcpSocket( parent ),
+    m_streamMode( UnknownStream ),
+    m_parser( handler, symbolizer )
 {
     connect( this, SIGNAL( readyRead() ),
              this, SLOT( handleIncomingData() ) );
@@ -44,23 +62,100 @@ void ClientSocket::handleIncomingData()
 {
     const QByteArray data = readAll();
     assert( !data.isEmpty() );
-    emit dataReceived( data );
+
+    if ( m_streamMode == PlainStream ) {
+        m_parser.addData( data );
+        return;
+    }
+
+    m_buffer.append( data );
+    if ( m_streamMode == UnknownStream ) {
+        size_t requestLength;
+        switch ( matchCompressionRequest( m_buffer.constData(), m_buffer.size(), &requestLength ) ) {
+            case IncompleteRequest:
+                return;
+            case CompleteRequest: {
+                m_buffer.remove( 0, static_cast<int>( requestLength ) );
+                unsigned char reply[ReplyLength];
+                writeReply( reply, Lz4Codec );
+                write( reinterpret_cast<const char *>( reply ), ReplyLength );
+                m_streamMode = NegotiatedStream;
+                break;
+            }
+            case NoRequest:
+                m_streamMode = PlainStream;
+                break;
+        }
+    }
+
+    if ( m_streamMode == NegotiatedStream && !m_buffer.isEmpty() ) {
+        // Unless the client gave up waiting for the reply, it starts compressing now
+        const int headerLength = static_cast<int>( StreamHeaderLength );
+        const int compareLength = qMin( m_buffer.size(), headerLength );
+        if ( memcmp( m_buffer.constData(), StreamHeader, compareLength ) != 0 ) {
+            m_streamMode = PlainStream;
+        } else if ( m_buffer.size() >= headerLength ) {
+            m_streamMode = CompressedStream;
+            m_buffer.remove( 0, headerLength );
+        }
+    }
+
+    if ( m_streamMode == PlainStream ) {
+        if ( !m_buffer.isEmpty() ) {
+            m_parser.addData( m_buffer );
+        }
+        m_buffer.clear();
+    } else if ( m_streamMode == CompressedStream ) {
+        decodeFrames();
+    }
+}
+
+void ClientSocket::decodeFrames()
+{
+    const int headerLength = static_cast<int>( FrameHeaderLength );
+    int pos = 0;
+    while ( m_buffer.size() - pos >= headerLength ) {
+        unsigned long compressedLength, length;
+        readFrameHeader( m_buffer.constData() + pos, &compressedLength, &length );
+        if ( compressedLength > MaximumFrameLength || length > MaximumFrameLength ) {
+            qWarning() << "Closing connection which sent a compressed frame of excessive length" << length;
+            abort();
+            return;
+        }
+        if ( static_cast<unsigned long>( m_buffer.size() - pos - headerLength ) < compressedLength ) {
+            break;
+        }
+
+        QByteArray frame( static_cast<int>( length ), Qt::Uninitialized );
+        if ( !decompressBlock( m_buffer.constData() + pos + headerLength, compressedLength,
+                               frame.data(), length ) ) {
+            qWarning() << "Closing connection which sent a corrupt compressed frame";
+            abort();
+            return;
+        }
+        pos += headerLength + static_cast<int>( compressedLength );
+
+        if ( !frame.isEmpty() ) {
+            m_parser.addData( frame );
+        }
+    }
+    m_buffer.remove( 0, pos );
 }
 
-NetworkingThread::NetworkingThread( int socketDescriptor, QObject *parent )
+NetworkingThread::NetworkingThread( int socketDescriptor, XmlParseEventsHandler *handler,
+                                    CrashSymbolizerThread *symbolizer, QObject *parent )
     : QThread( parent ),
     m_socketDescriptor( socketDescriptor ),
+    m_handler( handler ),
+    m_symbolizer( symbolizer ),
     m_clientSocket( 0 )
 {
 }
 
 void NetworkingThread::run()
 {
-    m_clientSocket = new ClientSocket;
+    m_clientSocket = new ClientSocket( m_handler, m_symbolizer );
     m_clientSocket->setSocketDescriptor( m_socketDescriptor );
-    connect( m_clientSocket, SIGNAL( dataReceived( const QByteArray & ) ),
-             this, SIGNAL( dataReceived( const QByteArray & ) ),
-             Qt::QueuedConnection );
     connect( m_clientSocket, SIGNAL( disconnected() ),
              this, SLOT( quit() ),
              Qt::QueuedConnection  );
@@ -89,10 +184,10 @@ ServerSocket::~ServerSocket()
 void ServerSocket::incomingConnection( int socketDescriptor )
 {
     NetworkingThread *thread = new NetworkingThread( socketDescriptor,
+                                                     m_server->parsedEventQueue(),
+                                                     m_server->crashSymbolizer(),
                                                      this );
     m_networkingThreads.push_back( thread );
-    connect( thread, SIGNAL( dataReceived( const QByteArray & ) ),
-             m_server, SLOT( handleIncomingData( const QByteArray & ) ) );
     connect( thread, SIGNAL( finished() ),
              thread, SLOT( deleteLater() ) );
     thread->start();
@@ -163,23 +258,66 @@ void GUIConnection::handleDisconnect()
 Server::Server( const QString &traceFile,
                 QSqlDatabase database,
                 unsigned short port, unsigned short guiPort,
+                int batchSize, int batchLatency, qint64 cacheMemoryBudget,
                 QObject *parent )
     : QObject( parent ),
-      DatabaseFeeder( database ),
-      m_tcpServer( 0 ),
-      m_xmlHandler( this )
+      DatabaseFeeder( database, cacheMemoryBudget ),
+      m_tcpServer( 0 )
 {
     QFileInfo fi( traceFile );
     m_traceFile = QDir::toNativeSeparators( fi.canonicalFilePath() );
 
+    setMaximumBatchSize( batchSize );
+    m_batchTimer.setSingleShot( true );
+    m_batchTimer.setInterval( batchLatency );
+    connect( &m_batchTimer, SIGNAL( timeout() ), SLOT( storePendingEntries() ) );
+
+    m_parsedEventQueue = new ParsedEventQueue( this, ParsedEventQueueCapacity, this );
+
+    m_crashSymbolizer = new CrashSymbolizerThread( this );
+    m_crashSymbolizer->start();
+
     m_tcpServer = new ServerSocket( this );
     m_tcpServer->listen( QHostAddress::Any, port );
 
+#ifdef Q_OS_UNIX
+    m_sharedMemoryWatcher = new SharedMemoryWatcher( this );
+#endif
+
     m_guiServer = new QTcpServer( this );
     connect( m_guiServer, SIGNAL( newConnection() ), SLOT( handleNewGUIConnection() ) );
     m_guiServer->listen( QHostAddress::LocalHost, guiPort );
+}
 
-    m_xmlHandler.addData( "<toplevel_trace_element>" );
+/* The threads producing data have to be stopped while the queue still
+ * exists; they might be waiting for it, too. The crash symbolizer goes
+ * last since the threads parsing the connections pass crashes to it.
+ */
+Server::~Server()
+{
+    m_parsedEventQueue->close();
+    delete m_tcpServer;
+#ifdef Q_OS_UNIX
+    delete m_sharedMemoryWatcher;
+#endif
+    delete m_crashSymbolizer;
+    storePendingEntries();
+
+    const QStringList statistics = cacheStatistics();
+    QStringList::ConstIterator it, end = statistics.end();
+    for ( it = statistics.begin(); it != end; ++it ) {
+        qDebug( "Cached IDs of %s", qPrintable( *it ) );
+    }
+}
+
+XmlParseEventsHandler *Server::parsedEventQueue() const
+{
+    return m_parsedEventQueue;
+}
+
+CrashSymbolizerThread *Server::crashSymbolizer() const
+{
+    return m_crashSymbolizer;
 }
 
 // duplicated in gui/mainwindow.cpp
@@ -221,15 +359,25 @@ QByteArray serializeGUIClientData( ServerDatagramType type, const T &v ) {
 void Server::handleTraceEntry( const TraceEntry &entry )
 {
     DatabaseFeeder::handleTraceEntry( entry );
+    if ( hasPendingEntries() && !m_batchTimer.isActive() ) {
+        m_batchTimer.start();
+    }
+}
 
-    QByteArray serializedEntry = serializeGUIClientData( TraceEntryDatagram, entry );
+// The GUI looks the entries up in the database, so they're announced now
+void Server::storedEntries( const QList<TraceEntry> &entries )
+{
+    QList<TraceEntry>::ConstIterator entryIt, entryEnd = entries.end();
+    for ( entryIt = entries.begin(); entryIt != entryEnd; ++entryIt ) {
+        QByteArray serializedEntry = serializeGUIClientData( TraceEntryDatagram, *entryIt );
 
-    QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
-    for ( it = m_guiConnections.begin(); it != end; ++it ) {
-        ( *it )->write( serializedEntry );
-    }
+        QList<GUIConnection *>::Iterator it, end = m_guiConnections.end();
+        for ( it = m_guiConnections.begin(); it != end; ++it ) {
+            ( *it )->write( serializedEntry );
+        }
 
-    emit traceEntryReceived( entry );
+        emit traceEntryReceived( *entryIt );
+    }
 }
 
 void Server::handleShutdownEvent( const ProcessShutdownEvent &ev )
@@ -246,11 +394,11 @@ void Server::handleShutdownEvent( const ProcessShutdownEvent &ev )
     emit processShutdown( ev );
 }
 
-void Server::handleIncomingData( const QByteArray &xmlData )
+void Server::storePendingEntries()
 {
+    m_batchTimer.stop();
     try {
-        m_xmlHandler.addData( xmlData );
-        m_xmlHandler.continueParsing();
+        flush();
     } catch ( const runtime_error &e ) {
         qWarning() << e.what();
     }
@@ -21,45 +21,67 @@
 #define TRACE_SERVER_H
 
 #include <QByteArray>
+#include <QHash>
 #include <QList>
 #include <QObject>
 #include <QSqlDatabase>
 #include <QTcpServer>
 #include <QTcpSocket>
 #include <QThread>
+#include <QTimer>
 #include <QXmlStreamReader>
 
+#include "contenthandler.h"
 #include "database.h"
 #include "xmlcontenthandler.h"
 #include "databasefeeder.h"
 
+class CrashSymbolizerThread;
+class ParsedEventQueue;
+#ifdef Q_OS_UNIX
+class SharedMemoryWatcher;
+#endif
+
+// Parses the received data right away, i.e. in the thread serving the socket
 class ClientSocket : public QTcpSocket
 {
     Q_OBJECT
 public:
-    ClientSocket( QObject *parent = 0 );
-
-signals:
-    void dataReceived( const QByteArray &data );
+    ClientSocket( XmlParseEventsHandler *handler, CrashSymbolizerThread *symbolizer,
+                  QObject *parent = 0 );
 
 private slots:
     void handleIncomingData();
+
+private:
+    void decodeFrames();
+
+    enum StreamMode {
+        UnknownStream,
+        NegotiatedStream,
+        PlainStream,
+        CompressedStream
+    };
+
+    StreamMode m_streamMode;
+    QByteArray m_buffer;
+    ConnectionParser m_parser;
 };
 
 class NetworkingThread : public QThread
 {
     Q_OBJECT
 public:
-    NetworkingThread( int socketDescriptor, QObject *parent = 0 );
-
-signals:
-    void dataReceived( const QByteArray &data );
+    NetworkingThread( int socketDescriptor, XmlParseEventsHandler *handler,
+                      CrashSymbolizerThread *symbolizer, QObject *parent = 0 );
 
 protected:
     virtual void run();
 
 private:
     int m_socketDescriptor;
+    XmlParseEventsHandler *m_handler;
+    CrashSymbolizerThread *m_symbolizer;
     ClientSocket *m_clientSocket;
 };
 
@@ -106,12 +128,23 @@ class Server : public QObject, public DatabaseFeeder
 {
     Q_OBJECT
 public:
+    /* Entries are stored once batchSize of them arrived or batchLatency
+     * milliseconds after the first of them arrived, whichever comes first.
+     * See DatabaseFeeder for the cacheMemoryBudget.
+     */
     Server( const QString &traceFile,
             QSqlDatabase database, unsigned short port, unsigned short guiPort,
+            int batchSize, int batchLatency, qint64 cacheMemoryBudget,
             QObject *parent = 0 );
+    ~Server();
+
+    /* Where the threads serving the traced processes pass the parsed data
+     * to; it's handled by the server in its own thread.
+     */
+    XmlParseEventsHandler *parsedEventQueue() const;
 
-public slots:
-    void handleIncomingData(const QByteArray &data);
+    // Symbolizes the crash records received from the traced processes
+    CrashSymbolizerThread *crashSymbolizer() const;
 
 signals:
     void traceEntryReceived( const TraceEntry &e );
@@ -121,16 +154,23 @@ private slots:
     void handleNewGUIConnection();
     void nukeDatabase();
     void guiDisconnected( GUIConnection *c );
+    void storePendingEntries();
 
 private:
     void handleDatagram( const QByteArray &datagram );
     void handleTraceEntry( const TraceEntry &e );
     void handleShutdownEvent( const ProcessShutdownEvent &ev );
     void archivedEntries();
+    void storedEntries( const QList<TraceEntry> &entries );
 
     QTcpServer *m_guiServer;
     ServerSocket *m_tcpServer;
-    XmlContentHandler m_xmlHandler;
+#ifdef Q_OS_UNIX
+    SharedMemoryWatcher *m_sharedMemoryWatcher;
+#endif
+    ParsedEventQueue *m_parsedEventQueue;
+    CrashSymbolizerThread *m_crashSymbolizer;
+    QTimer m_batchTimer;
     bool m_receivedData;
     QString m_traceFile;
     QList<GUIConnection *> m_guiConnections;
@@ -0,0 +1,284 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sharedmemoryreader.h"
+
+#include "server.h"
+
+#include "../hooklib/atomicops.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#endif
+
+using namespace TRACELIB_NAMESPACE_IDENT(SharedMemoryFormat);
+using TRACELIB_NAMESPACE_IDENT(atomicLoad);
+using TRACELIB_NAMESPACE_IDENT(atomicStore);
+using TRACELIB_NAMESPACE_IDENT(atomicExchange);
+using TRACELIB_NAMESPACE_IDENT(atomicCompareAndSwap);
+
+static const char SegmentDirectory[] = "/dev/shm";
+static const int ScanInterval = 1000;
+
+static bool processIsAlive( unsigned int pid )
+{
+    return pid != 0 && ( kill( pid, 0 ) == 0 || errno == EPERM );
+}
+
+// Segments are named SegmentPrefix, followed by the process ID and a timestamp
+static unsigned int producerPidFromName( const QByteArray &name )
+{
+    const int start = name.indexOf( SegmentPrefix );
+    if ( start == -1 ) {
+        return 0;
+    }
+    const QByteArray rest = name.mid( start + sizeof( SegmentPrefix ) - 1 );
+    return rest.left( rest.indexOf( '-' ) ).toUInt();
+}
+
+SharedMemoryReader::SharedMemoryReader( const QByteArray &name, XmlParseEventsHandler *handler,
+                                        CrashSymbolizerThread *symbolizer, QObject *parent )
+    : QThread( parent ),
+    m_name( name ),
+    m_handler( handler ),
+    m_symbolizer( symbolizer ),
+    m_header( 0 ),
+    m_data( 0 ),
+    m_mappedSize( 0 ),
+    m_stopRequested( false )
+{
+}
+
+SharedMemoryReader::~SharedMemoryReader()
+{
+    if ( m_header ) {
+        munmap( m_header, m_mappedSize );
+    }
+}
+
+bool SharedMemoryReader::attach()
+{
+    const int fd = shm_open( m_name.constData(), O_RDWR, 0 );
+    if ( fd == -1 ) {
+        return false;
+    }
+
+    struct stat st;
+    void *segment = MAP_FAILED;
+    if ( fstat( fd, &st ) == 0 && (size_t)st.st_size >= sizeof( SharedMemoryHeader ) ) {
+        segment = mmap( 0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    }
+    ::close( fd );
+
+    SharedMemoryHeader *header = 0;
+    if ( segment != MAP_FAILED ) {
+        header = static_cast<SharedMemoryHeader *>( segment );
+        const unsigned int capacity = header->capacity;
+        if ( atomicLoad( &header->magic ) != Magic || header->version != Version ||
+             capacity == 0 || ( capacity & ( capacity - 1 ) ) != 0 ||
+             sizeof( SharedMemoryHeader ) + capacity > (size_t)st.st_size ) {
+            munmap( segment, st.st_size );
+            header = 0;
+        }
+    }
+
+    // A process which died while creating its segment never finishes it
+    if ( !header ) {
+        if ( !processIsAlive( producerPidFromName( m_name ) ) ) {
+            shm_unlink( m_name.constData() );
+        }
+        return false;
+    }
+
+    // Take over segments whose reader crashed
+    const unsigned int self = getpid();
+    unsigned int owner = atomicLoad( &header->readerPid );
+    while ( owner != self ) {
+        if ( processIsAlive( owner ) ) {
+            munmap( segment, st.st_size );
+            return false;
+        }
+        if ( atomicCompareAndSwap( &header->readerPid, owner, self ) ) {
+            break;
+        }
+        owner = atomicLoad( &header->readerPid );
+    }
+
+    m_header = header;
+    m_data = static_cast<const char *>( segment ) + sizeof( SharedMemoryHeader );
+    m_mappedSize = st.st_size;
+    return true;
+}
+
+void SharedMemoryReader::stop()
+{
+    m_stopRequested = true;
+}
+
+/* Collects all records available at once into a single chunk of data; the
+ * producer may reuse the space as soon as readPos was advanced.
+ */
+void SharedMemoryReader::run()
+{
+    const unsigned int capacity = m_header->capacity;
+    const unsigned int mask = capacity - 1;
+    unsigned int readPos = atomicLoad( &m_header->readPos );
+    bool corrupt = false;
+    ConnectionParser parser( m_handler, m_symbolizer );
+
+    while ( !m_stopRequested && !corrupt ) {
+        const unsigned int writePos = atomicLoad( &m_header->writePos );
+        if ( readPos == writePos ) {
+            if ( atomicLoad( &m_header->producerClosed ) || !processIsAlive( m_header->pid ) ) {
+                break;
+            }
+            waitForData( readPos );
+            continue;
+        }
+
+        QByteArray data;
+        while ( readPos != writePos ) {
+            const unsigned int offset = readPos & mask;
+            unsigned int length;
+            memcpy( &length, m_data + offset, sizeof( length ) );
+            if ( length == PaddingRecord && capacity - offset <= writePos - readPos ) {
+                readPos += capacity - offset;
+                continue;
+            }
+            if ( length > capacity - offset - sizeof( length ) ||
+                 recordSize( length ) > writePos - readPos ) {
+                corrupt = true;
+                break;
+            }
+            data.append( m_data + offset + sizeof( length ), length );
+            readPos += recordSize( length );
+        }
+
+        atomicStore( &m_header->readPos, readPos );
+        if ( !data.isEmpty() ) {
+            parser.addData( data );
+        }
+    }
+
+    const unsigned int droppedRecords = atomicLoad( &m_header->droppedRecords );
+    if ( droppedRecords > 0 ) {
+        qWarning() << "Process" << m_header->pid << "dropped" << droppedRecords
+                   << "records since the shared memory buffer was full";
+    }
+
+    if ( corrupt ) {
+        qWarning() << "Shared memory segment" << m_name << "is corrupt; ignoring it";
+        shm_unlink( m_name.constData() );
+    } else if ( m_stopRequested ) {
+        // Let the next trace daemon continue right away
+        atomicCompareAndSwap( &m_header->readerPid, (unsigned int)getpid(), 0u );
+    } else {
+        shm_unlink( m_name.constData() );
+    }
+}
+
+/* Announces that the reader is about to sleep and sleeps unless the
+ * producer wrote something in the meantime; the timeout is needed to
+ * notice that the producer died.
+ */
+void SharedMemoryReader::waitForData( unsigned int readPos )
+{
+    const unsigned int doorbell = atomicLoad( &m_header->doorbell );
+    atomicExchange( &m_header->readerWaiting, 1u );
+    if ( atomicLoad( &m_header->writePos ) == readPos ) {
+#ifdef __linux__
+        struct timespec timeout = { 0, 100 * 1000 * 1000 };
+        syscall( SYS_futex, &m_header->doorbell, FUTEX_WAIT, doorbell, &timeout, NULL, 0 );
+#else
+        Q_UNUSED( doorbell );
+        msleep( 10 );
+#endif
+    }
+    atomicStore( &m_header->readerWaiting, 0u );
+}
+
+SharedMemoryWatcher::SharedMemoryWatcher( Server *server )
+    : QObject( server ),
+    m_server( server )
+{
+    connect( &m_timer, SIGNAL( timeout() ), SLOT( scanSegments() ) );
+    m_timer.start( ScanInterval );
+    scanSegments();
+}
+
+SharedMemoryWatcher::~SharedMemoryWatcher()
+{
+    QHash<QByteArray, SharedMemoryReader *>::Iterator it, end = m_readers.end();
+    for ( it = m_readers.begin(); it != end; ++it ) {
+        ( *it )->stop();
+    }
+
+    for ( it = m_readers.begin(); it != end; ++it ) {
+        ( *it )->wait();
+        delete *it;
+    }
+}
+
+void SharedMemoryWatcher::scanSegments()
+{
+    const QStringList entries = QDir( SegmentDirectory ).entryList(
+        QStringList() << QString::fromLatin1( SegmentPrefix ) + "*", QDir::Files );
+
+    QStringList::ConstIterator it, end = entries.end();
+    for ( it = entries.begin(); it != end; ++it ) {
+        const QByteArray name = '/' + QFile::encodeName( *it );
+        if ( m_readers.contains( name ) ) {
+            continue;
+        }
+
+        SharedMemoryReader *reader = new SharedMemoryReader( name, m_server->parsedEventQueue(),
+                                                            m_server->crashSymbolizer() );
+        if ( !reader->attach() ) {
+            delete reader;
+            continue;
+        }
+
+        m_readers.insert( name, reader );
+        connect( reader, SIGNAL( finished() ),
+                 this, SLOT( readerFinished() ) );
+        reader->start();
+    }
+}
+
+void SharedMemoryWatcher::readerFinished()
+{
+    SharedMemoryReader *reader = static_cast<SharedMemoryReader *>( sender() );
+    m_readers.remove( m_readers.key( reader ) );
+    reader->deleteLater();
+}
@@ -0,0 +1,88 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACE_SHAREDMEMORYREADER_H
+#define TRACE_SHAREDMEMORYREADER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QThread>
+#include <QTimer>
+
+#include "../hooklib/sharedmemoryformat.h"
+
+class CrashSymbolizerThread;
+class Server;
+class XmlParseEventsHandler;
+
+/* Reads the ring buffer of a single shared memory segment written by the
+ * SharedMemoryOutput of a traced process and parses the data. The segment
+ * is removed once the traced process is gone and everything was read.
+ */
+class SharedMemoryReader : public QThread
+{
+    Q_OBJECT
+public:
+    SharedMemoryReader( const QByteArray &name, XmlParseEventsHandler *handler,
+                        CrashSymbolizerThread *symbolizer, QObject *parent = 0 );
+    ~SharedMemoryReader();
+
+    /* Maps the segment and claims it; returns false if the segment is not
+     * (yet) usable or read by another live trace daemon.
+     */
+    bool attach();
+    void stop();
+
+protected:
+    virtual void run();
+
+private:
+    void waitForData( unsigned int readPos );
+
+    QByteArray m_name;
+    XmlParseEventsHandler *m_handler;
+    CrashSymbolizerThread *m_symbolizer;
+    TRACELIB_NAMESPACE_IDENT(SharedMemoryFormat)::SharedMemoryHeader *m_header;
+    const char *m_data;
+    size_t m_mappedSize;
+    volatile bool m_stopRequested;
+};
+
+/* Looks for new shared memory segments and starts a SharedMemoryReader for
+ * each of them.
+ */
+class SharedMemoryWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    SharedMemoryWatcher( Server *server );
+    ~SharedMemoryWatcher();
+
+private slots:
+    void scanSegments();
+    void readerFinished();
+
+private:
+    Server *m_server;
+    QTimer m_timer;
+    QHash<QByteArray, SharedMemoryReader *> m_readers;
+};
+
+#endif // !defined(TRACE_SHAREDMEMORYREADER_H)
@@ -21,7 +21,8 @@
 
 XmlContentHandler::XmlContentHandler( XmlParseEventsHandler *handler )
     : m_handler( handler ),
-    m_inFrameElement( false )
+    m_inFrameElement( false ),
+    m_inSessionElement( false )
 {
 }
 
@@ -61,7 +62,13 @@ void XmlContentHandler::handleStartElement()
         QDateTime dt = QDateTime::fromMSecsSinceEpoch( signedDt );
         m_currentEntry.processStartTime = dt;
         m_currentEntry.tid = atts.value( QLatin1String( "tid" ) ).toString().toUInt();
-        m_currentEntry.timestamp = QDateTime::fromMSecsSinceEpoch( atts.value( QLatin1String( "time" ) ).toString().toULongLong() );
+        m_currentEntry.threadName = m_threadNames.value( m_currentEntry.tid );
+        // older tracelib versions only send millisecond timestamps
+        if ( atts.hasAttribute( QLatin1String( "time_ns" ) ) ) {
+            m_currentEntry.timestamp = atts.value( QLatin1String( "time_ns" ) ).toString().toULongLong();
+        } else {
+            m_currentEntry.timestamp = atts.value( QLatin1String( "time" ) ).toString().toULongLong() * 1000000;
+        }
     } else if ( m_xmlReader.name() == QLatin1String( "variable" ) ) {
         m_currentVariable = Variable();
         m_currentVariable.name = atts.value( QLatin1String( "name" ) ).toString();
@@ -91,6 +98,10 @@ void XmlContentHandler::handleStartElement()
         m_currentStorageConfig = StorageConfiguration();
         m_currentStorageConfig.maximumSize = atts.value( QLatin1String( "maxSize" ) ).toString().toULong();
         m_currentStorageConfig.shrinkBy = atts.value( QLatin1String( "shrinkBy" ) ).toString().toUInt();
+    } else if ( m_xmlReader.name() == QLatin1String( "session" ) ) {
+        m_inSessionElement = true;
+        m_sessionTraceKeys.clear();
+        m_threadNames.clear();
     } else if ( m_xmlReader.name() == QLatin1String( "key" ) ) {
         m_currentTraceKey = TraceKey();
         m_currentTraceKey.enabled = atts.value( QLatin1String( "enabled" ) ) == QLatin1String( "true" );
@@ -108,6 +119,10 @@ void XmlContentHandler::handleEndElement()
     } else if ( m_xmlReader.name() == QLatin1String( "processname" ) ) {
         m_currentEntry.processName = m_s.trimmed();
         m_s.clear();
+    } else if ( m_xmlReader.name() == QLatin1String( "threadname" ) ) {
+        m_currentEntry.threadName = m_s.trimmed();
+        m_threadNames.insert( m_currentEntry.tid, m_currentEntry.threadName );
+        m_s.clear();
     } else if ( m_xmlReader.name() == QLatin1String( "stackposition" ) ) {
         m_currentEntry.stackPosition = m_s.trimmed().toULong();
         m_s.clear();
@@ -152,7 +167,15 @@ void XmlContentHandler::handleEndElement()
     } else if ( m_xmlReader.name() == QLatin1String( "key" ) ) {
         m_currentTraceKey.name = m_s.trimmed();
         m_s.clear();
-        m_currentEntry.traceKeys.append( m_currentTraceKey );
+        // Older versions of tracelib sent the keys with every entry
+        if ( m_inSessionElement ) {
+            m_sessionTraceKeys.append( m_currentTraceKey );
+        } else {
+            m_currentEntry.traceKeys.append( m_currentTraceKey );
+        }
+    } else if ( m_xmlReader.name() == QLatin1String( "session" ) ) {
+        m_inSessionElement = false;
+        m_handler->handleTraceKeys( m_sessionTraceKeys );
     } else if ( m_xmlReader.name() == QLatin1String( "storageconfiguration" ) ) {
         m_currentStorageConfig.archiveDir = m_s.trimmed();
         m_s.clear();
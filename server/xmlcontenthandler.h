@@ -20,7 +20,9 @@
 #ifndef TRACER_XMLCONTENTHANDLER_H
 #define TRACER_XMLCONTENTHANDLER_H
 
+#include "contenthandler.h"
 #include "database.h"
+#include <QHash>
 #include <QXmlStreamReader>
 
 struct StorageConfiguration
@@ -40,20 +42,25 @@ struct StorageConfiguration
 class XmlParseEventsHandler
 {
     friend class XmlContentHandler;
+    friend class BinaryContentHandler;
+    friend class CrashSymbolizerThread;
+    friend class ParsedEventQueue;
 protected:
     virtual void handleTraceEntry( const TraceEntry& ) = 0;
     virtual void applyStorageConfiguration( const StorageConfiguration & ) = 0;
     virtual void handleShutdownEvent( const ProcessShutdownEvent & ) = 0;
+    // Called with the trace keys configured for a traced process
+    virtual void handleTraceKeys( const QList<TraceKey> & ) = 0;
 };
 
-class XmlContentHandler
+class XmlContentHandler : public ContentHandler
 {
 public:
     XmlContentHandler( XmlParseEventsHandler *handler );
 
-    void addData( const QByteArray &data );
+    virtual void addData( const QByteArray &data );
 
-    void continueParsing();
+    virtual void continueParsing();
 
 private:
     void handleStartElement();
@@ -67,6 +74,10 @@ private:
     unsigned long m_currentLineNo;
     StackFrame m_currentFrame;
     bool m_inFrameElement;
+    bool m_inSessionElement;
+    QList<TraceKey> m_sessionTraceKeys;
+    // Names are only sent with the first entry of a thread in each session
+    QHash<unsigned int, QString> m_threadNames;
     ProcessShutdownEvent m_currentShutdownEvent;
     StorageConfiguration m_currentStorageConfig;
     TraceKey m_currentTraceKey;
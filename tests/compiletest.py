@@ -225,6 +225,7 @@ def verifyOutput(compiler, arch, srcdir, tracelibdir):
     replacements = [re.compile(r'(pid)="[0-9]+"'),
                     re.compile(r'(process_starttime)="[0-9]+"'),
                     re.compile(r'(time)="[0-9]+"'),
+                    re.compile(r'(time_ns)="[0-9]+"'),
                     re.compile(r'(tid)="[0-9]+"')]
     for repl in replacements:
         actualXml = repl.sub(r"\1=\"\1\"", actualXml)
@@ -0,0 +1,247 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../server/binarycontenthandler.h"
+#include "../hooklib/binaryformat.h"
+#include "../hooklib/tracepoint.h" // for TracePointType
+
+#include <QCoreApplication>
+#include <QList>
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+static void verify( const char *what, const char *expected, const QString &actual )
+{
+    verify( what, string( expected ), actual.toStdString() );
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+using namespace BinaryFormat;
+
+class RecordingHandler : public XmlParseEventsHandler
+{
+public:
+    QList<TraceEntry> entries;
+
+protected:
+    virtual void handleTraceEntry( const TraceEntry &e ) { entries.append( e ); }
+    virtual void applyStorageConfiguration( const StorageConfiguration & ) { }
+    virtual void handleShutdownEvent( const ProcessShutdownEvent & ) { }
+    virtual void handleTraceKeys( const QList<TraceKey> & ) { }
+};
+
+/* Encodes the records the way the hook library does, see the description
+ * in binaryformat.h.
+ */
+static void appendVarint( string &s, unsigned long long v )
+{
+    while ( v >= 0x80 ) {
+        s += static_cast<char>( ( v & 0x7f ) | 0x80 );
+        v >>= 7;
+    }
+    s += static_cast<char>( v );
+}
+
+static void appendString( string &s, const string &str )
+{
+    appendVarint( s, str.size() );
+    s += str;
+}
+
+static void appendRecord( string &stream, RecordType type, const string &payload )
+{
+    stream += static_cast<char>( RecordMarker );
+    stream += static_cast<char>( type );
+    appendVarint( stream, payload.size() );
+    stream += payload;
+}
+
+static string sessionRecord()
+{
+    string payload;
+    appendVarint( payload, 4711 ); // pid
+    appendVarint( payload, 1286886765000ULL ); // process start time
+    appendString( payload, "crasher" );
+    appendVarint( payload, 0 ); // trace keys
+    appendVarint( payload, 0 ); // maximum size
+    appendVarint( payload, 0 ); // shrink by
+    appendString( payload, "" ); // archive directory
+
+    string record;
+    appendRecord( record, SessionRecord, payload );
+    return record;
+}
+
+static string threadRecord( unsigned long tid, const string &name )
+{
+    string payload;
+    appendVarint( payload, tid );
+    appendString( payload, name );
+
+    string record;
+    appendRecord( record, ThreadRecord, payload );
+    return record;
+}
+
+/* A crash in thread 'tid' with two frames: one outside of any mapping and
+ * one within a module which doesn't exist on this machine, so neither of
+ * them can be symbolized.
+ */
+static string crashRecord( unsigned long tid, unsigned long frameCount = 2 )
+{
+    string payload;
+    appendVarint( payload, tid );
+    appendVarint( payload, 1286886765123456789ULL ); // timestamp
+    appendVarint( payload, 11 ); // SIGSEGV
+    appendVarint( payload, 0xdead ); // fault address
+    appendVarint( payload, frameCount );
+    appendVarint( payload, 0x1000 );
+    appendVarint( payload, 0x2050 );
+    appendVarint( payload, 0x2000 ); // mapping start
+    appendVarint( payload, 0x3000 ); // mapping end
+    appendVarint( payload, 0 ); // file offset
+    appendString( payload, "/nonexistent/libcrash.so" );
+
+    string record;
+    appendRecord( record, CrashRecord, payload );
+    return record;
+}
+
+static QList<TraceEntry> decode( const string &stream )
+{
+    RecordingHandler handler;
+    BinaryContentHandler contentHandler( &handler );
+    contentHandler.addData( QByteArray( stream.data(), static_cast<int>( stream.size() ) ) );
+    contentHandler.continueParsing();
+    return handler.entries;
+}
+
+static void testCrashRecord()
+{
+    const QList<TraceEntry> entries = decode( sessionRecord() + threadRecord( 7, "worker" ) + crashRecord( 7 ) );
+    verify( "crash record yields one entry", 1, entries.size() );
+    if ( entries.isEmpty() ) {
+        return;
+    }
+
+    const TraceEntry &e = entries.first();
+    verify( "pid of crash entry", 4711u, e.pid );
+    verify( "process name of crash entry", "crasher", e.processName );
+    verify( "thread of crash entry", 7u, e.tid );
+    verify( "thread name of crash entry", "worker", e.threadName );
+    verify( "timestamp of crash entry", static_cast<quint64>( 1286886765123456789ULL ), e.timestamp );
+    verify( "type of crash entry", static_cast<unsigned int>( TracePointType::Error ), e.type );
+    verify( "message of crash entry", "The application crashed at this point! (signal 11, address 0xdead)", e.message );
+
+    verify( "depth of crash backtrace", 2, e.backtrace.size() );
+    if ( e.backtrace.size() != 2 ) {
+        return;
+    }
+    verify( "unmapped frame has no module", "", e.backtrace[0].module );
+    verify( "unmapped frame shows the address", "0x1000", e.backtrace[0].function );
+    verify( "mapped frame names the module", "/nonexistent/libcrash.so", e.backtrace[1].module );
+    verify( "mapped frame shows the file offset", "0x50", e.backtrace[1].function );
+    verify( "location is taken from the innermost frame", "0x1000", e.function );
+    verify( "unknown source file", "<unknown file>", e.path );
+}
+
+static void testThreadRecord()
+{
+    QList<TraceEntry> entries = decode( sessionRecord() + threadRecord( 7, "worker" ) + crashRecord( 8 ) );
+    verify( "crash in unnamed thread yields one entry", 1, entries.size() );
+    if ( !entries.isEmpty() ) {
+        verify( "names of other threads aren't used", "", entries.first().threadName );
+    }
+
+    entries = decode( sessionRecord() + threadRecord( 7, "worker" ) + threadRecord( 7, "renamed" ) + crashRecord( 7 ) );
+    if ( !entries.isEmpty() ) {
+        verify( "the last thread record wins", "renamed", entries.first().threadName );
+    }
+
+    entries = decode( sessionRecord() + threadRecord( 7, "worker" ) + sessionRecord() + crashRecord( 7 ) );
+    if ( !entries.isEmpty() ) {
+        verify( "thread names are forgotten with a new session", "", entries.first().threadName );
+    }
+
+    entries = decode( sessionRecord() + threadRecord( 7, "w\xc3\xb6rker" ) + crashRecord( 7 ) );
+    if ( !entries.isEmpty() ) {
+        verify( "thread names are UTF-8", QString::fromUtf8( "w\xc3\xb6rker" ).toStdString(),
+                entries.first().threadName.toStdString() );
+    }
+}
+
+static void testMalformedRecords()
+{
+    verify( "crash record without session is dropped", 0, decode( crashRecord( 7 ) ).size() );
+    verify( "crash record with missing frames is dropped", 0,
+            decode( sessionRecord() + crashRecord( 7, 5 ) ).size() );
+
+    string truncatedThread = threadRecord( 7, "worker" );
+    truncatedThread[2] = static_cast<char>( truncatedThread[2] - 1 ); // cut off the last byte of the name
+    truncatedThread.erase( truncatedThread.size() - 1 );
+    const QList<TraceEntry> entries = decode( sessionRecord() + truncatedThread + crashRecord( 7 ) );
+    verify( "record after a malformed thread record is decoded", 1, entries.size() );
+    if ( !entries.isEmpty() ) {
+        verify( "malformed thread record is ignored", "", entries.first().threadName );
+    }
+
+    // Records arriving in pieces are decoded once they are complete
+    const string stream = sessionRecord() + threadRecord( 7, "worker" ) + crashRecord( 7 );
+    RecordingHandler handler;
+    BinaryContentHandler contentHandler( &handler );
+    for ( size_t i = 0; i < stream.size(); ++i ) {
+        contentHandler.addData( QByteArray( stream.data() + i, 1 ) );
+        contentHandler.continueParsing();
+    }
+    verify( "crash record arriving byte by byte", 1, handler.entries.size() );
+    if ( !handler.entries.isEmpty() ) {
+        verify( "thread name of crash record arriving byte by byte", "worker", handler.entries.first().threadName );
+    }
+}
+
+TRACELIB_NAMESPACE_END
+
+int main( int argc, char **argv )
+{
+    // Symbolizing crash records runs addr2line
+    QCoreApplication app( argc, argv );
+
+    TRACELIB_NAMESPACE_IDENT(testCrashRecord)();
+    TRACELIB_NAMESPACE_IDENT(testThreadRecord)();
+    TRACELIB_NAMESPACE_IDENT(testMalformedRecords)();
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
@@ -0,0 +1,170 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "streamcompression.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+using namespace StreamCompression;
+
+static string roundTrip( const string &data, size_t *compressedLength = 0 )
+{
+    vector<char> frame;
+    appendFrame( frame, data.data(), data.size() );
+
+    unsigned long frameCompressedLength, frameLength;
+    readFrameHeader( &frame[0], &frameCompressedLength, &frameLength );
+    if ( frameCompressedLength + FrameHeaderLength != frame.size() || frameLength != data.size() ) {
+        return "<bad frame header>";
+    }
+    if ( compressedLength ) {
+        *compressedLength = frameCompressedLength;
+    }
+
+    vector<char> out( frameLength + 1 );
+    if ( !decompressBlock( &frame[FrameHeaderLength], frameCompressedLength, &out[0], frameLength ) ) {
+        return "<decompression failed>";
+    }
+    return string( &out[0], frameLength );
+}
+
+static void testRoundTrip()
+{
+    verify( "empty data", string(), roundTrip( string() ) );
+    verify( "single byte", string( "x" ), roundTrip( "x" ) );
+    verify( "data shorter than the minimum match distance", string( "abcdabcdabcd" ), roundTrip( "abcdabcdabcd" ) );
+
+    const string run( 100000, 'a' );
+    size_t compressedLength;
+    verify( "long run of one byte", run, roundTrip( run, &compressedLength ) );
+    verify( "long run compresses well", true, compressedLength < 1000 );
+
+    ostringstream xml;
+    for ( int i = 0; i < 2000; ++i ) {
+        xml << "<traceentry pid=\"4711\" process_starttime=\"1286886765\" thread=\"140243\" "
+            << "time=\"" << 1286886765000 + i * 17 << "\" type=\"log\" "
+            << "stackpos=\"" << i % 7 << "\"><location lineno=\"" << i % 300
+            << "\"><![CDATA[main.cpp]]></location><message><![CDATA[entry "
+            << i << "]]></message></traceentry>\n";
+    }
+    const string entries = xml.str();
+    verify( "trace entries", entries, roundTrip( entries, &compressedLength ) );
+    verify( "trace entries compress to less than a quarter", true, compressedLength < entries.size() / 4 );
+
+    srand( 42 );
+    string noise( 70000, '\0' );
+    for ( size_t i = 0; i < noise.size(); ++i ) {
+        noise[i] = static_cast<char>( rand() );
+    }
+    verify( "incompressible data", noise, roundTrip( noise, &compressedLength ) );
+    verify( "incompressible data stays within the bound", true,
+            compressedLength <= maximumCompressedLength( noise.size() ) );
+
+    // Matches farther away than the maximum offset must not be used
+    const string far = noise.substr( 0, 1000 ) + noise.substr( 1000, 65000 ) + noise.substr( 0, 1000 );
+    verify( "repetition beyond the maximum offset", far, roundTrip( far ) );
+}
+
+static void testCorruptData()
+{
+    const string data( 5000, 'b' );
+    vector<char> frame;
+    appendFrame( frame, data.data(), data.size() );
+    const char *block = &frame[FrameHeaderLength];
+    const size_t blockLength = frame.size() - FrameHeaderLength;
+
+    vector<char> out( data.size() + 1 );
+    verify( "intact block decodes", true, decompressBlock( block, blockLength, &out[0], data.size() ) );
+    verify( "truncated block is rejected", false, decompressBlock( block, blockLength - 1, &out[0], data.size() ) );
+    verify( "block larger than announced is rejected", false, decompressBlock( block, blockLength, &out[0], data.size() - 1 ) );
+    verify( "block smaller than announced is rejected", false, decompressBlock( block, blockLength, &out[0], data.size() + 1 ) );
+
+    // A match referring to data before the start of the block
+    const char badOffset[] = { 0x10, 'x', 0x05, 0x00, 0x00 };
+    verify( "offset before the start is rejected", false, decompressBlock( badOffset, sizeof( badOffset ), &out[0], 10 ) );
+}
+
+static void testNegotiation()
+{
+    const vector<char> xmlRequest = compressionRequest( '<' );
+    const vector<char> binaryRequest = compressionRequest( static_cast<char>( BinaryFormat::RecordMarker ) );
+    verify( "XML streams get an XML request", '<', xmlRequest[0] );
+    verify( "binary streams get a binary request", BinaryFormat::RecordMarker,
+            static_cast<unsigned char>( binaryRequest[0] ) );
+
+    size_t requestLength = 0;
+    verify( "complete XML request", CompleteRequest,
+            matchCompressionRequest( &xmlRequest[0], xmlRequest.size(), &requestLength ) );
+    verify( "length of XML request", xmlRequest.size(), requestLength );
+    verify( "complete binary request", CompleteRequest,
+            matchCompressionRequest( &binaryRequest[0], binaryRequest.size(), &requestLength ) );
+    verify( "length of binary request", binaryRequest.size(), requestLength );
+    verify( "start of a request", IncompleteRequest,
+            matchCompressionRequest( &xmlRequest[0], 5, &requestLength ) );
+
+    const string entry = "<traceentry pid=\"1\">";
+    verify( "plain XML stream", NoRequest,
+            matchCompressionRequest( entry.data(), entry.size(), &requestLength ) );
+    const char sessionRecord[] = { static_cast<char>( BinaryFormat::RecordMarker ), BinaryFormat::SessionRecord, 0 };
+    verify( "plain binary stream", NoRequest,
+            matchCompressionRequest( sessionRecord, sizeof( sessionRecord ), &requestLength ) );
+
+    unsigned char reply[ReplyLength];
+    writeReply( reply, Lz4Codec );
+    verify( "reply accepting LZ4", true, replyAcceptsCodec( reply, Lz4Codec ) );
+
+    writeReply( reply, 0 );
+    verify( "reply accepting no codec", false, replyAcceptsCodec( reply, Lz4Codec ) );
+
+    const unsigned char garbage[ReplyLength] = { '<', 't', 'r', 'a', 'c', 'e' };
+    verify( "data which is not a reply", false, replyAcceptsCodec( garbage, Lz4Codec ) );
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    TRACELIB_NAMESPACE_IDENT(testRoundTrip)();
+    TRACELIB_NAMESPACE_IDENT(testCorruptData)();
+    TRACELIB_NAMESPACE_IDENT(testNegotiation)();
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
@@ -19,6 +19,7 @@
 
 #include "tracelib.h"
 #include "filter.h"
+#include "throttle.h"
 
 #include <iostream>
 
@@ -128,10 +129,55 @@ static void testWildcardPathFilter()
     verify( "questionMarkFilter on tpUpperCase", true, questionMarkFilter.acceptsTracePoint( &tpUpperCase ) );
 }
 
+static void testRegExpPathFilter()
+{
+    static TracePoint tpMain( TracePointType::Log, "/src/app/main.cpp", 0, NULL, 0 );
+    static TracePoint tpMain2( TracePointType::Log, "/src/app/main.cpp", 10, NULL, 0 );
+    static TracePoint tpHeader( TracePointType::Log, "/src/app/main.h", 0, NULL, 0 );
+
+    PathFilter sourceFileFilter;
+    sourceFileFilter.setPath( RegExpMatch, ".*\\.cpp" );
+    verify( "sourceFileFilter on tpMain", true, sourceFileFilter.acceptsTracePoint( &tpMain ) );
+    verify( "sourceFileFilter on tpMain2", true, sourceFileFilter.acceptsTracePoint( &tpMain2 ) );
+    verify( "sourceFileFilter on tpHeader", false, sourceFileFilter.acceptsTracePoint( &tpHeader ) );
+    verify( "sourceFileFilter on tpHeader (again)", false, sourceFileFilter.acceptsTracePoint( &tpHeader ) );
+
+    // Changing the pattern must not yield results matched before
+    sourceFileFilter.setPath( RegExpMatch, ".*\\.h" );
+    verify( "changed sourceFileFilter on tpMain", false, sourceFileFilter.acceptsTracePoint( &tpMain ) );
+    verify( "changed sourceFileFilter on tpHeader", true, sourceFileFilter.acceptsTracePoint( &tpHeader ) );
+}
+
 static void testPathFilter()
 {
     testStrictPathFilter();
     testWildcardPathFilter();
+    testRegExpPathFilter();
+}
+
+static void testFunctionFilter()
+{
+    static TracePoint tpMain( TracePointType::Log, "main.cpp", 0, "int main()", 0 );
+    static TracePoint tpRun( TracePointType::Log, "main.cpp", 0, "void Application::run()", 0 );
+    static TracePoint tpRun2( TracePointType::Log, "app.cpp", 3, "void Application::run()", 0 );
+
+    FunctionFilter strictFilter;
+    strictFilter.setFunction( StrictMatch, "int main()" );
+    verify( "strictFilter on tpMain", true, strictFilter.acceptsTracePoint( &tpMain ) );
+    verify( "strictFilter on tpRun", false, strictFilter.acceptsTracePoint( &tpRun ) );
+
+    FunctionFilter wildcardFilter;
+    wildcardFilter.setFunction( WildcardMatch, "*Application::*" );
+    verify( "wildcardFilter on tpMain", false, wildcardFilter.acceptsTracePoint( &tpMain ) );
+    verify( "wildcardFilter on tpRun", true, wildcardFilter.acceptsTracePoint( &tpRun ) );
+    verify( "wildcardFilter on tpRun2", true, wildcardFilter.acceptsTracePoint( &tpRun2 ) );
+    verify( "wildcardFilter on tpMain (again)", false, wildcardFilter.acceptsTracePoint( &tpMain ) );
+
+    FunctionFilter regExpFilter;
+    regExpFilter.setFunction( RegExpMatch, "int (main|f)\\(\\)" );
+    verify( "regExpFilter on tpMain", true, regExpFilter.acceptsTracePoint( &tpMain ) );
+    verify( "regExpFilter on tpRun", false, regExpFilter.acceptsTracePoint( &tpRun ) );
+    verify( "regExpFilter on tpMain (again)", true, regExpFilter.acceptsTracePoint( &tpMain ) );
 }
 
 static void testGroupFilter()
@@ -164,6 +210,105 @@ static void testGroupFilter()
     verify( "f2 (blacklisting) on consoleIOTP", false, f2.acceptsTracePoint( &consoleIOTP ) );
     verify( "f2 (blacklisting) on noGroupTP", false, f2.acceptsTracePoint( &noGroupTP ) );
     verify( "f2 (blacklisting) on noGroupTP2", false, f2.acceptsTracePoint( &noGroupTP2 ) );
+
+    static TracePoint networkTP( TracePointType::Log, "S:\\hello\\main.cpp", 13, "main()", "Network" );
+    static TracePoint databaseTP( TracePointType::Log, "S:\\hello\\main.cpp", 13, "main()", "Database" );
+
+    GroupFilter f3;
+    f3.setMode( GroupFilter::Whitelist );
+    f3.addGroupName( "Network" );
+    f3.addGroupName( "ConsoleIO" );
+    f3.addGroupName( "Widgets" );
+    f3.addGroupName( "Network" );
+    verify( "f3 (whitelisting) on consoleIOTP", true, f3.acceptsTracePoint( &consoleIOTP ) );
+    verify( "f3 (whitelisting) on networkTP", true, f3.acceptsTracePoint( &networkTP ) );
+    verify( "f3 (whitelisting) on databaseTP", false, f3.acceptsTracePoint( &databaseTP ) );
+    verify( "f3 (whitelisting) on noGroupTP", false, f3.acceptsTracePoint( &noGroupTP ) );
+}
+
+static void testThrottleAttributes()
+{
+    unsigned long rate = 42;
+    verify( "rate=\"0\" accepted", true, parseRateAttribute( "0", &rate ) );
+    verify( "rate=\"0\" value", 0ul, rate );
+    verify( "rate=\"100\" accepted", true, parseRateAttribute( "100", &rate ) );
+    verify( "rate=\"100\" value", 100ul, rate );
+    verify( "rate=\"\" rejected", false, parseRateAttribute( "", &rate ) );
+    verify( "rate=\"fast\" rejected", false, parseRateAttribute( "fast", &rate ) );
+    verify( "rate=\"-1\" rejected", false, parseRateAttribute( "-1", &rate ) );
+    verify( "rate=\"10x\" rejected", false, parseRateAttribute( "10x", &rate ) );
+    verify( "rate=\" 10\" rejected", false, parseRateAttribute( " 10", &rate ) );
+    verify( "rate=\"99999999999999999999999\" rejected", false, parseRateAttribute( "99999999999999999999999", &rate ) );
+    verify( "rejected rate= leaves value alone", 100ul, rate );
+
+    unsigned long sampleInterval = 42;
+    verify( "sample=\"1\" accepted", true, parseSampleAttribute( "1", &sampleInterval ) );
+    verify( "sample=\"1\" value", 1ul, sampleInterval );
+    verify( "sample=\"10\" accepted", true, parseSampleAttribute( "10", &sampleInterval ) );
+    verify( "sample=\"10\" value", 10ul, sampleInterval );
+    verify( "sample=\"0\" rejected", false, parseSampleAttribute( "0", &sampleInterval ) );
+    verify( "sample=\"\" rejected", false, parseSampleAttribute( "", &sampleInterval ) );
+    verify( "sample=\"-3\" rejected", false, parseSampleAttribute( "-3", &sampleInterval ) );
+    verify( "sample=\"often\" rejected", false, parseSampleAttribute( "often", &sampleInterval ) );
+    verify( "rejected sample= leaves value alone", 10ul, sampleInterval );
+}
+
+static void testSampling()
+{
+    TracePointThrottle throttle;
+    throttle.sampleInterval = 3;
+
+    const bool expected[] = { true, false, false, true, false, false, true };
+    for ( size_t i = 0; i < sizeof( expected ) / sizeof( expected[0] ); ++i ) {
+        verify( "sample=3 hit accepted", expected[i], acceptThrottledHit( &throttle, 1000 ) );
+    }
+    verify( "sample=3 suppressed hits", 4ul, throttle.suppressedHits );
+}
+
+static void testRateLimit()
+{
+    // 10 entries per second: one every 100ms, bursts of up to 10 entries
+    TracePointThrottle throttle;
+    throttle.rate = 10;
+
+    const unsigned long start = 5000000;
+    for ( int i = 0; i < 10; ++i ) {
+        verify( "rate=10 burst accepted", true, acceptThrottledHit( &throttle, start ) );
+    }
+    verify( "rate=10 hit exceeding burst", false, acceptThrottledHit( &throttle, start ) );
+    verify( "rate=10 hit 50ms later", false, acceptThrottledHit( &throttle, start + 50000 ) );
+    verify( "rate=10 hit 100ms later", true, acceptThrottledHit( &throttle, start + 100000 ) );
+    verify( "rate=10 second hit 100ms later", false, acceptThrottledHit( &throttle, start + 100000 ) );
+    verify( "rate=10 suppressed hits", 3ul, throttle.suppressedHits );
+
+    // After being idle for long, a full burst is allowed again
+    const unsigned long later = start + 60000000;
+    for ( int i = 0; i < 10; ++i ) {
+        verify( "rate=10 burst after idle time accepted", true, acceptThrottledHit( &throttle, later ) );
+    }
+    verify( "rate=10 hit exceeding burst after idle time", false, acceptThrottledHit( &throttle, later ) );
+
+    // The clock wraps around
+    TracePointThrottle wrappingThrottle;
+    wrappingThrottle.rate = 10;
+    const unsigned long beforeWrap = static_cast<unsigned long>( -50000 );
+    verify( "rate=10 hit long before wrap", true, acceptThrottledHit( &wrappingThrottle, beforeWrap - 5000000 ) );
+    for ( int i = 0; i < 10; ++i ) {
+        verify( "rate=10 burst before wrap accepted", true, acceptThrottledHit( &wrappingThrottle, beforeWrap ) );
+    }
+    verify( "rate=10 hit 50ms after burst, at wrap", false, acceptThrottledHit( &wrappingThrottle, beforeWrap + 50000 ) );
+    verify( "rate=10 hit 200ms after burst, after wrap", true, acceptThrottledHit( &wrappingThrottle, beforeWrap + 200000 ) );
+
+    // Sampling applies before the rate limit
+    TracePointThrottle combinedThrottle;
+    combinedThrottle.rate = 1;
+    combinedThrottle.sampleInterval = 2;
+    verify( "rate=1 sample=2 first hit", true, acceptThrottledHit( &combinedThrottle, start ) );
+    verify( "rate=1 sample=2 second hit", false, acceptThrottledHit( &combinedThrottle, start ) );
+    verify( "rate=1 sample=2 third hit", false, acceptThrottledHit( &combinedThrottle, start ) );
+    verify( "rate=1 sample=2 fourth hit a second later", false, acceptThrottledHit( &combinedThrottle, start + 1000000 ) );
+    verify( "rate=1 sample=2 fifth hit a second later", true, acceptThrottledHit( &combinedThrottle, start + 1000000 ) );
+    verify( "rate=1 sample=2 suppressed hits", 3ul, combinedThrottle.suppressedHits );
 }
 
 TRACELIB_NAMESPACE_END
@@ -171,7 +316,11 @@ TRACELIB_NAMESPACE_END
 int main()
 {
     TRACELIB_NAMESPACE_IDENT(testPathFilter)();
+    TRACELIB_NAMESPACE_IDENT(testFunctionFilter)();
     TRACELIB_NAMESPACE_IDENT(testGroupFilter)();
+    TRACELIB_NAMESPACE_IDENT(testThrottleAttributes)();
+    TRACELIB_NAMESPACE_IDENT(testSampling)();
+    TRACELIB_NAMESPACE_IDENT(testRateLimit)();
     cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
     return g_failureCount;
 }
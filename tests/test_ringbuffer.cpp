@@ -0,0 +1,122 @@
+/* tracetool - a framework for tracing the execution of C++ programs
+ * Copyright 2010-2016 froglogic GmbH
+ *
+ * This file is part of tracetool.
+ *
+ * tracetool is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * tracetool is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with tracetool.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ringbuffer.h"
+#include "thread.h"
+
+#include <iostream>
+
+using namespace std;
+
+int g_failureCount = 0;
+int g_verificationCount = 0;
+
+template <typename T>
+static void verify( const char *what, T expected, T actual )
+{
+    if ( !( expected == actual ) ) {
+        cout << "FAIL: " << what << "; expected '" << boolalpha << expected << "', got '" << boolalpha << actual << "'" << endl;
+        ++g_failureCount;
+    }
+    ++g_verificationCount;
+}
+
+TRACELIB_NAMESPACE_BEGIN
+
+static void testCapacity()
+{
+    RingBuffer<int> buf( 5 );
+    verify( "capacity is rounded up to a power of two", 8ul, buf.capacity() );
+    verify( "new buffer is empty", true, buf.isEmpty() );
+    verify( "new buffer has nothing to read", true, buf.beginRead() == 0 );
+
+    for ( int i = 0; i < 8; ++i ) {
+        int *slot = buf.beginWrite();
+        verify( "free slot available", true, slot != 0 );
+        *slot = i;
+        buf.commitWrite();
+    }
+    verify( "full buffer has no free slot", true, buf.beginWrite() == 0 );
+
+    for ( int i = 0; i < 8; ++i ) {
+        int *slot = buf.beginRead();
+        verify( "queued slot available", true, slot != 0 );
+        verify( "slots are read in order", i, *slot );
+        buf.commitRead();
+    }
+    verify( "drained buffer is empty", true, buf.isEmpty() );
+}
+
+class Producer : public Thread
+{
+public:
+    Producer( RingBuffer<unsigned long> &buf, unsigned long count )
+        : m_buf( buf ), m_count( count ) { }
+
+protected:
+    virtual void run() {
+        for ( unsigned long i = 0; i < m_count; ++i ) {
+            unsigned long *slot;
+            while ( !( slot = m_buf.beginWrite() ) ) {
+                Thread::yield();
+            }
+            *slot = i;
+            m_buf.commitWrite();
+        }
+    }
+
+private:
+    RingBuffer<unsigned long> &m_buf;
+    const unsigned long m_count;
+};
+
+static void testConcurrentAccess()
+{
+    const unsigned long count = 1000000;
+    RingBuffer<unsigned long> buf( 64 );
+    Producer producer( buf, count );
+    verify( "producer thread started", true, producer.start() );
+
+    unsigned long outOfOrder = 0;
+    for ( unsigned long i = 0; i < count; ++i ) {
+        unsigned long *slot;
+        while ( !( slot = buf.beginRead() ) ) {
+            Thread::yield();
+        }
+        if ( *slot != i ) {
+            ++outOfOrder;
+        }
+        buf.commitRead();
+    }
+    producer.wait();
+
+    verify( "entries read out of order", 0ul, outOfOrder );
+    verify( "buffer is empty after reading everything", true, buf.isEmpty() );
+}
+
+TRACELIB_NAMESPACE_END
+
+int main()
+{
+    TRACELIB_NAMESPACE_IDENT(testCapacity)();
+    TRACELIB_NAMESPACE_IDENT(testConcurrentAccess)();
+    cout << g_verificationCount << " verifications; " << g_failureCount << " failures found." << endl;
+    return g_failureCount;
+}
+
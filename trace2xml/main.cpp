@@ -71,6 +71,7 @@ static bool toXml(const QSqlDatabase db, FILE *output, QString *errMsg)
         "  <!ATTLIST traceentry id CDATA #REQUIRED\n"
         "                       type CDATA #REQUIRED>\n"
         "  <!ELEMENT timestamp (#PCDATA)>\n"
+        "  <!ATTLIST timestamp ns CDATA #IMPLIED>\n"
         "  <!ELEMENT process (pid, name, starttime, endtime)>\n"
         "  <!ELEMENT pid (#PCDATA)>\n"
         "  <!ELEMENT name (#PCDATA)>\n"
@@ -93,7 +94,7 @@ static bool toXml(const QSqlDatabase db, FILE *output, QString *errMsg)
     const char footer[] = "</trace>\n";
     const char traceentryTpl0[] =
         "  <traceentry id=\"%s\" type=\"%s\">\n"
-        "    <timestamp>%s</timestamp>\n"
+        "    <timestamp ns=\"%s\">%s</timestamp>\n"
         "    <process>\n"
         "      <pid>%s</pid>\n"
         "      <name><![CDATA[%s]]></name>\n"
@@ -174,7 +175,8 @@ static bool toXml(const QSqlDatabase db, FILE *output, QString *errMsg)
         fprintf(output, traceentryTpl0,
                 resultSet.value(0).toString().toUtf8().constData(),
                 tracePointTypeAsString(resultSet.value(10).toInt()).toUtf8().constData(), //type
-                resultSet.value(1).toString().toUtf8().constData(),
+                resultSet.value(1).toString().toUtf8().constData(), //timestamp in ns
+                QString::number(resultSet.value(1).toLongLong() / 1000000).toUtf8().constData(), //timestamp in ms
                 resultSet.value(3).toString().toUtf8().constData(), //pid
                 resultSet.value(2).toString().toUtf8().constData(), //process name
                 resultSet.value(4).toString().toUtf8().constData(),
@@ -18,7 +18,7 @@
  */
 
 #include "../hooklib/tracelib.h"
-#include "../server/xmlcontenthandler.h"
+#include "../server/contenthandler.h"
 #include "../server/databasefeeder.h"
 #include "config.h"
 
@@ -26,6 +26,7 @@
 #include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QFile>
+#include <QScopedPointer>
 #include <QSqlDatabase>
 
 namespace Error
@@ -40,16 +41,22 @@ namespace Error
 static bool fromXml( QSqlDatabase &db, QFile &input, QString *errMsg )
 {
     DatabaseFeeder feeder( db );
-    XmlContentHandler xmlparser(&feeder );
-    xmlparser.addData( "<toplevel_trace_element>" );
-    while( !input.atEnd() ) {
-        try {
-            xmlparser.addData( input.read( 1 << 16 ) );
-            xmlparser.continueParsing();
-        } catch( const SQLTransactionException &ex ) {
-            *errMsg = "Database error: " + QString::fromLatin1( ex.what() ) + ", driver message: " + ex.driverMessage() + "(" + QString::number(ex.driverCode()) + ")";
-            return false;
+    feeder.setMaximumBatchSize( 1000 );
+    QScopedPointer<ContentHandler> parser;
+    try {
+        while( !input.atEnd() ) {
+            const QByteArray data = input.read( 1 << 16 );
+            if ( !parser ) {
+                // Files written using the binary serializer are accepted, too
+                parser.reset( ContentHandler::createForData( data, &feeder ) );
+            }
+            parser->addData( data );
+            parser->continueParsing();
         }
+        feeder.flush();
+    } catch( const SQLTransactionException &ex ) {
+        *errMsg = "Database error: " + QString::fromLatin1( ex.what() ) + ", driver message: " + ex.driverMessage() + "(" + QString::number(ex.driverCode()) + ")";
+        return false;
     }
     return true;
 }